@@ -0,0 +1,68 @@
+"""
+Micro-benchmark for observe_hermite_interp as the interpolation density varies.
+
+The same long adaptive-step solution is interpolated at an increasing number of
+points. The time per point shows the cost of the interval search: a linear
+scan grows with the number of data points skipped between consecutive
+interpolation points, while the galloping search grows only logarithmically.
+
+Run against two builds to compare them, e.g.
+
+    python benchmarks/observe_interp.py --steps 2000000 --states 20
+"""
+
+import argparse
+import timeit
+
+import casadi
+import numpy as np
+
+from pybammsolvers import idaklu
+
+
+def make_function(n_states, n_inputs):
+    t = casadi.MX.sym("t")
+    y = casadi.MX.sym("y", n_states)
+    p = casadi.MX.sym("p", n_inputs)
+    return casadi.Function("f", [t, y, p], [casadi.sum1(y) * p[0] + t])
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--steps", type=int, default=200_000)
+    parser.add_argument("--states", type=int, default=20)
+    parser.add_argument("--repeat", type=int, default=5)
+    parser.add_argument("--num-threads", type=int, default=1)
+    args = parser.parse_args()
+
+    rng = np.random.default_rng(0)
+    # Adaptive steps: irregular, strictly increasing times
+    t = np.cumsum(rng.uniform(0.5, 1.5, args.steps))
+    y = np.asfortranarray(rng.standard_normal((args.states, args.steps)))
+    yp = np.asfortranarray(rng.standard_normal((args.states, args.steps)))
+    inputs = np.array([1.0])
+
+    func = make_function(args.states, inputs.size).serialize()
+
+    print(f"{'points':>10} {'total [ms]':>12} {'per point [us]':>16}")
+    for n_interp in [10, 100, 1_000, 10_000, 100_000, 1_000_000]:
+        t_interp = np.linspace(t[0], t[-1], n_interp)
+
+        def run(t_interp=t_interp, n_interp=n_interp):
+            idaklu.observe_hermite_interp(
+                t_interp,
+                idaklu.VectorRealtypeNdArray([t]),
+                idaklu.VectorRealtypeNdArray([y]),
+                idaklu.VectorRealtypeNdArray([yp]),
+                idaklu.VectorRealtypeNdArray([inputs]),
+                [func],
+                [1, n_interp],
+                num_threads=args.num_threads,
+            )
+
+        best = min(timeit.repeat(run, number=1, repeat=args.repeat))
+        print(f"{n_interp:>10} {best * 1e3:>12.3f} {best / n_interp * 1e6:>16.3f}")
+
+
+if __name__ == "__main__":
+    main()
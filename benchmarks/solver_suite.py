@@ -0,0 +1,457 @@
+"""
+Benchmark suite for the hot paths of the IDAKLU solver.
+
+Two synthetic battery-like models are built with casadi, so the suite does not
+depend on PyBaMM:
+
+- "spm": an ODE of two particles with nonlinear diffusion, driven by a
+  surface flux (a single particle model),
+- "dfn": a semi-explicit DAE of electrolyte diffusion, an algebraic potential
+  with Butler-Volmer kinetics and a particle at every electrolyte node (a
+  Doyle-Fuller-Newman model).
+
+The cases cover
+- the end-to-end solve of each model with the sparse (KLU, CSC to CSR),
+  banded and dense Jacobians, with the time split between residual,
+  Jacobian and linear solver evaluations taken from the solve statistics,
+- the cost of the forward sensitivities,
+- solver group throughput against the number of threads,
+- observe and observe_hermite_interp throughput.
+
+The results are written as JSON (in the layout of Google Benchmark, a
+"context" and a list of "benchmarks") so that they can be tracked across
+releases, e.g.
+
+    python benchmarks/solver_suite.py --json results.json
+
+`cmake --build <build dir> --target bench` runs the suite against the module
+in the build tree.
+"""
+
+import argparse
+import datetime
+import json
+import os
+import platform
+import time
+
+import casadi
+import numpy as np
+
+try:
+    # The module in a build tree, as run by the CMake bench target
+    import idaklu
+except ImportError:
+    from pybammsolvers import idaklu
+
+
+def base_options(**overrides):
+    options = {
+        # setup
+        "jacobian": "sparse",
+        "preconditioner": "none",
+        "precon_half_bandwidth": 5,
+        "precon_half_bandwidth_keep": 5,
+        "num_threads": 1,
+        "num_solvers": 1,
+        "linear_solver": "SUNLinSol_KLU",
+        "linsol_max_iterations": 5,
+        # solver
+        "print_stats": False,
+        "max_order_bdf": 5,
+        "max_num_steps": 100_000,
+        "dt_init": 0.0,
+        "dt_max": 0.0,
+        "max_error_test_failures": 10,
+        "max_nonlinear_iterations": 40,
+        "max_convergence_failures": 100,
+        "nonlinear_convergence_coefficient": 0.33,
+        "nonlinear_convergence_coefficient_ic": 0.0033,
+        "suppress_algebraic_error": False,
+        "hermite_interpolation": True,
+        "calc_ic": True,
+        "init_all_y_ic": False,
+        "max_num_steps_ic": 50,
+        "max_num_jacobians_ic": 40,
+        "max_num_iterations_ic": 100,
+        "max_linesearch_backtracks_ic": 100,
+        "linesearch_off_ic": False,
+        "linear_solution_scaling": True,
+        "epsilon_linear_tolerance": 0.05,
+        "increment_factor": 1.0,
+    }
+    options.update(overrides)
+    return options
+
+
+JACOBIANS = {
+    "sparse": {"jacobian": "sparse", "linear_solver": "SUNLinSol_KLU"},
+    "banded": {"jacobian": "banded", "linear_solver": "SUNLinSol_Band"},
+    "dense": {"jacobian": "dense", "linear_solver": "SUNLinSol_Dense"},
+}
+
+
+def particle_rhs(c, diffusivity, surface_flux):
+    """Finite volume diffusion in a particle of len(c) shells"""
+    n = c.shape[0]
+    dr = 1.0 / n
+    d = diffusivity * (1 + 0.5 * c)
+    flux = [-0.5 * (d[i] + d[i + 1]) * (c[i + 1] - c[i]) / dr for i in range(n - 1)]
+    flux = [0] + flux + [surface_flux]
+    return casadi.vertcat(*[-(flux[i + 1] - flux[i]) / dr for i in range(n)])
+
+
+class Model:
+    """The casadi functions of a DAE F(t, y, p) = M y'"""
+
+    def __init__(self, name, rhs, y, p, t, mass, y0):
+        self.name = name
+        self.n = y.shape[0]
+        self.n_inputs = p.shape[0]
+        self.mass = np.asarray(mass, dtype=float)
+        self.y0 = np.asarray(y0, dtype=float)
+
+        cj = casadi.SX.sym("cj")
+        v = casadi.SX.sym("v", self.n)
+        jac = casadi.jacobian(rhs, y) - cj * casadi.diag(casadi.SX(self.mass))
+        self.rhs_alg = casadi.Function("rhs_alg", [t, y, p], [rhs])
+        self.jac_times_cjmass = casadi.Function(
+            "jac_times_cjmass", [t, y, p, cj], [jac]
+        )
+        self.jac_action = casadi.Function(
+            "jac_action", [t, y, p, v], [casadi.jtimes(rhs, y, v)]
+        )
+        self.mass_action = casadi.Function(
+            "mass_action", [v], [casadi.SX(self.mass) * v]
+        )
+        dfdp = casadi.jacobian(rhs, p)
+        self.sens = casadi.Function(
+            "sens",
+            [t, y, p],
+            [casadi.densify(dfdp[:, i]) for i in range(self.n_inputs)],
+        )
+        # A cut-off that is never reached
+        self.events = casadi.Function("events", [t, y, p], [y[0] + 1e3])
+        self.output = casadi.Function("output", [t, y, p], [casadi.sum1(y) / self.n])
+
+        sparsity = self.jac_times_cjmass.sparsity_out(0)
+        self.colptrs = np.array(sparsity.colind(), dtype=np.int64)
+        self.rowvals = np.array(sparsity.row(), dtype=np.int64)
+        self.nnz = sparsity.nnz()
+        cols = np.repeat(np.arange(self.n), np.diff(self.colptrs))
+        self.bandwidth_lower = int(np.max(self.rowvals - cols))
+        self.bandwidth_upper = int(np.max(cols - self.rowvals))
+
+    def consistent_yp0(self, inputs):
+        """yp0 of the differential states (algebraic ones are found by calc_ic)"""
+        f = np.array(self.rhs_alg(0.0, self.y0, inputs)).ravel()
+        return np.where(self.mass != 0, f / np.where(self.mass != 0, self.mass, 1), 0)
+
+    def create_solver(self, number_of_parameters=0, **options):
+        def convert(f):
+            return idaklu.generate_function(f.serialize())
+
+        return idaklu.create_casadi_solver_group(
+            number_of_states=self.n,
+            number_of_parameters=number_of_parameters,
+            rhs_alg=convert(self.rhs_alg),
+            jac_times_cjmass=convert(self.jac_times_cjmass),
+            jac_times_cjmass_colptrs=self.colptrs,
+            jac_times_cjmass_rowvals=self.rowvals,
+            jac_times_cjmass_nnz=self.nnz,
+            jac_bandwidth_lower=self.bandwidth_lower,
+            jac_bandwidth_upper=self.bandwidth_upper,
+            jac_action=convert(self.jac_action),
+            mass_action=convert(self.mass_action),
+            sens=convert(self.sens),
+            events=convert(self.events),
+            number_of_events=1,
+            rhs_alg_id=(self.mass != 0).astype(float),
+            atol=np.full(self.n, 1e-6),
+            rtol=1e-6,
+            inputs=self.n_inputs,
+            var_fcns=[],
+            dvar_dy_fcns=[],
+            dvar_dp_fcns=[],
+            options=base_options(**options),
+        )
+
+    def initial_rows(self, inputs, number_of_parameters=0):
+        """y0 and yp0 rows (states, then zero sensitivities) for each input row"""
+        n_coeffs = self.n * (1 + number_of_parameters)
+        y0 = np.zeros((len(inputs), n_coeffs))
+        yp0 = np.zeros((len(inputs), n_coeffs))
+        for i, row in enumerate(inputs):
+            y0[i, : self.n] = self.y0
+            yp0[i, : self.n] = self.consistent_yp0(row)
+        return y0, yp0
+
+
+def spm(n_shells):
+    t = casadi.SX.sym("t")
+    y = casadi.SX.sym("y", 2 * n_shells)
+    p = casadi.SX.sym("p", 2)  # current, diffusivity
+    negative = particle_rhs(y[:n_shells], p[1], -p[0])
+    positive = particle_rhs(y[n_shells:], p[1], p[0])
+    rhs = casadi.vertcat(negative, positive)
+    y0 = np.concatenate([np.full(n_shells, 0.8), np.full(n_shells, 0.2)])
+    return Model("spm", rhs, y, p, t, np.ones(2 * n_shells), y0)
+
+
+def dfn(n_nodes, n_shells):
+    t = casadi.SX.sym("t")
+    n_particles = n_nodes * n_shells
+    y = casadi.SX.sym("y", 2 * n_nodes + n_particles)
+    p = casadi.SX.sym("p", 2)  # current, diffusivity
+    ce = y[:n_nodes]
+    phi = y[n_nodes : 2 * n_nodes]
+    offset = 2 * n_nodes
+    cs = [
+        y[offset + k * n_shells : offset + (k + 1) * n_shells] for k in range(n_nodes)
+    ]
+    dx = 1.0 / n_nodes
+
+    # Butler-Volmer reaction at each node
+    j = [
+        casadi.sinh(0.5 * (phi[k] - (0.5 - 0.2 * cs[k][n_shells - 1])))
+        for k in range(n_nodes)
+    ]
+
+    # Electrolyte diffusion with a source, and conservation of current
+    ce_flux = [0] + [-(ce[k + 1] - ce[k]) / dx for k in range(n_nodes - 1)] + [0]
+    i_e = (
+        [0]
+        + [-(1 + 0.1 * ce[k]) * (phi[k + 1] - phi[k]) / dx for k in range(n_nodes - 1)]
+        + [p[0]]
+    )
+    dce = [-(ce_flux[k + 1] - ce_flux[k]) / dx + 0.1 * j[k] for k in range(n_nodes)]
+    alg = [(i_e[k + 1] - i_e[k]) / dx - j[k] for k in range(n_nodes)]
+    dcs = [particle_rhs(cs[k], p[1], 0.1 * j[k]) for k in range(n_nodes)]
+
+    rhs = casadi.vertcat(*dce, *alg, *dcs)
+    mass = np.concatenate([np.ones(n_nodes), np.zeros(n_nodes), np.ones(n_particles)])
+    y0 = np.concatenate(
+        [np.ones(n_nodes), np.zeros(n_nodes), np.full(n_particles, 0.5)]
+    )
+    return Model("dfn", rhs, y, p, t, mass, y0)
+
+
+def best_time(run, repeat):
+    times = []
+    result = None
+    for _ in range(repeat):
+        start = time.perf_counter()
+        result = run()
+        times.append(time.perf_counter() - start)
+    return min(times), times, result
+
+
+def record(name, times, **fields):
+    return {
+        "name": name,
+        "run_type": "iteration",
+        "repetitions": len(times),
+        "real_time": min(times),
+        "mean_time": sum(times) / len(times),
+        "time_unit": "s",
+        **fields,
+    }
+
+
+def phase_fields(solution):
+    stats = solution.stats
+    return {
+        "nsteps": stats.nsteps,
+        "nrevals": stats.nrevals,
+        "njevals": stats.njevals,
+        "total_time": stats.total_time,
+        "residual_time": stats.residual_time,
+        "residual_time_per_eval": stats.residual_time / max(1, stats.nrevals),
+        "jacobian_time": stats.jacobian_time,
+        "jacobian_time_per_eval": stats.jacobian_time / max(1, stats.njevals),
+        "linear_solve_time": stats.linear_solve_time,
+        "storage_time": stats.storage_time,
+    }
+
+
+def bench_solve(models, t_eval, repeat):
+    results = []
+    inputs = np.array([[1.0, 1.0]])
+    t_interp = np.array([])
+    for model in models:
+        y0, yp0 = model.initial_rows(inputs)
+        for jacobian, options in JACOBIANS.items():
+            if jacobian == "dense" and model.n > 600:
+                continue
+            solver = model.create_solver(**options)
+            _, times, solutions = best_time(
+                lambda: solver.solve(t_eval, t_interp, y0, yp0, inputs), repeat
+            )
+            results.append(
+                record(
+                    f"solve/{model.name}/{jacobian}",
+                    times,
+                    states=model.n,
+                    nnz=model.nnz,
+                    **phase_fields(solutions[0]),
+                )
+            )
+    return results
+
+
+def bench_sensitivities(models, t_eval, repeat):
+    results = []
+    inputs = np.array([[1.0, 1.0]])
+    t_interp = np.array([])
+    for model in models:
+        for number_of_parameters in [0, model.n_inputs]:
+            y0, yp0 = model.initial_rows(inputs, number_of_parameters)
+            solver = model.create_solver(number_of_parameters)
+            _, times, solutions = best_time(
+                lambda: solver.solve(t_eval, t_interp, y0, yp0, inputs), repeat
+            )
+            results.append(
+                record(
+                    f"sensitivities/{model.name}/{number_of_parameters}",
+                    times,
+                    states=model.n,
+                    parameters=number_of_parameters,
+                    **phase_fields(solutions[0]),
+                )
+            )
+    return results
+
+
+def bench_group(model, t_eval, repeat, max_threads, rows):
+    results = []
+    rng = np.random.default_rng(0)
+    inputs = np.column_stack([rng.uniform(0.5, 1.5, rows), rng.uniform(0.5, 1.5, rows)])
+    y0, yp0 = model.initial_rows(inputs)
+    t_interp = np.array([])
+    threads = 1
+    while threads <= max_threads:
+        solver = model.create_solver(num_threads=threads, num_solvers=threads)
+        _, times, _ = best_time(
+            lambda: solver.solve(t_eval, t_interp, y0, yp0, inputs), repeat
+        )
+        results.append(
+            record(
+                f"group/{model.name}/threads:{threads}",
+                times,
+                threads=threads,
+                rows=rows,
+                rows_per_second=rows / min(times),
+            )
+        )
+        threads *= 2
+    return results
+
+
+def bench_observe(model, t_eval, repeat):
+    inputs = np.array([[1.0, 1.0]])
+    y0, yp0 = model.initial_rows(inputs)
+    solver = model.create_solver()
+    solution = solver.solve(t_eval, np.array([]), y0, yp0, inputs)[0]
+    t = np.asarray(solution.t)
+    y = np.asfortranarray(np.asarray(solution.y).reshape(len(t), model.n).T)
+    yp = np.asfortranarray(np.asarray(solution.yp).reshape(len(t), model.n).T)
+    func = model.output.serialize()
+    args = (
+        idaklu.VectorRealtypeNdArray([t]),
+        idaklu.VectorRealtypeNdArray([y]),
+    )
+    p = idaklu.VectorRealtypeNdArray([inputs[0]])
+
+    results = []
+    _, times, _ = best_time(
+        lambda: idaklu.observe(*args, p, [func], True, [1, len(t)]), repeat
+    )
+    results.append(
+        record(
+            f"observe/{model.name}",
+            times,
+            points=len(t),
+            points_per_second=len(t) / min(times),
+        )
+    )
+
+    for n_interp in [1_000, 100_000]:
+        t_interp = np.linspace(t[0], t[-1], n_interp)
+        _, times, _ = best_time(
+            lambda: idaklu.observe_hermite_interp(
+                t_interp,
+                *args,
+                idaklu.VectorRealtypeNdArray([yp]),
+                p,
+                [func],
+                [1, n_interp],
+            ),
+            repeat,
+        )
+        results.append(
+            record(
+                f"observe_hermite_interp/{model.name}/points:{n_interp}",
+                times,
+                points=n_interp,
+                points_per_second=n_interp / min(times),
+            )
+        )
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--json", help="write the results to this file")
+    parser.add_argument("--repeat", type=int, default=5)
+    parser.add_argument("--spm-shells", type=int, default=20)
+    parser.add_argument("--dfn-nodes", type=int, default=30)
+    parser.add_argument("--dfn-shells", type=int, default=10)
+    parser.add_argument(
+        "--max-threads", type=int, default=min(64, os.cpu_count() or 1)
+    )
+    parser.add_argument("--group-rows", type=int, default=64)
+    parser.add_argument(
+        "--filter", default="", help="only run the suites whose name contains this"
+    )
+    args = parser.parse_args()
+
+    models = [spm(args.spm_shells), dfn(args.dfn_nodes, args.dfn_shells)]
+    t_eval = np.array([0.0, 3600.0])
+
+    suites = [
+        ("solve", lambda: bench_solve(models, t_eval, args.repeat)),
+        ("sensitivities", lambda: bench_sensitivities(models, t_eval, args.repeat)),
+        (
+            "group",
+            lambda: bench_group(
+                models[1], t_eval, args.repeat, args.max_threads, args.group_rows
+            ),
+        ),
+        ("observe", lambda: bench_observe(models[1], t_eval, args.repeat)),
+    ]
+
+    benchmarks = []
+    print(f"{'benchmark':<48} {'time [ms]':>12}")
+    for name, suite in suites:
+        if args.filter and args.filter not in name:
+            continue
+        for result in suite():
+            print(f"{result['name']:<48} {result['real_time'] * 1e3:>12.3f}")
+            benchmarks.append(result)
+
+    if args.json:
+        context = {
+            "date": datetime.datetime.now().isoformat(),
+            "host_name": platform.node(),
+            "platform": platform.platform(),
+            "python": platform.python_version(),
+            "num_cpus": os.cpu_count(),
+            "casadi": casadi.__version__,
+            "idaklu": getattr(idaklu, "__file__", ""),
+        }
+        with open(args.json, "w") as f:
+            json.dump({"context": context, "benchmarks": benchmarks}, f, indent=2)
+
+
+if __name__ == "__main__":
+    main()
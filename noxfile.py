@@ -132,3 +132,13 @@ def run_unit(session):
             silent=False,
         )
     session.run("pytest", "tests")
+
+
+@nox.session(name="benchmarks")
+def run_benchmarks(session):
+    """Run the solver benchmarks. Arguments are passed on, e.g. --json results.json"""
+    set_environment_variables(PYBAMM_ENV, session=session)
+    session.install("setuptools", silent=False)
+    session.install("casadi", silent=False)
+    session.install("-e", ".[dev]", silent=False)
+    session.run("python", "benchmarks/solver_suite.py", *session.posargs)
@@ -93,12 +93,20 @@ class CMakeBuild(build_ext):
         build_type = os.getenv("PYBAMM_CPP_BUILD_TYPE", "RELEASE")
         idaklu_expr_casadi = os.getenv("PYBAMM_IDAKLU_EXPR_CASADI", "ON")
         idaklu_expr_iree = os.getenv("PYBAMM_IDAKLU_EXPR_IREE", "OFF")
+        idaklu_expr_codegen = os.getenv(
+            "PYBAMM_IDAKLU_EXPR_CODEGEN", "OFF" if system() == "Windows" else "ON"
+        )
+        idaklu_cuda = os.getenv("PYBAMM_IDAKLU_CUDA", "OFF")
+        idaklu_trace = os.getenv("PYBAMM_IDAKLU_TRACE", "ON")
         cmake_args = [
             f"-DCMAKE_BUILD_TYPE={build_type}",
             f"-DPYTHON_EXECUTABLE={sys.executable}",
             "-DUSE_PYTHON_CASADI={}".format("TRUE" if use_python_casadi else "FALSE"),
             f"-DPYBAMM_IDAKLU_EXPR_CASADI={idaklu_expr_casadi}",
             f"-DPYBAMM_IDAKLU_EXPR_IREE={idaklu_expr_iree}",
+            f"-DPYBAMM_IDAKLU_EXPR_CODEGEN={idaklu_expr_codegen}",
+            f"-DPYBAMM_IDAKLU_CUDA={idaklu_cuda}",
+            f"-DPYBAMM_IDAKLU_TRACE={idaklu_trace}",
         ]
         if self.suitesparse_root:
             cmake_args.append(
@@ -243,7 +251,11 @@ ext_modules = [
             "src/pybammsolvers/idaklu_source/Expressions/Base/ExpressionTypes.hpp",
             "src/pybammsolvers/idaklu_source/Expressions/Base/ExpressionSparsity.hpp",
             "src/pybammsolvers/idaklu_source/Expressions/Casadi/CasadiFunctions.cpp",
+            "src/pybammsolvers/idaklu_source/Expressions/Ensemble/EnsembleFunctions.hpp",
             "src/pybammsolvers/idaklu_source/Expressions/Casadi/CasadiFunctions.hpp",
+            "src/pybammsolvers/idaklu_source/Expressions/Codegen/CodegenBaseFunction.hpp",
+            "src/pybammsolvers/idaklu_source/Expressions/Codegen/CodegenFunctions.cpp",
+            "src/pybammsolvers/idaklu_source/Expressions/Codegen/CodegenFunctions.hpp",
             "src/pybammsolvers/idaklu_source/Expressions/IREE/IREEBaseFunction.hpp",
             "src/pybammsolvers/idaklu_source/Expressions/IREE/IREEFunction.hpp",
             "src/pybammsolvers/idaklu_source/Expressions/IREE/IREEFunctions.cpp",
@@ -255,6 +267,8 @@ ext_modules = [
             "src/pybammsolvers/idaklu_source/idaklu_solver.hpp",
             "src/pybammsolvers/idaklu_source/IDAKLUSolver.cpp",
             "src/pybammsolvers/idaklu_source/IDAKLUSolver.hpp",
+            "src/pybammsolvers/idaklu_source/IDAKLUEnsembleSolver.cpp",
+            "src/pybammsolvers/idaklu_source/IDAKLUEnsembleSolver.hpp",
             "src/pybammsolvers/idaklu_source/IDAKLUSolverGroup.cpp",
             "src/pybammsolvers/idaklu_source/IDAKLUSolverGroup.hpp",
             "src/pybammsolvers/idaklu_source/IDAKLUSolverOpenMP.inl",
@@ -269,12 +283,27 @@ ext_modules = [
             "src/pybammsolvers/idaklu_source/common.cpp",
             "src/pybammsolvers/idaklu_source/Solution.cpp",
             "src/pybammsolvers/idaklu_source/Solution.hpp",
+            "src/pybammsolvers/idaklu_source/SolutionArena.cpp",
+            "src/pybammsolvers/idaklu_source/SolutionArena.hpp",
             "src/pybammsolvers/idaklu_source/SolutionData.cpp",
             "src/pybammsolvers/idaklu_source/SolutionData.hpp",
+            "src/pybammsolvers/idaklu_source/SolverCheckpoint.hpp",
+            "src/pybammsolvers/idaklu_source/SolveStats.cpp",
+            "src/pybammsolvers/idaklu_source/SolveStats.hpp",
             "src/pybammsolvers/idaklu_source/observe.cpp",
             "src/pybammsolvers/idaklu_source/observe.hpp",
             "src/pybammsolvers/idaklu_source/Options.hpp",
             "src/pybammsolvers/idaklu_source/Options.cpp",
+            "src/pybammsolvers/idaklu_source/OutputReduction.cpp",
+            "src/pybammsolvers/idaklu_source/OutputReduction.hpp",
+            "src/pybammsolvers/idaklu_source/ThreadPlacement.cpp",
+            "src/pybammsolvers/idaklu_source/ThreadPlacement.hpp",
+            "src/pybammsolvers/idaklu_source/Trace.cpp",
+            "src/pybammsolvers/idaklu_source/Trace.hpp",
+            "src/pybammsolvers/idaklu_source/Autotune.cpp",
+            "src/pybammsolvers/idaklu_source/Autotune.hpp",
+            "src/pybammsolvers/idaklu_source/SparseILU.cpp",
+            "src/pybammsolvers/idaklu_source/SparseILU.hpp",
             "src/pybammsolvers/idaklu.cpp",
         ],
     )
@@ -12,9 +12,14 @@
 #include "idaklu_source/observe.hpp"
 #include "idaklu_source/IDAKLUSolverGroup.hpp"
 #include "idaklu_source/IdakluJax.hpp"
+#include "idaklu_source/Trace.hpp"
 #include "idaklu_source/common.hpp"
 #include "idaklu_source/Expressions/Casadi/CasadiFunctions.hpp"
 
+#ifdef CODEGEN_ENABLE
+#include "idaklu_source/Expressions/Codegen/CodegenFunctions.hpp"
+#endif
+
 #ifdef IREE_ENABLE
 #include "idaklu_source/Expressions/IREE/IREEFunctions.hpp"
 #endif
@@ -39,6 +44,32 @@ PYBIND11_MODULE(idaklu, m)
   py::bind_vector<std::vector<np_array_realtype>>(m, "VectorRealtypeNdArray");
   py::bind_vector<std::vector<Solution>>(m, "VectorSolution");
 
+  // function types are registered first as they are used in default arguments
+  py::class_<casadi::Function>(m, "Function");
+
+#ifdef CODEGEN_ENABLE
+  py::class_<CodegenBaseFunctionType>(m, "CodegenFunction")
+    .def(py::init<>())
+    .def(py::init<const std::string&, const std::string&>(),
+      py::arg("name"), py::arg("source"))
+    .def_readwrite("name", &CodegenBaseFunctionType::name)
+    .def_readwrite("source", &CodegenBaseFunctionType::source);
+#endif
+
+#ifdef IREE_ENABLE
+  py::class_<IREEBaseFunctionType>(m, "IREEBaseFunctionType")
+    .def(py::init<>())
+    .def_readwrite("mlir", &IREEBaseFunctionType::mlir)
+    .def_readwrite("kept_var_idx", &IREEBaseFunctionType::kept_var_idx)
+    .def_readwrite("nnz", &IREEBaseFunctionType::nnz)
+    .def_readwrite("numel", &IREEBaseFunctionType::numel)
+    .def_readwrite("col", &IREEBaseFunctionType::col)
+    .def_readwrite("row", &IREEBaseFunctionType::row)
+    .def_readwrite("pytree_shape", &IREEBaseFunctionType::pytree_shape)
+    .def_readwrite("pytree_sizes", &IREEBaseFunctionType::pytree_sizes)
+    .def_readwrite("n_args", &IREEBaseFunctionType::n_args);
+#endif
+
   py::class_<IDAKLUSolverGroup>(m, "IDAKLUSolverGroup")
   .def("solve", &IDAKLUSolverGroup::solve,
     "perform a solve",
@@ -47,6 +78,51 @@ PYBIND11_MODULE(idaklu, m)
     py::arg("y0"),
     py::arg("yp0"),
     py::arg("inputs"),
+    py::arg("cost_hint") = np_array(),
+    py::arg("resume_from") = std::vector<SolverCheckpoint>(),
+    py::arg("resume_consistent") = false,
+    py::arg("t_discontinuity") = py::none(),
+    py::return_value_policy::take_ownership)
+  .def("solve_async", &IDAKLUSolverGroup::solve_async,
+    "start a solve in the background and return a handle to it",
+    py::arg("t_eval"),
+    py::arg("t_interp"),
+    py::arg("y0"),
+    py::arg("yp0"),
+    py::arg("inputs"),
+    py::arg("cost_hint") = np_array(),
+    py::arg("resume_from") = std::vector<SolverCheckpoint>(),
+    py::arg("resume_consistent") = false,
+    py::arg("t_discontinuity") = py::none(),
+    py::keep_alive<0, 1>())
+  .def("solve_stream", &IDAKLUSolverGroup::solve_stream,
+    "perform a solve, calling callback(index, solution) as each solve finishes",
+    py::arg("t_eval"),
+    py::arg("t_interp"),
+    py::arg("y0"),
+    py::arg("yp0"),
+    py::arg("inputs"),
+    py::arg("callback"),
+    py::arg("max_pending") = 0,
+    py::arg("cost_hint") = np_array(),
+    py::arg("resume_from") = std::vector<SolverCheckpoint>(),
+    py::arg("resume_consistent") = false,
+    py::arg("t_discontinuity") = py::none())
+  .def("solve_adjoint", &IDAKLUSolverGroup::solve_adjoint,
+    "gradient of the time integral of a scalar output variable by adjoint sensitivities",
+    py::arg("t_eval"),
+    py::arg("y0"),
+    py::arg("yp0"),
+    py::arg("inputs"),
+    py::arg("loss_index"))
+  .def("last_solve_times", &IDAKLUSolverGroup::last_solve_times,
+    "per-row wall-clock solve times (s) from the last call to solve");
+
+  py::class_<IDAKLUSolveHandle>(m, "IDAKLUSolveHandle")
+  .def("done", &IDAKLUSolveHandle::done,
+    "check whether the solve has finished")
+  .def("result", &IDAKLUSolveHandle::result,
+    "wait for the solve to finish and return the solutions",
     py::return_value_policy::take_ownership);
 
   m.def("create_casadi_solver_group", &create_idaklu_solver_group<CasadiFunctions>,
@@ -73,7 +149,82 @@ PYBIND11_MODULE(idaklu, m)
     py::arg("dvar_dy_fcns"),
     py::arg("dvar_dp_fcns"),
     py::arg("options"),
+    py::arg("jac_action_batched") = static_cast<const casadi::Function*>(nullptr),
+    py::arg("var_fused") = static_cast<const casadi::Function*>(nullptr),
+    py::arg("rhs_alg_blocks") = std::vector<casadi::Function*>(),
+    py::arg("jac_times_cjmass_blocks") = std::vector<casadi::Function*>(),
+    py::arg("jac_action_blocks") = std::vector<casadi::Function*>(),
+    py::return_value_policy::take_ownership);
+
+  m.def("autotune_casadi_solver_group", &autotune_idaklu_solver_group<CasadiFunctions>,
+    "Time trial solves of a sample and return the options with the fastest linear solver "
+    "and split of the threads into solvers",
+    py::arg("number_of_states"),
+    py::arg("number_of_parameters"),
+    py::arg("rhs_alg"),
+    py::arg("jac_times_cjmass"),
+    py::arg("jac_times_cjmass_colptrs"),
+    py::arg("jac_times_cjmass_rowvals"),
+    py::arg("jac_times_cjmass_nnz"),
+    py::arg("jac_bandwidth_lower"),
+    py::arg("jac_bandwidth_upper"),
+    py::arg("jac_action"),
+    py::arg("mass_action"),
+    py::arg("sens"),
+    py::arg("events"),
+    py::arg("number_of_events"),
+    py::arg("rhs_alg_id"),
+    py::arg("atol"),
+    py::arg("rtol"),
+    py::arg("inputs"),
+    py::arg("var_fcns"),
+    py::arg("dvar_dy_fcns"),
+    py::arg("dvar_dp_fcns"),
+    py::arg("options"),
+    py::arg("t_eval"),
+    py::arg("y0"),
+    py::arg("yp0"),
+    py::arg("inputs_sample"),
+    py::arg("jac_action_batched") = static_cast<const casadi::Function*>(nullptr),
+    py::arg("var_fused") = static_cast<const casadi::Function*>(nullptr),
+    py::arg("rhs_alg_blocks") = std::vector<casadi::Function*>(),
+    py::arg("jac_times_cjmass_blocks") = std::vector<casadi::Function*>(),
+    py::arg("jac_action_blocks") = std::vector<casadi::Function*>(),
+    py::arg("repeats") = 2,
+    py::arg("cache_dir") = "");
+
+#ifdef CODEGEN_ENABLE
+  m.def("create_codegen_solver_group", &create_idaklu_solver_group<CodegenFunctions>,
+    "Create a group of idaklu solver objects from compiled casadi generated code",
+    py::arg("number_of_states"),
+    py::arg("number_of_parameters"),
+    py::arg("rhs_alg"),
+    py::arg("jac_times_cjmass"),
+    py::arg("jac_times_cjmass_colptrs"),
+    py::arg("jac_times_cjmass_rowvals"),
+    py::arg("jac_times_cjmass_nnz"),
+    py::arg("jac_bandwidth_lower"),
+    py::arg("jac_bandwidth_upper"),
+    py::arg("jac_action"),
+    py::arg("mass_action"),
+    py::arg("sens"),
+    py::arg("events"),
+    py::arg("number_of_events"),
+    py::arg("rhs_alg_id"),
+    py::arg("atol"),
+    py::arg("rtol"),
+    py::arg("inputs"),
+    py::arg("var_fcns"),
+    py::arg("dvar_dy_fcns"),
+    py::arg("dvar_dp_fcns"),
+    py::arg("options"),
+    py::arg("jac_action_batched") = static_cast<const CodegenBaseFunctionType*>(nullptr),
+    py::arg("var_fused") = static_cast<const CodegenBaseFunctionType*>(nullptr),
+    py::arg("rhs_alg_blocks") = std::vector<CodegenBaseFunctionType*>(),
+    py::arg("jac_times_cjmass_blocks") = std::vector<CodegenBaseFunctionType*>(),
+    py::arg("jac_action_blocks") = std::vector<CodegenBaseFunctionType*>(),
     py::return_value_policy::take_ownership);
+#endif
 
   m.def("observe", &observe,
     "Observe variables",
@@ -83,6 +234,7 @@ PYBIND11_MODULE(idaklu, m)
     py::arg("funcs"),
     py::arg("is_f_contiguous"),
     py::arg("shape"),
+    py::arg("num_threads") = 1,
     py::return_value_policy::take_ownership);
 
   m.def("observe_hermite_interp", &observe_hermite_interp,
@@ -94,8 +246,42 @@ PYBIND11_MODULE(idaklu, m)
     py::arg("inputs"),
     py::arg("funcs"),
     py::arg("shape"),
+    py::arg("num_threads") = 1,
     py::return_value_policy::take_ownership);
 
+  m.def("observe_hermite_interp_multi", &observe_hermite_interp_multi,
+    "Observe and Hermite interpolate several variables, interpolating the state once per point",
+    py::arg("t_interp"),
+    py::arg("ts"),
+    py::arg("ys"),
+    py::arg("yps"),
+    py::arg("inputs"),
+    py::arg("funcs"),
+    py::arg("shapes"),
+    py::arg("num_threads") = 1);
+
+  m.def("observe_cache_info", &observe_cache_info,
+    "Hit/miss counters and size of the observe function cache");
+
+  m.def("set_observe_cache_size", &set_observe_cache_size,
+    "Set the maximum number of functions held by the observe function cache",
+    py::arg("max_size"));
+
+  m.def("clear_observe_cache", &clear_observe_cache,
+    "Empty the observe function cache and reset its counters");
+
+  m.def("set_tracing", &set_tracing,
+    "Start (or stop) recording a timeline of the solver callbacks and solves, "
+    "keeping the last `capacity` spans of each thread",
+    py::arg("enabled"),
+    py::arg("capacity") = 1 << 16);
+
+  m.def("clear_trace", &clear_trace,
+    "Drop the recorded timeline");
+
+  m.def("trace_json", &trace_json,
+    "The recorded timeline as Chrome trace event JSON (for chrome://tracing or Perfetto)");
+
 #ifdef IREE_ENABLE
   m.def("create_iree_solver_group", &create_idaklu_solver_group<IREEFunctions>,
     "Create a group of iree idaklu solver objects",
@@ -121,6 +307,11 @@ PYBIND11_MODULE(idaklu, m)
     py::arg("dvar_dy_fcns"),
     py::arg("dvar_dp_fcns"),
     py::arg("options"),
+    py::arg("jac_action_batched") = static_cast<const IREEBaseFunctionType*>(nullptr),
+    py::arg("var_fused") = static_cast<const IREEBaseFunctionType*>(nullptr),
+    py::arg("rhs_alg_blocks") = std::vector<IREEBaseFunctionType*>(),
+    py::arg("jac_times_cjmass_blocks") = std::vector<IREEBaseFunctionType*>(),
+    py::arg("jac_action_blocks") = std::vector<IREEBaseFunctionType*>(),
     py::return_value_policy::take_ownership);
 #endif
 
@@ -157,6 +348,18 @@ PYBIND11_MODULE(idaklu, m)
       py::arg("callback_jvp"),
       py::arg("callback_vjp")
     )
+    .def(
+      "register_solver",
+      &IdakluJax::register_solver,
+      "Register a solver group to evaluate the primitives without python callbacks",
+      py::arg("solver"),
+      py::arg("t_eval"),
+      py::arg("y0"),
+      py::arg("yp0"),
+      py::arg("number_of_outputs"),
+      py::arg("initial_conditions") = static_cast<const casadi::Function*>(nullptr),
+      py::keep_alive<1, 2>()
+    )
     .def(
       "get_index",
       &IdakluJax::get_index,
@@ -172,21 +375,43 @@ PYBIND11_MODULE(idaklu, m)
     &Registrations
   );
 
-  py::class_<casadi::Function>(m, "Function");
+  py::class_<SolveStats>(m, "SolveStats")
+    .def_readonly("nsteps", &SolveStats::nsteps)
+    .def_readonly("nrevals", &SolveStats::nrevals)
+    .def_readonly("nlinsetups", &SolveStats::nlinsetups)
+    .def_readonly("njevals", &SolveStats::njevals)
+    .def_readonly("netfails", &SolveStats::netfails)
+    .def_readonly("nniters", &SolveStats::nniters)
+    .def_readonly("nncfails", &SolveStats::nncfails)
+    .def_readonly("ngevalsBBDP", &SolveStats::ngevalsBBDP)
+    .def_readonly("total_time", &SolveStats::total_time)
+    .def_readonly("residual_time", &SolveStats::residual_time)
+    .def_readonly("jacobian_time", &SolveStats::jacobian_time)
+    .def_readonly("linear_solve_time", &SolveStats::linear_solve_time)
+    .def_readonly("output_time", &SolveStats::output_time)
+    .def_readonly("storage_time", &SolveStats::storage_time);
 
-#ifdef IREE_ENABLE
-  py::class_<IREEBaseFunctionType>(m, "IREEBaseFunctionType")
-    .def(py::init<>())
-    .def_readwrite("mlir", &IREEBaseFunctionType::mlir)
-    .def_readwrite("kept_var_idx", &IREEBaseFunctionType::kept_var_idx)
-    .def_readwrite("nnz", &IREEBaseFunctionType::nnz)
-    .def_readwrite("numel", &IREEBaseFunctionType::numel)
-    .def_readwrite("col", &IREEBaseFunctionType::col)
-    .def_readwrite("row", &IREEBaseFunctionType::row)
-    .def_readwrite("pytree_shape", &IREEBaseFunctionType::pytree_shape)
-    .def_readwrite("pytree_sizes", &IREEBaseFunctionType::pytree_sizes)
-    .def_readwrite("n_args", &IREEBaseFunctionType::n_args);
-#endif
+  py::class_<SolverCheckpoint>(m, "SolverCheckpoint")
+    .def_readonly("t", &SolverCheckpoint::t)
+    .def_readonly("y", &SolverCheckpoint::y)
+    .def_readonly("yp", &SolverCheckpoint::yp)
+    .def_readonly("step_size", &SolverCheckpoint::step_size)
+    .def("valid", &SolverCheckpoint::valid)
+    .def(py::pickle(
+      [](const SolverCheckpoint &c) {
+        return py::make_tuple(c.t, c.y, c.yp, c.step_size);
+      },
+      [](const py::tuple &state) {
+        if (state.size() != 4) {
+          throw std::runtime_error("Invalid SolverCheckpoint state");
+        }
+        SolverCheckpoint c;
+        c.t = state[0].cast<realtype>();
+        c.y = state[1].cast<std::vector<realtype>>();
+        c.yp = state[2].cast<std::vector<realtype>>();
+        c.step_size = state[3].cast<realtype>();
+        return c;
+      }));
 
   py::class_<Solution>(m, "solution")
     .def_readwrite("t", &Solution::t)
@@ -195,5 +420,7 @@ PYBIND11_MODULE(idaklu, m)
     .def_readwrite("yS", &Solution::yS)
     .def_readwrite("ypS", &Solution::ypS)
     .def_readwrite("y_term", &Solution::y_term)
-    .def_readwrite("flag", &Solution::flag);
+    .def_readwrite("flag", &Solution::flag)
+    .def_readonly("stats", &Solution::stats)
+    .def_readonly("checkpoint", &Solution::checkpoint);
 }
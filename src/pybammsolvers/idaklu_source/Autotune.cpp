@@ -0,0 +1,155 @@
+#include "Autotune.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <random>
+
+namespace {
+
+std::filesystem::path cache_file(const std::string &cache_dir, uint64_t key) {
+  char name[40];
+  std::snprintf(name, sizeof(name), "autotune-%016llx.txt",
+    static_cast<unsigned long long>(key));
+  return std::filesystem::path(cache_dir) / name;
+}
+
+}  // namespace
+
+std::vector<AutotuneCandidate> autotune_linear_solvers(
+  const AutotuneCandidate &base,
+  int number_of_states,
+  int jac_bandwidth_lower,
+  int jac_bandwidth_upper
+) {
+  std::vector<AutotuneCandidate> candidates;
+  auto add = [&](const char *jacobian, const char *linear_solver, const char *preconditioner) {
+    AutotuneCandidate candidate = base;
+    candidate.jacobian = jacobian;
+    candidate.linear_solver = linear_solver;
+    candidate.preconditioner = preconditioner;
+    candidates.push_back(candidate);
+  };
+
+  add("sparse", "SUNLinSol_KLU", "none");
+  if (jac_bandwidth_lower >= 0 && jac_bandwidth_upper >= 0 &&
+      jac_bandwidth_lower + jac_bandwidth_upper + 1 < number_of_states) {
+    add("banded", "SUNLinSol_Band", "none");
+  }
+  // Dense factorisations only pay off for small systems
+  if (number_of_states <= 64) {
+    add("dense", "SUNLinSol_Dense", "none");
+  }
+  add("sparse", "SUNLinSol_SPGMR", "BBDP");
+  add("sparse", "SUNLinSol_SPGMR", "ILU");
+  return candidates;
+}
+
+std::vector<AutotuneCandidate> autotune_layouts(
+  const AutotuneCandidate &base,
+  int number_of_rows
+) {
+  const int max_solvers = std::max(1, std::min(base.num_threads, number_of_rows));
+  std::vector<int> solvers;
+  for (int s = 1; s <= max_solvers; s *= 2) {
+    solvers.push_back(s);
+  }
+  if (solvers.back() != max_solvers) {
+    solvers.push_back(max_solvers);
+  }
+
+  std::vector<AutotuneCandidate> candidates;
+  for (const int s : solvers) {
+    AutotuneCandidate candidate = base;
+    candidate.num_solvers = s;
+    candidates.push_back(candidate);
+  }
+  return candidates;
+}
+
+py::dict autotune_options(const py::dict &options, const AutotuneCandidate &candidate) {
+  py::dict tuned;
+  for (const auto &item : options) {
+    tuned[item.first] = item.second;
+  }
+  tuned["jacobian"] = candidate.jacobian;
+  tuned["linear_solver"] = candidate.linear_solver;
+  tuned["preconditioner"] = candidate.preconditioner;
+  tuned["num_solvers"] = candidate.num_solvers;
+  tuned["num_threads"] = candidate.num_threads;
+  return tuned;
+}
+
+uint64_t autotune_hash(const std::vector<std::string> &parts) {
+  // Parts are terminated so that moving characters between them changes
+  // the hash
+  uint64_t hash = fnv1a("");
+  for (const auto &part : parts) {
+    hash = fnv1a(part + '\xff', hash);
+  }
+  return hash;
+}
+
+std::string autotune_hash_part(double value) {
+  char text[32];
+  std::snprintf(text, sizeof(text), "%.17g", value);
+  return text;
+}
+
+std::string autotune_hash_part(const py::dict &options) {
+  std::map<std::string, std::string> fixed;
+  for (const auto &item : options) {
+    const auto name = item.first.cast<std::string>();
+    if (name != "jacobian" && name != "linear_solver" &&
+        name != "preconditioner" && name != "num_solvers") {
+      fixed[name] = py::repr(item.second).cast<std::string>();
+    }
+  }
+  std::string text;
+  for (const auto &[name, value] : fixed) {
+    text += name + "=" + value + ";";
+  }
+  return text;
+}
+
+bool read_autotune_cache(
+  const std::string &cache_dir, uint64_t key, AutotuneCandidate &candidate
+) {
+  std::ifstream file(cache_file(cache_dir, key));
+  AutotuneCandidate cached;
+  if (!(file >> cached.jacobian >> cached.linear_solver >> cached.preconditioner
+             >> cached.num_solvers >> cached.num_threads)) {
+    return false;
+  }
+  candidate = cached;
+  return true;
+}
+
+void write_autotune_cache(
+  const std::string &cache_dir, uint64_t key, const AutotuneCandidate &candidate
+) {
+  std::error_code ec;
+  std::filesystem::create_directories(cache_dir, ec);
+  const auto path = cache_file(cache_dir, key);
+  auto tmp_path = path;
+  // A random suffix keeps the temporary files of concurrent writers apart
+  tmp_path += "." + std::to_string(std::random_device()()) + ".tmp";
+  {
+    std::ofstream file(tmp_path);
+    file << candidate.jacobian << "\n"
+         << candidate.linear_solver << "\n"
+         << candidate.preconditioner << "\n"
+         << candidate.num_solvers << "\n"
+         << candidate.num_threads << "\n";
+    if (!file) {
+      std::filesystem::remove(tmp_path, ec);
+      return;
+    }
+  }
+  // Rename so that concurrent processes never read a partial entry
+  std::filesystem::rename(tmp_path, path, ec);
+  if (ec) {
+    std::filesystem::remove(tmp_path, ec);
+  }
+}
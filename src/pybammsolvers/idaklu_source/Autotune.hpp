@@ -0,0 +1,83 @@
+#ifndef PYBAMM_IDAKLU_AUTOTUNE_HPP
+#define PYBAMM_IDAKLU_AUTOTUNE_HPP
+
+#include "common.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Part of the cache key: change it whenever the candidate lists change, so
+// that entries tuned over other candidates are not reused
+#define AUTOTUNE_CANDIDATES_VERSION "2"
+
+/**
+ * @brief A linear solver and parallel layout tried by the autotuner
+ */
+struct AutotuneCandidate {
+  std::string jacobian;
+  std::string linear_solver;
+  std::string preconditioner;
+  int num_solvers;
+  int num_threads;  // overall, as in the options
+};
+
+/**
+ * @brief The linear solvers worth trying for a model
+ *
+ * KLU is always tried. The banded solver is tried if the bandwidths are
+ * narrower than the system, the dense solver for small systems, and GMRES
+ * with the band-block-diagonal or the ILU preconditioner.
+ * Each keeps the parallel layout of `base`.
+ */
+std::vector<AutotuneCandidate> autotune_linear_solvers(
+  const AutotuneCandidate &base,
+  int number_of_states,
+  int jac_bandwidth_lower,
+  int jac_bandwidth_upper);
+
+/**
+ * @brief The splits of `base.num_threads` into solvers worth trying
+ *
+ * Powers of two solvers (and one solver per thread), no more than the
+ * number of rows solved together. Each keeps the linear solver of `base`.
+ */
+std::vector<AutotuneCandidate> autotune_layouts(
+  const AutotuneCandidate &base,
+  int number_of_rows);
+
+/**
+ * @brief Copy of the options with the settings of a candidate
+ */
+py::dict autotune_options(const py::dict &options, const AutotuneCandidate &candidate);
+
+/**
+ * @brief Stable 64-bit hash (FNV-1a) of the given parts
+ */
+uint64_t autotune_hash(const std::vector<std::string> &parts);
+
+/**
+ * @brief Exact (round-trip) text of a number, for the cache key
+ */
+std::string autotune_hash_part(double value);
+
+/**
+ * @brief Text of every option the autotuner does not choose, sorted by
+ * name, for the cache key
+ */
+std::string autotune_hash_part(const py::dict &options);
+
+/**
+ * @brief Read the cached candidate for `key` from `cache_dir`, if any
+ */
+bool read_autotune_cache(
+  const std::string &cache_dir, uint64_t key, AutotuneCandidate &candidate);
+
+/**
+ * @brief Cache the candidate for `key` in `cache_dir` (created if needed)
+ *
+ * Failing to write the cache is not an error.
+ */
+void write_autotune_cache(
+  const std::string &cache_dir, uint64_t key, const AutotuneCandidate &candidate);
+
+#endif // PYBAMM_IDAKLU_AUTOTUNE_HPP
@@ -5,7 +5,13 @@
 #include "Expression.hpp"
 #include "../../common.hpp"
 #include "../../Options.hpp"
+#include "../../SparseILU.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
 #include <memory>
+#include <stdexcept>
+#include <string>
 
 template <class T>
 class ExpressionSet
@@ -55,6 +61,8 @@ public:
   int number_of_nnz;
   int jac_bandwidth_lower;
   int jac_bandwidth_upper;
+  // Number of copies of the model stacked in the states (see EnsembleFunctions)
+  int number_of_members = 1;
 
   Expression *rhs_alg = nullptr;
   Expression *jac_times_cjmass = nullptr;
@@ -62,6 +70,26 @@ public:
   Expression *mass_action = nullptr;
   Expression *sens = nullptr;
   Expression *events = nullptr;
+  // Optional multi-RHS Jacobian action (t, y, inputs, [yS_0 .. yS_np]) -> J [yS_0 .. yS_np]
+  Expression *jac_action_batched = nullptr;
+  // Optional single function (t, y, inputs) -> [var_fcns outputs], the
+  // nonzeros of all the output variables back to back
+  Expression *var_fused = nullptr;
+
+  // Optional partition of rhs_alg, jac_times_cjmass and jac_action into
+  // blocks that are evaluated concurrently: consecutive rows of the
+  // (dense) residual and Jacobian action, and consecutive columns of the
+  // Jacobian, so that each block fills a contiguous slice of the result
+  std::vector<Expression*> rhs_alg_blocks;  // cppcheck-suppress unusedStructMember
+  std::vector<Expression*> jac_times_cjmass_blocks;  // cppcheck-suppress unusedStructMember
+  std::vector<Expression*> jac_action_blocks;  // cppcheck-suppress unusedStructMember
+  // Start of each block's slice of the result (see set_partition)
+  std::vector<int64_t> rhs_alg_block_offsets;  // cppcheck-suppress unusedStructMember
+  std::vector<int64_t> jac_times_cjmass_block_offsets;  // cppcheck-suppress unusedStructMember
+  std::vector<int64_t> jac_action_block_offsets;  // cppcheck-suppress unusedStructMember
+  // Message of a block evaluation that failed inside a SUNDIALS callback,
+  // raised by the solver once IDAS has returned
+  std::string callback_error;  // cppcheck-suppress unusedStructMember
 
   // `cppcheck-suppress unusedStructMember` is used because codacy reports
   // these members as unused, but they are inherited through variadics
@@ -69,18 +97,197 @@ public:
   std::vector<Expression*> dvar_dy_fcns;  // cppcheck-suppress unusedStructMember
   std::vector<Expression*> dvar_dp_fcns;  // cppcheck-suppress unusedStructMember
 
-  std::vector<int64_t> jac_times_cjmass_rowvals;  // cppcheck-suppress unusedStructMember
-  std::vector<int64_t> jac_times_cjmass_colptrs;  // cppcheck-suppress unusedStructMember
+  // Jacobian sparsity pattern (CSC), immutable and shared between copies
+  std::shared_ptr<const std::vector<int64_t>> jac_times_cjmass_rowvals;  // cppcheck-suppress unusedStructMember
+  std::shared_ptr<const std::vector<int64_t>> jac_times_cjmass_colptrs;  // cppcheck-suppress unusedStructMember
+  // CSR position -> CSC position, only used if the Jacobian is stored as CSR
+  std::vector<int64_t> jac_times_cjmass_csr_gather;  // cppcheck-suppress unusedStructMember
+  // CSC position -> offset in the band matrix data, only used if banded
+  std::vector<int64_t> jac_times_cjmass_band_scatter;  // cppcheck-suppress unusedStructMember
+  // Host copy of the CSR values, only used if the Jacobian is on a device
+  std::vector<realtype> jac_times_cjmass_csr_data;  // cppcheck-suppress unusedStructMember
+  // Factors of the Jacobian, only used by the ILU preconditioner
+  SparseILU jac_times_cjmass_ilu;  // cppcheck-suppress unusedStructMember
   std::vector<realtype> inputs;  // cppcheck-suppress unusedStructMember
 
+  // Diagonal of the mass matrix, only valid if mass_matrix_is_diagonal
+  std::vector<realtype> mass_matrix_diagonal;  // cppcheck-suppress unusedStructMember
+  bool mass_matrix_is_diagonal = false;  // cppcheck-suppress unusedStructMember
+  bool mass_matrix_is_identity = false;  // cppcheck-suppress unusedStructMember
+  bool mass_matrix_detected = false;  // cppcheck-suppress unusedStructMember
+
   SetupOptions setup_opts;
 
+  /**
+   * @brief Detect a diagonal (or identity) mass matrix by probing mass_action
+   *
+   * The diagonal is M * 1; M is diagonal if M * v == diag(M * 1) * v for two
+   * irregular probe vectors v. If so, the residual and Jacobian callbacks
+   * apply the diagonal directly instead of evaluating mass_action.
+   */
+  void detect_mass_matrix() {
+    if (mass_matrix_detected) {
+      // Already probed (e.g. copied from another expression set)
+      return;
+    }
+    const int n = number_of_states;
+    std::vector<realtype> ones(n, 1.0);
+    std::vector<realtype> probe(n);
+    std::vector<realtype> result(n);
+    mass_matrix_diagonal.resize(n);
+    (*mass_action)({ones.data()}, {mass_matrix_diagonal.data()});
+
+    realtype scale = 1.0;
+    for (const auto d : mass_matrix_diagonal) {
+      scale = std::max(scale, std::abs(d));
+    }
+    const realtype tol = 1e-14 * scale;
+
+    bool is_diagonal = true;
+    for (const realtype irrational : {0.6180339887498949, 0.4142135623730951}) {
+      for (int i = 0; i < n; i++) {
+        probe[i] = 1.0 + std::fmod(irrational * (i + 1), 1.0);
+      }
+      (*mass_action)({probe.data()}, {result.data()});
+      for (int i = 0; i < n && is_diagonal; i++) {
+        is_diagonal = std::abs(result[i] - mass_matrix_diagonal[i] * probe[i]) <= tol;
+      }
+    }
+
+    mass_matrix_is_diagonal = is_diagonal;
+    mass_matrix_is_identity = is_diagonal && std::all_of(
+      mass_matrix_diagonal.begin(), mass_matrix_diagonal.end(),
+      [](realtype d) { return d == 1.0; });
+    mass_matrix_detected = true;
+  }
+
+  /**
+   * @brief Lay out the slices of the partitioned expressions, checking that
+   * the blocks of each expression add up to its whole result, and that each
+   * Jacobian block fills whole columns
+   */
+  void set_partition() {
+    rhs_alg_block_offsets = block_offsets(
+      rhs_alg_blocks, number_of_states, "rhs_alg_blocks");
+    jac_times_cjmass_block_offsets = block_offsets(
+      jac_times_cjmass_blocks, number_of_nnz, "jac_times_cjmass_blocks");
+    jac_action_block_offsets = block_offsets(
+      jac_action_blocks, number_of_states, "jac_action_blocks");
+
+    // Block k must return the nonzeros of columns [c_k, c_{k+1}), i.e. end on
+    // a column boundary of the CSC pattern (the columns follow by induction)
+    for (std::size_t k = 0; k < jac_times_cjmass_blocks.size(); k++) {
+      const auto &colptrs = *jac_times_cjmass_colptrs;
+      const int64_t end =
+        jac_times_cjmass_block_offsets[k] + jac_times_cjmass_blocks[k]->nnz_out();
+      if (!std::binary_search(colptrs.begin(), colptrs.end(), end)) {
+        throw std::invalid_argument(
+          "jac_times_cjmass_blocks[" + std::to_string(k) + "] must return the "
+          "nonzeros of a range of whole Jacobian columns, but ends at nonzero " +
+          std::to_string(end) + ", inside a column");
+      }
+    }
+  }
+
+  /**
+   * @brief Copy the Jacobian sparsity pattern from numpy
+   */
+  void set_sparsity_pattern(
+    const np_array_int &rowvals_arg,
+    const np_array_int &colptrs_arg
+  ) {
+    auto p_rowvals = rowvals_arg.unchecked<1>();
+    std::vector<int64_t> rowvals(p_rowvals.size());
+    for (py::ssize_t i = 0; i < p_rowvals.size(); i++) {
+      rowvals[i] = p_rowvals(i);
+    }
+    jac_times_cjmass_rowvals = std::make_shared<const std::vector<int64_t>>(std::move(rowvals));
+
+    auto p_colptrs = colptrs_arg.unchecked<1>();
+    std::vector<int64_t> colptrs(p_colptrs.size());
+    for (py::ssize_t i = 0; i < p_colptrs.size(); i++) {
+      colptrs[i] = p_colptrs(i);
+    }
+    jac_times_cjmass_colptrs = std::make_shared<const std::vector<int64_t>>(std::move(colptrs));
+  }
+
+  /**
+   * @brief Evaluate one of the set's expressions through its concrete type
+   *
+   * All expressions of a set share the type T, so the call is bound
+   * statically rather than through the Expression vtable.
+   */
+  static void evaluate(Expression *expr) {
+    static_cast<T *>(expr)->T::operator()();
+  }
+
+  /**
+   * @brief Evaluate an output expression f(t, y, inputs) into `result`
+   */
+  static void evaluate(
+    Expression *expr,
+    const realtype *t,
+    const realtype *y,
+    const realtype *inputs,
+    realtype *result
+  ) {
+    expr->m_arg[0] = t;
+    expr->m_arg[1] = y;
+    expr->m_arg[2] = inputs;
+    expr->m_res[0] = result;
+    evaluate(expr);
+  }
+
+  /**
+   * @brief One expression evaluating `expr` for `number_of_members` members
+   * in a single call, laid out as in EnsembleFunction, or nullptr if the
+   * backend cannot batch it (then the members are evaluated one by one)
+   *
+   * Bound statically through the concrete set, like evaluate.
+   */
+  std::unique_ptr<Expression> map_members(
+    Expression *expr,
+    int number_of_members,
+    const std::vector<std::ptrdiff_t> &arg_strides,
+    std::ptrdiff_t res_stride
+  ) const {
+    return nullptr;
+  }
+
   virtual realtype *get_tmp_state_vector() = 0;
   virtual realtype *get_tmp_sparse_jacobian_data() = 0;
 
+  /**
+   * @brief Workspace for jac_action_batched: the input then the output block
+   */
+  realtype *get_tmp_sensitivity_block() {
+    tmp_sensitivity_block.resize(2 * number_of_states * number_of_parameters);
+    return tmp_sensitivity_block.data();
+  }
+
 protected:
+  static std::vector<int64_t> block_offsets(
+    const std::vector<Expression*> &blocks,
+    int64_t total,
+    const std::string &name
+  ) {
+    std::vector<int64_t> offsets;
+    int64_t offset = 0;
+    for (auto block : blocks) {
+      offsets.push_back(offset);
+      offset += block->nnz_out();
+    }
+    if (!blocks.empty() && offset != total) {
+      throw std::invalid_argument(
+        name + " must return " + std::to_string(total) +
+        " values in total, but return " + std::to_string(offset));
+    }
+    return offsets;
+  }
+
   std::vector<realtype> tmp_state_vector;
   std::vector<realtype> tmp_sparse_jacobian_data;
+  std::vector<realtype> tmp_sensitivity_block;
 };
 
 #endif // PYBAMM_IDAKLU_EXPRESSION_SET_HPP
@@ -1,29 +1,58 @@
 #include "CasadiFunctions.hpp"
 #include <casadi/core/sparsity.hpp>
 
-CasadiFunction::CasadiFunction(const BaseFunctionType &f) : Expression(), m_func(f)
+CasadiFunctionData::CasadiFunctionData(const casadi::Function &f) : func(f)
+{
+  DEBUG("CasadiFunctionData constructor: " << func.name());
+
+  func.sz_work(sz_arg, sz_res, sz_iw, sz_w);
+
+  nnz_out = (sz_res>0) ? func.nnz_out() : 0;
+  DEBUG("name = "<< func.name() << " arg = " << sz_arg << " res = "
+    << sz_res << " iw = " << sz_iw << " w = " << sz_w << " nnz = " << nnz_out);
+
+  if (func.n_out() > 0) {
+    casadi::Sparsity casadi_sparsity = func.sparsity_out(0);
+    rows = casadi_sparsity.get_row();
+    cols = casadi_sparsity.get_col();
+  }
+}
+
+CasadiFunction::CasadiFunction(const BaseFunctionType &f)
+  : CasadiFunction(std::make_shared<const CasadiFunctionData>(f))
+{}
+
+CasadiFunction::CasadiFunction(std::shared_ptr<const CasadiFunctionData> data)
+  : Expression(), m_func(data->func), m_data(std::move(data))
 {
   DEBUG("CasadiFunction constructor: " << m_func.name());
 
-  size_t sz_arg;
-  size_t sz_res;
-  size_t sz_iw;
-  size_t sz_w;
-  m_func.sz_work(sz_arg, sz_res, sz_iw, sz_w);
-
-  int nnz = (sz_res>0) ? m_func.nnz_out() : 0;  // cppcheck-suppress unreadVariable
-  DEBUG("name = "<< m_func.name() << " arg = " << sz_arg << " res = "
-    << sz_res << " iw = " << sz_iw << " w = " << sz_w << " nnz = " << nnz);
-
-  m_arg.resize(sz_arg, nullptr);
-  m_res.resize(sz_res, nullptr);
-  m_iw.resize(sz_iw, 0);
-  m_w.resize(sz_w, 0);
-
-  if (m_func.n_out() > 0) {
-    casadi::Sparsity casadi_sparsity = m_func.sparsity_out(0);
-    m_rows = casadi_sparsity.get_row();
-    m_cols = casadi_sparsity.get_col();
+  m_arg.resize(m_data->sz_arg, nullptr);
+  m_res.resize(m_data->sz_res, nullptr);
+  m_iw.resize(m_data->sz_iw, 0);
+  m_w.resize(m_data->sz_w, 0);
+  m_mem = m_func.checkout();
+}
+
+CasadiFunction::CasadiFunction(const CasadiFunction &other)
+  : CasadiFunction(other.m_data)
+{}
+
+CasadiFunction::CasadiFunction(CasadiFunction &&other) noexcept
+  : Expression(std::move(other)),
+    m_func(std::move(other.m_func)),
+    m_data(std::move(other.m_data)),
+    m_mem(other.m_mem),
+    m_iw(std::move(other.m_iw)),
+    m_w(std::move(other.m_w))
+{
+  other.m_mem = -1;
+}
+
+CasadiFunction::~CasadiFunction()
+{
+  if (m_mem >= 0) {
+    m_func.release(m_mem);
   }
 }
 
@@ -31,34 +60,32 @@ CasadiFunction::CasadiFunction(const BaseFunctionType &f) : Expression(), m_func
 void CasadiFunction::operator()()
 {
   DEBUG("CasadiFunction operator(): " << m_func.name());
-  int mem = m_func.checkout();
-  m_func(m_arg.data(), m_res.data(), m_iw.data(), m_w.data(), mem);
-  m_func.release(mem);
+  m_func(m_arg.data(), m_res.data(), m_iw.data(), m_w.data(), m_mem);
 }
 
 expr_int CasadiFunction::out_shape(int k) {
-  DEBUG("CasadiFunctions out_shape(): " << m_func.name() << " " << m_func.nnz_out());
-  return static_cast<expr_int>(m_func.nnz_out());
+  DEBUG("CasadiFunctions out_shape(): " << m_func.name() << " " << m_data->nnz_out);
+  return m_data->nnz_out;
 }
 
 expr_int CasadiFunction::nnz() {
-  DEBUG("CasadiFunction nnz(): " << m_func.name() << " " << static_cast<expr_int>(m_func.nnz_out()));
-  return static_cast<expr_int>(m_func.nnz_out());
+  DEBUG("CasadiFunction nnz(): " << m_func.name() << " " << m_data->nnz_out);
+  return m_data->nnz_out;
 }
 
 expr_int CasadiFunction::nnz_out() {
-  DEBUG("CasadiFunction nnz_out(): " << m_func.name() << " " << static_cast<expr_int>(m_func.nnz_out()));
-  return static_cast<expr_int>(m_func.nnz_out());
+  DEBUG("CasadiFunction nnz_out(): " << m_func.name() << " " << m_data->nnz_out);
+  return m_data->nnz_out;
 }
 
 const std::vector<expr_int>& CasadiFunction::get_row() {
   DEBUG("CasadiFunction get_row(): " << m_func.name());
-  return m_rows;
+  return m_data->rows;
 }
 
 const std::vector<expr_int>& CasadiFunction::get_col() {
   DEBUG("CasadiFunction get_col(): " << m_func.name());
-  return m_cols;
+  return m_data->cols;
 }
 
 void CasadiFunction::operator()(const std::vector<realtype*>& inputs,
@@ -74,3 +101,31 @@ void CasadiFunction::operator()(const std::vector<realtype*>& inputs,
     m_res[k] = results[k];
   operator()();
 }
+
+std::unique_ptr<Expression> CasadiFunctions::map_members(
+  Expression *expr,
+  int number_of_members,
+  const std::vector<std::ptrdiff_t> &arg_strides,
+  std::ptrdiff_t res_stride
+) const {
+  const casadi::Function &func = static_cast<CasadiFunction *>(expr)->m_func;
+  if (func.n_out() != 1 || func.nnz_out(0) != res_stride ||
+      func.n_in() != static_cast<casadi_int>(arg_strides.size())) {
+    return nullptr;
+  }
+  // Map concatenates the repeated arguments and results member after member
+  std::vector<casadi_int> shared;
+  for (std::size_t i = 0; i < arg_strides.size(); i++) {
+    if (arg_strides[i] == 0) {
+      shared.push_back(static_cast<casadi_int>(i));
+    } else if (func.nnz_in(i) != arg_strides[i]) {
+      return nullptr;
+    }
+  }
+  const std::string parallelization = setup_opts.num_threads > 1 ? "openmp" : "serial";
+  DEBUG("CasadiFunctions map_members(): " << func.name() << " x " << number_of_members
+    << " (" << parallelization << ")");
+  return std::make_unique<CasadiFunction>(func.map(
+    func.name() + "_members", parallelization, number_of_members, shared,
+    std::vector<casadi_int>()));
+}
@@ -6,12 +6,30 @@
 #include <casadi/casadi.hpp>
 #include <casadi/core/function.hpp>
 #include <casadi/core/sparsity.hpp>
+#include <cstddef>
 #include <memory>
 
+/**
+ * @brief Immutable data of a casadi function, shared between solvers
+ */
+struct CasadiFunctionData
+{
+  explicit CasadiFunctionData(const casadi::Function &f);
+
+  casadi::Function func;
+  size_t sz_arg = 0;
+  size_t sz_res = 0;
+  size_t sz_iw = 0;
+  size_t sz_w = 0;
+  expr_int nnz_out = 0;
+  std::vector<expr_int> rows;
+  std::vector<expr_int> cols;
+};
+
 /**
  * @brief Class for handling individual casadi functions
  */
-class CasadiFunction : public Expression
+class CasadiFunction final : public Expression
 {
 public:
 
@@ -22,6 +40,34 @@ public:
    */
   explicit CasadiFunction(const BaseFunctionType &f);
 
+  /**
+   * @brief Constructor sharing the immutable data of another function
+   */
+  explicit CasadiFunction(std::shared_ptr<const CasadiFunctionData> data);
+
+  /**
+   * @brief Copy constructor (checks out a new memory slot)
+   */
+  CasadiFunction(const CasadiFunction &other);
+
+  /**
+   * @brief Move constructor (takes over the memory slot)
+   */
+  CasadiFunction(CasadiFunction &&other) noexcept;
+
+  CasadiFunction &operator=(const CasadiFunction &) = delete;
+  CasadiFunction &operator=(CasadiFunction &&) = delete;
+
+  /**
+   * @brief Destructor (releases the memory slot)
+   */
+  ~CasadiFunction();
+
+  /**
+   * @brief The shared, immutable part of the function
+   */
+  const std::shared_ptr<const CasadiFunctionData> &data() const { return m_data; }
+
   // Method overrides
   void operator()() override;
   void operator()(const std::vector<realtype*>& inputs,
@@ -39,10 +85,12 @@ public:
   BaseFunctionType m_func;
 
 private:
+  std::shared_ptr<const CasadiFunctionData> m_data;
+  // Memory slot, checked out once for the lifetime of the object
+  int m_mem = -1;
+  // Per-instance work arrays
   std::vector<expr_int> m_iw;  // cppcheck-suppress unusedStructMember
   std::vector<double> m_w;  // cppcheck-suppress unusedStructMember
-  std::vector<expr_int> m_rows;  // cppcheck-suppress unusedStructMember
-  std::vector<expr_int> m_cols;  // cppcheck-suppress unusedStructMember
 };
 
 /**
@@ -76,7 +124,12 @@ public:
     const std::vector<BaseFunctionType*>& var_fcns,
     const std::vector<BaseFunctionType*>& dvar_dy_fcns,
     const std::vector<BaseFunctionType*>& dvar_dp_fcns,
-    const SetupOptions& setup_opts
+    const SetupOptions& setup_opts,
+    const BaseFunctionType *jac_action_batched = nullptr,
+    const BaseFunctionType *var_fused = nullptr,
+    const std::vector<BaseFunctionType*>& rhs_alg_blocks = {},
+    const std::vector<BaseFunctionType*>& jac_times_cjmass_blocks = {},
+    const std::vector<BaseFunctionType*>& jac_action_blocks = {}
   ) :
     rhs_alg_casadi(rhs_alg),
     jac_times_cjmass_casadi(jac_times_cjmass),
@@ -118,33 +171,120 @@ public:
       this->dvar_dp_fcns.push_back(&this->dvar_dp_fcns_casadi[k]);
 
     // copy across numpy array values
-    const int n_row_vals = jac_times_cjmass_rowvals_arg.request().size;
-    auto p_jac_times_cjmass_rowvals = jac_times_cjmass_rowvals_arg.unchecked<1>();
-    jac_times_cjmass_rowvals.resize(n_row_vals);
-    for (int i = 0; i < n_row_vals; i++) {
-      jac_times_cjmass_rowvals[i] = p_jac_times_cjmass_rowvals[i];
+    set_sparsity_pattern(jac_times_cjmass_rowvals_arg, jac_times_cjmass_colptrs_arg);
+
+    if (jac_action_batched != nullptr && !jac_action_batched->is_null()) {
+      jac_action_batched_casadi = std::make_unique<CasadiFunction>(*jac_action_batched);
+      this->jac_action_batched = jac_action_batched_casadi.get();
     }
 
-    const int n_col_ptrs = jac_times_cjmass_colptrs_arg.request().size;
-    auto p_jac_times_cjmass_colptrs = jac_times_cjmass_colptrs_arg.unchecked<1>();
-    jac_times_cjmass_colptrs.resize(n_col_ptrs);
-    for (int i = 0; i < n_col_ptrs; i++) {
-      jac_times_cjmass_colptrs[i] = p_jac_times_cjmass_colptrs[i];
+    if (var_fused != nullptr && !var_fused->is_null()) {
+      var_fused_casadi = std::make_unique<CasadiFunction>(*var_fused);
+      this->var_fused = var_fused_casadi.get();
     }
 
+    for (auto& block : rhs_alg_blocks)
+      rhs_alg_blocks_casadi.push_back(CasadiFunction(*block));
+    for (auto& block : rhs_alg_blocks_casadi)
+      this->rhs_alg_blocks.push_back(&block);
+
+    for (auto& block : jac_times_cjmass_blocks)
+      jac_times_cjmass_blocks_casadi.push_back(CasadiFunction(*block));
+    for (auto& block : jac_times_cjmass_blocks_casadi)
+      this->jac_times_cjmass_blocks.push_back(&block);
+
+    for (auto& block : jac_action_blocks)
+      jac_action_blocks_casadi.push_back(CasadiFunction(*block));
+    for (auto& block : jac_action_blocks_casadi)
+      this->jac_action_blocks.push_back(&block);
+
     inputs.resize(inputs_length);
   }
 
+  /**
+   * @brief Copy constructor
+   *
+   * The functions, sparsity patterns and index arrays are shared with
+   * `other`; only the work arrays, inputs and temporaries are duplicated.
+   */
+  CasadiFunctions(const CasadiFunctions &other) :
+    ExpressionSet<CasadiFunction>(other),
+    rhs_alg_casadi(other.rhs_alg_casadi.data()),
+    jac_times_cjmass_casadi(other.jac_times_cjmass_casadi.data()),
+    jac_action_casadi(other.jac_action_casadi.data()),
+    mass_action_casadi(other.mass_action_casadi.data()),
+    sens_casadi(other.sens_casadi.data()),
+    events_casadi(other.events_casadi.data())
+  {
+    // Point the expression set at this object's functions
+    this->rhs_alg = &rhs_alg_casadi;
+    this->jac_times_cjmass = &jac_times_cjmass_casadi;
+    this->jac_action = &jac_action_casadi;
+    this->mass_action = &mass_action_casadi;
+    this->sens = &sens_casadi;
+    this->events = &events_casadi;
+
+    share_functions(other.var_fcns_casadi, var_fcns_casadi, ExpressionSet::var_fcns);
+    share_functions(other.dvar_dy_fcns_casadi, dvar_dy_fcns_casadi, this->dvar_dy_fcns);
+    share_functions(other.dvar_dp_fcns_casadi, dvar_dp_fcns_casadi, this->dvar_dp_fcns);
+    share_functions(other.rhs_alg_blocks_casadi, rhs_alg_blocks_casadi, this->rhs_alg_blocks);
+    share_functions(
+      other.jac_times_cjmass_blocks_casadi, jac_times_cjmass_blocks_casadi,
+      this->jac_times_cjmass_blocks);
+    share_functions(
+      other.jac_action_blocks_casadi, jac_action_blocks_casadi, this->jac_action_blocks);
+
+    this->jac_action_batched = nullptr;
+    if (other.jac_action_batched_casadi) {
+      jac_action_batched_casadi = std::make_unique<CasadiFunction>(
+        other.jac_action_batched_casadi->data());
+      this->jac_action_batched = jac_action_batched_casadi.get();
+    }
+
+    this->var_fused = nullptr;
+    if (other.var_fused_casadi) {
+      var_fused_casadi = std::make_unique<CasadiFunction>(other.var_fused_casadi->data());
+      this->var_fused = var_fused_casadi.get();
+    }
+  }
+
   CasadiFunction rhs_alg_casadi;
   CasadiFunction jac_times_cjmass_casadi;
   CasadiFunction jac_action_casadi;
   CasadiFunction mass_action_casadi;
   CasadiFunction sens_casadi;
   CasadiFunction events_casadi;
+  std::unique_ptr<CasadiFunction> jac_action_batched_casadi;
+  std::unique_ptr<CasadiFunction> var_fused_casadi;
 
   std::vector<CasadiFunction> var_fcns_casadi;
   std::vector<CasadiFunction> dvar_dy_fcns_casadi;
   std::vector<CasadiFunction> dvar_dp_fcns_casadi;
+  std::vector<CasadiFunction> rhs_alg_blocks_casadi;
+  std::vector<CasadiFunction> jac_times_cjmass_blocks_casadi;
+  std::vector<CasadiFunction> jac_action_blocks_casadi;
+
+  /**
+   * @brief The casadi map of `expr` over the members (see
+   * ExpressionSet::map_members)
+   *
+   * Arguments with a zero stride are shared by all members; the others, and
+   * the result, must be strided by their number of nonzeros. The map runs on
+   * OpenMP threads if the solver has more than one.
+   */
+  std::unique_ptr<Expression> map_members(
+    Expression *expr,
+    int number_of_members,
+    const std::vector<std::ptrdiff_t> &arg_strides,
+    std::ptrdiff_t res_stride
+  ) const;
+
+  /**
+   * @brief Serialized function, identifying it across processes
+   */
+  static std::string fingerprint(const BaseFunctionType &function) {
+    return function.serialize();
+  }
 
   realtype* get_tmp_state_vector() override {
     return tmp_state_vector.data();
@@ -152,6 +292,24 @@ public:
   realtype* get_tmp_sparse_jacobian_data() override {
     return tmp_sparse_jacobian_data.data();
   }
+
+private:
+  static void share_functions(
+    const std::vector<CasadiFunction> &from,
+    std::vector<CasadiFunction> &to,
+    std::vector<Expression*> &expressions
+  ) {
+    // NOTE: You must allocate ALL std::vector elements before taking references
+    to.clear();
+    to.reserve(from.size());
+    for (const auto &fcn : from) {
+      to.emplace_back(fcn.data());
+    }
+    expressions.clear();
+    for (auto &fcn : to) {
+      expressions.push_back(&fcn);
+    }
+  }
 };
 
 #endif // PYBAMM_IDAKLU_CASADI_FUNCTIONS_HPP
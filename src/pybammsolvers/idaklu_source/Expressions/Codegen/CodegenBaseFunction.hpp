@@ -0,0 +1,26 @@
+#ifndef PYBAMM_IDAKLU_CODEGEN_BASE_FUNCTION_HPP
+#define PYBAMM_IDAKLU_CODEGEN_BASE_FUNCTION_HPP
+
+#include <string>
+
+/*
+ * @brief Function definition passed from PyBaMM
+ *
+ * `source` is C code generated by casadi (casadi.CodeGenerator) and `name` is
+ * the name of the function within it; several functions may share a source.
+ */
+class CodegenBaseFunctionType
+{
+public:  // methods
+  CodegenBaseFunctionType() = default;
+  CodegenBaseFunctionType(const std::string &name, const std::string &source)
+    : name(name), source(source) {}
+
+  bool is_null() const { return name.empty(); }
+
+public:  // data members
+  std::string name;  // cppcheck-suppress unusedStructMember
+  std::string source;  // cppcheck-suppress unusedStructMember
+};
+
+#endif // PYBAMM_IDAKLU_CODEGEN_BASE_FUNCTION_HPP
@@ -0,0 +1,382 @@
+#include "CodegenFunctions.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <dlfcn.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+#include <unistd.h>
+
+/**
+ * @brief A loaded shared library (closed when the last function using it goes)
+ */
+class CodegenLibrary
+{
+public:
+  explicit CodegenLibrary(void *handle) : handle(handle) {}
+  ~CodegenLibrary() { dlclose(handle); }
+
+  CodegenLibrary(const CodegenLibrary &) = delete;
+  CodegenLibrary &operator=(const CodegenLibrary &) = delete;
+
+  void *symbol(const std::string &name) const {
+    return dlsym(handle, name.c_str());
+  }
+
+private:
+  void *handle;
+};
+
+namespace {
+
+std::string getenv_or(const char *name, const std::string &fallback) {
+  const char *value = std::getenv(name);
+  return (value != NULL && value[0] != '\0') ? std::string(value) : fallback;
+}
+
+// C compiler and flags: $PYBAMM_CODEGEN_CC (or $CC) and $PYBAMM_CODEGEN_CFLAGS
+std::string compiler() {
+  return getenv_or("PYBAMM_CODEGEN_CC", getenv_or("CC", "cc"));
+}
+
+std::string compiler_flags() {
+  return getenv_or("PYBAMM_CODEGEN_CFLAGS", "-O3 -march=native") + " -fPIC -shared";
+}
+
+// Identity of the host CPU model and features, so that libraries built with
+// -march=native are never loaded on another microarchitecture (e.g. from a
+// cache directory on a shared file system)
+std::string host_cpu_identity() {
+  std::string identity;
+  std::ifstream cpuinfo("/proc/cpuinfo");
+  std::string line;
+  while (std::getline(cpuinfo, line)) {
+    if (line.empty()) {
+      break;  // end of the first processor
+    }
+    for (const char *key : {"vendor_id", "model name", "flags", "Features", "CPU implementer",
+                            "CPU architecture", "CPU variant", "CPU part"}) {
+      if (line.compare(0, std::strlen(key), key) == 0) {
+        identity += line + "\n";
+      }
+    }
+  }
+#if defined(__x86_64__) || defined(__i386__)
+  if (identity.empty()) {
+    // No /proc/cpuinfo: the processor brand string and feature bits
+    unsigned int regs[12] = {0};
+    if (__get_cpuid(0x80000000, &regs[0], &regs[1], &regs[2], &regs[3]) &&
+        regs[0] >= 0x80000004) {
+      for (unsigned int leaf = 0; leaf < 3; leaf++) {
+        __get_cpuid(0x80000002 + leaf,
+          &regs[4 * leaf], &regs[4 * leaf + 1], &regs[4 * leaf + 2], &regs[4 * leaf + 3]);
+      }
+      identity.assign(reinterpret_cast<const char *>(regs), sizeof(regs));
+    }
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+    __get_cpuid(1, &eax, &ebx, &ecx, &edx);
+    identity += std::to_string(eax) + " " + std::to_string(ecx) + " " + std::to_string(edx);
+    if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+      identity += " " + std::to_string(ebx) + " " + std::to_string(ecx);
+    }
+  }
+#endif
+  return identity;
+}
+
+bool targets_host_cpu(const std::string &flags) {
+  return flags.find("=native") != std::string::npos;
+}
+
+std::shared_ptr<CodegenLibrary> open_library(const std::filesystem::path &path) {
+  void *handle = dlopen(path.string().c_str(), RTLD_NOW | RTLD_LOCAL);
+  if (handle == NULL) {
+    const char *err = dlerror();
+    throw std::runtime_error(
+      "Failed to load compiled function " + path.string() + ": " + (err ? err : ""));
+  }
+  return std::make_shared<CodegenLibrary>(handle);
+}
+
+// Compiled libraries, shared in memory between functions (e.g. several
+// functions in one source, or the solvers of a group) and persisted to disk
+// between processes
+class LibraryCache {
+public:
+  std::shared_ptr<CodegenLibrary> load(const std::string &source) {
+    const std::string cc = compiler();
+    const std::string flags = compiler_flags();
+    static const std::string cpu = host_cpu_identity();
+    char key_buf[17];
+    std::snprintf(key_buf, sizeof(key_buf), "%016llx",
+      static_cast<unsigned long long>(fnv1a(
+        cc + "\n" + flags + "\n" +
+        (targets_host_cpu(flags) ? cpu : std::string()) + "\n" + source)));
+    const std::string key(key_buf);
+
+    // Compilation happens under the lock so that a source is only built once
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = libraries.find(key);
+    if (it != libraries.end()) {
+      if (auto library = it->second.lock()) {
+        DEBUG("Codegen library cache: memory hit " << key);
+        return library;
+      }
+    }
+
+    auto dir = cache_dir("codegen");
+    const bool persistent = !dir.empty();
+    if (persistent) {
+      const auto path = dir / (key + ".so");
+      if (std::filesystem::exists(path)) {
+        DEBUG("Codegen library cache: disk hit " << key);
+        auto library = open_library(path);
+        libraries[key] = library;
+        return library;
+      }
+    } else {
+      dir = std::filesystem::temp_directory_path() /
+        ("pybammsolvers-codegen-" + std::to_string(getpid()));
+    }
+
+    auto library = compile(dir, key, source, cc, flags, persistent);
+    libraries[key] = library;
+    return library;
+  }
+
+private:
+  static std::shared_ptr<CodegenLibrary> compile(
+    const std::filesystem::path &dir,
+    const std::string &key,
+    const std::string &source,
+    const std::string &cc,
+    const std::string &flags,
+    bool persistent
+  ) {
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    const std::string suffix = "." + std::to_string(getpid()) + ".tmp";
+    const auto src_path = dir / (key + suffix + ".c");
+    const auto tmp_path = dir / (key + ".so" + suffix);
+    auto path = dir / (key + ".so");
+    {
+      std::ofstream file(src_path);
+      file << source;
+      if (!file) {
+        throw std::runtime_error("Failed to write generated code to " + src_path.string());
+      }
+    }
+
+    const std::string cmd = "\"" + cc + "\" " + flags +
+      " -o \"" + tmp_path.string() + "\" \"" + src_path.string() + "\"";
+    DEBUG("Codegen compile: " << cmd);
+    const int status = std::system(cmd.c_str());
+    std::filesystem::remove(src_path, ec);
+    if (status != 0) {
+      std::filesystem::remove(tmp_path, ec);
+      throw std::runtime_error("Failed to compile generated code: " + cmd);
+    }
+
+    // Rename so that concurrent processes never load a partial library. If
+    // another process got there first its (identical) library is used.
+    std::filesystem::rename(tmp_path, path, ec);
+    if (ec) {
+      if (std::filesystem::exists(path)) {
+        std::filesystem::remove(tmp_path, ec);
+      } else {
+        path = tmp_path;
+      }
+    }
+
+    auto library = open_library(path);
+    if (!persistent) {
+      // The loaded library stays mapped after the file is removed
+      std::filesystem::remove(path, ec);
+      std::filesystem::remove(dir, ec);
+    }
+    return library;
+  }
+
+  std::mutex mutex;
+  std::unordered_map<std::string, std::weak_ptr<CodegenLibrary>> libraries;
+};
+
+LibraryCache& library_cache() {
+  static LibraryCache cache;
+  return cache;
+}
+
+template <class F>
+F resolve(const CodegenLibrary &library, const std::string &name, bool required) {
+  void *sym = library.symbol(name);
+  if (sym == NULL && required) {
+    throw std::invalid_argument("Compiled code does not define '" + name + "'");
+  }
+  return reinterpret_cast<F>(sym);
+}
+
+// Number of non-zeros of a casadi compressed sparsity pattern
+expr_int sparsity_nnz(const expr_int *sp) {
+  const expr_int nrow = sp[0];
+  const expr_int ncol = sp[1];
+  // Dense patterns are stored as {nrow, ncol, 1}
+  return (sp[2] == 1) ? nrow * ncol : sp[2 + ncol];
+}
+
+}  // namespace
+
+CodegenFunctionData::CodegenFunctionData(const CodegenBaseFunctionType &f) : name(f.name)
+{
+  DEBUG("CodegenFunctionData constructor: " << name);
+  if (f.is_null()) {
+    // Placeholder for an unused function; evaluates to nothing
+    return;
+  }
+
+  library = library_cache().load(f.source);
+  eval = resolve<eval_t>(*library, name, true);
+  auto work = resolve<work_t>(*library, name + "_work", true);
+  auto sparsity_out = resolve<sparsity_t>(*library, name + "_sparsity_out", true);
+  auto n_out = resolve<n_t>(*library, name + "_n_out", true);
+  checkout = resolve<checkout_t>(*library, name + "_checkout", false);
+  release = resolve<release_t>(*library, name + "_release", false);
+  auto incref = resolve<refcount_t>(*library, name + "_incref", false);
+  decref = resolve<refcount_t>(*library, name + "_decref", false);
+  if (incref != nullptr) {
+    incref();
+  }
+
+  expr_int n_arg = 0, n_res = 0, n_iw = 0, n_w = 0;
+  work(&n_arg, &n_res, &n_iw, &n_w);
+  sz_arg = n_arg;
+  sz_res = n_res;
+  sz_iw = n_iw;
+  sz_w = n_w;
+
+  const expr_int n_outputs = n_out();
+  for (expr_int k = 0; k < n_outputs; k++) {
+    nnz_out += sparsity_nnz(sparsity_out(k));
+  }
+  DEBUG("name = "<< name << " arg = " << sz_arg << " res = "
+    << sz_res << " iw = " << sz_iw << " w = " << sz_w << " nnz = " << nnz_out);
+
+  if (n_outputs > 0) {
+    // COO indices of the first output
+    const expr_int *sp = sparsity_out(0);
+    const expr_int nrow = sp[0];
+    const expr_int ncol = sp[1];
+    const bool dense = sp[2] == 1;
+    const expr_int *colind = sp + 2;
+    const expr_int *row = sp + 3 + ncol;
+    for (expr_int j = 0; j < ncol; j++) {
+      const expr_int begin = dense ? j * nrow : colind[j];
+      const expr_int end = dense ? (j + 1) * nrow : colind[j + 1];
+      for (expr_int k = begin; k < end; k++) {
+        rows.push_back(dense ? k - begin : row[k]);
+        cols.push_back(j);
+      }
+    }
+  }
+}
+
+CodegenFunctionData::~CodegenFunctionData()
+{
+  if (decref != nullptr) {
+    decref();
+  }
+}
+
+CodegenFunction::CodegenFunction(const BaseFunctionType &f)
+  : CodegenFunction(std::make_shared<const CodegenFunctionData>(f))
+{}
+
+CodegenFunction::CodegenFunction(std::shared_ptr<const CodegenFunctionData> data)
+  : Expression(), m_data(std::move(data))
+{
+  DEBUG("CodegenFunction constructor: " << m_data->name);
+
+  m_arg.resize(m_data->sz_arg, nullptr);
+  m_res.resize(m_data->sz_res, nullptr);
+  m_iw.resize(m_data->sz_iw, 0);
+  m_w.resize(m_data->sz_w, 0);
+  if (m_data->checkout != nullptr) {
+    m_mem = m_data->checkout();
+  }
+}
+
+CodegenFunction::CodegenFunction(const CodegenFunction &other)
+  : CodegenFunction(other.m_data)
+{}
+
+CodegenFunction::CodegenFunction(CodegenFunction &&other) noexcept
+  : Expression(std::move(other)),
+    m_data(std::move(other.m_data)),
+    m_mem(other.m_mem),
+    m_iw(std::move(other.m_iw)),
+    m_w(std::move(other.m_w))
+{}
+
+CodegenFunction::~CodegenFunction()
+{
+  // Moved-from objects no longer hold the data (or the memory slot)
+  if (m_data && m_data->release != nullptr) {
+    m_data->release(m_mem);
+  }
+}
+
+// only call this once m_arg and m_res have been set appropriately
+void CodegenFunction::operator()()
+{
+  DEBUG("CodegenFunction operator(): " << m_data->name);
+  if (m_data->eval != nullptr) {
+    m_data->eval(m_arg.data(), m_res.data(), m_iw.data(), m_w.data(), m_mem);
+  }
+}
+
+expr_int CodegenFunction::out_shape(int k) {
+  DEBUG("CodegenFunction out_shape(): " << m_data->name << " " << m_data->nnz_out);
+  return m_data->nnz_out;
+}
+
+expr_int CodegenFunction::nnz() {
+  DEBUG("CodegenFunction nnz(): " << m_data->name << " " << m_data->nnz_out);
+  return m_data->nnz_out;
+}
+
+expr_int CodegenFunction::nnz_out() {
+  DEBUG("CodegenFunction nnz_out(): " << m_data->name << " " << m_data->nnz_out);
+  return m_data->nnz_out;
+}
+
+const std::vector<expr_int>& CodegenFunction::get_row() {
+  DEBUG("CodegenFunction get_row(): " << m_data->name);
+  return m_data->rows;
+}
+
+const std::vector<expr_int>& CodegenFunction::get_col() {
+  DEBUG("CodegenFunction get_col(): " << m_data->name);
+  return m_data->cols;
+}
+
+void CodegenFunction::operator()(const std::vector<realtype*>& inputs,
+                                 const std::vector<realtype*>& results)
+{
+  DEBUG("CodegenFunction operator() with inputs and results: " << m_data->name);
+
+  // Set-up input arguments, provide result vector, then execute function
+  // Example call: fcn({in1, in2, in3}, {out1})
+  for(size_t k=0; k<inputs.size(); k++)
+    m_arg[k] = inputs[k];
+  for(size_t k=0; k<results.size(); k++)
+    m_res[k] = results[k];
+  operator()();
+}
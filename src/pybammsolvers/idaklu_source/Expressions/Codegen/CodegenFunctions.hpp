@@ -0,0 +1,306 @@
+#ifndef PYBAMM_IDAKLU_CODEGEN_FUNCTIONS_HPP
+#define PYBAMM_IDAKLU_CODEGEN_FUNCTIONS_HPP
+
+#include "../../Options.hpp"
+#include "../Expressions.hpp"
+#include "CodegenBaseFunction.hpp"
+#include <memory>
+
+class CodegenLibrary;
+
+/**
+ * @brief Entry points of a compiled casadi function, shared between solvers
+ *
+ * The signatures follow the casadi code generator (casadi_real = double,
+ * casadi_int = long long int).
+ */
+struct CodegenFunctionData
+{
+  typedef int (*eval_t)(const double**, double**, expr_int*, double*, int);
+  typedef int (*work_t)(expr_int*, expr_int*, expr_int*, expr_int*);
+  typedef const expr_int* (*sparsity_t)(expr_int);
+  typedef expr_int (*n_t)(void);
+  typedef int (*checkout_t)(void);
+  typedef void (*release_t)(int);
+  typedef void (*refcount_t)(void);
+
+  explicit CodegenFunctionData(const CodegenBaseFunctionType &f);
+  ~CodegenFunctionData();
+
+  CodegenFunctionData(const CodegenFunctionData &) = delete;
+  CodegenFunctionData &operator=(const CodegenFunctionData &) = delete;
+
+  std::string name;
+  std::shared_ptr<CodegenLibrary> library;
+  eval_t eval = nullptr;
+  checkout_t checkout = nullptr;
+  release_t release = nullptr;
+  refcount_t decref = nullptr;
+  size_t sz_arg = 0;
+  size_t sz_res = 0;
+  size_t sz_iw = 0;
+  size_t sz_w = 0;
+  expr_int nnz_out = 0;
+  std::vector<expr_int> rows;
+  std::vector<expr_int> cols;
+};
+
+/**
+ * @brief Class for handling individual compiled (casadi codegen) functions
+ */
+class CodegenFunction final : public Expression
+{
+public:
+
+  typedef CodegenBaseFunctionType BaseFunctionType;
+
+  /**
+   * @brief Constructor (compiles and loads the function, or reuses a cached build)
+   */
+  explicit CodegenFunction(const BaseFunctionType &f);
+
+  /**
+   * @brief Constructor sharing the compiled function of another object
+   */
+  explicit CodegenFunction(std::shared_ptr<const CodegenFunctionData> data);
+
+  /**
+   * @brief Copy constructor (checks out a new memory slot)
+   */
+  CodegenFunction(const CodegenFunction &other);
+
+  /**
+   * @brief Move constructor (takes over the memory slot)
+   */
+  CodegenFunction(CodegenFunction &&other) noexcept;
+
+  CodegenFunction &operator=(const CodegenFunction &) = delete;
+  CodegenFunction &operator=(CodegenFunction &&) = delete;
+
+  /**
+   * @brief Destructor (releases the memory slot)
+   */
+  ~CodegenFunction();
+
+  /**
+   * @brief The shared, immutable part of the function
+   */
+  const std::shared_ptr<const CodegenFunctionData> &data() const { return m_data; }
+
+  // Method overrides
+  void operator()() override;
+  void operator()(const std::vector<realtype*>& inputs,
+                  const std::vector<realtype*>& results) override;
+  expr_int out_shape(int k) override;
+  expr_int nnz() override;
+  expr_int nnz_out() override;
+  const std::vector<expr_int>& get_row() override;
+  const std::vector<expr_int>& get_col() override;
+
+private:
+  std::shared_ptr<const CodegenFunctionData> m_data;
+  // Memory slot, checked out once for the lifetime of the object
+  int m_mem = 0;
+  // Per-instance work arrays
+  std::vector<expr_int> m_iw;  // cppcheck-suppress unusedStructMember
+  std::vector<double> m_w;  // cppcheck-suppress unusedStructMember
+};
+
+/**
+ * @brief Class for handling compiled (casadi codegen) functions
+ */
+class CodegenFunctions : public ExpressionSet<CodegenFunction>
+{
+public:
+
+  typedef CodegenFunction::BaseFunctionType BaseFunctionType;  // expose typedef in class
+
+  /**
+   * @brief Create a new CodegenFunctions object
+   */
+  CodegenFunctions(
+    const BaseFunctionType &rhs_alg,
+    const BaseFunctionType &jac_times_cjmass,
+    const int jac_times_cjmass_nnz,
+    const int jac_bandwidth_lower,
+    const int jac_bandwidth_upper,
+    const np_array_int &jac_times_cjmass_rowvals_arg,
+    const np_array_int &jac_times_cjmass_colptrs_arg,
+    const int inputs_length,
+    const BaseFunctionType &jac_action,
+    const BaseFunctionType &mass_action,
+    const BaseFunctionType &sens,
+    const BaseFunctionType &events,
+    const int n_s,
+    const int n_e,
+    const int n_p,
+    const std::vector<BaseFunctionType*>& var_fcns,
+    const std::vector<BaseFunctionType*>& dvar_dy_fcns,
+    const std::vector<BaseFunctionType*>& dvar_dp_fcns,
+    const SetupOptions& setup_opts,
+    const BaseFunctionType *jac_action_batched = nullptr,
+    const BaseFunctionType *var_fused = nullptr,
+    const std::vector<BaseFunctionType*>& rhs_alg_blocks = {},
+    const std::vector<BaseFunctionType*>& jac_times_cjmass_blocks = {},
+    const std::vector<BaseFunctionType*>& jac_action_blocks = {}
+  ) :
+    rhs_alg_codegen(rhs_alg),
+    jac_times_cjmass_codegen(jac_times_cjmass),
+    jac_action_codegen(jac_action),
+    mass_action_codegen(mass_action),
+    sens_codegen(sens),
+    events_codegen(events),
+    ExpressionSet<CodegenFunction>(
+      static_cast<Expression*>(&rhs_alg_codegen),
+      static_cast<Expression*>(&jac_times_cjmass_codegen),
+      jac_times_cjmass_nnz,
+      jac_bandwidth_lower,
+      jac_bandwidth_upper,
+      jac_times_cjmass_rowvals_arg,
+      jac_times_cjmass_colptrs_arg,
+      inputs_length,
+      static_cast<Expression*>(&jac_action_codegen),
+      static_cast<Expression*>(&mass_action_codegen),
+      static_cast<Expression*>(&sens_codegen),
+      static_cast<Expression*>(&events_codegen),
+      n_s, n_e, n_p,
+      setup_opts)
+  {
+    // convert BaseFunctionType list to CodegenFunction list
+    // NOTE: You must allocate ALL std::vector elements before taking references
+    for (auto& var : var_fcns)
+      var_fcns_codegen.push_back(CodegenFunction(*var));
+    for (int k = 0; k < var_fcns_codegen.size(); k++)
+      ExpressionSet::var_fcns.push_back(&this->var_fcns_codegen[k]);
+
+    for (auto& var : dvar_dy_fcns)
+      dvar_dy_fcns_codegen.push_back(CodegenFunction(*var));
+    for (int k = 0; k < dvar_dy_fcns_codegen.size(); k++)
+      this->dvar_dy_fcns.push_back(&this->dvar_dy_fcns_codegen[k]);
+
+    for (auto& var : dvar_dp_fcns)
+      dvar_dp_fcns_codegen.push_back(CodegenFunction(*var));
+    for (int k = 0; k < dvar_dp_fcns_codegen.size(); k++)
+      this->dvar_dp_fcns.push_back(&this->dvar_dp_fcns_codegen[k]);
+
+    // copy across numpy array values
+    set_sparsity_pattern(jac_times_cjmass_rowvals_arg, jac_times_cjmass_colptrs_arg);
+
+    if (jac_action_batched != nullptr && !jac_action_batched->is_null()) {
+      jac_action_batched_codegen = std::make_unique<CodegenFunction>(*jac_action_batched);
+      this->jac_action_batched = jac_action_batched_codegen.get();
+    }
+
+    if (var_fused != nullptr && !var_fused->is_null()) {
+      var_fused_codegen = std::make_unique<CodegenFunction>(*var_fused);
+      this->var_fused = var_fused_codegen.get();
+    }
+
+    for (auto& block : rhs_alg_blocks)
+      rhs_alg_blocks_codegen.push_back(CodegenFunction(*block));
+    for (auto& block : rhs_alg_blocks_codegen)
+      this->rhs_alg_blocks.push_back(&block);
+
+    for (auto& block : jac_times_cjmass_blocks)
+      jac_times_cjmass_blocks_codegen.push_back(CodegenFunction(*block));
+    for (auto& block : jac_times_cjmass_blocks_codegen)
+      this->jac_times_cjmass_blocks.push_back(&block);
+
+    for (auto& block : jac_action_blocks)
+      jac_action_blocks_codegen.push_back(CodegenFunction(*block));
+    for (auto& block : jac_action_blocks_codegen)
+      this->jac_action_blocks.push_back(&block);
+
+    inputs.resize(inputs_length);
+  }
+
+  /**
+   * @brief Copy constructor
+   *
+   * The compiled functions, sparsity patterns and index arrays are shared
+   * with `other`; only the work arrays, inputs and temporaries are duplicated.
+   */
+  CodegenFunctions(const CodegenFunctions &other) :
+    ExpressionSet<CodegenFunction>(other),
+    rhs_alg_codegen(other.rhs_alg_codegen.data()),
+    jac_times_cjmass_codegen(other.jac_times_cjmass_codegen.data()),
+    jac_action_codegen(other.jac_action_codegen.data()),
+    mass_action_codegen(other.mass_action_codegen.data()),
+    sens_codegen(other.sens_codegen.data()),
+    events_codegen(other.events_codegen.data())
+  {
+    // Point the expression set at this object's functions
+    this->rhs_alg = &rhs_alg_codegen;
+    this->jac_times_cjmass = &jac_times_cjmass_codegen;
+    this->jac_action = &jac_action_codegen;
+    this->mass_action = &mass_action_codegen;
+    this->sens = &sens_codegen;
+    this->events = &events_codegen;
+
+    share_functions(other.var_fcns_codegen, var_fcns_codegen, ExpressionSet::var_fcns);
+    share_functions(other.dvar_dy_fcns_codegen, dvar_dy_fcns_codegen, this->dvar_dy_fcns);
+    share_functions(other.dvar_dp_fcns_codegen, dvar_dp_fcns_codegen, this->dvar_dp_fcns);
+    share_functions(other.rhs_alg_blocks_codegen, rhs_alg_blocks_codegen, this->rhs_alg_blocks);
+    share_functions(
+      other.jac_times_cjmass_blocks_codegen, jac_times_cjmass_blocks_codegen,
+      this->jac_times_cjmass_blocks);
+    share_functions(
+      other.jac_action_blocks_codegen, jac_action_blocks_codegen, this->jac_action_blocks);
+
+    this->jac_action_batched = nullptr;
+    if (other.jac_action_batched_codegen) {
+      jac_action_batched_codegen = std::make_unique<CodegenFunction>(
+        other.jac_action_batched_codegen->data());
+      this->jac_action_batched = jac_action_batched_codegen.get();
+    }
+
+    this->var_fused = nullptr;
+    if (other.var_fused_codegen) {
+      var_fused_codegen = std::make_unique<CodegenFunction>(other.var_fused_codegen->data());
+      this->var_fused = var_fused_codegen.get();
+    }
+  }
+
+  CodegenFunction rhs_alg_codegen;
+  CodegenFunction jac_times_cjmass_codegen;
+  CodegenFunction jac_action_codegen;
+  CodegenFunction mass_action_codegen;
+  CodegenFunction sens_codegen;
+  CodegenFunction events_codegen;
+  std::unique_ptr<CodegenFunction> jac_action_batched_codegen;
+  std::unique_ptr<CodegenFunction> var_fused_codegen;
+
+  std::vector<CodegenFunction> var_fcns_codegen;
+  std::vector<CodegenFunction> dvar_dy_fcns_codegen;
+  std::vector<CodegenFunction> dvar_dp_fcns_codegen;
+  std::vector<CodegenFunction> rhs_alg_blocks_codegen;
+  std::vector<CodegenFunction> jac_times_cjmass_blocks_codegen;
+  std::vector<CodegenFunction> jac_action_blocks_codegen;
+
+  realtype* get_tmp_state_vector() override {
+    return tmp_state_vector.data();
+  }
+  realtype* get_tmp_sparse_jacobian_data() override {
+    return tmp_sparse_jacobian_data.data();
+  }
+
+private:
+  static void share_functions(
+    const std::vector<CodegenFunction> &from,
+    std::vector<CodegenFunction> &to,
+    std::vector<Expression*> &expressions
+  ) {
+    // NOTE: You must allocate ALL std::vector elements before taking references
+    to.clear();
+    to.reserve(from.size());
+    for (const auto &fcn : from) {
+      to.emplace_back(fcn.data());
+    }
+    expressions.clear();
+    for (auto &fcn : to) {
+      expressions.push_back(&fcn);
+    }
+  }
+};
+
+#endif // PYBAMM_IDAKLU_CODEGEN_FUNCTIONS_HPP
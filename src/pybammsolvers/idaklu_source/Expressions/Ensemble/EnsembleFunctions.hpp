@@ -0,0 +1,239 @@
+#ifndef PYBAMM_IDAKLU_ENSEMBLE_FUNCTIONS_HPP
+#define PYBAMM_IDAKLU_ENSEMBLE_FUNCTIONS_HPP
+
+#include "../../Options.hpp"
+#include "../Expressions.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+/**
+ * @brief An expression evaluated once for each member of an ensemble
+ *
+ * The arguments and results hold the values of all members back to back;
+ * member k's slice of argument i starts at k * arg_strides[i] (a stride of
+ * zero shares the argument, e.g. the time) and of each result at
+ * k * res_stride. If the backend can batch the member (see
+ * ExpressionSet::map_members), all members are evaluated in a single call;
+ * otherwise they are evaluated in order, so a member that writes up to
+ * out_shape past its slice is overwritten by the next one.
+ */
+class EnsembleFunction final : public Expression
+{
+public:
+  EnsembleFunction(
+    Expression *member,
+    int number_of_members,
+    std::vector<std::ptrdiff_t> arg_strides,
+    std::ptrdiff_t res_stride,
+    std::size_t number_of_results = 1,
+    expr_int row_offset = 0,
+    expr_int col_offset = 0
+  ) :
+    m_member(member),
+    m_number_of_members(number_of_members),
+    m_arg_strides(std::move(arg_strides)),
+    m_res_stride(res_stride),
+    m_number_of_results(number_of_results)
+  {
+    m_arg.resize(std::max(m_member->m_arg.size(), m_arg_strides.size()), nullptr);
+    m_res.resize(std::max(m_member->m_res.size(), m_number_of_results), nullptr);
+
+    // COO pattern of the stacked output: the member pattern shifted along the diagonal
+    const auto &rows = m_member->get_row();
+    const auto &cols = m_member->get_col();
+    for (int k = 0; k < m_number_of_members; k++) {
+      for (const auto row : rows) {
+        m_rows.push_back(row + k * row_offset);
+      }
+      for (const auto col : cols) {
+        m_cols.push_back(col + k * col_offset);
+      }
+    }
+  }
+
+  /**
+   * @brief Evaluate all members through `batched`, laid out as this function
+   */
+  void set_batched(std::unique_ptr<Expression> batched) {
+    m_batched = std::move(batched);
+  }
+
+  const std::vector<std::ptrdiff_t> &arg_strides() const { return m_arg_strides; }
+  std::ptrdiff_t res_stride() const { return m_res_stride; }
+
+  void operator()() override {
+    if (m_batched) {
+      for (std::size_t i = 0; i < m_arg_strides.size(); i++) {
+        m_batched->m_arg[i] = m_arg[i];
+      }
+      for (std::size_t j = 0; j < m_number_of_results; j++) {
+        m_batched->m_res[j] = m_res[j];
+      }
+      (*m_batched)();
+      return;
+    }
+    for (int k = 0; k < m_number_of_members; k++) {
+      for (std::size_t i = 0; i < m_arg_strides.size(); i++) {
+        m_member->m_arg[i] = m_arg[i] ? m_arg[i] + k * m_arg_strides[i] : nullptr;
+      }
+      for (std::size_t j = 0; j < m_number_of_results; j++) {
+        m_member->m_res[j] = m_res[j] ? m_res[j] + k * m_res_stride : nullptr;
+      }
+      (*m_member)();
+    }
+  }
+
+  void operator()(const std::vector<realtype*>& inputs,
+                  const std::vector<realtype*>& results) override {
+    for (std::size_t k = 0; k < inputs.size(); k++)
+      m_arg[k] = inputs[k];
+    for (std::size_t k = 0; k < results.size(); k++)
+      m_res[k] = results[k];
+    operator()();
+  }
+
+  expr_int out_shape(int k) override {
+    return (m_number_of_members - 1) * m_res_stride + m_member->out_shape(k);
+  }
+  expr_int nnz() override { return m_number_of_members * m_member->nnz(); }
+  expr_int nnz_out() override { return m_number_of_members * m_member->nnz_out(); }
+  const std::vector<expr_int>& get_row() override { return m_rows; }
+  const std::vector<expr_int>& get_col() override { return m_cols; }
+
+private:
+  Expression *m_member;
+  int m_number_of_members;
+  std::vector<std::ptrdiff_t> m_arg_strides;
+  std::ptrdiff_t m_res_stride;
+  std::size_t m_number_of_results;
+  std::unique_ptr<Expression> m_batched;  // all members in one call, if available
+  std::vector<expr_int> m_rows;
+  std::vector<expr_int> m_cols;
+};
+
+/**
+ * @brief The block-diagonal system of `number_of_members` copies of a model
+ *
+ * Each member has its own states and inputs, stored member after member, and
+ * is evaluated by the functions of a single (member) expression set. The
+ * Jacobian pattern is the member pattern repeated along the diagonal, which
+ * KLU factorises block by block. Output variables are stored per function,
+ * member after member. Sensitivities are not supported.
+ */
+template <class ExprSet>
+class EnsembleFunctions : public ExpressionSet<EnsembleFunction>
+{
+public:
+
+  typedef typename ExprSet::BaseFunctionType BaseFunctionType;  // expose typedef in class
+
+  /**
+   * @brief Create the ensemble of `number_of_members` copies of `member`
+   */
+  EnsembleFunctions(std::unique_ptr<ExprSet> member_arg, int number_of_members) :
+    ExpressionSet<EnsembleFunction>(
+      static_cast<Expression*>(&rhs_alg_ensemble),
+      static_cast<Expression*>(&jac_times_cjmass_ensemble),
+      number_of_members * member_arg->number_of_nnz,
+      member_arg->jac_bandwidth_lower,
+      member_arg->jac_bandwidth_upper,
+      np_array_int(),
+      np_array_int(),
+      number_of_members * static_cast<int>(member_arg->inputs.size()),
+      static_cast<Expression*>(&jac_action_ensemble),
+      static_cast<Expression*>(&mass_action_ensemble),
+      static_cast<Expression*>(&sens_ensemble),
+      static_cast<Expression*>(&events_ensemble),
+      number_of_members * member_arg->number_of_states,
+      number_of_members * member_arg->number_of_events,
+      0,
+      member_arg->setup_opts),
+    member(std::move(member_arg)),
+    // arguments are (t, y, inputs[, v]); the time is shared by all members
+    rhs_alg_ensemble(member->rhs_alg, number_of_members,
+      {0, member->number_of_states, member_inputs()}, member->number_of_states),
+    jac_times_cjmass_ensemble(member->jac_times_cjmass, number_of_members,
+      {0, member->number_of_states, member_inputs(), 0}, member->number_of_nnz),
+    jac_action_ensemble(member->jac_action, number_of_members,
+      {0, member->number_of_states, member_inputs(), member->number_of_states},
+      member->number_of_states),
+    mass_action_ensemble(member->mass_action, number_of_members,
+      {member->number_of_states}, member->number_of_states),
+    sens_ensemble(member->sens, number_of_members,
+      {0, member->number_of_states, member_inputs()}, member->number_of_states, 0),
+    events_ensemble(member->events, number_of_members,
+      {0, member->number_of_states, member_inputs()}, member->number_of_events)
+  {
+    this->number_of_members = number_of_members;
+
+    // The backend may evaluate all members in one call (e.g. a casadi map)
+    batch(rhs_alg_ensemble, member->rhs_alg);
+    batch(jac_times_cjmass_ensemble, member->jac_times_cjmass);
+    batch(jac_action_ensemble, member->jac_action);
+    batch(events_ensemble, member->events);
+
+    // NOTE: You must allocate ALL std::vector elements before taking references
+    for (auto& var : member->var_fcns) {
+      var_fcns_ensemble.emplace_back(var, number_of_members,
+        std::vector<std::ptrdiff_t>{0, member->number_of_states, member_inputs()},
+        var->nnz_out());
+    }
+    for (auto& var : var_fcns_ensemble)
+      this->var_fcns.push_back(&var);
+
+    // Repeat the member sparsity pattern along the diagonal
+    const auto &member_rowvals = *member->jac_times_cjmass_rowvals;
+    const auto &member_colptrs = *member->jac_times_cjmass_colptrs;
+    const int n = member->number_of_states;
+    const int64_t nnz = member->number_of_nnz;
+    std::vector<int64_t> rowvals;
+    std::vector<int64_t> colptrs;
+    rowvals.reserve(number_of_members * member_rowvals.size());
+    colptrs.reserve(number_of_members * n + 1);
+    for (int k = 0; k < number_of_members; k++) {
+      for (const auto row : member_rowvals) {
+        rowvals.push_back(row + k * n);
+      }
+      for (int col = 0; col < n; col++) {
+        colptrs.push_back(member_colptrs[col] + k * nnz);
+      }
+    }
+    colptrs.push_back(number_of_members * nnz);
+    jac_times_cjmass_rowvals = std::make_shared<const std::vector<int64_t>>(std::move(rowvals));
+    jac_times_cjmass_colptrs = std::make_shared<const std::vector<int64_t>>(std::move(colptrs));
+
+    inputs.resize(number_of_members * member->inputs.size());
+  }
+
+  EnsembleFunctions(const EnsembleFunctions &) = delete;
+
+  std::unique_ptr<ExprSet> member;
+  EnsembleFunction rhs_alg_ensemble;
+  EnsembleFunction jac_times_cjmass_ensemble;
+  EnsembleFunction jac_action_ensemble;
+  EnsembleFunction mass_action_ensemble;
+  EnsembleFunction sens_ensemble;
+  EnsembleFunction events_ensemble;
+  std::vector<EnsembleFunction> var_fcns_ensemble;
+
+  realtype* get_tmp_state_vector() override {
+    return tmp_state_vector.data();
+  }
+  realtype* get_tmp_sparse_jacobian_data() override {
+    return tmp_sparse_jacobian_data.data();
+  }
+
+private:
+  void batch(EnsembleFunction &ensemble, Expression *member_expr) {
+    ensemble.set_batched(member->map_members(
+      member_expr, this->number_of_members, ensemble.arg_strides(), ensemble.res_stride()));
+  }
+
+  std::ptrdiff_t member_inputs() const {
+    return static_cast<std::ptrdiff_t>(member->inputs.size());
+  }
+};
+
+#endif // PYBAMM_IDAKLU_ENSEMBLE_FUNCTIONS_HPP
@@ -10,7 +10,7 @@
 /**
  * @brief Class for handling individual iree functions
  */
-class IREEFunction : public Expression
+class IREEFunction final : public Expression
 {
 public:
   typedef IREEBaseFunctionType BaseFunctionType;
@@ -47,6 +47,11 @@ public:
   std::vector<std::vector<int>> input_shape;  // cppcheck-suppress unusedStructMember
   std::vector<std::vector<int>> output_shape;  // cppcheck-suppress unusedStructMember
   std::vector<std::vector<float>> input_data;  // cppcheck-suppress unusedStructMember
+  std::vector<std::vector<realtype>> result_f64;  // cppcheck-suppress unusedStructMember
+  std::vector<const void*> input_ptrs;  // cppcheck-suppress unusedStructMember
+  std::vector<void*> result_ptrs;  // cppcheck-suppress unusedStructMember
+  std::vector<size_t> result_numel;  // cppcheck-suppress unusedStructMember
+  bool use_f64 = false;  // cppcheck-suppress unusedStructMember
 
   BaseFunctionType m_func;  // cppcheck-suppress unusedStructMember
   std::string module_name;  // cppcheck-suppress unusedStructMember
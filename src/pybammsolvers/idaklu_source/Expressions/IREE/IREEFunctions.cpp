@@ -25,10 +25,12 @@ IREEFunction::IREEFunction(const BaseFunctionType &f) : Expression(), m_func(f)
   function_name = parser.getFunctionName();
   input_shape = parser.getInputShape();
   output_shape = parser.getOutputShape();
+  // Double precision modules exchange data with the solver without staging
+  use_f64 = parser.isFloat64() && sizeof(realtype) == sizeof(double);
 
   DEBUG("Compiling module: '" << module_name << "'");
   const char* device_uri = "local-sync";
-  session = std::make_unique<IREESession>(device_uri, mlir);
+  session = std::make_unique<IREESession>(device_uri, mlir, use_f64);
   DEBUG("compile complete.");
   // Create index vectors into m_arg
   // This is required since Jax expands input arguments through PyTrees, which need to
@@ -98,8 +100,11 @@ IREEFunction::IREEFunction(const BaseFunctionType &f) : Expression(), m_func(f)
       count *= input_shape[j][k];
     }
     numel[j] = count;
-    input_data[j].resize(numel[j]);
+    if (!use_f64) {
+      input_data[j].resize(numel[j]);
+    }
   }
+  input_ptrs.resize(input_shape.size(), nullptr);
 
   // Allocate memory for input arguments
   m_arg.resize(m_func.n_args, nullptr);
@@ -107,6 +112,9 @@ IREEFunction::IREEFunction(const BaseFunctionType &f) : Expression(), m_func(f)
   // Size iree results vector (single precision) and casadi results vector (double precision)
   result.clear();
   result.resize(output_shape.size());
+  result_f64.clear();
+  result_f64.resize(output_shape.size());
+  result_numel.resize(output_shape.size());
   for(int k=0; k<output_shape.size(); k++) {
     DEBUG("Output " << k << " size: " << output_shape[k][0]);
     auto elements = 1;
@@ -114,8 +122,15 @@ IREEFunction::IREEFunction(const BaseFunctionType &f) : Expression(), m_func(f)
       elements *= i;
     }
     // Sparse functions return NNZ elements, so we don't need to worry about sparsity
-    result[k].resize(elements, 0.0f);
+    if (use_f64) {
+      // Only used for outputs that are not requested by the caller
+      result_f64[k].resize(elements, 0.0);
+    } else {
+      result[k].resize(elements, 0.0f);
+    }
+    result_numel[k] = elements;
   }
+  result_ptrs.resize(output_shape.size(), nullptr);
   m_res.resize(output_shape.size(), nullptr);
 }
 
@@ -151,33 +166,52 @@ void IREEFunction::evaluate(int n_outputs) {
     int mlir_arg = m_func.kept_var_idx[j];
     int m_arg_from = m_arg_argno[mlir_arg];
     int m_arg_to = j;
+    // Both cases are contiguous slices of the original argument
+    const realtype* src = m_arg[m_arg_from];
+    int count = numel[m_arg_to];
     if (m_func.pytree_shape[m_arg_from] > 1) {
       // Index into argument using appropriate shape
-      for(int k=0; k<m_func.pytree_sizes[mlir_arg]; k++) {
-        input_data[m_arg_to][k] = static_cast<float>(m_arg[m_arg_from][m_arg_argix[mlir_arg]+k]);
-      }
+      src += m_arg_argix[mlir_arg];
+      count = m_func.pytree_sizes[mlir_arg];
+    }
+    if (use_f64) {
+      // Pass the solver data straight to the module
+      input_ptrs[m_arg_to] = src;
     } else {
-      // Copy the entire vector
-      for(int k=0; k<input_shape[m_arg_to][0]; k++) {
-        input_data[m_arg_to][k] = static_cast<float>(m_arg[m_arg_from][k]);
+      for(int k=0; k<count; k++) {
+        input_data[m_arg_to][k] = static_cast<float>(src[k]);
       }
+      input_ptrs[m_arg_to] = input_data[m_arg_to].data();
+    }
+  }
+
+  // Results are read straight into the requested outputs for f64 modules
+  for(size_t k=0; k<result_ptrs.size(); k++) {
+    if (!use_f64) {
+      result_ptrs[k] = result[k].data();
+    } else if (k < n_outputs) {
+      result_ptrs[k] = m_res[k];
+    } else {
+      result_ptrs[k] = result_f64[k].data();
     }
   }
 
   // Call the 'main' function of the module
-  const std::string mlir = m_func.get_mlir();
   DEBUG("Calling function '" << function_name << "'");
-  auto status = session->iree_runtime_exec(function_name, input_shape, input_data, result);
+  auto status = session->iree_runtime_exec(
+    function_name, input_shape, input_ptrs, result_ptrs, result_numel);
   if (!iree_status_is_ok(status)) {
     iree_status_fprint(stderr, status);
-    std::cerr << "MLIR: " << mlir.substr(0,1000) << std::endl;
+    std::cerr << "MLIR: " << m_func.get_mlir().substr(0,1000) << std::endl;
     throw std::runtime_error("Execution failed");
   }
 
-  // Copy results to output array
-  for(size_t k=0; k<n_outputs; k++) {
-    for(size_t j=0; j<result[k].size(); j++) {
-      m_res[k][j] = static_cast<realtype>(result[k][j]);
+  // Copy single precision results to output array
+  if (!use_f64) {
+    for(size_t k=0; k<n_outputs; k++) {
+      for(size_t j=0; j<result[k].size(); j++) {
+        m_res[k][j] = static_cast<realtype>(result[k][j]);
+      }
     }
   }
 
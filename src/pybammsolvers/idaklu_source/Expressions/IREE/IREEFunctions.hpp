@@ -59,7 +59,12 @@ public:
     const std::vector<BaseFunctionType*>& var_fcns,
     const std::vector<BaseFunctionType*>& dvar_dy_fcns,
     const std::vector<BaseFunctionType*>& dvar_dp_fcns,
-    const SetupOptions& setup_opts
+    const SetupOptions& setup_opts,
+    const BaseFunctionType *jac_action_batched = nullptr,
+    const BaseFunctionType *var_fused = nullptr,
+    const std::vector<BaseFunctionType*>& rhs_alg_blocks = {},
+    const std::vector<BaseFunctionType*>& jac_times_cjmass_blocks = {},
+    const std::vector<BaseFunctionType*>& jac_action_blocks = {}
   ) :
     iree_init_status(iree_init()),
     rhs_alg_iree(rhs_alg),
@@ -102,20 +107,33 @@ public:
       this->dvar_dp_fcns.push_back(&this->dvar_dp_fcns_iree[k]);
 
     // copy across numpy array values
-    const int n_row_vals = jac_times_cjmass_rowvals_arg.request().size;
-    auto p_jac_times_cjmass_rowvals = jac_times_cjmass_rowvals_arg.unchecked<1>();
-    jac_times_cjmass_rowvals.resize(n_row_vals);
-    for (int i = 0; i < n_row_vals; i++) {
-      jac_times_cjmass_rowvals[i] = p_jac_times_cjmass_rowvals[i];
+    set_sparsity_pattern(jac_times_cjmass_rowvals_arg, jac_times_cjmass_colptrs_arg);
+
+    if (jac_action_batched != nullptr && !jac_action_batched->mlir.empty()) {
+      jac_action_batched_iree = std::make_unique<IREEFunction>(*jac_action_batched);
+      this->jac_action_batched = jac_action_batched_iree.get();
     }
 
-    const int n_col_ptrs = jac_times_cjmass_colptrs_arg.request().size;
-    auto p_jac_times_cjmass_colptrs = jac_times_cjmass_colptrs_arg.unchecked<1>();
-    jac_times_cjmass_colptrs.resize(n_col_ptrs);
-    for (int i = 0; i < n_col_ptrs; i++) {
-      jac_times_cjmass_colptrs[i] = p_jac_times_cjmass_colptrs[i];
+    if (var_fused != nullptr && !var_fused->mlir.empty()) {
+      var_fused_iree = std::make_unique<IREEFunction>(*var_fused);
+      this->var_fused = var_fused_iree.get();
     }
 
+    for (auto& block : rhs_alg_blocks)
+      rhs_alg_blocks_iree.push_back(IREEFunction(*block));
+    for (auto& block : rhs_alg_blocks_iree)
+      this->rhs_alg_blocks.push_back(&block);
+
+    for (auto& block : jac_times_cjmass_blocks)
+      jac_times_cjmass_blocks_iree.push_back(IREEFunction(*block));
+    for (auto& block : jac_times_cjmass_blocks_iree)
+      this->jac_times_cjmass_blocks.push_back(&block);
+
+    for (auto& block : jac_action_blocks)
+      jac_action_blocks_iree.push_back(IREEFunction(*block));
+    for (auto& block : jac_action_blocks_iree)
+      this->jac_action_blocks.push_back(&block);
+
     inputs.resize(inputs_length);
   }
 
@@ -125,10 +143,15 @@ public:
   IREEFunction mass_action_iree;
   IREEFunction sens_iree;
   IREEFunction events_iree;
+  std::unique_ptr<IREEFunction> jac_action_batched_iree;
+  std::unique_ptr<IREEFunction> var_fused_iree;
 
   std::vector<IREEFunction> var_fcns_iree;
   std::vector<IREEFunction> dvar_dy_fcns_iree;
   std::vector<IREEFunction> dvar_dp_fcns_iree;
+  std::vector<IREEFunction> rhs_alg_blocks_iree;
+  std::vector<IREEFunction> jac_times_cjmass_blocks_iree;
+  std::vector<IREEFunction> jac_action_blocks_iree;
 
   realtype* get_tmp_state_vector() override {
     return tmp_state_vector.data();
@@ -37,6 +37,13 @@ void ModuleParser::parse()
     "Main function signature: " << main_sig_inputs << " -> " << main_sig_outputs << '\n'
   );
 
+  // Element type (modules are exported as either all f32 or all f64)
+  is_f64 = (
+    main_sig_inputs.find("f64>") != std::string::npos ||
+    main_sig_outputs.find("f64>") != std::string::npos
+  );
+  DEBUG("Module precision: " << (is_f64 ? "f64" : "f32"));
+
   // Parse input sizes
   input_shape.clear();
   std::regex input_size("tensor<(.*?)>");
@@ -17,6 +17,7 @@ private:
   std::string function_name;
   std::vector<std::vector<int>> input_shape;
   std::vector<std::vector<int>> output_shape;
+  bool is_f64 = false;
 public:
   /**
    * @brief Constructor
@@ -48,6 +49,12 @@ public:
    */
   const std::vector<std::vector<int>>& getOutputShape() const { return output_shape; }
 
+  /**
+   * @brief Whether the main function signature uses double precision tensors
+   * @return true for f64 modules, false for f32 modules
+   */
+  bool isFloat64() const { return is_f64; }
+
 private:
   void parse();
 };
@@ -10,6 +10,11 @@
 #include <tuple>
 #include <vector>
 #include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <unordered_map>
 #include <unistd.h>
 
 #include <iree/compiler/embedding_api.h>
@@ -29,6 +34,86 @@
 #define NULL_DEVICE "/dev/null"
 #endif
 
+namespace {
+
+// Global compiler flags (target backends etc.), part of the cache key
+std::string global_compiler_flags;
+
+typedef std::shared_ptr<const std::vector<uint8_t>> bytecode_ptr;
+
+// Compiled modules, shared in memory between sessions (e.g. the solvers of a
+// group) and persisted to disk between processes
+class BytecodeCache {
+public:
+  bytecode_ptr find(const std::string& key) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = modules.find(key);
+    if (it != modules.end()) {
+      if (auto bytecode = it->second.lock()) {
+        DEBUG("IREE bytecode cache: memory hit " << key);
+        return bytecode;
+      }
+    }
+
+    const auto dir = cache_dir("iree");
+    if (dir.empty()) {
+      return nullptr;
+    }
+    std::ifstream file(dir / (key + ".vmfb"), std::ios::binary | std::ios::ate);
+    if (!file) {
+      return nullptr;
+    }
+    auto bytecode = std::make_shared<std::vector<uint8_t>>(
+      static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    if (!file.read(reinterpret_cast<char*>(bytecode->data()), bytecode->size())) {
+      return nullptr;
+    }
+    DEBUG("IREE bytecode cache: disk hit " << key);
+    modules[key] = bytecode;
+    return bytecode;
+  }
+
+  bytecode_ptr insert(const std::string& key, const void *data, uint64_t size) {
+    auto bytecode = std::make_shared<std::vector<uint8_t>>(
+      static_cast<const uint8_t*>(data), static_cast<const uint8_t*>(data) + size);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    modules[key] = bytecode;
+
+    const auto dir = cache_dir("iree");
+    if (!dir.empty()) {
+      // Write to a temporary file and rename so that concurrent processes
+      // never read a partial module. Failures only disable the disk cache.
+      std::error_code ec;
+      std::filesystem::create_directories(dir, ec);
+      const auto path = dir / (key + ".vmfb");
+      const auto tmp_path = dir / (key + ".vmfb." + std::to_string(getpid()) + ".tmp");
+      {
+        std::ofstream file(tmp_path, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(bytecode->data()), bytecode->size());
+      }
+      std::filesystem::rename(tmp_path, path, ec);
+      if (ec) {
+        DEBUG("IREE bytecode cache: could not write " << path);
+        std::filesystem::remove(tmp_path, ec);
+      }
+    }
+    return bytecode;
+  }
+
+private:
+  std::mutex mutex;
+  std::unordered_map<std::string, std::weak_ptr<const std::vector<uint8_t>>> modules;
+};
+
+BytecodeCache& bytecode_cache() {
+  static BytecodeCache cache;
+  return cache;
+}
+
+}  // namespace
+
 void IREESession::handle_compiler_error(iree_compiler_error_t *error) {
   const char *msg = ireeCompilerErrorGetMessage(error);
   fprintf(stderr, "Error from compiler API:\n%s\n", msg);
@@ -69,17 +154,46 @@ IREESession::IREESession() {
   s.inv = NULL;
 };
 
-IREESession::IREESession(const char *device_uri, const std::string& mlir_code) : IREESession() {
+IREESession::IREESession(const char *device_uri, const std::string& mlir_code, bool f64) : IREESession() {
   this->device_uri=device_uri;
   this->mlir_code=mlir_code;
+  this->f64=f64;
+  if (f64) {
+    element_type = IREE_HAL_ELEMENT_TYPE_FLOAT_64;
+    element_size = sizeof(double);
+  }
   init();
 }
 
+std::string IREESession::cacheKey() const {
+  // Modules depend on the source, the compiler and all compilation flags
+  const std::string revision = ireeCompilerGetRevision();
+  const std::string key_source =
+    revision + '\n' + device_uri + '\n' + global_compiler_flags + '\n' +
+    (f64 ? "f64" : "f32") + '\n' + mlir_code;
+  char key[32];
+  snprintf(key, sizeof(key), "%016" PRIx64 "-%zu", fnv1a(key_source), mlir_code.size());
+  return key;
+}
+
 int IREESession::init() {
-  if (initCompiler() != 0)  // Prepare compiler inputs and outputs
-    return 1;
-  if (initCompileToByteCode() != 0)  // Compile to bytecode
-    return 1;
+  const std::string key = cacheKey();
+  bytecode = bytecode_cache().find(key);
+  if (!bytecode) {
+    if (initCompiler() != 0)  // Prepare compiler inputs and outputs
+      return 1;
+    if (initCompileToByteCode() != 0)  // Compile to bytecode
+      return 1;
+    bytecode = bytecode_cache().insert(key, contents, size);
+    // The compiler state is no longer needed once the bytecode is cached
+    cleanup_compiler_state(s);
+    s.session = NULL;
+    s.source = NULL;
+    s.output = NULL;
+    s.inv = NULL;
+  }
+  contents = const_cast<uint8_t*>(bytecode->data());
+  size = bytecode->size();
   if (initRuntime() != 0)  // Initialise runtime environment
     return 1;
   return 0;
@@ -134,6 +248,10 @@ int IREECompiler::initIREE(int argc, const char **argv) {
   // |ireeCompilerGetProcessCLArgs| and |ireeCompilerSetupGlobalCL|
   ireeCompilerGetProcessCLArgs(&cl_argc, &argv);
   ireeCompilerSetupGlobalCL(cl_argc, argv, "iree-jit", false);
+  global_compiler_flags.clear();
+  for (int i = 0; i < cl_argc; i++) {
+    global_compiler_flags += std::string(argv[i]) + ' ';
+  }
 
   // Check the API version before proceeding any further
   uint32_t api_version = (uint32_t)ireeCompilerGetAPIVersion();
@@ -162,6 +280,18 @@ int IREESession::initCompiler() {
   // A session provides a scope where one or more invocations can be executed
   s.session = ireeCompilerSessionCreate();
 
+  // Keep double precision modules in double precision (demoted by default)
+  if (f64) {
+    const char *flags[] = {"--iree-input-demote-f64-to-f32=false"};
+    error = ireeCompilerSessionSetFlags(s.session, 1, flags);
+    if (error) {
+      fprintf(stderr, "Error setting compiler flags\n");
+      handle_compiler_error(error);
+      cleanup_compiler_state(s);
+      return 1;
+    }
+  }
+
   // Read the MLIR from memory
   error = ireeCompilerSourceWrapBuffer(
     s.session,
@@ -185,6 +315,7 @@ int IREESession::initCompiler() {
 int IREESession::initCompileToByteCode() {
   // Use an invocation to compile from the input source to the output stream
   iree_compiler_invocation_t *inv = ireeCompilerInvocationCreate(s.session);
+  s.inv = inv;  // released with the rest of the compiler state
   ireeCompilerInvocationEnableConsoleDiagnostics(inv);
 
   if (!ireeCompilerInvocationParseSource(inv, s.source)) {
@@ -270,6 +401,14 @@ int IREESession::initRuntime() {
 
 // Release the session and free all cached resources.
 int IREESession::cleanup() {
+  for (auto arg : arg_views) {
+    iree_hal_buffer_view_release(arg);
+  }
+  arg_views.clear();
+  if (call_initialized) {
+    iree_runtime_call_deinitialize(&call);
+    call_initialized = false;
+  }
   iree_runtime_session_release(session);
   iree_hal_device_release(device);
   iree_runtime_instance_release(instance);
@@ -286,17 +425,24 @@ int IREESession::cleanup() {
 iree_status_t IREESession::iree_runtime_exec(
   const std::string& function_name,
   const std::vector<std::vector<int>>& inputs,
-  const std::vector<std::vector<float>>& data,
-  std::vector<std::vector<float>>& result
+  const std::vector<const void*>& data,
+  const std::vector<void*>& result,
+  const std::vector<size_t>& result_numel
 ) {
 
-  // Initialize the call to the function.
-  status = iree_runtime_call_initialize_by_name(
-      session, iree_make_cstring_view(function_name.c_str()), &call);
-  if (!iree_status_is_ok(status)) {
-    std::cerr << "Error: iree_runtime_call_initialize_by_name failed" << std::endl;
-    iree_status_fprint(stderr, status);
-    return status;
+  // Initialize the call to the function once; later calls only reset the
+  // input and output lists
+  if (!call_initialized) {
+    status = iree_runtime_call_initialize_by_name(
+        session, iree_make_cstring_view(function_name.c_str()), &call);
+    if (!iree_status_is_ok(status)) {
+      std::cerr << "Error: iree_runtime_call_initialize_by_name failed" << std::endl;
+      iree_status_fprint(stderr, status);
+      return status;
+    }
+    call_initialized = true;
+  } else {
+    iree_runtime_call_reset(&call);
   }
 
   // Append the function inputs with the HAL device allocator in use by the
@@ -306,58 +452,53 @@ iree_status_t IREESession::iree_runtime_exec(
       iree_runtime_session_device_allocator(session);
   host_allocator = iree_runtime_session_host_allocator(session);
   status = iree_ok_status();
-  if (iree_status_is_ok(status)) {
+  if (arg_views.size() != inputs.size()) {
+    arg_views.resize(inputs.size(), NULL);
+  }
 
-    for(int k=0; k<inputs.size(); k++) {
-      auto input_shape = inputs[k];
-      const auto input_data = data[k];
-
-      iree_hal_buffer_view_t* arg = NULL;
-      if (iree_status_is_ok(status)) {
-        std::vector<iree_hal_dim_t> arg_shape(input_shape.size());
-        for (int i = 0; i < input_shape.size(); i++) {
-          arg_shape[i] = input_shape[i];
-        }
-        int numel = 1;
-        for(int i = 0; i < input_shape.size(); i++) {
-          numel *= input_shape[i];
-        }
-        std::vector<float> arg_data(numel);
-        for(int i = 0; i < numel; i++) {
-          arg_data[i] = input_data[i];
-        }
-
-        status = iree_hal_buffer_view_allocate_buffer_copy(
-          device, device_allocator,
-          // Shape rank and dimensions:
-          arg_shape.size(), arg_shape.data(),
-          // Element type:
-          IREE_HAL_ELEMENT_TYPE_FLOAT_32,
-          // Encoding type:
-          IREE_HAL_ENCODING_TYPE_DENSE_ROW_MAJOR,
-          (iree_hal_buffer_params_t){
-              // Intended usage of the buffer (transfers, dispatches, etc):
-              .usage = IREE_HAL_BUFFER_USAGE_DEFAULT,
-              // Access to allow to this memory:
-              .access = IREE_HAL_MEMORY_ACCESS_ALL,
-              // Where to allocate (host or device):
-              .type = IREE_HAL_MEMORY_TYPE_DEVICE_LOCAL,
-          },
-          // The actual heap buffer to wrap or clone and its allocator:
-          iree_make_const_byte_span(&arg_data[0], sizeof(float) * arg_data.size()),
-          // Buffer view + storage are returned and owned by the caller:
-          &arg);
-      }
-      if (iree_status_is_ok(status)) {
-        // Add to the call inputs list (which retains the buffer view).
-        status = iree_runtime_call_inputs_push_back_buffer_view(&call, arg);
-        if (!iree_status_is_ok(status)) {
-          std::cerr << "Error: iree_runtime_call_inputs_push_back_buffer_view failed" << std::endl;
-          iree_status_fprint(stderr, status);
-        }
+  for(int k=0; k<inputs.size() && iree_status_is_ok(status); k++) {
+    const auto& input_shape = inputs[k];
+    iree_host_size_t numel = 1;
+    for(int i = 0; i < input_shape.size(); i++) {
+      numel *= input_shape[i];
+    }
+    const iree_host_size_t byte_length = numel * element_size;
+
+    if (arg_views[k] == NULL) {
+      // Allocate the buffer view on first use
+      std::vector<iree_hal_dim_t> arg_shape(input_shape.begin(), input_shape.end());
+      status = iree_hal_buffer_view_allocate_buffer_copy(
+        device, device_allocator,
+        // Shape rank and dimensions:
+        arg_shape.size(), arg_shape.data(),
+        // Element type:
+        element_type,
+        // Encoding type:
+        IREE_HAL_ENCODING_TYPE_DENSE_ROW_MAJOR,
+        (iree_hal_buffer_params_t){
+            // Intended usage of the buffer (transfers, dispatches, mapping):
+            .usage = IREE_HAL_BUFFER_USAGE_DEFAULT | IREE_HAL_BUFFER_USAGE_MAPPING,
+            // Access to allow to this memory:
+            .access = IREE_HAL_MEMORY_ACCESS_ALL,
+            // Where to allocate (host visible so that it can be refilled):
+            .type = IREE_HAL_MEMORY_TYPE_DEVICE_LOCAL | IREE_HAL_MEMORY_TYPE_HOST_VISIBLE,
+        },
+        // The actual heap buffer to clone:
+        iree_make_const_byte_span(data[k], byte_length),
+        // Buffer view + storage are owned by the session:
+        &arg_views[k]);
+    } else {
+      // Refill the existing buffer
+      status = iree_hal_buffer_map_write(
+        iree_hal_buffer_view_buffer(arg_views[k]), 0, data[k], byte_length);
+    }
+    if (iree_status_is_ok(status)) {
+      // Add to the call inputs list (which retains the buffer view).
+      status = iree_runtime_call_inputs_push_back_buffer_view(&call, arg_views[k]);
+      if (!iree_status_is_ok(status)) {
+        std::cerr << "Error: iree_runtime_call_inputs_push_back_buffer_view failed" << std::endl;
+        iree_status_fprint(stderr, status);
       }
-      // Since the call retains the buffer view we can release it here.
-      iree_hal_buffer_view_release(arg);
     }
   }
 
@@ -382,16 +523,17 @@ iree_status_t IREESession::iree_runtime_exec(
       }
     }
     if (iree_status_is_ok(status)) {
-      // Get the buffer view contents as a numeric array
+      // Read the buffer view contents straight into the output array
       iree_host_size_t buffer_length = iree_hal_buffer_view_element_count(result_view);
-      if (buffer_length != result[k].size()) {
+      if (buffer_length != result_numel[k]) {
+        iree_hal_buffer_view_release(result_view);
         throw std::runtime_error(
           "Error: buffer_length (" + std::to_string(buffer_length) +
-          ") != result[k].size()" + std::to_string(result[k].size())
+          ") != result[k].size()" + std::to_string(result_numel[k])
         );
       }
       status = iree_hal_buffer_map_read(iree_hal_buffer_view_buffer(result_view), 0,
-                               &result[k][0], sizeof(float) * result[k].size());
+                               result[k], element_size * result_numel[k]);
       if (!iree_status_is_ok(status)) {
         std::cerr << "Error: iree_hal_buffer_map_read failed" << std::endl;
         iree_status_fprint(stderr, status);
@@ -402,7 +544,5 @@ iree_status_t IREESession::iree_runtime_exec(
     iree_hal_buffer_view_release(result_view);
   }
 
-  iree_runtime_call_deinitialize(&call);
-
   return status;
 }
@@ -4,6 +4,8 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
+#include <memory>
+#include <string>
 #include <vector>
 
 #include <iree/compiler/embedding_api.h>
@@ -87,18 +89,26 @@ private:  // data members
   iree_compiler_error_t *error = NULL;
   void *contents = NULL;
   uint64_t size = 0;
+  // Compiled bytecode, shared between all sessions of the same module
+  std::shared_ptr<const std::vector<uint8_t>> bytecode;
   iree_runtime_session_t* session = NULL;
   iree_status_t status;
   iree_hal_device_t* device = NULL;
   iree_runtime_instance_t* instance = NULL;
   std::string mlir_code;  // cppcheck-suppress unusedStructMember
   iree_runtime_call_t call;
+  bool call_initialized = false;
   iree_allocator_t host_allocator;
+  bool f64 = false;  // double precision module
+  iree_hal_element_type_t element_type = IREE_HAL_ELEMENT_TYPE_FLOAT_32;
+  size_t element_size = sizeof(float);
+  std::vector<iree_hal_buffer_view_t*> arg_views;  // reused between calls
 
 private:  // private methods
   void handle_compiler_error(iree_compiler_error_t *error);
   void cleanup_compiler_state(compiler_state_t s);
   int init();
+  std::string cacheKey() const;
   int initCompiler();
   int initCompileToByteCode();
   int initRuntime();
@@ -114,8 +124,14 @@ public:  // public methods
    * @brief Constructor with device URI and MLIR code
    * @param device_uri Device URI
    * @param mlir_code MLIR code
+   * @param f64 Compile and run the module in double precision
    */
-  explicit IREESession(const char *device_uri, const std::string& mlir_code);
+  explicit IREESession(const char *device_uri, const std::string& mlir_code, bool f64 = false);
+
+  /*
+   * @brief Whether the session runs in double precision
+   */
+  bool is_f64() const { return f64; }
 
   /*
    * @brief Cleanup the IREE session
@@ -124,16 +140,21 @@ public:  // public methods
 
   /*
    * @brief Execute the pre-compiled byte-code with the given inputs
+   * @details The input buffer views are allocated on the first call and
+   *        refilled on subsequent calls. Data must be contiguous and of the
+   *        session element type (float or double).
    * @param function_name Function name to execute
    * @param inputs List of input shapes
-   * @param data List of input data
-   * @param result List of output data
+   * @param data Pointers to the input data
+   * @param result Pointers to the output data
+   * @param result_numel Number of elements of each output
    */
   iree_status_t iree_runtime_exec(
     const std::string& function_name,
     const std::vector<std::vector<int>>& inputs,
-    const std::vector<std::vector<float>>& data,
-    std::vector<std::vector<float>>& result
+    const std::vector<const void*>& data,
+    const std::vector<void*>& result,
+    const std::vector<size_t>& result_numel
   );
 };
 
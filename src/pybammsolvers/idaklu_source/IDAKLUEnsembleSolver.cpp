@@ -0,0 +1,140 @@
+#include "IDAKLUEnsembleSolver.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+
+// Restores the member length of the previous ensemble (if any) when done
+class MemberLengthScope
+{
+public:
+  explicit MemberLengthScope(sunindextype length) : previous(active_member_length()) {
+    active_member_length() = length;
+  }
+  ~MemberLengthScope() { active_member_length() = previous; }
+
+  MemberLengthScope(const MemberLengthScope &) = delete;
+  MemberLengthScope &operator=(const MemberLengthScope &) = delete;
+
+private:
+  sunindextype previous;
+};
+
+// max_k sqrt(sum_{i in member k, mask_i > 0} (x_i w_i)^2 / n)
+realtype member_wrms_norm(N_Vector x, N_Vector w, N_Vector mask) {
+  const sunindextype N = N_VGetLength(x);
+  sunindextype n = active_member_length();
+  if (n <= 0 || n > N) {
+    n = N;
+  }
+  wait_for_device(x);
+  const realtype *xd = host_data(x);
+  const realtype *wd = host_data(w);
+  const realtype *md = mask ? host_data(mask) : nullptr;
+
+  realtype norm = 0.0;
+  for (sunindextype begin = 0; begin < N; begin += n) {
+    const sunindextype end = std::min(begin + n, N);
+    realtype sum = 0.0;
+    for (sunindextype i = begin; i < end; i++) {
+      if (md == nullptr || md[i] > 0.0) {
+        const realtype xw = xd[i] * wd[i];
+        sum += xw * xw;
+      }
+    }
+    norm = std::max(norm, std::sqrt(sum / n));
+  }
+  return norm;
+}
+
+realtype member_wrms_norm(N_Vector x, N_Vector w) {
+  return member_wrms_norm(x, w, nullptr);
+}
+
+}  // namespace
+
+void use_member_error_norm(N_Vector v) {
+  v->ops->nvwrmsnorm = static_cast<realtype (*)(N_Vector, N_Vector)>(member_wrms_norm);
+  v->ops->nvwrmsnormmask =
+    static_cast<realtype (*)(N_Vector, N_Vector, N_Vector)>(member_wrms_norm);
+}
+
+np_array tile_members(const np_array &a, int number_of_members) {
+  auto in = a.unchecked<1>();
+  const py::ssize_t n = in.shape(0);
+  np_array out(number_of_members * n);
+  auto tiled = out.mutable_unchecked<1>();
+  for (int k = 0; k < number_of_members; k++) {
+    for (py::ssize_t i = 0; i < n; i++) {
+      tiled(k * n + i) = in(i);
+    }
+  }
+  return out;
+}
+
+IDAKLUEnsembleSolver::IDAKLUEnsembleSolver(
+    std::unique_ptr<IDAKLUSolver> solver,
+    int number_of_members,
+    int number_of_states,
+    int number_of_inputs,
+    std::vector<int> output_lengths) :
+  m_solver(std::move(solver)),
+  number_of_members(number_of_members),
+  number_of_states(number_of_states),
+  number_of_inputs(number_of_inputs),
+  output_lengths(std::move(output_lengths)),
+  y0_stacked(number_of_members * number_of_states),
+  yp0_stacked(number_of_members * number_of_states),
+  inputs_stacked(number_of_members * number_of_inputs)
+{
+  if (this->output_lengths.empty()) {
+    // The full state vector is returned
+    this->output_lengths.push_back(number_of_states);
+  }
+}
+
+std::vector<SolutionData> IDAKLUEnsembleSolver::solve(
+    const std::vector<realtype> &t_eval,
+    const std::vector<realtype> &t_interp,
+    const std::vector<const realtype *> &y0,
+    const std::vector<const realtype *> &yp0,
+    const std::vector<const realtype *> &inputs,
+    bool save_adaptive_steps,
+    bool save_interp_steps) {
+  DEBUG("IDAKLUEnsembleSolver::solve");
+  const int number_of_rows = static_cast<int>(y0.size());
+  if (number_of_rows < 1 || number_of_rows > number_of_members) {
+    throw std::invalid_argument(
+      "An ensemble solves between 1 and " + std::to_string(number_of_members) +
+      " input sets, got " + std::to_string(number_of_rows));
+  }
+
+  for (int k = 0; k < number_of_members; k++) {
+    const int row = std::min(k, number_of_rows - 1);
+    std::copy_n(y0[row], number_of_states, &y0_stacked[k * number_of_states]);
+    std::copy_n(yp0[row], number_of_states, &yp0_stacked[k * number_of_states]);
+    std::copy_n(inputs[row], number_of_inputs, &inputs_stacked[k * number_of_inputs]);
+  }
+
+  SolutionData stacked;
+  {
+    MemberLengthScope scope(number_of_states);
+    stacked = m_solver->solve(
+      t_eval, t_interp, y0_stacked.data(), yp0_stacked.data(), inputs_stacked.data(),
+      save_adaptive_steps, save_interp_steps);
+  }
+
+  std::vector<SolutionData> members;
+  const int flag = stacked.get_flag();
+  if (flag >= 0 && flag != IDA_ROOT_RETURN) {
+    try {
+      members = stacked.split_ensemble(number_of_rows, number_of_members, output_lengths);
+    } catch (...) {
+      stacked.free_buffers();
+      throw;
+    }
+  }
+  stacked.free_buffers();
+  return members;
+}
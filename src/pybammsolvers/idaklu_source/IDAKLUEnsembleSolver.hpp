@@ -0,0 +1,100 @@
+#ifndef PYBAMM_IDAKLU_ENSEMBLE_SOLVER_HPP
+#define PYBAMM_IDAKLU_ENSEMBLE_SOLVER_HPP
+
+#include "common.hpp"
+#include "IDAKLUSolver.hpp"
+#include <memory>
+#include <vector>
+
+/**
+ * @brief Length of one member of the ensemble solved on this thread (0 if none)
+ *
+ * The error norm of an ensemble (see use_member_error_norm) is found here, as
+ * the N_Vector operations have no user data.
+ */
+inline sunindextype &active_member_length()
+{
+  thread_local sunindextype length = 0;
+  return length;
+}
+
+/**
+ * @brief Replace the WRMS norms of `v` (and of its future clones) by the
+ * maximum of the norms of its members
+ *
+ * IDA then accepts a step only if every member passes its own error test,
+ * instead of testing the root mean square over the whole ensemble.
+ */
+void use_member_error_norm(N_Vector v);
+
+/**
+ * @brief Repeat a vector `number_of_members` times
+ */
+np_array tile_members(const np_array &a, int number_of_members);
+
+/**
+ * Integrates up to `number_of_members` input sets in lockstep as a single
+ * stacked (block-diagonal) system, so that the integrator overhead of small
+ * models is shared between the members.
+ * @brief A solver for an ensemble of copies of a model
+ */
+class IDAKLUEnsembleSolver
+{
+public:
+  /**
+   * @brief Constructor
+   *
+   * `solver` integrates the stacked system (see EnsembleFunctions) of members
+   * with `number_of_states` states and `number_of_inputs` inputs each.
+   * `output_lengths` holds the length of each output variable of a member,
+   * or is empty if the full state vector is returned.
+   */
+  IDAKLUEnsembleSolver(
+    std::unique_ptr<IDAKLUSolver> solver,
+    int number_of_members,
+    int number_of_states,
+    int number_of_inputs,
+    std::vector<int> output_lengths);
+
+  /**
+   * @brief Maximum number of input sets solved together
+   */
+  int get_number_of_members() const { return number_of_members; }
+
+  /**
+   * @brief Restrict the restarts of the next solve to some t_eval entries
+   * (see IDAKLUSolver::set_breakpoints)
+   */
+  void set_breakpoints(const std::vector<char> *breakpoints) {
+    m_solver->set_breakpoints(breakpoints);
+  }
+
+  /**
+   * @brief Solve one input set per entry of y0, yp0 and inputs
+   *
+   * Unused members repeat the last input set. The members share the time
+   * steps and the solve statistics. Returns no solutions if the ensemble did
+   * not reach the final time (a terminating event or a failure in any
+   * member); those input sets must then be solved individually.
+   */
+  std::vector<SolutionData> solve(
+    const std::vector<realtype> &t_eval,
+    const std::vector<realtype> &t_interp,
+    const std::vector<const realtype *> &y0,
+    const std::vector<const realtype *> &yp0,
+    const std::vector<const realtype *> &inputs,
+    bool save_adaptive_steps,
+    bool save_interp_steps);
+
+private:
+  std::unique_ptr<IDAKLUSolver> m_solver;
+  int number_of_members;
+  int number_of_states;
+  int number_of_inputs;
+  std::vector<int> output_lengths;
+  std::vector<realtype> y0_stacked;
+  std::vector<realtype> yp0_stacked;
+  std::vector<realtype> inputs_stacked;
+};
+
+#endif // PYBAMM_IDAKLU_ENSEMBLE_SOLVER_HPP
@@ -3,6 +3,17 @@
 
 #include "common.hpp"
 #include "SolutionData.hpp"
+#include <vector>
+
+/**
+ * @brief Result of an adjoint sensitivity solve
+ */
+struct AdjointSolution
+{
+  int flag;  // IDA return flag of the forward or backward integration
+  realtype loss;  // value of the loss functional
+  std::vector<realtype> gradient;  // derivative of the loss wrt each parameter
+};
 
 
 /**
@@ -37,6 +48,49 @@ public:
     bool save_interp_steps
   ) = 0;
 
+  /**
+   * @brief Make the next solve resume from `checkpoint` (nullptr for none)
+   *
+   * The next solve must be given the checkpoint's y and yp as y0 and yp0.
+   * If `consistent`, they are taken to be consistent with the new inputs
+   * and the consistent initialisation is skipped.
+   */
+  virtual void set_resume(const SolverCheckpoint *checkpoint, bool consistent) = 0;
+
+  /**
+   * @brief Restrict the restarts of the next solve to some t_eval entries
+   *
+   * `breakpoints` holds, for each t_eval entry, whether the model may be
+   * discontinuous there. The integrator is only reinitialised at those
+   * entries; the others are plain stop times. By default (nullptr) it is
+   * reinitialised at every t_eval entry.
+   */
+  virtual void set_breakpoints(const std::vector<char> *breakpoints) = 0;
+
+  /**
+   * @brief Number of values saved per time point: the states, or the output
+   * variables if there are any
+   */
+  virtual int get_number_of_outputs() const = 0;
+
+  /**
+   * @brief Whether the outputs are reduced over time (see the
+   * output_reductions option) instead of saved at each time point
+   */
+  virtual bool reduces_outputs() const = 0;
+
+  /**
+   * @brief Abstract method that computes the gradient of an integral loss
+   * with the adjoint (backward) sensitivity equations
+   */
+  virtual AdjointSolution solve_adjoint(
+    const std::vector<realtype> &t_eval,
+    const realtype *y0,
+    const realtype *yp0,
+    const realtype *inputs,
+    int loss_index
+  ) = 0;
+
   /**
    * Abstract method to initialize the solver, once vectors and solver classes
    * are set
@@ -1,26 +1,147 @@
 #include "IDAKLUSolverGroup.hpp"
+#include "Trace.hpp"
 #include <omp.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <numeric>
 #include <optional>
 
-std::vector<Solution> IDAKLUSolverGroup::solve(
-    np_array t_eval_np,
-    np_array t_interp_np,
-    np_array y0_np,
-    np_array yp0_np,
-    np_array inputs) {
-  DEBUG("IDAKLUSolverGroup::solve");
+namespace {
 
-  // If t_interp is empty, save all adaptive steps
-  bool save_adaptive_steps =  t_interp_np.size() == 0;
+// create solutions (needs to be serial as we're using the Python GIL)
+std::vector<Solution> generate_solutions(std::vector<SolutionData> &results) {
+  std::vector<Solution> solutions(results.size());
+  for (std::size_t i = 0; i < results.size(); i++) {
+    solutions[i] = results[i].generate_solution();
+  }
+  return solutions;
+}
+
+/**
+ * @brief Pass a solution to the sink, which owns its buffers once it returns
+ *
+ * A sink that throws never took the buffers, so they are freed here.
+ */
+void deliver(
+    const IDAKLUSolverGroup::SolutionSink &sink,
+    std::size_t index,
+    SolutionData &solution) {
+  try {
+    sink(index, solution);
+  } catch (...) {
+    solution.free_buffers();
+    throw;
+  }
+}
+
+/**
+ * @brief Bounded queue of finished solves, filled by the solver threads
+ */
+class SolutionQueue
+{
+public:
+  explicit SolutionQueue(std::size_t capacity) : m_capacity(capacity) {}
+
+  /**
+   * @brief Block until there is room; returns false if cancelled
+   */
+  bool push(std::size_t index, SolutionData &solution) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_not_full.wait(lock, [this] { return m_cancelled || m_items.size() < m_capacity; });
+    if (m_cancelled) {
+      return false;
+    }
+    m_items.emplace_back(index, solution);
+    m_not_empty.notify_one();
+    return true;
+  }
 
-  const realtype* t_eval_begin = t_eval_np.data();
-  const realtype* t_eval_end = t_eval_begin + t_eval_np.size();
-  const realtype* t_interp_begin = t_interp_np.data();
-  const realtype* t_interp_end = t_interp_begin + t_interp_np.size();
+  /**
+   * @brief Block until an item is available; returns false once closed and empty
+   */
+  bool pop(std::pair<std::size_t, SolutionData> &item) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_not_empty.wait(lock, [this] { return m_closed || !m_items.empty(); });
+    if (m_items.empty()) {
+      return false;
+    }
+    item = m_items.front();
+    m_items.pop_front();
+    m_not_full.notify_one();
+    return true;
+  }
+
+  /**
+   * @brief No more items will be pushed
+   */
+  void close() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_closed = true;
+    m_not_empty.notify_all();
+  }
+
+  /**
+   * @brief Reject further pushes and release any blocked producers
+   */
+  void cancel() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_cancelled = true;
+    m_not_full.notify_all();
+  }
+
+private:
+  std::size_t const m_capacity;
+  std::deque<std::pair<std::size_t, SolutionData>> m_items;
+  std::mutex m_mutex;
+  std::condition_variable m_not_full;
+  std::condition_variable m_not_empty;
+  bool m_closed = false;
+  bool m_cancelled = false;
+};
+
+}  // namespace
+
+void IDAKLUSolverGroup::allow_nested_teams(const ThreadPlacement &placement) {
+  if (placement.threads_per_solver() > 1 && omp_get_max_active_levels() < 2) {
+    omp_set_max_active_levels(2);
+  }
+}
+
+std::vector<std::size_t> IDAKLUSolverGroup::dispatch_order(
+    const SolveBatch &batch) const {
+  std::vector<std::size_t> order(batch.number_of_groups);
+  std::iota(order.begin(), order.end(), 0);
+
+  const realtype *cost = nullptr;
+  if (!batch.cost_hint.empty()) {
+    cost = batch.cost_hint.data();
+  } else if (m_solve_times.size() == batch.number_of_groups) {
+    cost = m_solve_times.data();
+  }
+
+  // Largest jobs first, so the cheap ones fill in the tail
+  if (cost != nullptr) {
+    std::stable_sort(order.begin(), order.end(),
+      [cost](std::size_t a, std::size_t b) { return cost[a] > cost[b]; });
+  }
+  return order;
+}
+
+void SolveBatch::set_times(
+    const realtype *t_eval_begin,
+    const realtype *t_eval_end,
+    const realtype *t_interp_begin,
+    const realtype *t_interp_end) {
+  // If t_interp is empty, save all adaptive steps
+  save_adaptive_steps = t_interp_begin == t_interp_end;
 
   // Process the time inputs
   // 1. Get the sorted and unique t_eval vector
-  auto const t_eval = makeSortedUnique(t_eval_begin, t_eval_end);
+  t_eval = makeSortedUnique(t_eval_begin, t_eval_end);
 
   // 2.1. Get the sorted and unique t_interp vector
   auto const t_interp_unique_sorted = makeSortedUnique(t_interp_begin, t_interp_end);
@@ -29,7 +150,7 @@ std::vector<Solution> IDAKLUSolverGroup::solve(
   auto const t_interp_setdiff = setDiff(t_interp_unique_sorted.begin(), t_interp_unique_sorted.end(), t_eval_begin, t_eval_end);
 
   // 2.3 Finally, get the sorted and unique t_interp vector with t_eval values removed
-  auto const t_interp = makeSortedUnique(t_interp_setdiff.begin(), t_interp_setdiff.end());
+  t_interp = makeSortedUnique(t_interp_setdiff.begin(), t_interp_setdiff.end());
 
   int const number_of_evals = t_eval.size();
   int const number_of_interps = t_interp.size();
@@ -38,7 +159,7 @@ std::vector<Solution> IDAKLUSolverGroup::solve(
   // t_eval, so we need to check if we need to interpolate any unique points.
   // This is not the same as save_adaptive_steps since some entries of t_interp
   // may be removed by setDiff
-  bool save_interp_steps = number_of_interps > 0;
+  save_interp_steps = number_of_interps > 0;
 
   // 3. Check if the timestepping entries are valid
   if (number_of_evals < 2) {
@@ -58,6 +179,21 @@ std::vector<Solution> IDAKLUSolverGroup::solve(
       );
     }
   }
+}
+
+SolveBatch IDAKLUSolverGroup::prepare_batch(
+    np_array &t_eval_np,
+    np_array &t_interp_np,
+    np_array &y0_np,
+    np_array &yp0_np,
+    np_array &inputs,
+    np_array &cost_hint) const {
+  DEBUG("IDAKLUSolverGroup::prepare_batch");
+
+  SolveBatch batch;
+  batch.set_times(
+    t_eval_np.data(), t_eval_np.data() + t_eval_np.size(),
+    t_interp_np.data(), t_interp_np.data() + t_interp_np.size());
 
   auto n_coeffs = number_of_states + number_of_parameters * number_of_states;
 
@@ -92,54 +228,459 @@ std::vector<Solution> IDAKLUSolverGroup::solve(
       "inputs has wrong number of rows. Expected " + std::to_string(number_of_groups) +
       " but got " + std::to_string(inputs.shape()[0]));
 
-  const std::size_t solves_per_thread = number_of_groups / m_solvers.size();
-  const std::size_t remainder_solves = number_of_groups % m_solvers.size();
+  // An empty cost_hint means no hint
+  if (cost_hint.size() > 0) {
+    if (cost_hint.ndim() != 1)
+      throw std::domain_error(
+        "cost_hint has wrong number of dimensions. Expected 1 but got " +
+        std::to_string(cost_hint.ndim()));
+    if (cost_hint.size() != number_of_groups)
+      throw std::domain_error(
+        "cost_hint has wrong number of entries. Expected " + std::to_string(number_of_groups) +
+        " but got " + std::to_string(cost_hint.size()));
+    // The dispatch order sorts by cost, which needs a strict weak ordering
+    const realtype *cost = cost_hint.data();
+    if (!std::all_of(cost, cost + cost_hint.size(), [](realtype c) { return std::isfinite(c); }))
+      throw std::domain_error("cost_hint must be finite");
+  }
+
+  batch.number_of_groups = number_of_groups;
+  batch.y0 = y0_np.data();
+  batch.y0_stride = y0_np.shape(1);
+  batch.yp0 = yp0_np.data();
+  batch.yp0_stride = yp0_np.shape(1);
+  batch.inputs = inputs.data();
+  batch.inputs_stride = inputs.shape(1);
+  batch.cost_hint.assign(cost_hint.data(), cost_hint.data() + cost_hint.size());
+  return batch;
+}
+
+std::vector<SolutionData> IDAKLUSolverGroup::solve_batch(const SolveBatch &batch) {
+  std::vector<SolutionData> results(batch.number_of_groups);
+  try {
+    solve_batch(batch, [&results](std::size_t index, SolutionData &solution) {
+      results[index] = solution;
+    });
+  } catch (...) {
+    // The rows collected before the failure are never handed to numpy
+    for (auto &result : results) {
+      result.free_buffers();
+    }
+    throw;
+  }
+  return results;
+}
+
+void IDAKLUSolverGroup::solve_batch(
+    const SolveBatch &batch,
+    const SolutionSink &sink) {
+  DEBUG("IDAKLUSolverGroup::solve_batch");
+  std::lock_guard<std::mutex> lock(m_mutex);
 
-  const realtype *y0 = y0_np.data();
-  const realtype *yp0 = yp0_np.data();
-  const realtype *inputs_data = inputs.data();
+  const std::size_t number_of_groups = batch.number_of_groups;
+  const std::vector<std::size_t> order = dispatch_order(batch);
 
-  std::vector<SolutionData> results(number_of_groups);
+  std::vector<double> solve_times(number_of_groups, 0.0);
 
-  std::optional<std::exception> exception;
+  std::optional<std::string> error;
 
-  omp_set_num_threads(m_solvers.size());
-  #pragma omp parallel for
-  for (int i = 0; i < m_solvers.size(); i++) {
+  // Each thread owns one solver and pulls the next job (a row, or the rows
+  // of an ensemble) off a shared counter, so a slow job never holds up a
+  // fixed block of fast ones
+  const std::size_t rows_per_job = m_ensembles.empty() ?
+    1 : m_ensembles.front()->get_number_of_members();
+  const std::size_t number_of_jobs = (number_of_groups + rows_per_job - 1) / rows_per_job;
+  std::atomic<std::size_t> next_job(0);
+  const int number_of_threads = std::max<std::size_t>(
+    1, std::min<std::size_t>(m_solvers.size(), number_of_jobs));
+
+  omp_set_num_threads(number_of_threads);
+  #pragma omp parallel
+  {
+    ThreadPlacement::Scope pinned(m_placement, omp_get_thread_num());
+    IDAKLUSolver *solver = m_solvers[omp_get_thread_num()].get();
+    IDAKLUEnsembleSolver *ensemble = m_ensembles.empty() ?
+      nullptr : m_ensembles[omp_get_thread_num()].get();
+    std::vector<const realtype *> ys, yps, inputs;
     try {
-      for (int j = 0; j < solves_per_thread; j++) {
-        const std::size_t index = i * solves_per_thread + j;
-        const realtype *y = y0 + index * y0_np.shape(1);
-        const realtype *yp = yp0 + index * yp0_np.shape(1);
-        const realtype *input = inputs_data + index * inputs.shape(1);
-        results[index] = m_solvers[i]->solve(t_eval, t_interp, y, yp, input, save_adaptive_steps, save_interp_steps);
+      for (
+        std::size_t job = next_job++;
+        job < number_of_jobs;
+        job = next_job++
+      ) {
+        const std::size_t first = job * rows_per_job;
+        const std::size_t last = std::min(first + rows_per_job, number_of_groups);
+
+        if (ensemble != nullptr && batch.resume.empty() && last - first > 1) {
+          ys.clear();
+          yps.clear();
+          inputs.clear();
+          for (std::size_t i = first; i < last; i++) {
+            const std::size_t index = order[i];
+            ys.push_back(batch.y0 + index * batch.y0_stride);
+            yps.push_back(batch.yp0 + index * batch.yp0_stride);
+            inputs.push_back(batch.inputs + index * batch.inputs_stride);
+          }
+          ensemble->set_breakpoints(
+            batch.breakpoints.empty() ? nullptr : &batch.breakpoints);
+          const double start = omp_get_wtime();
+          TRACE_SPAN("ensemble_solve", static_cast<int64_t>(order[first]));
+          std::vector<SolutionData> solutions = ensemble->solve(
+            batch.t_eval, batch.t_interp, ys, yps, inputs,
+            batch.save_adaptive_steps, batch.save_interp_steps);
+          if (!solutions.empty()) {
+            const double time = (omp_get_wtime() - start) / (last - first);
+            for (std::size_t i = first; i < last; i++) {
+              solve_times[order[i]] = time;
+              try {
+                deliver(sink, order[i], solutions[i - first]);
+              } catch (...) {
+                // deliver has freed member i; the rest were never handed over
+                for (std::size_t j = i + 1; j < last; j++) {
+                  solutions[j - first].free_buffers();
+                }
+                throw;
+              }
+            }
+            continue;
+          }
+          // An event or a failure in one of the members: solve them one by one
+        }
+
+        for (std::size_t i = first; i < last; i++) {
+          const std::size_t index = order[i];
+          const realtype *y = batch.y0 + index * batch.y0_stride;
+          const realtype *yp = batch.yp0 + index * batch.yp0_stride;
+          const realtype *input = batch.inputs + index * batch.inputs_stride;
+          if (!batch.resume.empty()) {
+            const SolverCheckpoint &checkpoint = batch.resume[index];
+            y = checkpoint.y.data();
+            yp = checkpoint.yp.data();
+            solver->set_resume(&checkpoint, batch.resume_consistent);
+          }
+          solver->set_breakpoints(batch.breakpoints.empty() ? nullptr : &batch.breakpoints);
+          const double start = omp_get_wtime();
+          SolutionData solution;
+          {
+            TRACE_SPAN("solve", static_cast<int64_t>(index));
+            solution = solver->solve(
+              batch.t_eval, batch.t_interp, y, yp, input,
+              batch.save_adaptive_steps, batch.save_interp_steps);
+          }
+          solve_times[index] = omp_get_wtime() - start;
+          deliver(sink, index, solution);
+        }
       }
     } catch (std::exception &e) {
       // If an exception is thrown, we need to catch it and rethrow it outside the parallel region
       #pragma omp critical
       {
-        exception = e;
+        error = e.what();
       }
+      // Drain the queue so the other threads stop picking up work
+      next_job = number_of_jobs;
     }
   }
 
-  if (exception.has_value()) {
-    py::set_error(PyExc_ValueError, exception->what());
+  if (error.has_value()) {
+    throw std::runtime_error(*error);
+  }
+
+  m_solve_times = std::move(solve_times);
+}
+
+void SolveBatch::set_discontinuities(const realtype *begin, const realtype *end) {
+  breakpoints.assign(t_eval.size(), 0);
+  for (const realtype *t_i = begin; t_i != end; t_i++) {
+    auto const it = std::lower_bound(t_eval.begin(), t_eval.end(), *t_i);
+    if (it == t_eval.end() || *it != *t_i) {
+      throw std::invalid_argument(
+        "t_discontinuity values must be entries of t_eval, but got " +
+        std::to_string(*t_i));
+    }
+    breakpoints[it - t_eval.begin()] = 1;
+  }
+}
+
+void IDAKLUSolverGroup::set_resume(
+    SolveBatch &batch,
+    std::vector<SolverCheckpoint> resume_from,
+    bool resume_consistent,
+    const std::optional<np_array> &t_discontinuity) const {
+  if (t_discontinuity.has_value()) {
+    batch.set_discontinuities(
+      t_discontinuity->data(), t_discontinuity->data() + t_discontinuity->size());
+  }
+
+  if (!resume_from.empty()) {
+    const std::size_t n_coeffs =
+      number_of_states + number_of_parameters * number_of_states;
+    if (resume_from.size() != batch.number_of_groups)
+      throw std::domain_error(
+        "resume_from has wrong number of entries. Expected " +
+        std::to_string(batch.number_of_groups) + " but got " +
+        std::to_string(resume_from.size()));
+    for (const auto &checkpoint : resume_from) {
+      if (!checkpoint.valid())
+        throw std::domain_error(
+          "Cannot resume from the checkpoint of a failed solve, or of a solve "
+          "without the save_checkpoint option");
+      if (checkpoint.y.size() != n_coeffs || checkpoint.yp.size() != n_coeffs)
+        throw std::domain_error(
+          "Checkpoint has wrong number of states. Expected " + std::to_string(n_coeffs) +
+          " but got " + std::to_string(checkpoint.y.size()));
+    }
+    batch.resume = std::move(resume_from);
+    batch.resume_consistent = resume_consistent;
+  }
+}
+
+std::vector<Solution> IDAKLUSolverGroup::solve(
+    np_array t_eval_np,
+    np_array t_interp_np,
+    np_array y0_np,
+    np_array yp0_np,
+    np_array inputs,
+    np_array cost_hint,
+    std::vector<SolverCheckpoint> resume_from,
+    bool resume_consistent,
+    std::optional<np_array> t_discontinuity) {
+  DEBUG("IDAKLUSolverGroup::solve");
+
+  SolveBatch batch = prepare_batch(
+    t_eval_np, t_interp_np, y0_np, yp0_np, inputs, cost_hint);
+  set_resume(batch, std::move(resume_from), resume_consistent, t_discontinuity);
+
+  std::vector<SolutionData> results;
+  try {
+    py::gil_scoped_release release;
+    results = solve_batch(batch);
+  } catch (std::exception &e) {
+    py::set_error(PyExc_ValueError, e.what());
     throw py::error_already_set();
   }
 
-  for (int i = 0; i < remainder_solves; i++) {
-    const std::size_t index = number_of_groups - remainder_solves + i;
-    const realtype *y = y0 + index * y0_np.shape(1);
-    const realtype *yp = yp0 + index * yp0_np.shape(1);
-    const realtype *input = inputs_data + index * inputs.shape(1);
-    results[index] = m_solvers[i]->solve(t_eval, t_interp, y, yp, input, save_adaptive_steps, save_interp_steps);
+  return generate_solutions(results);
+}
+
+py::tuple IDAKLUSolverGroup::solve_adjoint(
+    np_array t_eval_np,
+    np_array y0_np,
+    np_array yp0_np,
+    np_array inputs,
+    int loss_index) {
+  DEBUG("IDAKLUSolverGroup::solve_adjoint");
+
+  np_array t_interp_np(0);
+  np_array cost_hint(0);
+  const SolveBatch batch = prepare_batch(
+    t_eval_np, t_interp_np, y0_np, yp0_np, inputs, cost_hint);
+  const std::size_t number_of_groups = batch.number_of_groups;
+
+  std::vector<AdjointSolution> results(number_of_groups);
+  std::optional<std::string> error;
+  {
+    py::gil_scoped_release release;
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    std::atomic<std::size_t> next_row(0);
+    const int number_of_threads = std::max<std::size_t>(
+      1, std::min<std::size_t>(m_solvers.size(), number_of_groups));
+
+    omp_set_num_threads(number_of_threads);
+    #pragma omp parallel
+    {
+      ThreadPlacement::Scope pinned(m_placement, omp_get_thread_num());
+      IDAKLUSolver *solver = m_solvers[omp_get_thread_num()].get();
+      try {
+        for (std::size_t i = next_row++; i < number_of_groups; i = next_row++) {
+          TRACE_SPAN("solve_adjoint", static_cast<int64_t>(i));
+          results[i] = solver->solve_adjoint(
+            batch.t_eval,
+            batch.y0 + i * batch.y0_stride,
+            batch.yp0 + i * batch.yp0_stride,
+            batch.inputs + i * batch.inputs_stride,
+            loss_index);
+        }
+      } catch (std::exception &e) {
+        #pragma omp critical
+        {
+          error = e.what();
+        }
+        next_row = number_of_groups;
+      }
+    }
   }
 
-  // create solutions (needs to be serial as we're using the Python GIL)
-  std::vector<Solution> solutions(number_of_groups);
-  for (int i = 0; i < number_of_groups; i++) {
-    solutions[i] = results[i].generate_solution();
+  if (error.has_value()) {
+    py::set_error(PyExc_ValueError, error->c_str());
+    throw py::error_already_set();
   }
-  return solutions;
+
+  const auto n_p = static_cast<py::ssize_t>(number_of_parameters);
+  np_array loss(number_of_groups);
+  np_array gradient({static_cast<py::ssize_t>(number_of_groups), n_p});
+  py::array_t<int> flag(number_of_groups);
+  auto loss_data = loss.mutable_unchecked<1>();
+  auto gradient_data = gradient.mutable_unchecked<2>();
+  auto flag_data = flag.mutable_unchecked<1>();
+  for (std::size_t i = 0; i < number_of_groups; i++) {
+    loss_data(i) = results[i].loss;
+    flag_data(i) = results[i].flag;
+    for (py::ssize_t p = 0; p < n_p; p++) {
+      gradient_data(i, p) = results[i].gradient[p];
+    }
+  }
+  return py::make_tuple(loss, gradient, flag);
+}
+
+std::unique_ptr<IDAKLUSolveHandle> IDAKLUSolverGroup::solve_async(
+    np_array t_eval_np,
+    np_array t_interp_np,
+    np_array y0_np,
+    np_array yp0_np,
+    np_array inputs,
+    np_array cost_hint,
+    std::vector<SolverCheckpoint> resume_from,
+    bool resume_consistent,
+    std::optional<np_array> t_discontinuity) {
+  DEBUG("IDAKLUSolverGroup::solve_async");
+
+  SolveBatch batch = prepare_batch(
+    t_eval_np, t_interp_np, y0_np, yp0_np, inputs, cost_hint);
+  set_resume(batch, std::move(resume_from), resume_consistent, t_discontinuity);
+
+  auto future = std::async(
+    std::launch::async,
+    [this, batch = std::move(batch)]() { return solve_batch(batch); }
+  );
+
+  return std::make_unique<IDAKLUSolveHandle>(
+    std::move(future),
+    std::vector<np_array>{y0_np, yp0_np, inputs}
+  );
+}
+
+void IDAKLUSolverGroup::solve_stream(
+    np_array t_eval_np,
+    np_array t_interp_np,
+    np_array y0_np,
+    np_array yp0_np,
+    np_array inputs,
+    const py::function &callback,
+    int max_pending,
+    np_array cost_hint,
+    std::vector<SolverCheckpoint> resume_from,
+    bool resume_consistent,
+    std::optional<np_array> t_discontinuity) {
+  DEBUG("IDAKLUSolverGroup::solve_stream");
+
+  if (max_pending < 0)
+    throw std::invalid_argument("max_pending must be non-negative");
+
+  SolveBatch batch = prepare_batch(
+    t_eval_np, t_interp_np, y0_np, yp0_np, inputs, cost_hint);
+  set_resume(batch, std::move(resume_from), resume_consistent, t_discontinuity);
+
+  SolutionQueue queue(max_pending > 0 ? max_pending : m_solvers.size());
+
+  auto future = std::async(std::launch::async, [this, &batch, &queue]() {
+    try {
+      solve_batch(batch, [&queue](std::size_t index, SolutionData &solution) {
+        if (!queue.push(index, solution)) {
+          throw std::runtime_error("solve cancelled");
+        }
+      });
+    } catch (...) {
+      queue.close();
+      throw;
+    }
+    queue.close();
+  });
+
+  auto wait_for_solvers = [&]() {
+    queue.cancel();
+    {
+      py::gil_scoped_release release;
+      future.wait();
+    }
+    // free anything still queued
+    std::pair<std::size_t, SolutionData> item;
+    while (queue.pop(item)) {
+      item.second.generate_solution();
+    }
+  };
+
+  std::pair<std::size_t, SolutionData> item;
+  while (true) {
+    bool has_item;
+    {
+      py::gil_scoped_release release;
+      has_item = queue.pop(item);
+    }
+    if (!has_item) {
+      break;
+    }
+    Solution solution = item.second.generate_solution();
+    try {
+      callback(item.first, solution);
+    } catch (...) {
+      wait_for_solvers();
+      throw;
+    }
+  }
+
+  try {
+    future.get();
+  } catch (std::exception &e) {
+    py::set_error(PyExc_ValueError, e.what());
+    throw py::error_already_set();
+  }
+}
+
+std::vector<double> IDAKLUSolverGroup::last_solve_times() {
+  py::gil_scoped_release release;
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_solve_times;
+}
+
+IDAKLUSolveHandle::~IDAKLUSolveHandle() {
+  if (!m_future.valid()) {
+    return;
+  }
+  {
+    py::gil_scoped_release release;
+    m_future.wait();
+  }
+  // Hand any unclaimed results to numpy so that their buffers are freed
+  try {
+    auto results = m_future.get();
+    generate_solutions(results);
+  } catch (std::exception &) {
+  }
+}
+
+bool IDAKLUSolveHandle::done() const {
+  return !m_future.valid() ||
+    m_future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+std::vector<Solution> IDAKLUSolveHandle::result() {
+  if (!m_future.valid()) {
+    throw std::runtime_error("result has already been retrieved");
+  }
+
+  std::vector<SolutionData> results;
+  try {
+    {
+      py::gil_scoped_release release;
+      m_future.wait();
+    }
+    results = m_future.get();
+  } catch (std::exception &e) {
+    py::set_error(PyExc_ValueError, e.what());
+    throw py::error_already_set();
+  }
+
+  return generate_solutions(results);
 }
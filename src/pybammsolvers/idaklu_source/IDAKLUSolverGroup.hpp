@@ -1,8 +1,57 @@
 #ifndef PYBAMM_IDAKLU_SOLVER_GROUP_HPP
 #define PYBAMM_IDAKLU_SOLVER_GROUP_HPP
 
+#include "IDAKLUEnsembleSolver.hpp"
 #include "IDAKLUSolver.hpp"
+#include "ThreadPlacement.hpp"
 #include "common.hpp"
+#include <functional>
+#include <future>
+#include <mutex>
+#include <optional>
+
+class IDAKLUSolveHandle;
+
+/**
+ * @brief A validated batch of solves that no longer needs the Python GIL
+ *
+ * The state, derivative and input pointers refer to numpy buffers that must
+ * be kept alive by the caller until the batch has been solved.
+ */
+struct SolveBatch
+{
+  std::vector<realtype> t_eval;
+  std::vector<realtype> t_interp;
+  bool save_adaptive_steps;
+  bool save_interp_steps;
+  std::size_t number_of_groups;
+  const realtype *y0;
+  std::size_t y0_stride;
+  const realtype *yp0;
+  std::size_t yp0_stride;
+  const realtype *inputs;
+  std::size_t inputs_stride;
+  std::vector<realtype> cost_hint;
+  std::vector<SolverCheckpoint> resume;  // one per row, or empty
+  bool resume_consistent = false;
+  std::vector<char> breakpoints;  // per t_eval entry, or empty for all of them
+
+  /**
+   * @brief Sort and validate the time inputs and set t_eval, t_interp and
+   * the save flags (all adaptive steps are saved if t_interp is empty)
+   */
+  void set_times(
+    const realtype *t_eval_begin,
+    const realtype *t_eval_end,
+    const realtype *t_interp_begin,
+    const realtype *t_interp_end);
+
+  /**
+   * @brief Mark the t_eval entries in [begin, end) as the only breakpoints
+   * (see IDAKLUSolver::set_breakpoints); each must be an entry of t_eval
+   */
+  void set_discontinuities(const realtype *begin, const realtype *end);
+};
 
 /**
  * @brief class for a group of solvers.
@@ -13,12 +62,25 @@ public:
 
   /**
    * @brief Default constructor
+   *
+   * If `ensembles` are given (one per solver), the input rows are solved in
+   * ensembles of consecutive rows in dispatch order. The thread running
+   * solver k is pinned to the CPUs of solver k of the `placement`.
    */
-  IDAKLUSolverGroup(std::vector<std::unique_ptr<IDAKLUSolver>> solvers, int number_of_states, int number_of_parameters):
+  IDAKLUSolverGroup(
+    std::vector<std::unique_ptr<IDAKLUSolver>> solvers,
+    int number_of_states,
+    int number_of_parameters,
+    std::vector<std::unique_ptr<IDAKLUEnsembleSolver>> ensembles = {},
+    ThreadPlacement placement = {}):
     m_solvers(std::move(solvers)),
+    m_ensembles(std::move(ensembles)),
+    m_placement(std::move(placement)),
     number_of_states(number_of_states),
     number_of_parameters(number_of_parameters)
-    {}
+    {
+      allow_nested_teams(m_placement);
+    }
 
   // no copy constructor (unique_ptr cannot be copied)
   IDAKLUSolverGroup(IDAKLUSolverGroup &) = delete;
@@ -30,19 +92,218 @@ public:
 
   /**
    * @brief solver method that returns a vector of Solutions
+   *
+   * Input rows are handed out dynamically to whichever solver is free.
+   * Rows are dispatched in descending order of `cost_hint` if given,
+   * otherwise by the wall-clock times recorded in the previous call (if
+   * the number of rows is unchanged), otherwise in their natural order.
+   *
+   * If `resume_from` holds a checkpoint per row (see Solution::checkpoint,
+   * which is only saved with the `save_checkpoint` option),
+   * each row continues from the states and step size of its checkpoint
+   * instead of y0 and yp0 (which are still checked), and skips the
+   * consistent initialisation if `resume_consistent` is set. Resumed rows
+   * are never solved as ensembles.
+   *
+   * If `t_discontinuity` is given, the integrator is only restarted at those
+   * t_eval entries, and steps straight through the others. By default it is
+   * restarted at every t_eval entry.
    */
   std::vector<Solution> solve(
     np_array t_eval_np,
     np_array t_interp_np,
     np_array y0_np,
     np_array yp0_np,
-    np_array inputs);
+    np_array inputs,
+    np_array cost_hint,
+    std::vector<SolverCheckpoint> resume_from = {},
+    bool resume_consistent = false,
+    std::optional<np_array> t_discontinuity = std::nullopt);
+
+  /**
+   * @brief Start a solve on a background thread and return a handle to it
+   *
+   * The arguments, including `resume_from`, `resume_consistent` and
+   * `t_discontinuity` (see solve), are validated immediately; the
+   * integration itself runs without the GIL. Calls on the same group are
+   * serialised.
+   */
+  std::unique_ptr<IDAKLUSolveHandle> solve_async(
+    np_array t_eval_np,
+    np_array t_interp_np,
+    np_array y0_np,
+    np_array yp0_np,
+    np_array inputs,
+    np_array cost_hint,
+    std::vector<SolverCheckpoint> resume_from = {},
+    bool resume_consistent = false,
+    std::optional<np_array> t_discontinuity = std::nullopt);
 
+  /**
+   * @brief Solve and pass each (index, Solution) to a callback as soon as
+   * it finishes
+   *
+   * At most `max_pending` finished solves are buffered before the solvers
+   * wait for the callback to catch up (0 means one per solver). Solutions
+   * are delivered in completion order, not index order. The remaining
+   * arguments are as for solve.
+   */
+  void solve_stream(
+    np_array t_eval_np,
+    np_array t_interp_np,
+    np_array y0_np,
+    np_array yp0_np,
+    np_array inputs,
+    const py::function &callback,
+    int max_pending,
+    np_array cost_hint,
+    std::vector<SolverCheckpoint> resume_from = {},
+    bool resume_consistent = false,
+    std::optional<np_array> t_discontinuity = std::nullopt);
+
+  /**
+   * @brief Gradients of an integral loss by adjoint sensitivity analysis
+   *
+   * For each input row, computes L = int_{t0}^{tf} g dt, with g the scalar
+   * output variable `loss_index`, and dL/dp for the sensitivity parameters
+   * (see IDAKLUSolverOpenMP::solve_adjoint). Returns the tuple
+   * (loss [n_rows], gradient [n_rows, n_p], flag [n_rows]).
+   */
+  py::tuple solve_adjoint(
+    np_array t_eval_np,
+    np_array y0_np,
+    np_array yp0_np,
+    np_array inputs,
+    int loss_index);
+
+  /**
+   * @brief Get the per-row wall-clock solve times from the last call
+   */
+  std::vector<double> last_solve_times();
+
+  using SolutionSink = std::function<void(std::size_t, SolutionData &)>;
+
+  /**
+   * @brief Solve a batch, passing each result to `sink` from the solver
+   * thread that produced it
+   *
+   * Does not touch any Python objects, so it may be called without the
+   * GIL. The sink takes ownership of the solution buffers when it returns;
+   * if it throws, the buffers are freed and the exception is rethrown.
+   */
+  void solve_batch(const SolveBatch &batch, const SolutionSink &sink);
+
+  /**
+   * @brief Number of states of the solvers in the group
+   */
+  int get_number_of_states() const { return number_of_states; }
+
+  /**
+   * @brief Number of sensitivity parameters of the solvers in the group
+   */
+  int get_number_of_parameters() const { return number_of_parameters; }
+
+  /**
+   * @brief Number of values saved per time point (see IDAKLUSolver)
+   */
+  int get_number_of_outputs() const { return m_solvers.front()->get_number_of_outputs(); }
+
+  /**
+   * @brief Whether the outputs are reduced over time (see IDAKLUSolver)
+   */
+  bool reduces_outputs() const { return m_solvers.front()->reduces_outputs(); }
 
   private:
+    /**
+     * @brief Let each solver's vector op team run nested in the team of
+     * solvers
+     *
+     * The number of active levels is a process-wide OpenMP setting, so it is
+     * set once here (where the GIL serialises the calls), and only ever
+     * raised to 2, never lowered. Each solver was set up for
+     * num_threads / num_solvers threads, so the nested teams never add up to
+     * more than num_threads.
+     */
+    static void allow_nested_teams(const ThreadPlacement &placement);
+
+    /**
+     * @brief Validate the arguments and process the time inputs
+     */
+    SolveBatch prepare_batch(
+      np_array &t_eval_np,
+      np_array &t_interp_np,
+      np_array &y0_np,
+      np_array &yp0_np,
+      np_array &inputs,
+      np_array &cost_hint) const;
+
+    /**
+     * @brief Validate the checkpoints and breakpoints of a solve (see solve)
+     * and add them to `batch`
+     */
+    void set_resume(
+      SolveBatch &batch,
+      std::vector<SolverCheckpoint> resume_from,
+      bool resume_consistent,
+      const std::optional<np_array> &t_discontinuity) const;
+
+    /**
+     * @brief Solve a batch (does not touch any Python objects)
+     *
+     * If a row throws, the rows already solved are freed before the
+     * exception is rethrown.
+     */
+    std::vector<SolutionData> solve_batch(const SolveBatch &batch);
+
+    /**
+     * @brief Order in which the input rows are dispatched to the solvers
+     */
+    std::vector<std::size_t> dispatch_order(const SolveBatch &batch) const;
+
     std::vector<std::unique_ptr<IDAKLUSolver>> m_solvers;
+    std::vector<std::unique_ptr<IDAKLUEnsembleSolver>> m_ensembles;
+    ThreadPlacement m_placement;
     int number_of_states;
     int number_of_parameters;
+    std::vector<double> m_solve_times;
+    std::mutex m_mutex;
+};
+
+/**
+ * @brief Handle to a solve running on a background thread
+ */
+class IDAKLUSolveHandle
+{
+public:
+  /**
+   * @brief Constructor
+   */
+  IDAKLUSolveHandle(
+    std::future<std::vector<SolutionData>> future,
+    std::vector<np_array> arrays
+  ):
+    m_future(std::move(future)),
+    m_arrays(std::move(arrays))
+    {}
+
+  /**
+   * @brief Destructor (waits for the solve to finish)
+   */
+  ~IDAKLUSolveHandle();
+
+  /**
+   * @brief Returns true if the solve has finished
+   */
+  bool done() const;
+
+  /**
+   * @brief Wait for the solve to finish and return the solutions
+   */
+  std::vector<Solution> result();
+
+private:
+  std::future<std::vector<SolutionData>> m_future;
+  std::vector<np_array> m_arrays;  // keeps the input buffers alive
 };
 
 #endif // PYBAMM_IDAKLU_SOLVER_GROUP_HPP
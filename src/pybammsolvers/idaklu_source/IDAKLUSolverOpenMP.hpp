@@ -7,7 +7,11 @@
 using std::vector;
 
 #include "Options.hpp"
+#include "OutputReduction.hpp"
 #include "Solution.hpp"
+#include "SolutionArena.hpp"
+#include "SolveStats.hpp"
+#include "Expressions/Base/ExpressionTypes.hpp"
 #include "sundials_legacy_wrapper.hpp"
 
 /**
@@ -64,22 +68,61 @@ public:
   int const jac_bandwidth_upper;  // cppcheck-suppress unusedStructMember
   SUNMatrix J;
   SUNLinearSolver LS = nullptr;
+  // Wrapper around LS attached to IDAS (see timed_linear_solver)
+  SUNLinearSolver LS_timed = nullptr;
+#ifdef CUDA_ENABLE
+  // Library handles of the device matrix and linear solver
+  cusparseHandle_t cusparse_handle = nullptr;
+  cusolverSpHandle_t cusolver_handle = nullptr;
+#endif
   std::unique_ptr<ExprSet> functions;
   vector<realtype> res;
   vector<realtype> res_dvar_dy;
   vector<realtype> res_dvar_dp;
+  // Output sensitivity scratch: the yS entries of the states used by any
+  // dvar_dy function, gathered as [state][parameter], and per-function maps
+  // from the dvar_dy / dvar_dp nonzeros to those states / parameters
+  vector<realtype> yS_used;  // cppcheck-suppress unusedStructMember
+  vector<sunindextype> yS_used_states;  // cppcheck-suppress unusedStructMember
+  vector<vector<int>> dvar_dy_used_index;  // cppcheck-suppress unusedStructMember
+  vector<const expr_int *> dvar_dp_rows;  // cppcheck-suppress unusedStructMember
+  vector<int> dvar_dp_nnz;  // cppcheck-suppress unusedStructMember
   bool const sensitivity;  // cppcheck-suppress unusedStructMember
   bool const save_outputs_only; // cppcheck-suppress unusedStructMember
   bool save_hermite;  // cppcheck-suppress unusedStructMember
   bool is_ODE;  // cppcheck-suppress unusedStructMember
   int length_of_return_vector;  // cppcheck-suppress unusedStructMember
-  vector<realtype> t;  // cppcheck-suppress unusedStructMember
-  vector<vector<realtype>> y;  // cppcheck-suppress unusedStructMember
-  vector<vector<realtype>> yp;  // cppcheck-suppress unusedStructMember
-  vector<vector<vector<realtype>>> yS;  // cppcheck-suppress unusedStructMember
-  vector<vector<vector<realtype>>> ypS;  // cppcheck-suppress unusedStructMember
+  // Solution storage, one row per saved time step. Sensitivity rows are
+  // [parameter][variable] for full states and [variable][parameter] for outputs
+  SolutionArena t;  // cppcheck-suppress unusedStructMember
+  SolutionArena y;  // cppcheck-suppress unusedStructMember
+  SolutionArena yp;  // cppcheck-suppress unusedStructMember
+  SolutionArena yS;  // cppcheck-suppress unusedStructMember
+  SolutionArena ypS;  // cppcheck-suppress unusedStructMember
+  // Adaptive steps dropped since the last kept step (see output_thinning_tolerance)
+  bool thin_output = false;  // cppcheck-suppress unusedStructMember
+  int i_thin_candidate = -1;  // cppcheck-suppress unusedStructMember
+  vector<realtype> t_thinned;  // cppcheck-suppress unusedStructMember
+  SolutionArena y_thinned;  // states, then sensitivities  // cppcheck-suppress unusedStructMember
+  static constexpr std::size_t max_thinned_steps = 16;
+  // Output variables reduced to a single row (see output_reductions)
+  bool const reduce_output;  // cppcheck-suppress unusedStructMember
+  OutputReduction reduction;  // cppcheck-suppress unusedStructMember
+  // Interpolated states awaiting output evaluation (see defer_interp_output)
+  bool defer_output;  // cppcheck-suppress unusedStructMember
+  SolutionArena y_deferred;  // cppcheck-suppress unusedStructMember
+  SolutionArena yS_deferred;  // cppcheck-suppress unusedStructMember
+  vector<int> i_save_deferred;  // cppcheck-suppress unusedStructMember
+  // Counters and timings of the current solve
+  SolveStats stats;  // cppcheck-suppress unusedStructMember
+  long int ngevalsBBDP_start = 0;  // cppcheck-suppress unusedStructMember
   SetupOptions const setup_opts;
   SolverOptions const solver_opts;
+  // Checkpoint the next solve resumes from (see set_resume)
+  const SolverCheckpoint *resume_checkpoint = nullptr;  // cppcheck-suppress unusedStructMember
+  bool resume_consistent = false;  // cppcheck-suppress unusedStructMember
+  // t_eval entries of the next solve at which to reinitialise (see set_breakpoints)
+  const std::vector<char> *breakpoints = nullptr;  // cppcheck-suppress unusedStructMember
 
 #if SUNDIALS_VERSION_MAJOR >= 6
   SUNContext sunctx;
@@ -121,6 +164,61 @@ public:
     bool save_interp_steps
   ) override;
 
+  /**
+   * @brief Make the next solve resume from a checkpoint
+   */
+  void set_resume(const SolverCheckpoint *checkpoint, bool consistent) override {
+    resume_checkpoint = checkpoint;
+    resume_consistent = consistent;
+  }
+
+  /**
+   * @brief Restrict the restarts of the next solve to some t_eval entries
+   */
+  void set_breakpoints(const std::vector<char> *breakpoints_arg) override {
+    breakpoints = breakpoints_arg;
+  }
+
+  /**
+   * @brief Number of values saved per time point
+   */
+  int get_number_of_outputs() const override {
+    if (!save_outputs_only) {
+      return number_of_states;
+    }
+    int number_of_outputs = 0;
+    for (auto &var_fcn : functions->var_fcns) {
+      number_of_outputs += var_fcn->nnz_out();
+    }
+    return number_of_outputs;
+  }
+
+  /**
+   * @brief Whether the outputs are reduced over time
+   */
+  bool reduces_outputs() const override {
+    return !solver_opts.output_reductions.empty();
+  }
+
+  /**
+   * @brief Gradient of L = int_{t0}^{tf} g(t, y, p) dt by adjoint sensitivities
+   *
+   * g is the scalar output variable `loss_index` and p are the sensitivity
+   * parameters. The forward solution is checkpointed every
+   * `adjoint_checkpoint_steps` steps and recomputed between checkpoints
+   * during the backward (adjoint) solve, so the cost does not grow with the
+   * number of parameters. The system is integrated in a single pass from the
+   * first to the last t_eval (interior t_eval values are not breakpoints).
+   * A terminating event that stops the solve raises std::domain_error, as the
+   * gradient would miss the sensitivity of the event time.
+   */
+  AdjointSolution solve_adjoint(
+    const std::vector<realtype> &t_eval,
+    const realtype *y0,
+    const realtype *yp0,
+    const realtype *inputs,
+    int loss_index
+  ) override;
 
   /**
    * @brief Concrete implementation of initialization method
@@ -137,11 +235,34 @@ public:
    */
   void SetMatrix();
 
+  /**
+   * @brief Install the (fixed) Jacobian sparsity pattern in the sparse matrix
+   */
+  void SetSparsityPattern();
+
+  /**
+   * @brief Map each Jacobian nonzero to its place in the band matrix storage
+   */
+  void SetBandScatter();
+
+  /**
+   * @brief Install the Jacobian sparsity pattern in the device matrix
+   *
+   * The device matrix stores the diagonal blocks of an ensemble (one block
+   * if there is no ensemble) in CSR format, all sharing the same pattern.
+   */
+  void SetDeviceSparsityPattern();
+
   /**
    * @brief Get the length of the return vector
    */
   int ReturnVectorLength();
 
+  /**
+   * @brief Build the index maps used by SetStepOutputSensitivities
+   */
+  void SetOutputSensitivityMaps();
+
   /**
    * @brief Initialize the storage for the solution
    */
@@ -167,6 +288,14 @@ public:
    */
   void PrintStats();
 
+  /**
+   * @brief Add the IDA counters to the solve statistics
+   *
+   * IDAReInit resets the counters, so this is called before each restart
+   * of the integrator and at the end of the solve.
+   */
+  void AccumulateStats();
+
   /**
    * @brief Set a consistent initialization for ODEs
    */
@@ -203,6 +332,25 @@ public:
    */
   void ExtendHermiteArrays();
 
+  /**
+   * @brief Decide whether the adaptive step saved before the newest one
+   * can be dropped
+   *
+   * The step is dropped if the cubic Hermite interpolant between the last
+   * kept step and the newest one reproduces its states and sensitivities,
+   * and those of the steps dropped since the last kept one, to within
+   * output_thinning_tolerance times the integration error weights. The
+   * newest step is a candidate for the next call if it is `thinnable`.
+   */
+  void ThinSavedSteps(bool thinnable, int &i_save);
+
+  /**
+   * @brief Whether the Hermite interpolant between saved rows i0 and i1
+   * reproduces the states y_c and the sensitivities yS_c (or nullptr) at t_c
+   */
+  bool HermiteWithinTolerance(
+    int i0, int i1, realtype t_c, const realtype *y_c, const realtype *yS_c);
+
   /**
    * @brief Set the step values
    */
@@ -232,6 +380,21 @@ public:
     int &i_save
   );
 
+  /**
+   * @brief Store the interpolated state for a later output evaluation
+   */
+  void SetStepDeferred(
+    realtype &t_val,
+    realtype *y_val,
+    vector<realtype *> const &yS_val,
+    int &i_save
+  );
+
+  /**
+   * @brief Evaluate the output variables at all deferred interpolation points
+   */
+  void SetDeferredOutputs();
+
   /**
    * @brief Save y and yS at the current time
    */
@@ -262,6 +425,17 @@ public:
     int &i_save
   );
 
+  /**
+   * @brief Fold the output function results at the requested time into
+   * the reduced outputs
+   */
+  void SetStepReduced(
+    realtype &t_val,
+    realtype *y_val,
+    const vector<realtype*> &yS_val,
+    int &i_save
+  );
+
   /**
    * @brief Save the output function sensitivities at the requested time
    */
@@ -1,8 +1,14 @@
 #include "Expressions/Expressions.hpp"
+#include "IDAKLUEnsembleSolver.hpp"
 #include "sundials_functions.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <vector>
 #include "common.hpp"
 #include "SolutionData.hpp"
+#include "Trace.hpp"
 
 template <class ExprSet>
 IDAKLUSolverOpenMP<ExprSet>::IDAKLUSolverOpenMP(
@@ -29,6 +35,7 @@ IDAKLUSolverOpenMP<ExprSet>::IDAKLUSolverOpenMP(
   functions(std::move(functions_arg)),
   sensitivity(number_of_parameters > 0),
   save_outputs_only(functions->var_fcns.size() > 0),
+  reduce_output(!solver_input.output_reductions.empty()),
   setup_opts(setup_input),
   solver_opts(solver_input)
 {
@@ -43,8 +50,24 @@ IDAKLUSolverOpenMP<ExprSet>::IDAKLUSolverOpenMP(
   // allocate memory for solver
   ida_mem = IDACreate(sunctx);
 
+  // use the mass matrix diagonal directly in the residual if possible
+  functions->detect_mass_matrix();
+
+  // slices of the partitioned expressions, if any
+  functions->set_partition();
+  if (!functions->jac_times_cjmass_blocks.empty() &&
+      !setup_opts.using_sparse_matrix && !setup_opts.using_banded_matrix) {
+    throw std::invalid_argument(
+      "jac_times_cjmass_blocks requires a sparse or banded jacobian");
+  }
+
   // create the vector of initial values
   AllocateVectors();
+  if (functions->number_of_members > 1) {
+    // Each member of an ensemble passes the error test on its own. IDA
+    // clones its work vectors from yy, so they inherit the norm.
+    use_member_error_norm(yy);
+  }
   if (sensitivity) {
     yyS = N_VCloneVectorArray(number_of_parameters, yy);
     yypS = N_VCloneVectorArray(number_of_parameters, yyp);
@@ -89,13 +112,48 @@ IDAKLUSolverOpenMP<ExprSet>::IDAKLUSolverOpenMP(
 
   // Will be overwritten during the solve() call
   save_hermite = solver_opts.hermite_interpolation;
+
+  if (reduce_output) {
+    if (solver_opts.output_reductions.size() != functions->var_fcns.size()) {
+      throw std::invalid_argument(
+        "output_reductions must name one reduction per output variable. Expected " +
+        std::to_string(functions->var_fcns.size()) + " but got " +
+        std::to_string(solver_opts.output_reductions.size()));
+    }
+    // Each element of a variable is reduced in the same way
+    vector<OutputReduction::Kind> kinds;
+    for (size_t i = 0; i < functions->var_fcns.size(); i++) {
+      kinds.insert(
+        kinds.end(),
+        functions->var_fcns[i]->nnz_out(),
+        OutputReduction::parse(solver_opts.output_reductions[i]));
+    }
+    reduction.reset(std::move(kinds), number_of_parameters);
+  }
 }
 
 template <class ExprSet>
 void IDAKLUSolverOpenMP<ExprSet>::AllocateVectors() {
-  DEBUG("IDAKLUSolverOpenMP::AllocateVectors (num_threads = " << setup_opts.num_threads << ")");
+  // Extra vector op threads only pay off with enough states for each of them
+  int num_threads = setup_opts.num_threads;
+  if (setup_opts.min_states_per_thread > 0) {
+    num_threads = std::max(
+      1, std::min(num_threads, number_of_states / setup_opts.min_states_per_thread));
+  }
+  DEBUG("IDAKLUSolverOpenMP::AllocateVectors (num_threads = " << num_threads << ")");
   // Create vectors
-  if (setup_opts.num_threads == 1) {
+#ifdef CUDA_ENABLE
+  if (setup_opts.using_device_solver) {
+    DEBUG("IDAKLUSolverOpenMP::AllocateVectors CUDA");
+    yy = N_VNewManaged_Cuda(number_of_states, sunctx);
+    yyp = N_VNewManaged_Cuda(number_of_states, sunctx);
+    y_cache = N_VNewManaged_Cuda(number_of_states, sunctx);
+    avtol = N_VNewManaged_Cuda(number_of_states, sunctx);
+    id = N_VNewManaged_Cuda(number_of_states, sunctx);
+    return;
+  }
+#endif
+  if (num_threads == 1) {
     yy = N_VNew_Serial(number_of_states, sunctx);
     yyp = N_VNew_Serial(number_of_states, sunctx);
     y_cache = N_VNew_Serial(number_of_states, sunctx);
@@ -103,11 +161,11 @@ void IDAKLUSolverOpenMP<ExprSet>::AllocateVectors() {
     id = N_VNew_Serial(number_of_states, sunctx);
   } else {
     DEBUG("IDAKLUSolverOpenMP::AllocateVectors OpenMP");
-    yy = N_VNew_OpenMP(number_of_states, setup_opts.num_threads, sunctx);
-    yyp = N_VNew_OpenMP(number_of_states, setup_opts.num_threads, sunctx);
-    y_cache = N_VNew_OpenMP(number_of_states, setup_opts.num_threads, sunctx);
-    avtol = N_VNew_OpenMP(number_of_states, setup_opts.num_threads, sunctx);
-    id = N_VNew_OpenMP(number_of_states, setup_opts.num_threads, sunctx);
+    yy = N_VNew_OpenMP(number_of_states, num_threads, sunctx);
+    yyp = N_VNew_OpenMP(number_of_states, num_threads, sunctx);
+    y_cache = N_VNew_OpenMP(number_of_states, num_threads, sunctx);
+    avtol = N_VNew_OpenMP(number_of_states, num_threads, sunctx);
+    id = N_VNew_OpenMP(number_of_states, num_threads, sunctx);
   }
 }
 
@@ -115,40 +173,38 @@ template <class ExprSet>
 void IDAKLUSolverOpenMP<ExprSet>::InitializeStorage(int const N) {
   length_of_return_vector = ReturnVectorLength();
 
-  t = vector<realtype>(N, 0.0);
-
-  y = vector<vector<realtype>>(
-      N,
-      vector<realtype>(length_of_return_vector, 0.0)
-  );
+  // The integration stays in double precision; only the stored rows may be
+  // rounded
+  StorageType const output_type = storage_type(solver_opts.output_dtype);
+  StorageType const sensitivity_type = storage_type(solver_opts.sensitivity_dtype);
+  y.set_type(output_type);
+  yp.set_type(output_type);
+  yS.set_type(sensitivity_type);
+  ypS.set_type(sensitivity_type);
+
+  if (!solver_opts.storage_directory.empty()) {
+    // Stream the saved rows of each field to its own file
+    std::string const prefix = solution_file_prefix(solver_opts.storage_directory);
+    t.set_file(prefix + "_t.bin");
+    y.set_file(prefix + "_y.bin");
+    yS.set_file(prefix + "_yS.bin");
+    if (save_hermite) {
+      yp.set_file(prefix + "_yp.bin");
+      ypS.set_file(prefix + "_ypS.bin");
+    }
+  }
 
-  yS = vector<vector<vector<realtype>>>(
-      N,
-      vector<vector<realtype>>(
-          number_of_parameters,
-          vector<realtype>(length_of_return_vector, 0.0)
-      )
-  );
+  t.reset(1, N);
+  y.reset(length_of_return_vector, N);
+  yS.reset(number_of_parameters * length_of_return_vector, N);
 
-  if (save_hermite) {
-    InitializeHermiteStorage(N);
-  }
+  InitializeHermiteStorage(save_hermite ? N : 0);
 }
 
 template <class ExprSet>
 void IDAKLUSolverOpenMP<ExprSet>::InitializeHermiteStorage(int const N) {
-  yp = vector<vector<realtype>>(
-      N,
-      vector<realtype>(number_of_states, 0.0)
-  );
-
-  ypS = vector<vector<vector<realtype>>>(
-      N,
-      vector<vector<realtype>>(
-          number_of_parameters,
-          vector<realtype>(number_of_states, 0.0)
-      )
-  );
+  yp.reset(number_of_states, N);
+  ypS.reset(number_of_parameters * number_of_states, N);
 }
 
 template <class ExprSet>
@@ -177,9 +233,58 @@ int IDAKLUSolverOpenMP<ExprSet>::ReturnVectorLength() {
     res_dvar_dp.resize(max_res_dvar_dp);
   }
 
+  // The fused function writes its outputs straight into the storage rows
+  if (functions->var_fused != nullptr &&
+      functions->var_fused->out_shape(0) != length_of_return_vector) {
+    throw std::invalid_argument(
+      "var_fused must return the " + std::to_string(length_of_return_vector) +
+      " output values of var_fcns, but returns " +
+      std::to_string(functions->var_fused->out_shape(0)));
+  }
+
+  if (sensitivity) {
+    SetOutputSensitivityMaps();
+  }
+
   return length_of_return_vector;
 }
 
+template <class ExprSet>
+void IDAKLUSolverOpenMP<ExprSet>::SetOutputSensitivityMaps() {
+  DEBUG("IDAKLUSolver::SetOutputSensitivityMaps");
+  // The sparsity of the output functions is fixed, so this only needs to
+  // be done once per solver
+  if (dvar_dy_used_index.size() == functions->dvar_dy_fcns.size()) {
+    return;
+  }
+
+  // Compact index of each state that appears in any dvar_dy function
+  vector<int> used_index(number_of_states, -1);
+  yS_used_states.clear();
+  dvar_dy_used_index.clear();
+  for (auto& dvar_dy : functions->dvar_dy_fcns) {
+    const auto& cols = dvar_dy->get_col();
+    vector<int> index(dvar_dy->nnz_out());
+    for (size_t spk = 0; spk < index.size(); spk++) {
+      auto const col = cols[spk];
+      if (used_index[col] < 0) {
+        used_index[col] = yS_used_states.size();
+        yS_used_states.push_back(col);
+      }
+      index[spk] = used_index[col];
+    }
+    dvar_dy_used_index.push_back(std::move(index));
+  }
+  yS_used.resize(yS_used_states.size() * number_of_parameters);
+
+  dvar_dp_rows.clear();
+  dvar_dp_nnz.clear();
+  for (auto& dvar_dp : functions->dvar_dp_fcns) {
+    dvar_dp_rows.push_back(dvar_dp->get_row().data());
+    dvar_dp_nnz.push_back(dvar_dp->nnz_out());
+  }
+}
+
 template <class ExprSet>
 void IDAKLUSolverOpenMP<ExprSet>::SetSolverOptions() {
   // Maximum order of the linear multistep method
@@ -248,6 +353,29 @@ void IDAKLUSolverOpenMP<ExprSet>::SetSolverOptions() {
 template <class ExprSet>
 void IDAKLUSolverOpenMP<ExprSet>::SetMatrix() {
   // Create Matrix object
+#ifdef CUDA_ENABLE
+  if (setup_opts.using_device_solver) {
+    DEBUG("\tsetting device block-CSR matrix");
+    int const number_of_blocks = functions->number_of_members;
+    if (cusparseCreate(&cusparse_handle) != CUSPARSE_STATUS_SUCCESS ||
+        cusolverSpCreate(&cusolver_handle) != CUSOLVER_STATUS_SUCCESS) {
+      throw std::runtime_error("Failed to create the cuSPARSE/cuSolverSp handles");
+    }
+    J = SUNMatrix_cuSparse_NewBlockCSR(
+      number_of_blocks,
+      number_of_states / number_of_blocks,
+      number_of_states / number_of_blocks,
+      jac_times_cjmass_nnz / number_of_blocks,
+      cusparse_handle,
+      sunctx
+    );
+    if (J == NULL) {
+      throw std::runtime_error("Failed to create the device Jacobian matrix");
+    }
+    SetDeviceSparsityPattern();
+    return;
+  }
+#endif
   if (setup_opts.jacobian == "sparse") {
     DEBUG("\tsetting sparse matrix");
     J = SUNSparseMatrix(
@@ -257,6 +385,7 @@ void IDAKLUSolverOpenMP<ExprSet>::SetMatrix() {
       CSC_MAT,
       sunctx
     );
+    SetSparsityPattern();
   } else if (setup_opts.jacobian == "banded") {
     DEBUG("\tsetting banded matrix");
     J = SUNBandMatrix(
@@ -265,6 +394,7 @@ void IDAKLUSolverOpenMP<ExprSet>::SetMatrix() {
       jac_bandwidth_lower,
       sunctx
     );
+    SetBandScatter();
   } else if (setup_opts.jacobian == "dense" || setup_opts.jacobian == "none") {
     DEBUG("\tsetting dense matrix");
     J = SUNDenseMatrix(
@@ -280,6 +410,101 @@ void IDAKLUSolverOpenMP<ExprSet>::SetMatrix() {
   }
 }
 
+template <class ExprSet>
+void IDAKLUSolverOpenMP<ExprSet>::SetSparsityPattern() {
+  DEBUG("IDAKLUSolverOpenMP::SetSparsityPattern");
+  auto const &rowvals = *functions->jac_times_cjmass_rowvals;
+  auto const &colptrs = *functions->jac_times_cjmass_colptrs;
+  sunindextype *index_ptrs = SUNSparseMatrix_IndexPointers(J);
+  sunindextype *index_vals = SUNSparseMatrix_IndexValues(J);
+
+  if (SUNSparseMatrix_SparseType(J) == CSC_MAT) {
+    std::copy(rowvals.begin(), rowvals.end(), index_vals);
+    std::copy(colptrs.begin(), colptrs.end(), index_ptrs);
+  } else {
+    // Transpose the CSC pattern, recording where each CSR entry comes from
+    auto &gather = functions->jac_times_cjmass_csr_gather;
+    gather.resize(rowvals.size());
+    std::fill(index_ptrs, index_ptrs + number_of_states + 1, 0);
+    for (auto const row : rowvals) {
+      index_ptrs[row + 1]++;
+    }
+    for (int row = 0; row < number_of_states; row++) {
+      index_ptrs[row + 1] += index_ptrs[row];
+    }
+    vector<sunindextype> next(index_ptrs, index_ptrs + number_of_states);
+    for (int col = 0; col < number_of_states; col++) {
+      for (auto k = colptrs[col]; k < colptrs[col + 1]; k++) {
+        auto const pos = next[rowvals[k]]++;
+        index_vals[pos] = col;
+        gather[pos] = k;
+      }
+    }
+  }
+
+  // The pattern is fixed, so stop IDA from clearing it before each evaluation
+  J->ops->zero = SUNMatZero_Sparse_KeepPattern;
+}
+
+template <class ExprSet>
+void IDAKLUSolverOpenMP<ExprSet>::SetBandScatter() {
+  DEBUG("IDAKLUSolverOpenMP::SetBandScatter");
+  auto const &rowvals = *functions->jac_times_cjmass_rowvals;
+  auto const &colptrs = *functions->jac_times_cjmass_colptrs;
+  realtype *const data = SM_DATA_B(J);
+
+  auto &scatter = functions->jac_times_cjmass_band_scatter;
+  scatter.resize(rowvals.size());
+  for (int col = 0; col < number_of_states; col++) {
+    realtype *const banded_col = SM_COLUMN_B(J, col);
+    for (auto k = colptrs[col]; k < colptrs[col + 1]; k++) {
+      auto const row = rowvals[k];
+      if (row - col > jac_bandwidth_lower || col - row > jac_bandwidth_upper) {
+        throw std::invalid_argument(
+          "Jacobian entry (" + std::to_string(row) + ", " + std::to_string(col) +
+          ") lies outside the given bandwidths");
+      }
+      scatter[k] = &SM_COLUMN_ELEMENT_B(banded_col, row, col) - data;
+    }
+  }
+}
+
+template <class ExprSet>
+void IDAKLUSolverOpenMP<ExprSet>::SetDeviceSparsityPattern() {
+  DEBUG("IDAKLUSolverOpenMP::SetDeviceSparsityPattern");
+#ifdef CUDA_ENABLE
+  auto const &rowvals = *functions->jac_times_cjmass_rowvals;
+  auto const &colptrs = *functions->jac_times_cjmass_colptrs;
+
+  // Transpose the CSC pattern of the whole (block-diagonal) matrix,
+  // recording where each CSR entry comes from
+  auto &gather = functions->jac_times_cjmass_csr_gather;
+  gather.resize(rowvals.size());
+  vector<int> row_ptrs(number_of_states + 1, 0);
+  vector<int> col_vals(rowvals.size());
+  for (auto const row : rowvals) {
+    row_ptrs[row + 1]++;
+  }
+  for (int row = 0; row < number_of_states; row++) {
+    row_ptrs[row + 1] += row_ptrs[row];
+  }
+  vector<int> next(row_ptrs.begin(), row_ptrs.end() - 1);
+  for (int col = 0; col < number_of_states; col++) {
+    for (auto k = colptrs[col]; k < colptrs[col + 1]; k++) {
+      auto const pos = next[rowvals[k]]++;
+      col_vals[pos] = col;
+      gather[pos] = k;
+    }
+  }
+  functions->jac_times_cjmass_csr_data.resize(rowvals.size());
+
+  // The blocks are stored one after another, so the pattern of the first
+  // block is the leading part of the CSR pattern
+  CheckErrors(SUNMatrix_cuSparse_CopyToDevice(J, NULL, row_ptrs.data(), col_vals.data()));
+  CheckErrors(SUNMatrix_cuSparse_SetFixedPattern(J, SUNTRUE));
+#endif
+}
+
 template <class ExprSet>
 void IDAKLUSolverOpenMP<ExprSet>::Initialize() {
   // Call after setting the solver
@@ -288,15 +513,27 @@ void IDAKLUSolverOpenMP<ExprSet>::Initialize() {
   if (LS == nullptr) {
     throw std::invalid_argument("Linear solver not set");
   }
-  CheckErrors(IDASetLinearSolver(ida_mem, LS, J));
+  // IDAS drives the solver through a wrapper that times its setup and solve
+  LS_timed = timed_linear_solver(LS, sunctx);
+  CheckErrors(IDASetLinearSolver(ida_mem, LS_timed, J));
 
-  if (setup_opts.preconditioner != "none") {
+  if (setup_opts.preconditioner == "BBDP") {
     DEBUG("\tsetting IDADDB preconditioner");
     // setup preconditioner
     CheckErrors(IDABBDPrecInit(
       ida_mem, number_of_states, setup_opts.precon_half_bandwidth,
       setup_opts.precon_half_bandwidth, setup_opts.precon_half_bandwidth_keep,
       setup_opts.precon_half_bandwidth_keep, 0.0, residual_eval_approx<ExprSet>, NULL));
+  } else if (setup_opts.preconditioner == "ILU") {
+    DEBUG("\tsetting ILU preconditioner");
+    // The pattern of the analytic Jacobian is analysed once; each setup only
+    // evaluates and factorises it
+    functions->jac_times_cjmass_ilu.analyse(
+      number_of_states,
+      *functions->jac_times_cjmass_colptrs,
+      *functions->jac_times_cjmass_rowvals);
+    CheckErrors(IDASetPreconditioner(
+      ida_mem, precondition_setup<ExprSet>, precondition_solve<ExprSet>));
   }
 
   if (setup_opts.jacobian == "matrix-free") {
@@ -328,6 +565,10 @@ void IDAKLUSolverOpenMP<ExprSet>::Initialize() {
 
   // Variable types: differential (1) and algebraic (0)
   CheckErrors(IDASetId(ida_mem, id));
+
+  // The options are fixed for the lifetime of the solver and are preserved
+  // by IDAReInit, so they only need to be applied once
+  SetSolverOptions();
 }
 
 template <class ExprSet>
@@ -338,6 +579,7 @@ IDAKLUSolverOpenMP<ExprSet>::~IDAKLUSolverOpenMP() {
       IDASensFree(ida_mem);
   }
 
+  CheckErrors(SUNLinSolFree(LS_timed));
   CheckErrors(SUNLinSolFree(LS));
 
   SUNMatDestroy(J);
@@ -353,6 +595,14 @@ IDAKLUSolverOpenMP<ExprSet>::~IDAKLUSolverOpenMP() {
   }
 
   IDAFree(&ida_mem);
+#ifdef CUDA_ENABLE
+  if (cusolver_handle != nullptr) {
+    cusolverSpDestroy(cusolver_handle);
+  }
+  if (cusparse_handle != nullptr) {
+    cusparseDestroy(cusparse_handle);
+  }
+#endif
   SUNContext_Free(&sunctx);
 }
 
@@ -368,6 +618,38 @@ SolutionData IDAKLUSolverOpenMP<ExprSet>::solve(
 )
 {
   DEBUG("IDAKLUSolver::solve");
+  auto const solve_start = PhaseTimer::clock::now();
+  // A resume only applies to this solve
+  const SolverCheckpoint *resume = resume_checkpoint;
+  resume_checkpoint = nullptr;
+  if (resume != nullptr) {
+    const std::size_t n_resume =
+      number_of_states + number_of_parameters * number_of_states;
+    if (resume->y.size() != n_resume || resume->yp.size() != n_resume) {
+      throw std::invalid_argument(
+        "Checkpoint has wrong number of states. Expected " + std::to_string(n_resume) +
+        " but got " + std::to_string(resume->y.size()) + " (y) and " +
+        std::to_string(resume->yp.size()) + " (yp)");
+    }
+    // The solve continues from the checkpoint, so it must start where it ended
+    if (t_eval.empty() ||
+        std::abs(resume->t - t_eval.front()) >
+          1e-12 * std::max(1.0, std::abs(resume->t))) {
+      throw std::invalid_argument(
+        "Checkpoint time " + std::to_string(resume->t) +
+        " does not match the first t_eval point" +
+        (t_eval.empty() ? std::string() : " " + std::to_string(t_eval.front())));
+    }
+  }
+  const std::vector<char> *reinit_at = breakpoints;
+  breakpoints = nullptr;
+  functions->callback_error.clear();
+  stats = SolveStats();
+  SolveStatsScope stats_scope(stats);
+  if (setup_opts.preconditioner == "BBDP") {
+    CheckErrors(IDABBDPrecGetNumGfnEvals(ida_mem, &ngevalsBBDP_start));
+  }
+
   const int number_of_evals = t_eval.size();
   const int number_of_interps = t_interp.size();
 
@@ -379,7 +661,32 @@ SolutionData IDAKLUSolverOpenMP<ExprSet>::solve(
     !save_outputs_only
   );
 
-  InitializeStorage(number_of_evals + number_of_interps);
+  // Reduced outputs only need the accumulated row and a scratch row
+  InitializeStorage(reduce_output ? 2 : number_of_evals + number_of_interps);
+  if (reduce_output) {
+    reduction.clear();
+  }
+
+  // Output variables at t_interp can be evaluated in a single pass after the
+  // integration, so that the integrator only stores the interpolated states
+  defer_output = (
+    solver_opts.defer_interp_output &&
+    save_outputs_only &&
+    save_interp_steps &&
+    !reduce_output
+  );
+  thin_output = save_hermite && solver_opts.output_thinning_tolerance > 0.0;
+  i_thin_candidate = -1;
+  t_thinned.clear();
+  if (thin_output) {
+    y_thinned.reset(number_of_states * (1 + number_of_parameters), 0);
+  }
+
+  if (defer_output) {
+    y_deferred.reset(number_of_states, number_of_interps);
+    yS_deferred.reset(number_of_parameters * number_of_states, number_of_interps);
+    i_save_deferred.clear();
+  }
 
   int i_save = 0;
 
@@ -423,8 +730,6 @@ SolutionData IDAKLUSolverOpenMP<ExprSet>::solve(
     yp_val[i] = yp0[i];
   }
 
-  SetSolverOptions();
-
   // Prepare first time step
   i_eval = 1;
   realtype t_eval_next = t_eval[i_eval];
@@ -432,8 +737,11 @@ SolutionData IDAKLUSolverOpenMP<ExprSet>::solve(
 
   // Consistent initialization
   ReinitializeIntegrator(t0);
+  // A resumed solve continues with the last step size of the checkpoint
+  CheckErrors(IDASetInitStep(
+    ida_mem, resume != nullptr ? resume->step_size : solver_opts.dt_init));
   int const init_type = solver_opts.init_all_y_ic ? IDA_Y_INIT : IDA_YA_YDP_INIT;
-  if (solver_opts.calc_ic) {
+  if (solver_opts.calc_ic && !(resume != nullptr && resume_consistent)) {
     ConsistentInitialization(t0, t_eval_next, init_type);
   }
 
@@ -450,7 +758,10 @@ SolutionData IDAKLUSolverOpenMP<ExprSet>::solve(
     CheckErrors(IDAGetSensDky(ida_mem, t0, 0, yyS));
   }
 
-  SetStep(t0, y_val, yp_val, yS_val, ypS_val, i_save);
+  {
+    PhaseTimer timer(&SolveStats::storage_time);
+    SetStep(t0, y_val, yp_val, yS_val, ypS_val, i_save);
+  }
 
   // Reset the states at t = t_val. Sensitivities are handled in the while-loop
   CheckErrors(IDAGetDky(ida_mem, t_val, 0, yy));
@@ -480,6 +791,7 @@ SolutionData IDAKLUSolverOpenMP<ExprSet>::solve(
 
     if (hit_tinterp) {
       // Save the interpolated state at t_prev < t < t_val, for all t in t_interp
+      PhaseTimer timer(&SolveStats::storage_time);
       SetStepInterp(
         i_interp,
         t_interp_next,
@@ -506,13 +818,17 @@ SolutionData IDAKLUSolverOpenMP<ExprSet>::solve(
       // Save the current state at t_val
       // First, check to make sure that the t_val is not equal to the current t value
       // If it is, we don't want to save the current state twice
-      if (!hit_tinterp || t_val != t.back()) {
-        if (hit_adaptive) {
+      if (!hit_tinterp || t_val != *t.row(i_save - 1)) {
+        PhaseTimer timer(&SolveStats::storage_time);
+        if (hit_adaptive && !reduce_output) {
           // Dynamically allocate memory for the adaptive step
           ExtendAdaptiveArrays();
         }
 
         SetStep(t_val, y_val, yp_val, yS_val, ypS_val, i_save);
+        if (thin_output) {
+          ThinSavedSteps(hit_adaptive && !hit_teval && !hit_event && !hit_final_time, i_save);
+        }
       }
     }
 
@@ -520,14 +836,21 @@ SolutionData IDAKLUSolverOpenMP<ExprSet>::solve(
       // Successful simulation. Exit the while loop
       break;
     } else if (hit_teval) {
+      bool const discontinuity = reinit_at == nullptr || (*reinit_at)[i_eval];
+
       // Set the next stop time
       i_eval++;
       t_eval_next = t_eval[i_eval];
       CheckErrors(IDASetStopTime(ida_mem, t_eval_next));
 
       // Reinitialize the solver to deal with the discontinuity at t = t_val.
-      ReinitializeIntegrator(t_val);
-      ConsistentInitialization(t_val, t_eval_next, IDA_YA_YDP_INIT);
+      // At a pure output time the integration carries on with its current
+      // order, step size and Jacobian.
+      if (discontinuity) {
+        AccumulateStats();
+        ReinitializeIntegrator(t_val);
+        ConsistentInitialization(t_val, t_eval_next, IDA_YA_YDP_INIT);
+      }
     }
 
     t_prev = t_val;
@@ -536,90 +859,89 @@ SolutionData IDAKLUSolverOpenMP<ExprSet>::solve(
     retval = IDASolve(ida_mem, tf, &t_val, yy, yyp, IDA_ONE_STEP);
   }
 
+  AccumulateStats();
+  // A callback that failed stopped IDAS with an unrecoverable error
+  if (!functions->callback_error.empty()) {
+    throw std::runtime_error(functions->callback_error);
+  }
+  // The storage timers include the output evaluations made while saving
+  stats.storage_time -= stats.output_time;
+
+  // Final state, from which a later solve can resume (only on request, as it
+  // costs extra interpolations and a copy of the states and sensitivities)
+  SolverCheckpoint checkpoint;
+  if (retval >= 0 && solver_opts.save_checkpoint) {
+    checkpoint.t = t_val;
+    checkpoint.y.resize(n_coeffs);
+    checkpoint.yp.resize(n_coeffs);
+    // The interpolation of the last output may have overwritten yy and yyp
+    CheckErrors(IDAGetDky(ida_mem, t_val, 0, yy));
+    CheckErrors(IDAGetDky(ida_mem, t_val, 1, yyp));
+    if (sensitivity) {
+      CheckErrors(IDAGetSensDky(ida_mem, t_val, 0, yyS));
+      CheckErrors(IDAGetSensDky(ida_mem, t_val, 1, yypS));
+    }
+    wait_for_device(yy);
+    wait_for_device(yyp);
+    std::copy_n(y_val, number_of_states, checkpoint.y.begin());
+    std::copy_n(yp_val, number_of_states, checkpoint.yp.begin());
+    for (int p = 0; p < number_of_parameters; p++) {
+      std::copy_n(yS_val[p], number_of_states,
+        checkpoint.y.begin() + (p + 1) * number_of_states);
+      std::copy_n(ypS_val[p], number_of_states,
+        checkpoint.yp.begin() + (p + 1) * number_of_states);
+    }
+    CheckErrors(IDAGetLastStep(ida_mem, &checkpoint.step_size));
+  }
+
+  if (defer_output) {
+    SetDeferredOutputs();
+  }
+  if (reduce_output) {
+    reduction.finalize(y.row(0), sensitivity ? yS.row(0) : nullptr);
+  }
+
   int const length_of_final_sv_slice = save_outputs_only ? number_of_states : 0;
-  realtype *yterm_return = new realtype[length_of_final_sv_slice];
+  realtype *yterm_return = static_cast<realtype *>(
+    std::malloc(std::max(1, length_of_final_sv_slice) * sizeof(realtype)));
   if (save_outputs_only) {
     // store final state slice if outout variables are specified
-    std::memcpy(yterm_return, y_val, length_of_final_sv_slice * sizeof(realtype*));
+    wait_for_device(yy);
+    std::memcpy(yterm_return, y_val, length_of_final_sv_slice * sizeof(realtype));
   }
 
   if (solver_opts.print_stats) {
     PrintStats();
   }
 
+  stats.total_time = std::chrono::duration<double>(
+    PhaseTimer::clock::now() - solve_start).count();
+
   // store number of timesteps so we can generate the solution later
   number_of_timesteps = i_save;
 
-  // Copy the data to return as numpy arrays
-
-  // Time, t
-  realtype *t_return = new realtype[number_of_timesteps];
-  for (size_t i = 0; i < number_of_timesteps; i++) {
-    t_return[i] = t[i];
-  }
-
-  // States, y
-  realtype *y_return = new realtype[number_of_timesteps * length_of_return_vector];
-  int count = 0;
-  for (size_t i = 0; i < number_of_timesteps; i++) {
-    for (size_t j = 0; j < length_of_return_vector; j++) {
-      y_return[count] = y[i][j];
-      count++;
-    }
-  }
-
-  // Sensitivity states, yS
-  // Note: Ordering of vector is different if computing outputs vs returning
-  // the complete state vector
+  // Hand the storage to the solution without copying
+  // Note: Ordering of the sensitivities is different if computing outputs vs
+  // returning the complete state vector
   auto const arg_sens0 = (save_outputs_only ? number_of_timesteps : number_of_parameters);
   auto const arg_sens1 = (save_outputs_only ? length_of_return_vector : number_of_timesteps);
   auto const arg_sens2 = (save_outputs_only ? number_of_parameters : length_of_return_vector);
 
-  realtype *yS_return = new realtype[arg_sens0 * arg_sens1 * arg_sens2];
-  count = 0;
-  for (size_t idx0 = 0; idx0 < arg_sens0; idx0++) {
-    for (size_t idx1 = 0; idx1 < arg_sens1; idx1++) {
-      for (size_t idx2 = 0; idx2 < arg_sens2; idx2++) {
-        auto i = (save_outputs_only ? idx0 : idx1);
-        auto j = (save_outputs_only ? idx1 : idx2);
-        auto k = (save_outputs_only ? idx2 : idx0);
-
-        yS_return[count] = yS[i][k][j];
-        count++;
-      }
-    }
-  }
-
-  realtype *yp_return = new realtype[(save_hermite ? 1 : 0) * (number_of_timesteps * number_of_states)];
-  realtype *ypS_return = new realtype[(save_hermite ? 1 : 0) * (arg_sens0 * arg_sens1 * arg_sens2)];
-  if (save_hermite) {
-    count = 0;
-    for (size_t i = 0; i < number_of_timesteps; i++) {
-      for (size_t j = 0; j < number_of_states; j++) {
-        yp_return[count] = yp[i][j];
-        count++;
-      }
-    }
-
-    // Sensitivity states, ypS
-    // Note: Ordering of vector is different if computing outputs vs returning
-    // the complete state vector
-    count = 0;
-    for (size_t idx0 = 0; idx0 < arg_sens0; idx0++) {
-      for (size_t idx1 = 0; idx1 < arg_sens1; idx1++) {
-        for (size_t idx2 = 0; idx2 < arg_sens2; idx2++) {
-          auto i = (save_outputs_only ? idx0 : idx1);
-          auto j = (save_outputs_only ? idx1 : idx2);
-          auto k = (save_outputs_only ? idx2 : idx0);
-
-          ypS_return[count] = ypS[i][k][j];
-          count++;
-        }
-      }
-    }
-  }
-
-  return SolutionData(
+  t.resize(number_of_timesteps);
+  y.resize(number_of_timesteps);
+  yS.resize(number_of_timesteps);
+  yp.resize(save_hermite ? number_of_timesteps : 0);
+  ypS.resize(save_hermite ? number_of_timesteps : 0);
+
+  realtype *t_return = static_cast<realtype *>(t.release());
+  StorageType const output_type = y.type();
+  StorageType const sensitivity_type = yS.type();
+  void *y_return = y.release();
+  void *yS_return = yS.release();
+  void *yp_return = yp.release();
+  void *ypS_return = ypS.release();
+
+  SolutionData solution(
     retval,
     number_of_timesteps,
     length_of_return_vector,
@@ -628,27 +950,207 @@ SolutionData IDAKLUSolverOpenMP<ExprSet>::solve(
     arg_sens2,
     length_of_final_sv_slice,
     save_hermite,
+    !save_outputs_only,
     t_return,
     y_return,
     yp_return,
     yS_return,
     ypS_return,
-    yterm_return);
+    yterm_return,
+    stats,
+    output_type,
+    sensitivity_type);
+  solution.set_checkpoint(std::move(checkpoint));
+  return solution;
 }
 
 template <class ExprSet>
-void IDAKLUSolverOpenMP<ExprSet>::ExtendAdaptiveArrays() {
-  DEBUG("IDAKLUSolver::ExtendAdaptiveArrays");
-  // Time
-  t.emplace_back(0.0);
+AdjointSolution IDAKLUSolverOpenMP<ExprSet>::solve_adjoint(
+  const std::vector<realtype> &t_eval,
+  const realtype *y0,
+  const realtype *yp0,
+  const realtype *inputs,
+  int loss_index
+)
+{
+  DEBUG("IDAKLUSolver::solve_adjoint");
+  if (!sensitivity) {
+    throw std::invalid_argument(
+      "Adjoint sensitivities need the sensitivity functions of the model, "
+      "so the solver must be created with number_of_parameters > 0");
+  }
+  if (setup_opts.jacobian != "sparse" || setup_opts.linear_solver != "SUNLinSol_KLU") {
+    throw std::invalid_argument(
+      "Adjoint sensitivities require a sparse jacobian and the SUNLinSol_KLU linear solver");
+  }
+  if (loss_index < 0 ||
+      loss_index >= static_cast<int>(functions->dvar_dy_fcns.size()) ||
+      functions->var_fcns[loss_index]->nnz_out() != 1) {
+    throw std::invalid_argument("loss_index must refer to a scalar output variable");
+  }
+  functions->callback_error.clear();
 
-  // States
-  y.emplace_back(length_of_return_vector, 0.0);
+  const int np = number_of_parameters;
+  realtype const t0 = t_eval.front();
+  realtype const tf = t_eval.back();
 
-  // Sensitivity
-  if (sensitivity) {
-    yS.emplace_back(number_of_parameters, vector<realtype>(length_of_return_vector, 0.0));
+  for (int i = 0; i < functions->inputs.size(); i++) {
+    functions->inputs[i] = inputs[i];
   }
+  realtype *y_val = N_VGetArrayPointer(yy);
+  realtype *yp_val = N_VGetArrayPointer(yyp);
+  for (int i = 0; i < number_of_states; i++) {
+    y_val[i] = y0[i];
+    yp_val[i] = yp0[i];
+  }
+
+  AdjointData<ExprSet> adjoint;
+  adjoint.functions = functions.get();
+  adjoint.loss = functions->var_fcns[loss_index];
+  adjoint.dloss_dy = functions->dvar_dy_fcns[loss_index];
+  adjoint.dloss_dp = functions->dvar_dp_fcns[loss_index];
+  adjoint.jac.resize(jac_times_cjmass_nnz);
+  adjoint.res.resize(std::max<expr_int>(
+    {1, adjoint.dloss_dy->nnz_out(), adjoint.dloss_dp->nnz_out()}));
+  adjoint.sens.resize(np * number_of_states);
+  if (!functions->mass_matrix_is_diagonal) {
+    // jac_times_cjmass is J - cj M with a constant M, so M is the difference
+    // of its values at cj = 0 and cj = 1
+    adjoint.mass.resize(jac_times_cjmass_nnz);
+    auto jacobian_values = [&](realtype cj, realtype *values) {
+      functions->jac_times_cjmass->m_arg[0] = &t0;
+      functions->jac_times_cjmass->m_arg[1] = y_val;
+      functions->jac_times_cjmass->m_arg[2] = functions->inputs.data();
+      functions->jac_times_cjmass->m_arg[3] = &cj;
+      functions->jac_times_cjmass->m_res[0] = values;
+      functions->evaluate(functions->jac_times_cjmass);
+    };
+    jacobian_values(0.0, adjoint.jac.data());
+    jacobian_values(1.0, adjoint.mass.data());
+    for (int k = 0; k < jac_times_cjmass_nnz; k++) {
+      adjoint.mass[k] = adjoint.jac[k] - adjoint.mass[k];
+    }
+  }
+
+  // Frees the adjoint memory and the backward problem on every exit path
+  struct AdjointMemory {
+    void *ida_mem;
+    N_Vector yB = nullptr;
+    N_Vector ypB = nullptr;
+    N_Vector qB = nullptr;
+    SUNMatrix JB = nullptr;
+    SUNLinearSolver LSB = nullptr;
+    ~AdjointMemory() {
+      IDAAdjFree(ida_mem);
+      if (LSB != nullptr) SUNLinSolFree(LSB);
+      if (JB != nullptr) SUNMatDestroy(JB);
+      if (qB != nullptr) N_VDestroy(qB);
+      if (ypB != nullptr) N_VDestroy(ypB);
+      if (yB != nullptr) N_VDestroy(yB);
+    }
+  } memory{ida_mem};
+
+  // Forward solve, without forward sensitivities, storing checkpoints
+  ReinitializeIntegrator(t0);
+  // A previous resumed solve may have left the checkpoint's step size
+  CheckErrors(IDASetInitStep(ida_mem, solver_opts.dt_init));
+  CheckErrors(IDASensToggleOff(ida_mem));
+  if (solver_opts.calc_ic) {
+    int const init_type = solver_opts.init_all_y_ic ? IDA_Y_INIT : IDA_YA_YDP_INIT;
+    ConsistentInitialization(t0, tf, init_type);
+  }
+  CheckErrors(IDASetStopTime(ida_mem, tf));
+  CheckErrors(IDAAdjInit(ida_mem, setup_opts.adjoint_checkpoint_steps, IDA_HERMITE));
+
+  realtype t_val = t0;
+  int number_of_checkpoints;
+  int const retval = IDASolveF(
+    ida_mem, tf, &t_val, yy, yyp, IDA_NORMAL, &number_of_checkpoints);
+  AdjointSolution result{retval, 0.0, std::vector<realtype>(np, 0.0)};
+  if (retval < 0) {
+    return result;
+  }
+  if (retval == IDA_ROOT_RETURN) {
+    // The gradient would miss the dependence of the event time on p
+    throw std::domain_error(
+      "Adjoint sensitivities are not available when a terminating event stops "
+      "the solve (at t = " + std::to_string(t_val) + ")");
+  }
+
+  // Backward (adjoint) problem, starting from the final time
+  int which;
+  CheckErrors(IDACreateB(ida_mem, &which));
+  memory.yB = N_VClone(yy);
+  memory.ypB = N_VClone(yy);
+  N_VConst(RCONST(0.0), memory.yB);
+  N_VConst(RCONST(0.0), memory.ypB);
+  CheckErrors(IDAInitB(
+    ida_mem, which, adjoint_residual_eval<ExprSet>, t_val, memory.yB, memory.ypB));
+  CheckErrors(IDASVtolerancesB(ida_mem, which, rtol, avtol));
+  CheckErrors(IDASetUserDataB(ida_mem, which, &adjoint));
+  CheckErrors(IDASetMaxNumStepsB(ida_mem, which, solver_opts.max_num_steps));
+  CheckErrors(IDASetIdB(ida_mem, which, id));
+
+  // J^T has the forward (CSC) pattern read as CSR
+  auto const &rowvals = *functions->jac_times_cjmass_rowvals;
+  auto const &colptrs = *functions->jac_times_cjmass_colptrs;
+  memory.JB = SUNSparseMatrix(
+    number_of_states, number_of_states, jac_times_cjmass_nnz, CSR_MAT, sunctx);
+  std::copy(colptrs.begin(), colptrs.end(), SUNSparseMatrix_IndexPointers(memory.JB));
+  std::copy(rowvals.begin(), rowvals.end(), SUNSparseMatrix_IndexValues(memory.JB));
+  memory.JB->ops->zero = SUNMatZero_Sparse_KeepPattern;
+  memory.LSB = SUNLinSol_KLU(memory.yB, memory.JB, sunctx);
+  CheckErrors(IDASetLinearSolverB(ida_mem, which, memory.LSB, memory.JB));
+  CheckErrors(IDASetJacFnB(ida_mem, which, adjoint_jacobian_eval<ExprSet>));
+
+  memory.qB = N_VNew_Serial(np + 1, sunctx);
+  N_VConst(RCONST(0.0), memory.qB);
+  CheckErrors(IDAQuadInitB(ida_mem, which, adjoint_quadrature_eval<ExprSet>, memory.qB));
+
+  // The terminal condition yB^T M = 0 fixes the differential part of yB;
+  // the rest follows from the adjoint residual
+  CheckErrors(IDACalcICB(ida_mem, which, t0, yy, yyp));
+
+  int const retval_backward = IDASolveB(ida_mem, t0, IDA_NORMAL);
+  if (retval_backward < 0) {
+    result.flag = retval_backward;
+    return result;
+  }
+  realtype t_backward;
+  CheckErrors(IDAGetB(ida_mem, which, &t_backward, memory.yB, memory.ypB));
+  CheckErrors(IDAGetQuadB(ida_mem, which, &t_backward, memory.qB));
+
+  // dL/dp = int (∂g/∂p - yB^T ∂F/∂p) dt - yB(t0)^T M dy/dp(t0)
+  const realtype *q = N_VGetArrayPointer(memory.qB);
+  realtype *lambda = N_VGetArrayPointer(memory.yB);
+  vector<realtype> mass_lambda(number_of_states, 0.0);
+  if (functions->mass_matrix_is_diagonal) {
+    mass_axpy(functions.get(), 1., lambda, mass_lambda.data());
+  } else {
+    jacobian_pattern_transpose_axpy(
+      functions.get(), adjoint.mass.data(), lambda, mass_lambda.data());
+  }
+  result.loss = q[0];
+  for (int p = 0; p < np; p++) {
+    const realtype *yS0 = y0 + (p + 1) * number_of_states;
+    realtype initial_term = 0.0;
+    for (int i = 0; i < number_of_states; i++) {
+      initial_term += mass_lambda[i] * yS0[i];
+    }
+    result.gradient[p] = q[1 + p] - initial_term;
+  }
+
+  return result;
+}
+
+template <class ExprSet>
+void IDAKLUSolverOpenMP<ExprSet>::ExtendAdaptiveArrays() {
+  DEBUG("IDAKLUSolver::ExtendAdaptiveArrays");
+  auto const N = t.rows() + 1;
+
+  t.resize(N);
+  y.resize(N);
+  yS.resize(N);
 
   if (save_hermite) {
     ExtendHermiteArrays();
@@ -658,13 +1160,10 @@ void IDAKLUSolverOpenMP<ExprSet>::ExtendAdaptiveArrays() {
 template <class ExprSet>
 void IDAKLUSolverOpenMP<ExprSet>::ExtendHermiteArrays() {
   DEBUG("IDAKLUSolver::ExtendHermiteArrays");
-  // States
-  yp.emplace_back(number_of_states, 0.0);
+  auto const N = yp.rows() + 1;
 
-  // Sensitivity
-  if (sensitivity) {
-    ypS.emplace_back(number_of_parameters, vector<realtype>(number_of_states, 0.0));
-  }
+  yp.resize(N);
+  ypS.resize(N);
 }
 
 template <class ExprSet>
@@ -682,6 +1181,7 @@ void IDAKLUSolverOpenMP<ExprSet>::ConsistentInitialization(
   const realtype& t_next,
   const int& icopt) {
   DEBUG("IDAKLUSolver::ConsistentInitialization");
+  TRACE_SPAN("ConsistentInitialization");
 
   if (is_ODE && icopt == IDA_YA_YDP_INIT) {
     ConsistentInitializationODE(t_val);
@@ -708,12 +1208,116 @@ void IDAKLUSolverOpenMP<ExprSet>::ConsistentInitializationODE(
   // by analytically computing the yp values. If we take our implicit
   // DAE system res(t,y,yp) = f(t,y) - I*yp, then yp = res(t,y,0). This
   // avoids an expensive call to IDACalcIC.
-  realtype *y_cache_val = N_VGetArrayPointer(y_cache);
+  wait_for_device(y_cache);
+  realtype *y_cache_val = host_data(y_cache);
   std::memset(y_cache_val, 0, number_of_states * sizeof(realtype));
   // Overwrite yp
   residual_eval<ExprSet>(t_val, yy, y_cache, yyp, functions.get());
 }
 
+template <class ExprSet>
+void IDAKLUSolverOpenMP<ExprSet>::ThinSavedSteps(bool thinnable, int &i_save) {
+  DEBUG("IDAKLUSolver::ThinSavedSteps");
+  int const i_new = i_save - 1;
+  int const i_candidate = i_thin_candidate;
+
+  bool drop = i_candidate >= 1 && i_candidate == i_new - 1 &&
+    t_thinned.size() < max_thinned_steps &&
+    HermiteWithinTolerance(
+      i_candidate - 1, i_new, *t.row(i_candidate), y.row(i_candidate),
+      sensitivity ? yS.row(i_candidate) : nullptr);
+  for (size_t k = 0; drop && k < t_thinned.size(); k++) {
+    const realtype *y_k = y_thinned.row(k);
+    drop = HermiteWithinTolerance(
+      i_candidate - 1, i_new, t_thinned[k], y_k,
+      sensitivity ? y_k + number_of_states : nullptr);
+  }
+
+  if (!drop) {
+    // The candidate (if any) is kept and becomes the new anchor
+    t_thinned.clear();
+    y_thinned.resize(0);
+    i_thin_candidate = thinnable ? i_new : -1;
+    return;
+  }
+
+  // Remember the dropped step, so that later interpolants are also checked
+  // against it, and move the newest step into its row
+  t_thinned.push_back(*t.row(i_candidate));
+  y_thinned.resize(t_thinned.size());
+  realtype *y_dropped = y_thinned.row(t_thinned.size() - 1);
+  std::copy_n(y.row(i_candidate), number_of_states, y_dropped);
+  if (sensitivity) {
+    std::copy_n(
+      yS.row(i_candidate), number_of_parameters * number_of_states,
+      y_dropped + number_of_states);
+  }
+  for (SolutionArena *arena : {&t, &y, &yS, &yp, &ypS}) {
+    arena->copy_row(i_new, i_candidate);
+    arena->resize(arena->rows() - 1);
+  }
+  i_save--;
+
+  if (thinnable) {
+    i_thin_candidate = i_candidate;
+  } else {
+    t_thinned.clear();
+    y_thinned.resize(0);
+    i_thin_candidate = -1;
+  }
+}
+
+template <class ExprSet>
+bool IDAKLUSolverOpenMP<ExprSet>::HermiteWithinTolerance(
+  int i0,
+  int i1,
+  realtype t_c,
+  const realtype *y_c,
+  const realtype *yS_c
+) {
+  realtype const t0 = *t.row(i0);
+  realtype const h = *t.row(i1) - t0;
+  realtype const s = (t_c - t0) / h;
+  realtype const s2 = s * s;
+  realtype const s3 = s2 * s;
+  realtype const h00 = 2 * s3 - 3 * s2 + 1;
+  realtype const h10 = (s3 - 2 * s2 + s) * h;
+  realtype const h01 = -2 * s3 + 3 * s2;
+  realtype const h11 = (s3 - s2) * h;
+
+  const realtype *y0 = y.row(i0);
+  const realtype *y1 = y.row(i1);
+  const realtype *yp0 = yp.row(i0);
+  const realtype *yp1 = yp.row(i1);
+  wait_for_device(avtol);
+  const realtype *atol = host_data(avtol);
+  realtype const tol = solver_opts.output_thinning_tolerance;
+  for (int i = 0; i < number_of_states; i++) {
+    realtype const y_h = h00 * y0[i] + h10 * yp0[i] + h01 * y1[i] + h11 * yp1[i];
+    if (std::abs(y_h - y_c[i]) > tol * (atol[i] + rtol * std::abs(y_c[i]))) {
+      return false;
+    }
+  }
+  if (yS_c == nullptr) {
+    return true;
+  }
+
+  // The sensitivities are interpolated from ypS in the same way, and are
+  // weighted as IDAS weights them (with unit parameter scales)
+  const realtype *yS0 = yS.row(i0);
+  const realtype *yS1 = yS.row(i1);
+  const realtype *ypS0 = ypS.row(i0);
+  const realtype *ypS1 = ypS.row(i1);
+  for (int k = 0; k < number_of_parameters * number_of_states; k++) {
+    int const i = k % number_of_states;
+    realtype const yS_h = h00 * yS0[k] + h10 * ypS0[k] + h01 * yS1[k] + h11 * ypS1[k];
+    if (std::abs(yS_h - yS_c[k]) > tol * (atol[i] + rtol * std::abs(yS_c[k]))) {
+      return false;
+    }
+  }
+  return true;
+}
+
 template <class ExprSet>
 void IDAKLUSolverOpenMP<ExprSet>::SetStep(
   realtype &tval,
@@ -725,9 +1329,19 @@ void IDAKLUSolverOpenMP<ExprSet>::SetStep(
 ) {
   // Set adaptive step results for y and yS
   DEBUG("IDAKLUSolver::SetStep");
+  TRACE_SPAN("SetStep");
+
+  // The interpolated states may still be computed on the device
+  wait_for_device(yy);
+
+  if (reduce_output) {
+    // Only the reduced outputs are stored
+    SetStepReduced(tval, y_val, yS_val, i_save);
+    return;
+  }
 
   // Time
-  t[i_save] = tval;
+  *t.row(i_save) = tval;
 
   if (save_outputs_only) {
     SetStepOutput(tval, y_val, yS_val, i_save);
@@ -757,6 +1371,7 @@ void IDAKLUSolverOpenMP<ExprSet>::SetStepInterp(
   vector<realtype *> const &ypS_val,
   int &i_save
   ) {
+  TRACE_SPAN("SetStepInterp");
   // Save the state at the requested time
   DEBUG("IDAKLUSolver::SetStepInterp");
 
@@ -767,7 +1382,11 @@ void IDAKLUSolverOpenMP<ExprSet>::SetStepInterp(
     }
 
     // Memory is already allocated for the interpolated values
-    SetStep(t_interp_next, y_val, yp_val, yS_val, ypS_val, i_save);
+    if (defer_output) {
+      SetStepDeferred(t_interp_next, y_val, yS_val, i_save);
+    } else {
+      SetStep(t_interp_next, y_val, yp_val, yS_val, ypS_val, i_save);
+    }
 
     i_interp++;
     if (i_interp == (t_interp.size())) {
@@ -778,6 +1397,76 @@ void IDAKLUSolverOpenMP<ExprSet>::SetStepInterp(
   }
 }
 
+template <class ExprSet>
+void IDAKLUSolverOpenMP<ExprSet>::SetStepDeferred(
+  realtype &t_val,
+  realtype *y_val,
+  vector<realtype *> const &yS_val,
+  int &i_save
+) {
+  DEBUG("IDAKLUSolver::SetStepDeferred");
+  TRACE_SPAN("SetStepDeferred");
+
+  // Reserve the output row; it is filled in by SetDeferredOutputs
+  *t.row(i_save) = t_val;
+  wait_for_device(yy);
+
+  auto const k = i_save_deferred.size();
+  std::memcpy(y_deferred.row(k), y_val, number_of_states * sizeof(realtype));
+  if (sensitivity) {
+    realtype *yS_back = yS_deferred.row(k);
+    for (size_t j = 0; j < number_of_parameters; ++j) {
+      std::memcpy(yS_back + j * number_of_states, yS_val[j], number_of_states * sizeof(realtype));
+    }
+  }
+  i_save_deferred.push_back(i_save);
+
+  i_save++;
+}
+
+template <class ExprSet>
+void IDAKLUSolverOpenMP<ExprSet>::SetDeferredOutputs() {
+  DEBUG("IDAKLUSolver::SetDeferredOutputs");
+  TRACE_SPAN("SetDeferredOutputs");
+  PhaseTimer timer(&SolveStats::output_time);
+
+  auto const n_deferred = i_save_deferred.size();
+
+  if (functions->var_fused != nullptr) {
+    for (size_t k = 0; k < n_deferred; k++) {
+      realtype t_val = *t.row(i_save_deferred[k]);
+      ExprSet::evaluate(
+        functions->var_fused, &t_val, y_deferred.row(k), functions->inputs.data(),
+        y.write_row(i_save_deferred[k]));
+      y.commit_row(i_save_deferred[k]);
+    }
+  } else {
+    // Evaluate one variable at all points before moving to the next, so that
+    // each function's workspace stays hot across the batch
+    size_t j = 0;
+    for (auto& var_fcn : functions->var_fcns) {
+      auto const nnz = var_fcn->nnz_out();
+      for (size_t k = 0; k < n_deferred; k++) {
+        realtype t_val = *t.row(i_save_deferred[k]);
+        ExprSet::evaluate(var_fcn, &t_val, y_deferred.row(k), functions->inputs.data(), &res[0]);
+        y.store(i_save_deferred[k], j, &res[0], nnz);
+      }
+      j += nnz;
+    }
+  }
+
+  if (sensitivity) {
+    vector<realtype *> yS_k(number_of_parameters);
+    for (size_t k = 0; k < n_deferred; k++) {
+      realtype t_val = *t.row(i_save_deferred[k]);
+      for (int p = 0; p < number_of_parameters; p++) {
+        yS_k[p] = yS_deferred.row(k) + p * number_of_states;
+      }
+      SetStepOutputSensitivities(t_val, y_deferred.row(k), yS_k, i_save_deferred[k]);
+    }
+  }
+}
+
 template <class ExprSet>
 void IDAKLUSolverOpenMP<ExprSet>::SetStepFull(
   realtype &tval,
@@ -787,12 +1476,10 @@ void IDAKLUSolverOpenMP<ExprSet>::SetStepFull(
 ) {
   // Set adaptive step results for y and yS
   DEBUG("IDAKLUSolver::SetStepFull");
+  TRACE_SPAN("SetStepFull");
 
   // States
-  auto &y_back = y[i_save];
-  for (size_t j = 0; j < number_of_states; ++j) {
-    y_back[j] = y_val[j];
-  }
+  y.store(i_save, 0, y_val, number_of_states);
 
   // Sensitivity
   if (sensitivity) {
@@ -811,11 +1498,7 @@ void IDAKLUSolverOpenMP<ExprSet>::SetStepFullSensitivities(
 
   // Calculate sensitivities for the full yS array
   for (size_t j = 0; j < number_of_parameters; ++j) {
-    auto &yS_back_j = yS[i_save][j];
-    auto &ySval_j = yS_val[j];
-    for (size_t k = 0; k < number_of_states; ++k) {
-      yS_back_j[k] = ySval_j[k];
-    }
+    yS.store(i_save, j * number_of_states, yS_val[j], number_of_states);
   }
 }
 
@@ -827,22 +1510,49 @@ void IDAKLUSolverOpenMP<ExprSet>::SetStepOutput(
     int &i_save
 ) {
   DEBUG("IDAKLUSolver::SetStepOutput");
+  TRACE_SPAN("SetStepOutput");
+  PhaseTimer timer(&SolveStats::output_time);
   // Evaluate functions for each requested variable and store
 
-  size_t j = 0;
-  for (auto& var_fcn : functions->var_fcns) {
-    (*var_fcn)({&tval, y_val, functions->inputs.data()}, {&res[0]});
-    // store in return vector
-    for (size_t jj=0; jj<var_fcn->nnz_out(); jj++) {
-      y[i_save][j++] = res[jj];
+  realtype *y_back = y.write_row(i_save);
+  if (functions->var_fused != nullptr) {
+    // all the variables at once, sharing their common subexpressions
+    ExprSet::evaluate(functions->var_fused, &tval, y_val, functions->inputs.data(), y_back);
+  } else {
+    size_t j = 0;
+    for (auto& var_fcn : functions->var_fcns) {
+      ExprSet::evaluate(var_fcn, &tval, y_val, functions->inputs.data(), &res[0]);
+      // store in return vector
+      for (size_t jj=0; jj<var_fcn->nnz_out(); jj++) {
+        y_back[j++] = res[jj];
+      }
     }
   }
+  y.commit_row(i_save);
   // calculate sensitivities
   if (sensitivity) {
     SetStepOutputSensitivities(tval, y_val, yS_val, i_save);
   }
 }
 
+template <class ExprSet>
+void IDAKLUSolverOpenMP<ExprSet>::SetStepReduced(
+    realtype &tval,
+    realtype *y_val,
+    const vector<realtype*>& yS_val,
+    int &i_save
+) {
+  DEBUG("IDAKLUSolver::SetStepReduced");
+  TRACE_SPAN("SetStepReduced");
+  // Row 0 holds the reduced outputs (at the last saved time) and row 1 is
+  // the scratch row for the outputs at tval
+  int i_scratch = 1;
+  SetStepOutput(tval, y_val, yS_val, i_scratch);
+  reduction.accumulate(tval, y.row(1), sensitivity ? yS.row(1) : nullptr);
+  *t.row(0) = tval;
+  i_save = 1;
+}
+
 template <class ExprSet>
 void IDAKLUSolverOpenMP<ExprSet>::SetStepOutputSensitivities(
   realtype &tval,
@@ -851,32 +1561,46 @@ void IDAKLUSolverOpenMP<ExprSet>::SetStepOutputSensitivities(
     int &i_save
   ) {
   DEBUG("IDAKLUSolver::SetStepOutputSensitivities");
-  // Calculate sensitivities
-  vector<realtype> dens_dvar_dp = vector<realtype>(number_of_parameters, 0);
+  TRACE_SPAN("SetStepOutputSensitivities");
+  // Calculate sensitivities: dvar/dp = (dvar/dy)(dy/dp) + dvar/dp|_y, with
+  // dvar/dy sparse and dy/dp gathered as [state][parameter] so that the
+  // product vectorises over the parameters
+  int const np = number_of_parameters;
+  for (size_t u = 0; u < yS_used_states.size(); u++) {
+    auto const state = yS_used_states[u];
+    realtype *yS_used_u = &yS_used[u * np];
+    for (int p = 0; p < np; p++) {
+      yS_used_u[p] = yS_val[p][state];
+    }
+  }
+
+  realtype *yS_back = yS.write_row(i_save);
   for (size_t dvar_k=0; dvar_k<functions->dvar_dy_fcns.size(); dvar_k++) {
-    // Isolate functions
-    Expression* dvar_dy = functions->dvar_dy_fcns[dvar_k];
-    Expression* dvar_dp = functions->dvar_dp_fcns[dvar_k];
     // Calculate dvar/dy
-    (*dvar_dy)({&tval, y_val, functions->inputs.data()}, {&res_dvar_dy[0]});
-    // Calculate dvar/dp and convert to dense array for indexing
-    (*dvar_dp)({&tval, y_val, functions->inputs.data()}, {&res_dvar_dp[0]});
-    for (int k=0; k<number_of_parameters; k++) {
-      dens_dvar_dp[k]=0;
-    }
-    for (int k=0; k<dvar_dp->nnz_out(); k++) {
-      dens_dvar_dp[dvar_dp->get_row()[k]] = res_dvar_dp[k];
-    }
-    // Calculate sensitivities
-    for (int paramk=0; paramk<number_of_parameters; paramk++) {
-      auto &yS_back_paramk = yS[i_save][paramk];
-      yS_back_paramk[dvar_k] = dens_dvar_dp[paramk];
-
-      for (int spk=0; spk<dvar_dy->nnz_out(); spk++) {
-        yS_back_paramk[dvar_k] += res_dvar_dy[spk] * yS_val[paramk][dvar_dy->get_col()[spk]];
+    ExprSet::evaluate(functions->dvar_dy_fcns[dvar_k], &tval, y_val, functions->inputs.data(), &res_dvar_dy[0]);
+    // Calculate dvar/dp
+    ExprSet::evaluate(functions->dvar_dp_fcns[dvar_k], &tval, y_val, functions->inputs.data(), &res_dvar_dp[0]);
+
+    // Scatter the explicit parameter dependence
+    realtype *yS_back_dvar_k = yS_back + dvar_k * np;
+    std::fill_n(yS_back_dvar_k, np, 0.0);
+    const expr_int *rows = dvar_dp_rows[dvar_k];
+    for (int k = 0; k < dvar_dp_nnz[dvar_k]; k++) {
+      yS_back_dvar_k[rows[k]] = res_dvar_dp[k];
+    }
+
+    // Add the state dependence
+    const auto &index = dvar_dy_used_index[dvar_k];
+    for (size_t spk = 0; spk < index.size(); spk++) {
+      realtype const a = res_dvar_dy[spk];
+      const realtype *yS_used_spk = &yS_used[index[spk] * np];
+      #pragma omp simd
+      for (int p = 0; p < np; p++) {
+        yS_back_dvar_k[p] += a * yS_used_spk[p];
       }
     }
   }
+  yS.commit_row(i_save);
 }
 
 template <class ExprSet>
@@ -888,14 +1612,12 @@ void IDAKLUSolverOpenMP<ExprSet>::SetStepHermite(
 ) {
   // Set adaptive step results for yp and ypS
   DEBUG("IDAKLUSolver::SetStepHermite");
+  TRACE_SPAN("SetStepHermite");
 
   // States
   CheckErrors(IDAGetDky(ida_mem, tval, 1, yyp));
-  auto &yp_back = yp[i_save];
-    for (size_t j = 0; j < length_of_return_vector; ++j) {
-    yp_back[j] = yp_val[j];
-
-  }
+  wait_for_device(yyp);
+  yp.store(i_save, 0, yp_val, length_of_return_vector);
 
   // Sensitivity
   if (sensitivity) {
@@ -914,25 +1636,54 @@ void IDAKLUSolverOpenMP<ExprSet>::SetStepHermiteSensitivities(
 
   // Calculate sensitivities for the full ypS array
   CheckErrors(IDAGetSensDky(ida_mem, tval, 1, yypS));
+  wait_for_device(yypS[0]);
   for (size_t j = 0; j < number_of_parameters; ++j) {
-    auto &ypS_back_j = ypS[i_save][j];
-    auto &ypSval_j = ypS_val[j];
-    for (size_t k = 0; k < number_of_states; ++k) {
-      ypS_back_j[k] = ypSval_j[k];
-    }
+    ypS.store(i_save, j * number_of_states, ypS_val[j], number_of_states);
   }
 }
 
 template <class ExprSet>
 void IDAKLUSolverOpenMP<ExprSet>::CheckErrors(int const & flag) {
   if (flag < 0) {
+    // Report the cause if a callback failed (see evaluate_blocks)
+    if (!functions->callback_error.empty()) {
+      throw std::runtime_error(functions->callback_error);
+    }
     auto message = std::string("IDA failed with flag ") + std::to_string(flag);
     throw std::runtime_error(message.c_str());
   }
 }
 
+template <class ExprSet>
+void IDAKLUSolverOpenMP<ExprSet>::AccumulateStats() {
+  long int nsteps, nrevals, nlinsetups, netfails, nniters, nncfails, njevals;
+  CheckErrors(IDAGetNumSteps(ida_mem, &nsteps));
+  CheckErrors(IDAGetNumResEvals(ida_mem, &nrevals));
+  CheckErrors(IDAGetNumLinSolvSetups(ida_mem, &nlinsetups));
+  CheckErrors(IDAGetNumErrTestFails(ida_mem, &netfails));
+  CheckErrors(IDAGetNonlinSolvStats(ida_mem, &nniters, &nncfails));
+  CheckErrors(IDAGetNumJacEvals(ida_mem, &njevals));
+  stats.nsteps += nsteps;
+  stats.nrevals += nrevals;
+  stats.nlinsetups += nlinsetups;
+  stats.netfails += netfails;
+  stats.nniters += nniters;
+  stats.nncfails += nncfails;
+  stats.njevals += njevals;
+
+  // The preconditioner counter is never reset, so count from the start
+  // of the solve
+  if (setup_opts.preconditioner == "BBDP") {
+    long int ngevalsBBDP;
+    CheckErrors(IDABBDPrecGetNumGfnEvals(ida_mem, &ngevalsBBDP));
+    stats.ngevalsBBDP = ngevalsBBDP - ngevalsBBDP_start;
+  }
+}
+
 template <class ExprSet>
 void IDAKLUSolverOpenMP<ExprSet>::PrintStats() {
+  // Counters are taken from the solve statistics, which cover every
+  // restart of the integrator, rather than from the last restart only
   long nsteps, nrevals, nlinsetups, netfails;
   int klast, kcur;
   realtype hinused, hlast, hcur, tcur;
@@ -951,27 +1702,21 @@ void IDAKLUSolverOpenMP<ExprSet>::PrintStats() {
     &tcur
   ));
 
-  long nniters, nncfails;
-  CheckErrors(IDAGetNonlinSolvStats(ida_mem, &nniters, &nncfails));
-
-  long int ngevalsBBDP = 0;
-  if (setup_opts.using_iterative_solver) {
-    CheckErrors(IDABBDPrecGetNumGfnEvals(ida_mem, &ngevalsBBDP));
-  }
-
+  // solves may run with the GIL released
+  py::gil_scoped_acquire acquire;
   py::print("Solver Stats:");
-  py::print("\tNumber of steps =", nsteps);
-  py::print("\tNumber of calls to residual function =", nrevals);
+  py::print("\tNumber of steps =", stats.nsteps);
+  py::print("\tNumber of calls to residual function =", stats.nrevals);
   py::print("\tNumber of calls to residual function in preconditioner =",
-            ngevalsBBDP);
-  py::print("\tNumber of linear solver setup calls =", nlinsetups);
-  py::print("\tNumber of error test failures =", netfails);
+            stats.ngevalsBBDP);
+  py::print("\tNumber of linear solver setup calls =", stats.nlinsetups);
+  py::print("\tNumber of error test failures =", stats.netfails);
   py::print("\tMethod order used on last step =", klast);
   py::print("\tMethod order used on next step =", kcur);
   py::print("\tInitial step size =", hinused);
   py::print("\tStep size on last step =", hlast);
   py::print("\tStep size on next step =", hcur);
   py::print("\tCurrent internal time reached =", tcur);
-  py::print("\tNumber of nonlinear iterations performed =", nniters);
-  py::print("\tNumber of nonlinear convergence failures =", nncfails);
+  py::print("\tNumber of nonlinear iterations performed =", stats.nniters);
+  py::print("\tNumber of nonlinear convergence failures =", stats.nncfails);
 }
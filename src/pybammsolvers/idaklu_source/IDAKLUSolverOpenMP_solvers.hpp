@@ -18,6 +18,22 @@ public:
   }
 };
 
+/**
+ * @brief KLU initialization that keeps an existing symbolic factorization
+ *
+ * IDA re-initializes the linear solver after every IDAReInit, which makes
+ * KLU redo its symbolic analysis. The Jacobian sparsity pattern is fixed for
+ * the lifetime of the solver, so only the first analysis is needed; later
+ * setups reuse it and only refactor numerically.
+ */
+inline int SUNLinSolInitialize_KLU_KeepSymbolic(SUNLinearSolver S)
+{
+  if (SUNLinSol_KLUGetSymbolic(S) == NULL) {
+    return SUNLinSolInitialize_KLU(S);
+  }
+  return SUNLS_SUCCESS;
+}
+
 /**
  * @brief IDAKLUSolver KLU implementation with OpenMP class
  */
@@ -29,6 +45,9 @@ public:
   IDAKLUSolverOpenMP_KLU(Args&& ... args) : Base(std::forward<Args>(args) ...)
   {
     Base::LS = SUNLinSol_KLU(Base::yy, Base::J, Base::sunctx);
+    if (Base::setup_opts.keep_symbolic_factorization) {
+      Base::LS->ops->initialize = SUNLinSolInitialize_KLU_KeepSymbolic;
+    }
     Base::Initialize();
   }
 };
@@ -48,6 +67,27 @@ public:
   }
 };
 
+#ifdef CUDA_ENABLE
+/**
+ * @brief IDAKLUSolver batched QR (cuSolverSp) implementation on a CUDA device
+ *
+ * The diagonal blocks of the Jacobian (the members of an ensemble) share a
+ * sparsity pattern and are factorised together on the device.
+ */
+template <class T>
+class IDAKLUSolverOpenMP_cuSolverSp_batchQR : public IDAKLUSolverOpenMP<T> {
+public:
+  using Base = IDAKLUSolverOpenMP<T>;
+  template<typename ... Args>
+  IDAKLUSolverOpenMP_cuSolverSp_batchQR(Args&& ... args) : Base(std::forward<Args>(args) ...)
+  {
+    Base::LS = SUNLinSol_cuSolverSp_batchQR(
+      Base::yy, Base::J, Base::cusolver_handle, Base::sunctx);
+    Base::Initialize();
+  }
+};
+#endif
+
 /**
  * @brief IDAKLUSolver SPBCGS implementation with OpenMP class
  */
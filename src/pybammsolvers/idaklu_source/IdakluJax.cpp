@@ -6,9 +6,11 @@
 #include <pybind11/stl.h>
 #include <pybind11/stl_bind.h>
 
+#include <algorithm>
 #include <vector>
 #include <iostream>
 #include <functional>
+#include <limits>
 
 // Initialise static variable
 std::int64_t IdakluJax::universal_count = 0;
@@ -49,80 +51,313 @@ void IdakluJax::register_callbacks(CallbackEval h_eval, CallbackJvp h_jvp, Callb
   register_callback_vjp(h_vjp);
 }
 
-void IdakluJax::cpu_idaklu_eval(void *out_tuple, const void **in) {
-  // Parse the inputs --- note that these come from jax lowering and are NOT np_array's
-  int k = 1;  // Start indexing at 1 to skip idaklu_jax index
-  const std::int64_t n_t = *reinterpret_cast<const std::int64_t *>(in[k++]);
-  const std::int64_t n_vars = *reinterpret_cast<const std::int64_t *>(in[k++]);
-  const std::int64_t n_inputs = *reinterpret_cast<const std::int64_t *>(in[k++]);
-  const realtype *t = reinterpret_cast<const realtype *>(in[k++]);
-  realtype *inputs = new realtype(n_inputs);
-  for (int i = 0; i < n_inputs; i++)
-    inputs[i] = reinterpret_cast<const realtype *>(in[k++])[0];
-  void *out = reinterpret_cast<realtype *>(out_tuple);
-
-  // Log
-  DEBUG("cpu_idaklu");
-  DEBUG_n(index);
-  DEBUG_n(n_t);
-  DEBUG_n(n_vars);
-  DEBUG_n(n_inputs);
-  DEBUG_v(t, n_t);
-  DEBUG_v(inputs, n_inputs);
-
-  // Acquire GIL (since this function is called as a capsule)
+void IdakluJax::register_solver(
+    IDAKLUSolverGroup *group,
+    np_array t_eval_np,
+    np_array y0_np,
+    np_array yp0_np,
+    std::int64_t number_of_outputs,
+    const casadi::Function *initial_conditions) {
+  // The custom calls cannot raise, so everything that can be checked ahead
+  // of them is checked here
+  if (group->reduces_outputs()) {
+    throw std::invalid_argument(
+      "A solver with output_reductions does not save the outputs at each "
+      "time point, so it cannot be registered");
+  }
+  if (group->get_number_of_outputs() != number_of_outputs) {
+    throw std::invalid_argument(
+      "The solver returns " + std::to_string(group->get_number_of_outputs()) +
+      " outputs, expected " + std::to_string(number_of_outputs));
+  }
+  const auto n_coeffs = group->get_number_of_states() *
+    (1 + group->get_number_of_parameters());
+  if (y0_np.size() != n_coeffs || yp0_np.size() != n_coeffs) {
+    throw std::domain_error(
+      "y0 and yp0 must have " + std::to_string(n_coeffs) + " entries");
+  }
+  if (t_eval_np.size() < 2) {
+    throw std::invalid_argument("t_eval must have at least 2 entries");
+  }
+  const realtype *t_eval = t_eval_np.data();
+  if (!std::is_sorted(t_eval, t_eval + t_eval_np.size()) ||
+      std::adjacent_find(t_eval, t_eval + t_eval_np.size()) != t_eval + t_eval_np.size()) {
+    throw std::invalid_argument("t_eval must be strictly increasing");
+  }
+  if (initial_conditions != nullptr) {
+    const casadi::Function &f = *initial_conditions;
+    if (f.n_in() != 1 || f.n_out() != 2 || !f.sparsity_in(0).is_dense() ||
+        f.nnz_in(0) != group->get_number_of_parameters()) {
+      throw std::invalid_argument(
+        "initial_conditions must take the " +
+        std::to_string(group->get_number_of_parameters()) +
+        " inputs as a single dense argument and return y0 and yp0");
+    }
+    for (casadi_int i = 0; i < 2; i++) {
+      if (!f.sparsity_out(i).is_dense() || f.nnz_out(i) != n_coeffs) {
+        throw std::domain_error(
+          "initial_conditions must return dense y0 and yp0 with " +
+          std::to_string(n_coeffs) + " entries");
+      }
+    }
+  }
+  solver_group = group;
+  native_t_eval.assign(t_eval, t_eval + t_eval_np.size());
+  native_y0.assign(y0_np.data(), y0_np.data() + y0_np.size());
+  native_yp0.assign(yp0_np.data(), yp0_np.data() + yp0_np.size());
+  native_initial_conditions.reset();
+  if (initial_conditions != nullptr) {
+    native_initial_conditions = *initial_conditions;
+  }
+}
+
+namespace {
+
+// Read the scalar inputs of the custom call, which are passed as separate
+// buffers of n_batch entries each, into a [n_batch][n_inputs] array
+std::vector<realtype> read_inputs(
+    const void **in, int &k, std::int64_t n_inputs, std::int64_t n_batch = 1) {
+  std::vector<realtype> inputs(n_batch * n_inputs);
+  for (std::int64_t i = 0; i < n_inputs; i++) {
+    const realtype *input = reinterpret_cast<const realtype *>(in[k++]);
+    for (std::int64_t b = 0; b < n_batch; b++) {
+      inputs[b * n_inputs + i] = input[b];
+    }
+  }
+  return inputs;
+}
+
+constexpr realtype nan = std::numeric_limits<realtype>::quiet_NaN();
+
+// An exception leaving a custom call terminates the process, so a failure
+// (e.g. a python callback that raised) is reported as NaN outputs, as for a
+// failed solve
+template <class F>
+void nan_on_error(realtype *out, std::int64_t n_out, const F &f) {
+  try {
+    f();
+  } catch (const std::exception &e) {
+    DEBUG("custom call failed: " << e.what());
+    std::fill(out, out + n_out, nan);
+  } catch (...) {
+    std::fill(out, out + n_out, nan);
+  }
+}
+
+bool is_valid(const SolutionData &solution, const std::vector<std::int64_t> &rows) {
+  return solution.get_flag() >= 0 &&
+    std::none_of(rows.begin(), rows.end(), [](std::int64_t row) { return row < 0; });
+}
+
+void check_outputs(const SolutionData &solution, std::int64_t n_vars) {
+  if (solution.get_length_of_return_vector() != n_vars) {
+    throw std::domain_error(
+      "The registered solver returns " +
+      std::to_string(solution.get_length_of_return_vector()) +
+      " outputs, expected " + std::to_string(n_vars));
+  }
+}
+
+// out[t][var] = y
+void write_outputs(
+    const SolutionData &solution,
+    const std::vector<std::int64_t> &rows,
+    std::int64_t n_vars,
+    realtype *out) {
+  check_outputs(solution, n_vars);
+  const bool failed = solution.get_flag() < 0;
+  for (std::size_t i = 0; i < rows.size(); i++) {
+    realtype *out_row = out + i * n_vars;
+    if (failed || rows[i] < 0) {
+      std::fill(out_row, out_row + n_vars, std::numeric_limits<realtype>::quiet_NaN());
+    } else {
+      for (std::int64_t v = 0; v < n_vars; v++) {
+        out_row[v] = solution.get_y(rows[i], v);
+      }
+    }
+  }
+}
+
+// out[t][var] = dy/dp . tangent
+void write_jvp(
+    const SolutionData &solution,
+    const std::vector<std::int64_t> &rows,
+    std::int64_t n_vars,
+    std::int64_t n_inputs,
+    const realtype *tangent,
+    realtype *out) {
+  check_outputs(solution, n_vars);
+  const bool failed = solution.get_flag() < 0;
+  for (std::size_t i = 0; i < rows.size(); i++) {
+    for (std::int64_t v = 0; v < n_vars; v++) {
+      realtype y_dot = std::numeric_limits<realtype>::quiet_NaN();
+      if (!failed && rows[i] >= 0) {
+        y_dot = 0.0;
+        for (std::int64_t p = 0; p < n_inputs; p++) {
+          y_dot += solution.get_yS(rows[i], v, p) * tangent[p];
+        }
+      }
+      out[i * n_vars + v] = y_dot;
+    }
+  }
+}
+
+// y_bar . dy/dp[invar]
+realtype contract_vjp(
+    const SolutionData &solution,
+    const std::vector<std::int64_t> &rows,
+    std::int64_t n_y_bar,
+    const realtype *y_bar,
+    std::int64_t invar) {
+  const std::int64_t n_vars = solution.get_length_of_return_vector();
+  if (n_vars * static_cast<std::int64_t>(rows.size()) != n_y_bar) {
+    throw std::domain_error(
+      "y_bar has " + std::to_string(n_y_bar) + " entries, expected " +
+      std::to_string(n_vars * rows.size()));
+  }
+  if (!is_valid(solution, rows)) {
+    return std::numeric_limits<realtype>::quiet_NaN();
+  }
+  realtype sum = 0.0;
+  for (std::size_t i = 0; i < rows.size(); i++) {
+    for (std::int64_t v = 0; v < n_vars; v++) {
+      sum += y_bar[i * n_vars + v] * solution.get_yS(rows[i], v, invar);
+    }
+  }
+  return sum;
+}
+
+}  // namespace
+
+void IdakluJax::solve_native(
+    const realtype *t,
+    std::int64_t n_t,
+    const realtype *inputs,
+    std::int64_t n_inputs,
+    std::int64_t n_batch,
+    const NativeSink &sink) {
+  // Times outside t_eval cannot be saved by the solver
+  if (std::any_of(t, t + n_t, [&](realtype t_k) {
+        return !(t_k >= native_t_eval.front() && t_k <= native_t_eval.back());
+      })) {
+    throw std::invalid_argument("The requested times must lie within t_eval");
+  }
+  SolveBatch batch;
+  batch.set_times(
+    native_t_eval.data(), native_t_eval.data() + native_t_eval.size(),
+    t, t + n_t);
+  // Only the breakpoints and the requested times are saved
+  batch.save_adaptive_steps = false;
+  batch.number_of_groups = n_batch;
+  batch.y0 = native_y0.data();
+  batch.y0_stride = 0;
+  batch.yp0 = native_yp0.data();
+  batch.yp0_stride = 0;
+
+  // Initial conditions that depend on the inputs are evaluated per row
+  std::vector<realtype> y0, yp0;
+  if (native_initial_conditions.has_value()) {
+    const casadi::Function &f = *native_initial_conditions;
+    if (f.nnz_in(0) != n_inputs) {
+      throw std::invalid_argument(
+        "initial_conditions expects " + std::to_string(f.nnz_in(0)) +
+        " inputs, got " + std::to_string(n_inputs));
+    }
+    const std::size_t n_coeffs = native_y0.size();
+    y0.resize(n_batch * n_coeffs);
+    yp0.resize(n_batch * n_coeffs);
+    std::vector<const realtype *> args(f.sz_arg());
+    std::vector<realtype *> results(f.sz_res());
+    std::vector<casadi_int> iw(f.sz_iw());
+    std::vector<realtype> w(f.sz_w());
+    const int mem = f.checkout();
+    for (std::int64_t b = 0; b < n_batch; b++) {
+      args[0] = inputs + b * n_inputs;
+      results[0] = &y0[b * n_coeffs];
+      results[1] = &yp0[b * n_coeffs];
+      f(args.data(), results.data(), iw.data(), w.data(), mem);
+    }
+    f.release(mem);
+    batch.y0 = y0.data();
+    batch.y0_stride = n_coeffs;
+    batch.yp0 = yp0.data();
+    batch.yp0_stride = n_coeffs;
+  }
+  batch.inputs = inputs;
+  batch.inputs_stride = n_inputs;
+
+  solver_group->solve_batch(batch, [&](std::size_t index, SolutionData &solution) {
+    // The saved times are sorted and contain every requested time (up to a
+    // terminating event)
+    const realtype *t_saved = solution.get_t();
+    const realtype *t_saved_end = t_saved + solution.get_number_of_timesteps();
+    std::vector<std::int64_t> rows(n_t);
+    for (std::int64_t k = 0; k < n_t; k++) {
+      const realtype *row = std::lower_bound(t_saved, t_saved_end, t[k]);
+      rows[k] = (row != t_saved_end && *row == t[k]) ? row - t_saved : -1;
+    }
+    // If the sink throws, solve_batch frees the buffers
+    sink(index, solution, rows);
+    solution.free_buffers();
+  });
+}
+
+bool IdakluJax::native_jvp(std::int64_t n_inputs, const realtype *tangent_t, std::int64_t n_t) const {
+  // Time tangents need the time derivative of the outputs, which only the
+  // python callback provides
+  return solver_group != nullptr &&
+    solver_group->get_number_of_parameters() == n_inputs &&
+    std::all_of(tangent_t, tangent_t + n_t, [](realtype dt) { return dt == 0.0; });
+}
+
+bool IdakluJax::native_vjp(std::int64_t n_inputs, std::int64_t invar) const {
+  return solver_group != nullptr &&
+    solver_group->get_number_of_parameters() == n_inputs &&
+    invar >= 0 && invar < n_inputs;
+}
+
+void IdakluJax::python_eval(
+    const realtype *t,
+    std::int64_t n_t,
+    std::int64_t n_vars,
+    const realtype *inputs,
+    std::int64_t n_inputs,
+    realtype *out) {
+  // Acquire GIL (since this function is called as a capsule); the scope also
+  // releases it if the callback raises
   py::gil_scoped_acquire acquire;
-  PyGILState_STATE state = PyGILState_Ensure();
 
   // Convert time vector to an np_array
   py::capsule t_capsule(t, "t_capsule");
   np_array t_np = np_array({n_t}, {sizeof(realtype)}, t, t_capsule);
 
-  // Convert inputs to an np_array
-  py::capsule in_capsule(inputs, "in_capsule");
-  np_array in_np = np_array({n_inputs}, {sizeof(realtype)}, inputs, in_capsule);
+  // Copy inputs to an np_array
+  np_array in_np = np_array(n_inputs, inputs);
 
   // Call solve function in python to obtain an np_array
   np_array out_np = callback_eval(t_np, in_np);
+  if (out_np.size() != n_t * n_vars) {
+    throw std::domain_error("The eval callback returned the wrong number of values");
+  }
   auto out_buf = out_np.request();
   const realtype *out_ptr = reinterpret_cast<realtype *>(out_buf.ptr);
 
   // Arrange into 'out' array
   memcpy(out, out_ptr, n_t * n_vars * sizeof(realtype));
-
-  // Release GIL
-  PyGILState_Release(state);
 }
 
-void IdakluJax::cpu_idaklu_jvp(void *out_tuple, const void **in) {
-  // Parse the inputs --- note that these come from jax lowering and are NOT np_array's
-  int k = 1;  // Start indexing at 1 to skip idaklu_jax index
-  const std::int64_t n_t = *reinterpret_cast<const std::int64_t *>(in[k++]);
-  const std::int64_t n_vars = *reinterpret_cast<const std::int64_t *>(in[k++]);
-  const std::int64_t n_inputs = *reinterpret_cast<const std::int64_t *>(in[k++]);
-  const realtype *primal_t = reinterpret_cast<const realtype *>(in[k++]);
-  realtype *primal_inputs = new realtype(n_inputs);
-  for (int i = 0; i < n_inputs; i++)
-    primal_inputs[i] = reinterpret_cast<const realtype *>(in[k++])[0];
-  const realtype *tangent_t = reinterpret_cast<const realtype *>(in[k++]);
-  realtype *tangent_inputs = new realtype(n_inputs);
-  for (int i = 0; i < n_inputs; i++)
-    tangent_inputs[i] = reinterpret_cast<const realtype *>(in[k++])[0];
-  void *out = reinterpret_cast<realtype *>(out_tuple);
-
-  // Log
-  DEBUG("cpu_idaklu_jvp");
-  DEBUG_n(n_t);
-  DEBUG_n(n_vars);
-  DEBUG_n(n_inputs);
-  DEBUG_v(primal_t, n_t);
-  DEBUG_v(primal_inputs, n_inputs);
-  DEBUG_v(tangent_t, n_t);
-  DEBUG_v(tangent_inputs, n_inputs);
-
-  // Acquire GIL (since this function is called as a capsule)
+void IdakluJax::python_jvp(
+    const realtype *primal_t,
+    std::int64_t n_t,
+    std::int64_t n_vars,
+    const realtype *primal_inputs,
+    const realtype *tangent_t,
+    const realtype *tangent_inputs,
+    std::int64_t n_inputs,
+    realtype *out) {
+  // Acquire GIL (since this function is called as a capsule); the scope also
+  // releases it if the callback raises
   py::gil_scoped_acquire acquire;
-  PyGILState_STATE state = PyGILState_Ensure();
 
   // Form primals time vector as np_array
   py::capsule primal_t_capsule(primal_t, "primal_t_capsule");
@@ -133,14 +368,8 @@ void IdakluJax::cpu_idaklu_jvp(void *out_tuple, const void **in) {
     primal_t_capsule
   );
 
-  // Pack primals as np_array
-  py::capsule primal_inputs_capsule(primal_inputs, "primal_inputs_capsule");
-  np_array primal_inputs_np = np_array(
-    {n_inputs},
-    {sizeof(realtype)},
-    primal_inputs,
-    primal_inputs_capsule
-  );
+  // Copy primals to an np_array
+  np_array primal_inputs_np = np_array(n_inputs, primal_inputs);
 
   // Form tangents time vector as np_array
   py::capsule tangent_t_capsule(tangent_t, "tangent_t_capsule");
@@ -151,59 +380,38 @@ void IdakluJax::cpu_idaklu_jvp(void *out_tuple, const void **in) {
     tangent_t_capsule
   );
 
-  // Pack tangents as np_array
-  py::capsule tangent_inputs_capsule(tangent_inputs, "tangent_inputs_capsule");
-  np_array tangent_inputs_np = np_array(
-    {n_inputs},
-    {sizeof(realtype)},
-    tangent_inputs,
-    tangent_inputs_capsule
-  );
+  // Copy tangents to an np_array
+  np_array tangent_inputs_np = np_array(n_inputs, tangent_inputs);
 
   // Call JVP function in python to obtain an np_array
   np_array y_dot = callback_jvp(
     primal_t_np, primal_inputs_np,
     tangent_t_np, tangent_inputs_np
   );
+  if (y_dot.size() != n_t * n_vars) {
+    throw std::domain_error("The JVP callback returned the wrong number of values");
+  }
   auto buf = y_dot.request();
   const realtype *ptr = reinterpret_cast<realtype *>(buf.ptr);
 
   // Arrange into 'out' array
   memcpy(out, ptr, n_t * n_vars * sizeof(realtype));
-
-  // Release GIL
-  PyGILState_Release(state);
 }
 
-void IdakluJax::cpu_idaklu_vjp(void *out_tuple, const void **in) {
-  int k = 1;  // Start indexing at 1 to skip idaklu_jax index
-  const std::int64_t n_t = *reinterpret_cast<const std::int64_t *>(in[k++]);
-  const std::int64_t n_inputs = *reinterpret_cast<const std::int64_t *>(in[k++]);
-  const std::int64_t n_y_bar0 = *reinterpret_cast<const std::int64_t *>(in[k++]);
-  const std::int64_t n_y_bar1 = *reinterpret_cast<const std::int64_t *>(in[k++]);
+realtype IdakluJax::python_vjp(
+    const realtype *y_bar,
+    std::int64_t n_y_bar0,
+    std::int64_t n_y_bar1,
+    std::int64_t invar,
+    const realtype *t,
+    std::int64_t n_t,
+    const realtype *inputs,
+    std::int64_t n_inputs) {
   const std::int64_t n_y_bar = (n_y_bar1 > 0) ? (n_y_bar0*n_y_bar1) : n_y_bar0;
-  const realtype *y_bar = reinterpret_cast<const realtype *>(in[k++]);
-  const std::int64_t *invar = reinterpret_cast<const std::int64_t *>(in[k++]);
-  const realtype *t = reinterpret_cast<const realtype *>(in[k++]);
-  realtype *inputs = new realtype(n_inputs);
-  for (int i = 0; i < n_inputs; i++)
-    inputs[i] = reinterpret_cast<const realtype *>(in[k++])[0];
-  realtype *out = reinterpret_cast<realtype *>(out_tuple);
 
-  // Log
-  DEBUG("cpu_idaklu_vjp");
-  DEBUG_n(n_t);
-  DEBUG_n(n_inputs);
-  DEBUG_n(n_y_bar0);
-  DEBUG_n(n_y_bar1);
-  DEBUG_v(y_bar, n_y_bar0*n_y_bar1);
-  DEBUG_v(invar, 1);
-  DEBUG_v(t, n_t);
-  DEBUG_v(inputs, n_inputs);
-
-  // Acquire GIL (since this function is called as a capsule)
+  // Acquire GIL (since this function is called as a capsule); the scope also
+  // releases it if the callback raises
   py::gil_scoped_acquire acquire;
-  PyGILState_STATE state = PyGILState_Ensure();
 
   // Convert time vector to an np_array
   py::capsule t_capsule(t, "t_capsule");
@@ -218,21 +426,247 @@ void IdakluJax::cpu_idaklu_vjp(void *out_tuple, const void **in) {
       y_bar_capsule
     );
 
-  // Convert inputs to an np_array
-  py::capsule in_capsule(inputs, "in_capsule");
-  np_array in_np = np_array({n_inputs}, {sizeof(realtype)}, inputs, in_capsule);
+  // Copy inputs to an np_array
+  np_array in_np = np_array(n_inputs, inputs);
 
   // Call VJP function in python to obtain an np_array
-  np_array y_dot = callback_vjp(y_bar_np, n_y_bar0, n_y_bar1, invar[0], t_np, in_np);
+  np_array y_dot = callback_vjp(y_bar_np, n_y_bar0, n_y_bar1, invar, t_np, in_np);
+  if (y_dot.size() < 1) {
+    throw std::domain_error("The VJP callback returned no value");
+  }
   auto buf = y_dot.request();
   const realtype *ptr = reinterpret_cast<realtype *>(buf.ptr);
+  const realtype result = ptr[0];  // output is scalar
+  return result;
+}
 
-  // Arrange output
-  //memcpy(out, ptr, sizeof(realtype));
-  out[0] = ptr[0];  // output is scalar
+void IdakluJax::cpu_idaklu_eval(void *out_tuple, const void **in) {
+  // Parse the inputs --- note that these come from jax lowering and are NOT np_array's
+  int k = 1;  // Start indexing at 1 to skip idaklu_jax index
+  const std::int64_t n_t = *reinterpret_cast<const std::int64_t *>(in[k++]);
+  const std::int64_t n_vars = *reinterpret_cast<const std::int64_t *>(in[k++]);
+  const std::int64_t n_inputs = *reinterpret_cast<const std::int64_t *>(in[k++]);
+  const realtype *t = reinterpret_cast<const realtype *>(in[k++]);
+  const std::vector<realtype> inputs = read_inputs(in, k, n_inputs);
+  realtype *out = reinterpret_cast<realtype *>(out_tuple);
 
-  // Release GIL
-  PyGILState_Release(state);
+  nan_on_error(out, n_t * n_vars, [&] {
+    // Log
+    DEBUG("cpu_idaklu");
+    DEBUG_n(index);
+    DEBUG_n(n_t);
+    DEBUG_n(n_vars);
+    DEBUG_n(n_inputs);
+    DEBUG_v(t, n_t);
+    DEBUG_v(inputs.data(), n_inputs);
+
+    if (solver_group == nullptr) {
+      python_eval(t, n_t, n_vars, inputs.data(), n_inputs, out);
+      return;
+    }
+
+    // Solve directly into the output buffer, without the GIL
+    solve_native(t, n_t, inputs.data(), n_inputs, 1,
+      [&](std::size_t, const SolutionData &solution, const std::vector<std::int64_t> &rows) {
+        write_outputs(solution, rows, n_vars, out);
+      });
+  });
+}
+
+void IdakluJax::cpu_idaklu_jvp(void *out_tuple, const void **in) {
+  // Parse the inputs --- note that these come from jax lowering and are NOT np_array's
+  int k = 1;  // Start indexing at 1 to skip idaklu_jax index
+  const std::int64_t n_t = *reinterpret_cast<const std::int64_t *>(in[k++]);
+  const std::int64_t n_vars = *reinterpret_cast<const std::int64_t *>(in[k++]);
+  const std::int64_t n_inputs = *reinterpret_cast<const std::int64_t *>(in[k++]);
+  const realtype *primal_t = reinterpret_cast<const realtype *>(in[k++]);
+  const std::vector<realtype> primal_inputs = read_inputs(in, k, n_inputs);
+  const realtype *tangent_t = reinterpret_cast<const realtype *>(in[k++]);
+  const std::vector<realtype> tangent_inputs = read_inputs(in, k, n_inputs);
+  realtype *out = reinterpret_cast<realtype *>(out_tuple);
+
+  nan_on_error(out, n_t * n_vars, [&] {
+    // Log
+    DEBUG("cpu_idaklu_jvp");
+    DEBUG_n(n_t);
+    DEBUG_n(n_vars);
+    DEBUG_n(n_inputs);
+    DEBUG_v(primal_t, n_t);
+    DEBUG_v(primal_inputs.data(), n_inputs);
+    DEBUG_v(tangent_t, n_t);
+    DEBUG_v(tangent_inputs.data(), n_inputs);
+
+    if (!native_jvp(n_inputs, tangent_t, n_t)) {
+      python_jvp(
+        primal_t, n_t, n_vars, primal_inputs.data(),
+        tangent_t, tangent_inputs.data(), n_inputs, out);
+      return;
+    }
+
+    solve_native(primal_t, n_t, primal_inputs.data(), n_inputs, 1,
+      [&](std::size_t, const SolutionData &solution, const std::vector<std::int64_t> &rows) {
+        write_jvp(solution, rows, n_vars, n_inputs, tangent_inputs.data(), out);
+      });
+  });
+}
+
+void IdakluJax::cpu_idaklu_vjp(void *out_tuple, const void **in) {
+  int k = 1;  // Start indexing at 1 to skip idaklu_jax index
+  const std::int64_t n_t = *reinterpret_cast<const std::int64_t *>(in[k++]);
+  const std::int64_t n_inputs = *reinterpret_cast<const std::int64_t *>(in[k++]);
+  const std::int64_t n_y_bar0 = *reinterpret_cast<const std::int64_t *>(in[k++]);
+  const std::int64_t n_y_bar1 = *reinterpret_cast<const std::int64_t *>(in[k++]);
+  const std::int64_t n_y_bar = (n_y_bar1 > 0) ? (n_y_bar0*n_y_bar1) : n_y_bar0;
+  const realtype *y_bar = reinterpret_cast<const realtype *>(in[k++]);
+  const std::int64_t *invar = reinterpret_cast<const std::int64_t *>(in[k++]);
+  const realtype *t = reinterpret_cast<const realtype *>(in[k++]);
+  const std::vector<realtype> inputs = read_inputs(in, k, n_inputs);
+  realtype *out = reinterpret_cast<realtype *>(out_tuple);
+
+  nan_on_error(out, 1, [&] {
+    // Log
+    DEBUG("cpu_idaklu_vjp");
+    DEBUG_n(n_t);
+    DEBUG_n(n_inputs);
+    DEBUG_n(n_y_bar0);
+    DEBUG_n(n_y_bar1);
+    DEBUG_v(y_bar, n_y_bar0*n_y_bar1);
+    DEBUG_v(invar, 1);
+    DEBUG_v(t, n_t);
+    DEBUG_v(inputs.data(), n_inputs);
+
+    if (!native_vjp(n_inputs, invar[0])) {
+      out[0] = python_vjp(
+        y_bar, n_y_bar0, n_y_bar1, invar[0], t, n_t, inputs.data(), n_inputs);
+      return;
+    }
+
+    solve_native(t, n_t, inputs.data(), n_inputs, 1,
+      [&](std::size_t, const SolutionData &solution, const std::vector<std::int64_t> &rows) {
+        out[0] = contract_vjp(solution, rows, n_y_bar, y_bar, invar[0]);  // output is scalar
+      });
+  });
+}
+
+void IdakluJax::cpu_idaklu_eval_batch(void *out_tuple, const void **in) {
+  // As cpu_idaklu_eval, with the number of batch elements after the index and
+  // each input a [n_batch] buffer; t is shared by the whole batch
+  int k = 1;  // Start indexing at 1 to skip idaklu_jax index
+  const std::int64_t n_batch = *reinterpret_cast<const std::int64_t *>(in[k++]);
+  const std::int64_t n_t = *reinterpret_cast<const std::int64_t *>(in[k++]);
+  const std::int64_t n_vars = *reinterpret_cast<const std::int64_t *>(in[k++]);
+  const std::int64_t n_inputs = *reinterpret_cast<const std::int64_t *>(in[k++]);
+  const realtype *t = reinterpret_cast<const realtype *>(in[k++]);
+  const std::vector<realtype> inputs = read_inputs(in, k, n_inputs, n_batch);
+  realtype *out = reinterpret_cast<realtype *>(out_tuple);  // [n_batch][n_t][n_vars]
+
+  nan_on_error(out, n_batch * n_t * n_vars, [&] {
+    // Log
+    DEBUG("cpu_idaklu_batch");
+    DEBUG_n(n_batch);
+    DEBUG_n(n_t);
+    DEBUG_n(n_vars);
+    DEBUG_n(n_inputs);
+    DEBUG_v(t, n_t);
+
+    if (solver_group == nullptr) {
+      for (std::int64_t b = 0; b < n_batch; b++) {
+        python_eval(
+          t, n_t, n_vars, inputs.data() + b * n_inputs, n_inputs,
+          out + b * n_t * n_vars);
+      }
+      return;
+    }
+
+    // The batch is spread over the solvers of the group
+    solve_native(t, n_t, inputs.data(), n_inputs, n_batch,
+      [&](std::size_t b, const SolutionData &solution, const std::vector<std::int64_t> &rows) {
+        write_outputs(solution, rows, n_vars, out + b * n_t * n_vars);
+      });
+  });
+}
+
+void IdakluJax::cpu_idaklu_jvp_batch(void *out_tuple, const void **in) {
+  int k = 1;  // Start indexing at 1 to skip idaklu_jax index
+  const std::int64_t n_batch = *reinterpret_cast<const std::int64_t *>(in[k++]);
+  const std::int64_t n_t = *reinterpret_cast<const std::int64_t *>(in[k++]);
+  const std::int64_t n_vars = *reinterpret_cast<const std::int64_t *>(in[k++]);
+  const std::int64_t n_inputs = *reinterpret_cast<const std::int64_t *>(in[k++]);
+  const realtype *primal_t = reinterpret_cast<const realtype *>(in[k++]);
+  const std::vector<realtype> primal_inputs = read_inputs(in, k, n_inputs, n_batch);
+  const realtype *tangent_t = reinterpret_cast<const realtype *>(in[k++]);
+  const std::vector<realtype> tangent_inputs = read_inputs(in, k, n_inputs, n_batch);
+  realtype *out = reinterpret_cast<realtype *>(out_tuple);  // [n_batch][n_t][n_vars]
+
+  nan_on_error(out, n_batch * n_t * n_vars, [&] {
+    // Log
+    DEBUG("cpu_idaklu_jvp_batch");
+    DEBUG_n(n_batch);
+    DEBUG_n(n_t);
+    DEBUG_n(n_vars);
+    DEBUG_n(n_inputs);
+    DEBUG_v(primal_t, n_t);
+    DEBUG_v(tangent_t, n_t);
+
+    if (!native_jvp(n_inputs, tangent_t, n_t)) {
+      for (std::int64_t b = 0; b < n_batch; b++) {
+        python_jvp(
+          primal_t, n_t, n_vars, primal_inputs.data() + b * n_inputs,
+          tangent_t, tangent_inputs.data() + b * n_inputs, n_inputs,
+          out + b * n_t * n_vars);
+      }
+      return;
+    }
+
+    solve_native(primal_t, n_t, primal_inputs.data(), n_inputs, n_batch,
+      [&](std::size_t b, const SolutionData &solution, const std::vector<std::int64_t> &rows) {
+        write_jvp(
+          solution, rows, n_vars, n_inputs, tangent_inputs.data() + b * n_inputs,
+          out + b * n_t * n_vars);
+      });
+  });
+}
+
+void IdakluJax::cpu_idaklu_vjp_batch(void *out_tuple, const void **in) {
+  int k = 1;  // Start indexing at 1 to skip idaklu_jax index
+  const std::int64_t n_batch = *reinterpret_cast<const std::int64_t *>(in[k++]);
+  const std::int64_t n_t = *reinterpret_cast<const std::int64_t *>(in[k++]);
+  const std::int64_t n_inputs = *reinterpret_cast<const std::int64_t *>(in[k++]);
+  // Shape of y_bar for a single batch element; the buffer is [n_batch][...]
+  const std::int64_t n_y_bar0 = *reinterpret_cast<const std::int64_t *>(in[k++]);
+  const std::int64_t n_y_bar1 = *reinterpret_cast<const std::int64_t *>(in[k++]);
+  const std::int64_t n_y_bar = (n_y_bar1 > 0) ? (n_y_bar0*n_y_bar1) : n_y_bar0;
+  const realtype *y_bar = reinterpret_cast<const realtype *>(in[k++]);
+  const std::int64_t *invar = reinterpret_cast<const std::int64_t *>(in[k++]);
+  const realtype *t = reinterpret_cast<const realtype *>(in[k++]);
+  const std::vector<realtype> inputs = read_inputs(in, k, n_inputs, n_batch);
+  realtype *out = reinterpret_cast<realtype *>(out_tuple);  // [n_batch]
+
+  nan_on_error(out, n_batch, [&] {
+    // Log
+    DEBUG("cpu_idaklu_vjp_batch");
+    DEBUG_n(n_batch);
+    DEBUG_n(n_t);
+    DEBUG_n(n_inputs);
+    DEBUG_n(n_y_bar0);
+    DEBUG_n(n_y_bar1);
+    DEBUG_v(invar, 1);
+    DEBUG_v(t, n_t);
+
+    if (!native_vjp(n_inputs, invar[0])) {
+      for (std::int64_t b = 0; b < n_batch; b++) {
+        out[b] = python_vjp(
+          y_bar + b * n_y_bar, n_y_bar0, n_y_bar1, invar[0], t, n_t,
+          inputs.data() + b * n_inputs, n_inputs);
+      }
+      return;
+    }
+
+    solve_native(t, n_t, inputs.data(), n_inputs, n_batch,
+      [&](std::size_t b, const SolutionData &solution, const std::vector<std::int64_t> &rows) {
+        out[b] = contract_vjp(solution, rows, n_y_bar, y_bar + b * n_y_bar, invar[0]);
+      });
+  });
 }
 
 template <typename T>
@@ -255,10 +689,28 @@ void wrap_cpu_idaklu_vjp_f64(void *out_tuple, const void **in) {
   idaklu_jax_instances[index]->cpu_idaklu_vjp(out_tuple, in);
 }
 
+void wrap_cpu_idaklu_eval_batch_f64(void *out_tuple, const void **in) {
+  const std::int64_t index = *reinterpret_cast<const std::int64_t *>(in[0]);
+  idaklu_jax_instances[index]->cpu_idaklu_eval_batch(out_tuple, in);
+}
+
+void wrap_cpu_idaklu_jvp_batch_f64(void *out_tuple, const void **in) {
+  const std::int64_t index = *reinterpret_cast<const std::int64_t *>(in[0]);
+  idaklu_jax_instances[index]->cpu_idaklu_jvp_batch(out_tuple, in);
+}
+
+void wrap_cpu_idaklu_vjp_batch_f64(void *out_tuple, const void **in) {
+  const std::int64_t index = *reinterpret_cast<const std::int64_t *>(in[0]);
+  idaklu_jax_instances[index]->cpu_idaklu_vjp_batch(out_tuple, in);
+}
+
 pybind11::dict Registrations() {
   pybind11::dict dict;
   dict["cpu_idaklu_f64"] = EncapsulateFunction(wrap_cpu_idaklu_eval_f64);
   dict["cpu_idaklu_jvp_f64"] = EncapsulateFunction(wrap_cpu_idaklu_jvp_f64);
   dict["cpu_idaklu_vjp_f64"] = EncapsulateFunction(wrap_cpu_idaklu_vjp_f64);
+  dict["cpu_idaklu_batch_f64"] = EncapsulateFunction(wrap_cpu_idaklu_eval_batch_f64);
+  dict["cpu_idaklu_jvp_batch_f64"] = EncapsulateFunction(wrap_cpu_idaklu_jvp_batch_f64);
+  dict["cpu_idaklu_vjp_batch_f64"] = EncapsulateFunction(wrap_cpu_idaklu_vjp_batch_f64);
   return dict;
 }
@@ -2,6 +2,9 @@
 #define PYBAMM_IDAKLU_JAX_SOLVER_HPP
 
 #include "common.hpp"
+#include "IDAKLUSolverGroup.hpp"
+#include <casadi/core/function.hpp>
+#include <optional>
 
 /**
  * @brief Callback function type for JAX evaluation
@@ -23,9 +26,9 @@ using CallbackVjp = std::function<np_array(np_array, int, int, realtype, np_arra
  *
  * This class provides an interface to the IDAKLU-JAX solver. It is called by the
  * IDAKLUJax class in python and provides the lowering rules for the JAX evaluation,
- * JVP and VJP primitive functions. Each of these make use of the IDAKLU solver via
- * the IDAKLUSolver python class, so this IDAKLUJax class provides a wrapper which
- * redirects calls back to the IDAKLUSolver via python callbacks.
+ * JVP and VJP primitive functions. If a solver group has been registered (see
+ * register_solver) the primitives solve directly from the XLA buffers, without the
+ * GIL; otherwise they redirect calls back to the IDAKLUSolver via python callbacks.
  */
 class IdakluJax {
 private:
@@ -77,6 +80,31 @@ public:
    */
   void register_callbacks(CallbackEval h, CallbackJvp h_jvp, CallbackVjp h_vjp);
 
+  /**
+   * @brief Register a solver group to evaluate the primitives natively
+   *
+   * The group must have been created with the output variables of the JAX
+   * function, and with sensitivities for all of its inputs (in input order)
+   * for the JVP/VJP. `t_eval` holds the integration breakpoints; `y0` and
+   * `yp0` the initial state and sensitivities. If these depend on the
+   * inputs, `initial_conditions` must map the inputs to y0 and yp0 (both
+   * dense, laid out as y0 and yp0 here), and is evaluated for each input
+   * set; otherwise `y0` and `yp0` are used for every input set. The group is
+   * held by reference and must outlive this object.
+   *
+   * The primitives cannot raise: they return NaN for a failed solve, for
+   * times outside t_eval and for any other error. The group must therefore
+   * return `number_of_outputs` values per time point, which is checked here,
+   * and must not reduce its outputs over time (output_reductions).
+   */
+  void register_solver(
+    IDAKLUSolverGroup *group,
+    np_array t_eval_np,
+    np_array y0_np,
+    np_array yp0_np,
+    std::int64_t number_of_outputs,
+    const casadi::Function *initial_conditions = nullptr);
+
   /**
    * @brief JAX evaluation primitive function
    */
@@ -92,10 +120,82 @@ public:
    */
   void cpu_idaklu_vjp(void *out_tuple, const void **in);
 
+  /**
+   * @brief Batched (vmapped) primitive functions
+   *
+   * The operands follow the unbatched primitives, with the batch size after
+   * the instance index and a leading batch axis on the inputs, y_bar and the
+   * outputs. With a registered solver group the batch is solved in parallel
+   * in a single call; otherwise each element goes through the callbacks.
+   */
+  void cpu_idaklu_eval_batch(void *out_tuple, const void **in);
+  void cpu_idaklu_jvp_batch(void *out_tuple, const void **in);
+  void cpu_idaklu_vjp_batch(void *out_tuple, const void **in);
+
   /**
    * @brief Get the instance index
    */
   std::int64_t get_index() { return index; };
+
+private:
+  using NativeSink = std::function<void(
+    std::size_t, const SolutionData &, const std::vector<std::int64_t> &)>;
+
+  /**
+   * @brief Solve each row of `inputs` ([n_batch][n_inputs]) with the registered
+   * group, saving the requested times
+   *
+   * `sink(b, solution, rows)` is called from the solver threads, where rows[k]
+   * is the solution row of t[k], or -1 if the solve did not reach it.
+   */
+  void solve_native(
+    const realtype *t,
+    std::int64_t n_t,
+    const realtype *inputs,
+    std::int64_t n_inputs,
+    std::int64_t n_batch,
+    const NativeSink &sink);
+
+  /**
+   * @brief Whether the JVP / VJP can be evaluated with the registered group
+   */
+  bool native_jvp(std::int64_t n_inputs, const realtype *tangent_t, std::int64_t n_t) const;
+  bool native_vjp(std::int64_t n_inputs, std::int64_t invar) const;
+
+  /**
+   * @brief Evaluate a single element through the python callbacks
+   */
+  void python_eval(
+    const realtype *t,
+    std::int64_t n_t,
+    std::int64_t n_vars,
+    const realtype *inputs,
+    std::int64_t n_inputs,
+    realtype *out);
+  void python_jvp(
+    const realtype *primal_t,
+    std::int64_t n_t,
+    std::int64_t n_vars,
+    const realtype *primal_inputs,
+    const realtype *tangent_t,
+    const realtype *tangent_inputs,
+    std::int64_t n_inputs,
+    realtype *out);
+  realtype python_vjp(
+    const realtype *y_bar,
+    std::int64_t n_y_bar0,
+    std::int64_t n_y_bar1,
+    std::int64_t invar,
+    const realtype *t,
+    std::int64_t n_t,
+    const realtype *inputs,
+    std::int64_t n_inputs);
+
+  IDAKLUSolverGroup *solver_group = nullptr;
+  std::vector<realtype> native_t_eval;
+  std::vector<realtype> native_y0;
+  std::vector<realtype> native_yp0;
+  std::optional<casadi::Function> native_initial_conditions;
 };
 
 /**
@@ -1,4 +1,6 @@
 #include "Options.hpp"
+#include "OutputReduction.hpp"
+#include "SolutionArena.hpp"
 #include <iostream>
 #include <stdexcept>
 #include <cmath>
@@ -6,6 +8,21 @@
 
 using namespace std::string_literals;
 
+namespace {
+
+// Read an optional entry, falling back to a default if it is not provided
+template<typename T>
+T get_option(py::dict &py_opts, const char *key, T default_value)
+{
+    if (py_opts.contains(key))
+    {
+        return py_opts[key].cast<T>();
+    }
+    return default_value;
+}
+
+}  // namespace
+
 SetupOptions::SetupOptions(py::dict &py_opts)
     : jacobian(py_opts["jacobian"].cast<std::string>()),
       preconditioner(py_opts["preconditioner"].cast<std::string>()),
@@ -14,8 +31,28 @@ SetupOptions::SetupOptions(py::dict &py_opts)
       num_threads(py_opts["num_threads"].cast<int>()),
       num_solvers(py_opts["num_solvers"].cast<int>()),
       linear_solver(py_opts["linear_solver"].cast<std::string>()),
-      linsol_max_iterations(py_opts["linsol_max_iterations"].cast<int>())
+      linsol_max_iterations(py_opts["linsol_max_iterations"].cast<int>()),
+      keep_symbolic_factorization(get_option(py_opts, "keep_symbolic_factorization", false)),
+      ensemble_size(get_option(py_opts, "ensemble_size", 1)),
+      adjoint_checkpoint_steps(get_option(py_opts, "adjoint_checkpoint_steps", 100)),
+      thread_placement(get_option(py_opts, "thread_placement", "none"s)),
+      min_states_per_thread(get_option(py_opts, "min_states_per_thread", 0))
 {
+    if (ensemble_size < 1)
+    {
+        throw std::domain_error("ensemble_size must be at least 1");
+    }
+
+    if (adjoint_checkpoint_steps < 1)
+    {
+        throw std::domain_error("adjoint_checkpoint_steps must be at least 1");
+    }
+
+    if (min_states_per_thread < 0)
+    {
+        throw std::domain_error("min_states_per_thread must be non-negative");
+    }
+
     if (num_solvers > num_threads)
     {
         throw std::domain_error(
@@ -57,6 +94,7 @@ SetupOptions::SetupOptions(py::dict &py_opts)
     }
 
     using_iterative_solver = false;
+    using_device_solver = false;
     if (linear_solver == "SUNLinSol_Dense" && (jacobian == "dense" || jacobian == "none"))
     {
     }
@@ -65,6 +103,14 @@ SetupOptions::SetupOptions(py::dict &py_opts)
     }
     else if (linear_solver == "SUNLinSol_cuSolverSp_batchQR" && jacobian == "sparse")
     {
+#ifdef CUDA_ENABLE
+        using_device_solver = true;
+#else
+        throw std::domain_error(
+            "The SUNLinSol_cuSolverSp_batchQR linear solver requires the IDAKLU "
+            "module to be built with PYBAMM_IDAKLU_CUDA=ON"
+        );
+#endif
     }
     else if (linear_solver == "SUNLinSol_Band" && jacobian == "banded")
     {
@@ -122,11 +168,11 @@ SetupOptions::SetupOptions(py::dict &py_opts)
 
     if (using_iterative_solver)
     {
-        if (preconditioner != "none" && preconditioner != "BBDP")
+        if (preconditioner != "none" && preconditioner != "BBDP" && preconditioner != "ILU")
         {
             throw std::domain_error(
                 "Unknown preconditioner \""s + preconditioner +
-                "\", use one of \"BBDP\" or \"none\""s
+                "\", use one of \"BBDP\", \"ILU\" or \"none\""s
             );
         }
     }
@@ -150,6 +196,13 @@ SolverOptions::SolverOptions(py::dict &py_opts)
       nonlinear_convergence_coefficient_ic(RCONST(py_opts["nonlinear_convergence_coefficient_ic"].cast<double>())),
       suppress_algebraic_error(py_opts["suppress_algebraic_error"].cast<sunbooleantype>()),
       hermite_interpolation(py_opts["hermite_interpolation"].cast<sunbooleantype>()),
+      output_thinning_tolerance(get_option(py_opts, "output_thinning_tolerance", 0.0)),
+      defer_interp_output(get_option(py_opts, "defer_interp_output", false)),
+      output_reductions(get_option(py_opts, "output_reductions", std::vector<std::string>())),
+      storage_directory(get_option(py_opts, "storage_directory", std::string())),
+      output_dtype(get_option(py_opts, "output_dtype", "float64"s)),
+      sensitivity_dtype(get_option(py_opts, "sensitivity_dtype", "float64"s)),
+      save_checkpoint(get_option(py_opts, "save_checkpoint", false)),
       // IDA initial conditions calculation
       calc_ic(py_opts["calc_ic"].cast<bool>()),
       init_all_y_ic(py_opts["init_all_y_ic"].cast<bool>()),
@@ -162,4 +215,43 @@ SolverOptions::SolverOptions(py::dict &py_opts)
       linear_solution_scaling(py_opts["linear_solution_scaling"].cast<sunbooleantype>()),
       epsilon_linear_tolerance(RCONST(py_opts["epsilon_linear_tolerance"].cast<double>())),
       increment_factor(RCONST(py_opts["increment_factor"].cast<double>()))
-{}
+{
+    if (output_thinning_tolerance < 0.0)
+    {
+        throw std::domain_error("output_thinning_tolerance must be non-negative");
+    }
+
+    for (const auto &name : output_reductions)
+    {
+        OutputReduction::parse(name);
+    }
+
+    if (storage_type(output_dtype) == StorageType::BFloat16)
+    {
+        throw std::domain_error(
+            "output_dtype must be \"float64\" or \"float32\" (bfloat16 is only "
+            "available for the sensitivities)");
+    }
+    storage_type(sensitivity_dtype);
+    if (output_dtype != "float64" || sensitivity_dtype != "float64")
+    {
+        // These read the saved rows back during the solve
+        if (output_thinning_tolerance > 0.0)
+        {
+            throw std::domain_error(
+                "output_thinning_tolerance requires float64 output_dtype and sensitivity_dtype");
+        }
+        if (!output_reductions.empty())
+        {
+            throw std::domain_error(
+                "output_reductions require float64 output_dtype and sensitivity_dtype");
+        }
+    }
+
+#ifdef _WIN32
+    if (!storage_directory.empty())
+    {
+        throw std::domain_error("storage_directory is not supported on Windows");
+    }
+#endif
+}
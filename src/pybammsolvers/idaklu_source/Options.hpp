@@ -10,6 +10,7 @@ struct SetupOptions {
   bool using_sparse_matrix;
   bool using_banded_matrix;
   bool using_iterative_solver;
+  bool using_device_solver; // states and Jacobian are stored on a CUDA device
   std::string jacobian;
   std::string preconditioner; // spbcg
   int precon_half_bandwidth;
@@ -19,6 +20,11 @@ struct SetupOptions {
   // IDALS linear solver interface
   std::string linear_solver; // klu, lapack, spbcg
   int linsol_max_iterations;
+  bool keep_symbolic_factorization; // reuse the KLU analysis between solves
+  int ensemble_size; // number of inputs integrated together as one stacked system
+  int adjoint_checkpoint_steps; // integration steps between adjoint checkpoints
+  std::string thread_placement; // none, compact or spread (see ThreadPlacement)
+  int min_states_per_thread; // fewest states per vector op thread (0: no limit)
   explicit SetupOptions(py::dict &py_opts);
 };
 
@@ -39,6 +45,13 @@ struct SolverOptions {
   double nonlinear_convergence_coefficient_ic;
   sunbooleantype suppress_algebraic_error;
   bool hermite_interpolation;
+  double output_thinning_tolerance; // drop adaptive steps the Hermite data reconstructs (0 = off)
+  bool defer_interp_output; // evaluate output variables at t_interp after integration
+  std::vector<std::string> output_reductions; // one per output variable, or empty
+  std::string storage_directory; // map the solution storage to files here, if set
+  std::string output_dtype; // stored y and yp: float64 or float32
+  std::string sensitivity_dtype; // stored yS and ypS: float64, float32 or bfloat16
+  bool save_checkpoint; // return the final integrator state for a later resume
   // IDA initial conditions calculation
   bool calc_ic;
   bool init_all_y_ic;
@@ -0,0 +1,121 @@
+#include "OutputReduction.hpp"
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+OutputReduction::Kind OutputReduction::parse(const std::string &name) {
+  if (name == "min") {
+    return Kind::Min;
+  } else if (name == "max") {
+    return Kind::Max;
+  } else if (name == "last") {
+    return Kind::Last;
+  } else if (name == "integral") {
+    return Kind::Integral;
+  } else if (name == "event_time") {
+    return Kind::EventTime;
+  }
+  throw std::domain_error(
+    "Unknown output reduction \"" + name + "\". Should be one of \"min\", "
+    "\"max\", \"last\", \"integral\" or \"event_time\"");
+}
+
+void OutputReduction::reset(std::vector<Kind> kinds, int number_of_parameters) {
+  m_kinds = std::move(kinds);
+  m_np = number_of_parameters;
+  const std::size_t n = m_kinds.size();
+  m_value.resize(n);
+  m_prev.resize(n);
+  m_valueS.resize(n * m_np);
+  m_prevS.resize(n * m_np);
+  m_found.resize(n);
+  clear();
+}
+
+void OutputReduction::clear() {
+  m_started = false;
+}
+
+void OutputReduction::accumulate(realtype t, const realtype *row, const realtype *rowS) {
+  const std::size_t n = m_kinds.size();
+  const int np = rowS != nullptr ? m_np : 0;
+
+  if (!m_started) {
+    for (std::size_t j = 0; j < n; j++) {
+      realtype *S = &m_valueS[j * m_np];
+      switch (m_kinds[j]) {
+        case Kind::Integral:
+          m_value[j] = 0.0;
+          std::fill_n(S, np, 0.0);
+          break;
+        case Kind::EventTime:
+          m_found[j] = row[j] == 0.0;
+          m_value[j] = m_found[j] ? t : std::numeric_limits<realtype>::quiet_NaN();
+          std::fill_n(S, np, 0.0);
+          break;
+        default:
+          m_value[j] = row[j];
+          std::copy_n(rowS + j * np, np, S);
+          break;
+      }
+    }
+  } else {
+    const realtype dt = t - m_t_prev;
+    for (std::size_t j = 0; j < n; j++) {
+      const realtype v = row[j];
+      const realtype v_prev = m_prev[j];
+      const realtype *vS = rowS + j * np;
+      const realtype *vS_prev = &m_prevS[j * m_np];
+      realtype *S = &m_valueS[j * m_np];
+      switch (m_kinds[j]) {
+        case Kind::Min:
+          if (v < m_value[j]) {
+            m_value[j] = v;
+            std::copy_n(vS, np, S);
+          }
+          break;
+        case Kind::Max:
+          if (v > m_value[j]) {
+            m_value[j] = v;
+            std::copy_n(vS, np, S);
+          }
+          break;
+        case Kind::Last:
+          m_value[j] = v;
+          std::copy_n(vS, np, S);
+          break;
+        case Kind::Integral:
+          m_value[j] += 0.5 * dt * (v + v_prev);
+          for (int p = 0; p < np; p++) {
+            S[p] += 0.5 * dt * (vS[p] + vS_prev[p]);
+          }
+          break;
+        case Kind::EventTime:
+          if (!m_found[j] && (v == 0.0 || (v < 0.0) != (v_prev < 0.0))) {
+            // Root of the linear interpolant between the two points
+            const realtype dv = v_prev - v;
+            m_found[j] = true;
+            m_value[j] = m_t_prev + dt * v_prev / dv;
+            for (int p = 0; p < np; p++) {
+              S[p] = dt * (v_prev * vS[p] - v * vS_prev[p]) / (dv * dv);
+            }
+          }
+          break;
+      }
+    }
+  }
+
+  m_started = true;
+  m_t_prev = t;
+  std::copy_n(row, n, m_prev.begin());
+  if (np > 0) {
+    std::copy_n(rowS, n * np, m_prevS.begin());
+  }
+}
+
+void OutputReduction::finalize(realtype *row, realtype *rowS) const {
+  std::copy(m_value.begin(), m_value.end(), row);
+  if (rowS != nullptr) {
+    std::copy(m_valueS.begin(), m_valueS.end(), rowS);
+  }
+}
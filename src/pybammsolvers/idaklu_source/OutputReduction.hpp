@@ -0,0 +1,64 @@
+#ifndef PYBAMM_IDAKLU_OUTPUT_REDUCTION_HPP
+#define PYBAMM_IDAKLU_OUTPUT_REDUCTION_HPP
+
+#include "common.hpp"
+#include <string>
+#include <vector>
+
+/**
+ * @brief Reduces the output variables of a solve to one row while it runs
+ *
+ * Each element of the output row is reduced over the saved time points by
+ * one of
+ *  - "min" / "max": the extreme value,
+ *  - "last": the value at the final saved time,
+ *  - "integral": the trapezoidal time integral,
+ *  - "event_time": the (linearly interpolated) time at which the value first
+ *    changes sign, as an event function would, or NaN if it never does.
+ * The output sensitivities ([element][parameter]) are reduced alongside,
+ * holding the times of the saved points fixed.
+ */
+class OutputReduction
+{
+public:
+  enum class Kind { Min, Max, Last, Integral, EventTime };
+
+  /**
+   * @brief Parse a reduction name (see the class description)
+   */
+  static Kind parse(const std::string &name);
+
+  /**
+   * @brief Set the reduction of each element of the output row, for
+   * `number_of_parameters` sensitivity parameters
+   */
+  void reset(std::vector<Kind> kinds, int number_of_parameters);
+
+  /**
+   * @brief Start a new solve
+   */
+  void clear();
+
+  /**
+   * @brief Fold in the outputs (and sensitivities, or nullptr) at time t
+   */
+  void accumulate(realtype t, const realtype *row, const realtype *rowS);
+
+  /**
+   * @brief Write the reduced outputs (and sensitivities, or nullptr)
+   */
+  void finalize(realtype *row, realtype *rowS) const;
+
+private:
+  std::vector<Kind> m_kinds;
+  int m_np = 0;
+  bool m_started = false;
+  realtype m_t_prev = 0.0;
+  std::vector<realtype> m_value;
+  std::vector<realtype> m_valueS;
+  std::vector<realtype> m_prev;
+  std::vector<realtype> m_prevS;
+  std::vector<char> m_found;  // event_time elements whose crossing was found
+};
+
+#endif // PYBAMM_IDAKLU_OUTPUT_REDUCTION_HPP
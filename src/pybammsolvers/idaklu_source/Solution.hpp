@@ -2,6 +2,8 @@
 #define PYBAMM_IDAKLU_SOLUTION_HPP
 
 #include "common.hpp"
+#include "SolveStats.hpp"
+#include "SolverCheckpoint.hpp"
 
 /**
  * @brief Solution class
@@ -17,8 +19,8 @@ public:
   /**
    * @brief Constructor
    */
-  Solution(int &retval, np_array &t_np, np_array &y_np, np_array &yp_np, np_array &yS_np, np_array &ypS_np, np_array &y_term_np)
-      : flag(retval), t(t_np), y(y_np), yp(yp_np), yS(yS_np), ypS(ypS_np), y_term(y_term_np)
+  Solution(int &retval, np_array &t_np, py::array &y_np, py::array &yp_np, py::array &yS_np, py::array &ypS_np, np_array &y_term_np, const SolveStats &solve_stats, SolverCheckpoint solver_checkpoint = {})
+      : flag(retval), t(t_np), y(y_np), yp(yp_np), yS(yS_np), ypS(ypS_np), y_term(y_term_np), stats(solve_stats), checkpoint(std::move(solver_checkpoint))
   {
   }
 
@@ -29,11 +31,14 @@ public:
 
   int flag;
   np_array t;
-  np_array y;
-  np_array yp;
-  np_array yS;
-  np_array ypS;
+  // float64, unless a reduced precision output_dtype / sensitivity_dtype is set
+  py::array y;
+  py::array yp;
+  py::array yS;
+  py::array ypS;
   np_array y_term;
+  SolveStats stats;
+  SolverCheckpoint checkpoint;
 };
 
 #endif // PYBAMM_IDAKLU_COMMON_HPP
@@ -0,0 +1,302 @@
+#include "SolutionArena.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <system_error>
+#include <unordered_map>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Length in bytes of each released file mapping, by address
+std::mutex &mappings_mutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+std::unordered_map<void *, std::size_t> &mappings() {
+  static std::unordered_map<void *, std::size_t> lengths;
+  return lengths;
+}
+
+// Round to nearest, ties to even, keeping NaNs quiet
+uint16_t to_bfloat16(float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  if ((bits & 0x7fffffffu) > 0x7f800000u) {
+    return static_cast<uint16_t>((bits >> 16) | 0x0040u);
+  }
+  bits += 0x7fffu + ((bits >> 16) & 1u);
+  return static_cast<uint16_t>(bits >> 16);
+}
+
+float from_bfloat16(uint16_t value) {
+  const uint32_t bits = static_cast<uint32_t>(value) << 16;
+  float result;
+  std::memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+#ifndef _WIN32
+[[noreturn]] void throw_file_error(const std::string &what) {
+  throw std::system_error(errno, std::generic_category(), what);
+}
+#endif
+
+}  // namespace
+
+StorageType storage_type(const std::string &dtype) {
+  if (dtype == "float64") {
+    return StorageType::Float64;
+  }
+  if (dtype == "float32") {
+    return StorageType::Float32;
+  }
+  if (dtype == "bfloat16") {
+    return StorageType::BFloat16;
+  }
+  throw std::domain_error(
+    "Unknown storage dtype \"" + dtype +
+    "\". Should be one of \"float64\", \"float32\" or \"bfloat16\"");
+}
+
+std::size_t storage_size(StorageType type) {
+  switch (type) {
+    case StorageType::Float32:
+      return sizeof(float);
+    case StorageType::BFloat16:
+      return sizeof(uint16_t);
+    default:
+      return sizeof(realtype);
+  }
+}
+
+py::dtype storage_dtype(StorageType type) {
+  switch (type) {
+    case StorageType::Float32:
+      return py::dtype::of<float>();
+    case StorageType::BFloat16:
+      return py::dtype::of<uint16_t>();
+    default:
+      return py::dtype::of<realtype>();
+  }
+}
+
+void store_values(const realtype *values, std::size_t n, StorageType type, void *dst) {
+  switch (type) {
+    case StorageType::Float32: {
+      float *out = static_cast<float *>(dst);
+      for (std::size_t i = 0; i < n; i++) {
+        out[i] = static_cast<float>(values[i]);
+      }
+      break;
+    }
+    case StorageType::BFloat16: {
+      uint16_t *out = static_cast<uint16_t *>(dst);
+      for (std::size_t i = 0; i < n; i++) {
+        out[i] = to_bfloat16(static_cast<float>(values[i]));
+      }
+      break;
+    }
+    default:
+      std::memcpy(dst, values, n * sizeof(realtype));
+  }
+}
+
+realtype load_value(const void *data, StorageType type, std::size_t i) {
+  switch (type) {
+    case StorageType::Float32:
+      return static_cast<const float *>(data)[i];
+    case StorageType::BFloat16:
+      return from_bfloat16(static_cast<const uint16_t *>(data)[i]);
+    default:
+      return static_cast<const realtype *>(data)[i];
+  }
+}
+
+SolutionArena::~SolutionArena() {
+  discard();
+}
+
+void SolutionArena::set_file(std::string path) {
+#ifdef _WIN32
+  throw std::domain_error("File-backed solution storage is not supported on Windows");
+#else
+  m_pending_path = std::move(path);
+#endif
+}
+
+void SolutionArena::set_type(StorageType type) {
+  if (m_data != nullptr && storage_size(type) != m_value_size) {
+    // the allocation is counted in values of the old size
+    discard();
+  }
+  m_type = type;
+  m_value_size = storage_size(type);
+}
+
+void SolutionArena::reset(std::size_t stride, std::size_t rows) {
+#ifndef _WIN32
+  if (!m_pending_path.empty()) {
+    discard();
+    m_fd = ::open(m_pending_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (m_fd < 0) {
+      throw_file_error("Cannot create solution file " + m_pending_path);
+    }
+    m_pending_path.clear();
+  }
+#endif
+  m_stride = stride;
+  m_rows = 0;
+  if (m_type != StorageType::Float64) {
+    m_staging.resize(stride);
+  }
+  reserve(std::max(rows, m_rows_hint));
+  m_rows = rows;
+}
+
+void SolutionArena::resize(std::size_t rows) {
+  if (rows * m_stride > m_allocated) {
+    // grow geometrically so that saving adaptive steps is amortised O(1)
+    reserve(std::max(rows, 2 * m_rows));
+  }
+  m_rows = rows;
+}
+
+void SolutionArena::copy_row(std::size_t from, std::size_t to) {
+  std::memmove(
+    m_data + to * m_stride * m_value_size,
+    m_data + from * m_stride * m_value_size,
+    m_stride * m_value_size);
+}
+
+void SolutionArena::reserve(std::size_t rows) {
+  // always hold at least one value so that numpy never sees a null pointer
+  std::size_t const size = std::max<std::size_t>(1, rows * m_stride);
+  if (size <= m_allocated) {
+    return;
+  }
+
+  if (m_fd >= 0) {
+    map_file(size);
+    return;
+  }
+
+  void *data = std::realloc(m_data, size * m_value_size);
+  if (data == nullptr) {
+    throw std::bad_alloc();
+  }
+  m_data = static_cast<unsigned char *>(data);
+  m_allocated = size;
+}
+
+void SolutionArena::map_file(std::size_t size) {
+#ifndef _WIN32
+  // The saved rows live in the file, so the old mapping can simply be
+  // replaced by a larger one
+  if (m_data != nullptr) {
+    ::munmap(m_data, m_allocated * m_value_size);
+    m_data = nullptr;
+    m_allocated = 0;
+  }
+  if (::ftruncate(m_fd, static_cast<off_t>(size * m_value_size)) != 0) {
+    throw_file_error("Cannot extend solution file");
+  }
+  void *data = ::mmap(
+    nullptr, size * m_value_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+  if (data == MAP_FAILED) {
+    throw_file_error("Cannot map solution file");
+  }
+  m_data = static_cast<unsigned char *>(data);
+  m_allocated = size;
+#endif
+}
+
+void SolutionArena::discard() {
+#ifndef _WIN32
+  if (m_fd >= 0) {
+    if (m_data != nullptr) {
+      ::munmap(m_data, m_allocated * m_value_size);
+    }
+    ::close(m_fd);
+    m_fd = -1;
+    m_data = nullptr;
+    m_allocated = 0;
+    return;
+  }
+#endif
+  std::free(m_data);
+  m_data = nullptr;
+  m_allocated = 0;
+}
+
+void *SolutionArena::release() {
+  if (m_data == nullptr) {
+    reserve(0);
+  }
+
+  std::size_t const size = std::max<std::size_t>(1, m_rows * m_stride);
+#ifndef _WIN32
+  if (m_fd >= 0) {
+    // Trim the file to the saved rows; the mapping stays valid once the
+    // file is closed, and is unmapped by free_solution_buffer
+    if (::ftruncate(m_fd, static_cast<off_t>(size * m_value_size)) != 0) {
+      throw_file_error("Cannot truncate solution file");
+    }
+    ::close(m_fd);
+    m_fd = -1;
+    std::lock_guard<std::mutex> lock(mappings_mutex());
+    mappings()[m_data] = m_allocated * m_value_size;
+  } else
+#endif
+  if (size < m_allocated - m_allocated / 4) {
+    // give back any large unused tail from the geometric growth
+    void *data = std::realloc(m_data, size * m_value_size);
+    if (data != nullptr) {
+      m_data = static_cast<unsigned char *>(data);
+    }
+  }
+
+  void *data = m_data;
+  m_rows_hint = m_rows;
+  m_data = nullptr;
+  m_allocated = 0;
+  m_rows = 0;
+  return data;
+}
+
+void free_solution_buffer(void *data) {
+#ifndef _WIN32
+  {
+    std::lock_guard<std::mutex> lock(mappings_mutex());
+    auto mapping = mappings().find(data);
+    if (mapping != mappings().end()) {
+      ::munmap(data, mapping->second);
+      mappings().erase(mapping);
+      return;
+    }
+  }
+#endif
+  std::free(data);
+}
+
+std::string solution_file_prefix(const std::string &directory) {
+  static std::atomic<unsigned long> counter(0);
+#ifdef _WIN32
+  const long pid = 0;
+#else
+  const long pid = static_cast<long>(::getpid());
+#endif
+  return directory + "/idaklu_" + std::to_string(pid) + "_" +
+    std::to_string(counter++);
+}
@@ -0,0 +1,183 @@
+#ifndef PYBAMM_IDAKLU_SOLUTION_ARENA_HPP
+#define PYBAMM_IDAKLU_SOLUTION_ARENA_HPP
+
+#include "common.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Element type of a solution field
+ *
+ * The integration is always in double precision; only the stored values
+ * are rounded. BFloat16 values are returned to numpy as their raw uint16
+ * bits (the upper half of the float32 representation), as numpy has no
+ * bfloat16 dtype.
+ */
+enum class StorageType { Float64, Float32, BFloat16 };
+
+/**
+ * @brief Parse "float64", "float32" or "bfloat16"
+ */
+StorageType storage_type(const std::string &dtype);
+
+/**
+ * @brief Size in bytes of one stored value
+ */
+std::size_t storage_size(StorageType type);
+
+/**
+ * @brief numpy dtype of the stored values
+ */
+py::dtype storage_dtype(StorageType type);
+
+/**
+ * @brief Round n values into `dst`, which holds values of the given type
+ */
+void store_values(const realtype *values, std::size_t n, StorageType type, void *dst);
+
+/**
+ * @brief Value i of `data`, which holds values of the given type
+ */
+realtype load_value(const void *data, StorageType type, std::size_t i);
+
+/**
+ * @brief Contiguous, growable, time-major storage for one solution field
+ *
+ * Each saved time step occupies one row of `stride` values. Rows are stored
+ * back to back in a single heap block that grows geometrically. The block
+ * can be released to a numpy array without copying (it must then be freed
+ * with free_solution_buffer); the row count of the released solution is
+ * remembered so the next solve on the same solver starts with enough
+ * capacity.
+ *
+ * If a file is set (see set_file), the block is instead a shared memory
+ * mapping of that file, so the saved rows are paged out to disk rather
+ * than held in memory, and can be read (as raw row-major values) while
+ * the solve is still running.
+ *
+ * Values are stored as doubles unless another type is set (see set_type),
+ * in which case rows are written through store or write_row / commit_row.
+ */
+class SolutionArena
+{
+public:
+  /**
+   * @brief Default constructor
+   */
+  SolutionArena() = default;
+
+  // no copy constructor (owns a raw buffer)
+  SolutionArena(const SolutionArena &) = delete;
+  SolutionArena &operator=(const SolutionArena &) = delete;
+
+  /**
+   * @brief Destructor
+   */
+  ~SolutionArena();
+
+  /**
+   * @brief Map the storage of the next solution (see reset) to a new file
+   * at `path`, which is left in place when the solution is freed
+   */
+  void set_file(std::string path);
+
+  /**
+   * @brief Store the values of the following solutions as `type`
+   */
+  void set_type(StorageType type);
+
+  /**
+   * @brief Element type of the stored values
+   */
+  StorageType type() const { return m_type; }
+
+  /**
+   * @brief Start a new solution with `rows` rows of `stride` values each
+   */
+  void reset(std::size_t stride, std::size_t rows);
+
+  /**
+   * @brief Change the number of rows, growing the storage if needed
+   */
+  void resize(std::size_t rows);
+
+  /**
+   * @brief Pointer to the start of row i (invalidated by resize)
+   *
+   * Only for double storage.
+   */
+  realtype *row(std::size_t i) {
+    return reinterpret_cast<realtype *>(m_data + i * m_stride * m_value_size);
+  }
+
+  /**
+   * @brief Round n values into row i, from value `offset` on
+   */
+  void store(std::size_t i, std::size_t offset, const realtype *values, std::size_t n) {
+    store_values(values, n, m_type, m_data + (i * m_stride + offset) * m_value_size);
+  }
+
+  /**
+   * @brief Double precision buffer for row i, stored by commit_row(i)
+   *
+   * This is row i itself for double storage, otherwise a staging row.
+   */
+  realtype *write_row(std::size_t i) {
+    return m_type == StorageType::Float64 ? row(i) : m_staging.data();
+  }
+
+  /**
+   * @brief Store the staging row (see write_row) into row i
+   */
+  void commit_row(std::size_t i) {
+    if (m_type != StorageType::Float64) {
+      store(i, 0, m_staging.data(), m_stride);
+    }
+  }
+
+  /**
+   * @brief Overwrite row `to` with row `from`
+   */
+  void copy_row(std::size_t from, std::size_t to);
+
+  /**
+   * @brief Number of rows in use
+   */
+  std::size_t rows() const { return m_rows; }
+
+  /**
+   * @brief Hand ownership of the storage to the caller
+   *
+   * A file is truncated to the rows in use.
+   */
+  void *release();
+
+private:
+  void reserve(std::size_t rows);
+  void map_file(std::size_t size);
+  void discard();
+
+  unsigned char *m_data = nullptr;
+  StorageType m_type = StorageType::Float64;
+  std::size_t m_value_size = sizeof(realtype);
+  std::vector<realtype> m_staging;  // see write_row
+  std::size_t m_stride = 0;
+  std::size_t m_rows = 0;
+  std::size_t m_allocated = 0;  // in values
+  std::size_t m_rows_hint = 0;  // rows used by the last released solution
+  std::string m_pending_path;  // file of the next solution
+  int m_fd = -1;  // file of the current solution, if mapped
+};
+
+/**
+ * @brief Free a buffer released by a SolutionArena (or from std::malloc)
+ */
+void free_solution_buffer(void *data);
+
+/**
+ * @brief A unique path prefix for the files of one solution in `directory`
+ */
+std::string solution_file_prefix(const std::string &directory);
+
+#endif // PYBAMM_IDAKLU_SOLUTION_ARENA_HPP
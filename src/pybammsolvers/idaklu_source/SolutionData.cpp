@@ -1,99 +1,264 @@
 #include "SolutionData.hpp"
+#include "SolutionArena.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <numeric>
 
-Solution SolutionData::generate_solution() {
-  py::capsule free_t_when_done(
-    t_return,
+namespace {
+
+py::capsule free_when_done(void *data) {
+  return py::capsule(
+    data,
     [](void *f) {
-      realtype *vect = reinterpret_cast<realtype *>(f);
-      delete[] vect;
+      free_solution_buffer(f);
     }
   );
+}
 
-  np_array t_ret = np_array(
-    number_of_timesteps,
-    &t_return[0],
-    free_t_when_done
-  );
+realtype *allocate(std::size_t size) {
+  // always hold at least one value so that numpy never sees a null pointer
+  void *data = std::malloc(std::max<std::size_t>(1, size) * sizeof(realtype));
+  if (data == nullptr) {
+    throw std::bad_alloc();
+  }
+  return static_cast<realtype *>(data);
+}
 
-  py::capsule free_y_when_done(
-    y_return,
+// numpy frees the buffer when done with it, or only drops its share of a
+// buffer shared with other solutions
+py::capsule free_when_done(void *data, const std::shared_ptr<void> &owner) {
+  if (!owner) {
+    return free_when_done(data);
+  }
+  return py::capsule(
+    new std::shared_ptr<void>(owner),
     [](void *f) {
-      realtype *vect = reinterpret_cast<realtype *>(f);
-      delete[] vect;
+      delete static_cast<std::shared_ptr<void> *>(f);
     }
   );
+}
 
-  np_array y_ret = np_array(
-    number_of_timesteps * length_of_return_vector,
-    &y_return[0],
-    free_y_when_done
-  );
+// Regroup rows of `segment_lengths` segments of n_members values each, in
+// place, so that the values of each member are contiguous (member after
+// member, then row after row)
+void regroup_members(
+    realtype *data,
+    int number_of_rows,
+    int n_members,
+    const std::vector<int> &segment_lengths) {
+  // Offsets of the segments in a stacked row and in a member row
+  std::vector<std::size_t> stacked_offsets {0};
+  std::vector<std::size_t> member_offsets {0};
+  for (const int length : segment_lengths) {
+    stacked_offsets.push_back(stacked_offsets.back() + n_members * length);
+    member_offsets.push_back(member_offsets.back() + length);
+  }
+  const std::size_t row_length = stacked_offsets.back();
+  const std::size_t member_length = member_offsets.back();
+  const std::size_t size = static_cast<std::size_t>(number_of_rows) * row_length;
 
-  py::capsule free_yp_when_done(
-    yp_return,
-    [](void *f) {
-      realtype *vect = reinterpret_cast<realtype *>(f);
-      delete[] vect;
+  auto destination = [&](std::size_t i) {
+    const std::size_t row = i / row_length;
+    std::size_t offset = i % row_length;
+    std::size_t s = 0;
+    while (offset >= stacked_offsets[s + 1]) {
+      s++;
+    }
+    offset -= stacked_offsets[s];
+    const std::size_t k = offset / segment_lengths[s];
+    const std::size_t j = offset % segment_lengths[s];
+    return (k * number_of_rows + row) * member_length + member_offsets[s] + j;
+  };
+
+  // Follow each cycle of the permutation (one bit of bookkeeping per value)
+  std::vector<bool> moved(size, false);
+  for (std::size_t start = 0; start < size; start++) {
+    if (moved[start]) {
+      continue;
     }
+    realtype value = data[start];
+    std::size_t i = start;
+    do {
+      i = destination(i);
+      std::swap(value, data[i]);
+      moved[i] = true;
+    } while (i != start);
+  }
+}
+
+}  // namespace
+
+Solution SolutionData::generate_solution() {
+  np_array t_ret = np_array(
+    number_of_timesteps,
+    &t_return[0],
+    free_when_done(t_return)
   );
 
-  np_array yp_ret = np_array(
-    (save_hermite ? 1 : 0) * number_of_timesteps * length_of_return_vector,
-    &yp_return[0],
-    free_yp_when_done
+  py::array y_ret = py::array(
+    storage_dtype(output_type),
+    {static_cast<ptrdiff_t>(number_of_timesteps) * length_of_return_vector},
+    {},
+    y_return,
+    free_when_done(y_return, y_owner)
   );
 
-  py::capsule free_yS_when_done(
-    yS_return,
-    [](void *f) {
-      realtype *vect = reinterpret_cast<realtype *>(f);
-      delete[] vect;
-    }
+  py::array yp_ret = py::array(
+    storage_dtype(output_type),
+    {(save_hermite ? 1 : 0) * static_cast<ptrdiff_t>(number_of_timesteps) *
+      length_of_return_vector},
+    {},
+    yp_return,
+    free_when_done(yp_return, yp_owner)
   );
 
-  np_array yS_ret = np_array(
+  // Sensitivities are stored time-major; when returning the full state
+  // vector they are viewed with permuted strides as [parameter][time][state]
+  const auto value_size = static_cast<ptrdiff_t>(storage_size(sensitivity_type));
+  std::vector<ptrdiff_t> sens_strides {
+    arg_sens1 * arg_sens2 * value_size,
+    arg_sens2 * value_size,
+    value_size
+  };
+  if (time_major_sensitivities) {
+    sens_strides = {
+      arg_sens2 * value_size,
+      arg_sens0 * arg_sens2 * value_size,
+      value_size
+    };
+  }
+
+  py::array yS_ret = py::array(
+    storage_dtype(sensitivity_type),
     std::vector<ptrdiff_t> {
       arg_sens0,
       arg_sens1,
       arg_sens2
     },
-    &yS_return[0],
-    free_yS_when_done
-  );
-
-  py::capsule free_ypS_when_done(
-    ypS_return,
-    [](void *f) {
-      realtype *vect = reinterpret_cast<realtype *>(f);
-      delete[] vect;
-    }
+    sens_strides,
+    yS_return,
+    free_when_done(yS_return)
   );
 
-  np_array ypS_ret = np_array(
+  py::array ypS_ret = py::array(
+    storage_dtype(sensitivity_type),
     std::vector<ptrdiff_t> {
       (save_hermite ? 1 : 0) * arg_sens0,
       arg_sens1,
       arg_sens2
     },
-    &ypS_return[0],
-    free_ypS_when_done
+    sens_strides,
+    ypS_return,
+    free_when_done(ypS_return)
   );
 
   // Final state slice, yterm
-  py::capsule free_yterm_when_done(
-    yterm_return,
-    [](void *f) {
-      realtype *vect = reinterpret_cast<realtype *>(f);
-      delete[] vect;
-    }
-  );
-
   np_array y_term = np_array(
     length_of_final_sv_slice,
     &yterm_return[0],
-    free_yterm_when_done
+    free_when_done(yterm_return)
   );
 
   // Store the solution
-  return Solution(flag, t_ret, y_ret, yp_ret, yS_ret, ypS_ret, y_term);
+  return Solution(flag, t_ret, y_ret, yp_ret, yS_ret, ypS_ret, y_term, stats, checkpoint);
+}
+
+void SolutionData::free_buffers() {
+  // A shared y or yp is freed with its last owner
+  for (void *buffer : {static_cast<void *>(t_return), y_owner ? nullptr : y_return,
+                       yp_owner ? nullptr : yp_return, yS_return, ypS_return,
+                       static_cast<void *>(yterm_return)}) {
+    free_solution_buffer(buffer);
+  }
+  t_return = yterm_return = nullptr;
+  y_return = yp_return = yS_return = ypS_return = nullptr;
+  y_owner.reset();
+  yp_owner.reset();
+}
+
+std::vector<SolutionData> SolutionData::split_ensemble(
+    int n_rows,
+    int n_members,
+    const std::vector<int> &segment_lengths) {
+  const int member_length = std::accumulate(
+    segment_lengths.begin(), segment_lengths.end(), 0);
+  const int member_final_sv_slice = length_of_final_sv_slice / n_members;
+  const std::size_t member_size =
+    static_cast<std::size_t>(number_of_timesteps) * member_length;
+
+  // Hand y (and yp) over to owners shared by the members
+  regroup_members(
+    static_cast<realtype *>(y_return), number_of_timesteps, n_members, segment_lengths);
+  if (save_hermite) {
+    regroup_members(
+      static_cast<realtype *>(yp_return), number_of_timesteps, n_members, segment_lengths);
+  }
+  void *y_data = y_return;
+  y_return = nullptr;
+  std::shared_ptr<void> y_shared(y_data, free_solution_buffer);
+  std::shared_ptr<void> yp_shared;
+  if (save_hermite) {
+    void *yp_data = yp_return;
+    yp_return = nullptr;
+    yp_shared.reset(yp_data, free_solution_buffer);
+  }
+
+  std::vector<SolutionData> members;
+  members.reserve(n_rows);
+  try {
+    for (int k = 0; k < n_rows; k++) {
+      members.push_back(SolutionData(
+        flag,
+        number_of_timesteps,
+        member_length,
+        time_major_sensitivities ? 0 : number_of_timesteps,
+        time_major_sensitivities ? number_of_timesteps : member_length,
+        time_major_sensitivities ? member_length : 0,
+        member_final_sv_slice,
+        save_hermite,
+        time_major_sensitivities,
+        nullptr,
+        static_cast<realtype *>(y_data) + k * member_size,
+        nullptr,
+        nullptr,
+        nullptr,
+        nullptr,
+        stats));
+      SolutionData &member = members.back();
+      member.y_owner = y_shared;
+      if (save_hermite) {
+        member.yp_return = static_cast<realtype *>(yp_shared.get()) + k * member_size;
+        member.yp_owner = yp_shared;
+      } else {
+        member.yp_return = allocate(0);
+      }
+      member.yS_return = allocate(0);
+      member.ypS_return = allocate(0);
+      // The times and final states are small, so they are copied
+      member.t_return = allocate(number_of_timesteps);
+      std::copy_n(t_return, number_of_timesteps, member.t_return);
+      member.yterm_return = allocate(member_final_sv_slice);
+      std::copy_n(
+        yterm_return + k * member_final_sv_slice, member_final_sv_slice,
+        member.yterm_return);
+
+      if (checkpoint.valid()) {
+        // The stacked state holds the members back to back
+        const size_t n = checkpoint.y.size() / n_members;
+        SolverCheckpoint member_checkpoint = checkpoint;
+        member_checkpoint.y.assign(
+          checkpoint.y.begin() + k * n, checkpoint.y.begin() + (k + 1) * n);
+        member_checkpoint.yp.assign(
+          checkpoint.yp.begin() + k * n, checkpoint.yp.begin() + (k + 1) * n);
+        member.set_checkpoint(std::move(member_checkpoint));
+      }
+    }
+  } catch (...) {
+    for (auto &member : members) {
+      member.free_buffers();
+    }
+    throw;
+  }
+  return members;
 }
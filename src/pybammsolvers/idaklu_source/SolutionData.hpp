@@ -4,6 +4,9 @@
 
 #include "common.hpp"
 #include "Solution.hpp"
+#include "SolutionArena.hpp"
+#include <memory>
+#include <vector>
 
 /**
  * @brief SolutionData class. Contains all the data needed to create a Solution
@@ -28,12 +31,16 @@ class SolutionData
       int arg_sens2,
       int length_of_final_sv_slice,
       bool save_hermite,
+      bool time_major_sensitivities,
       realtype *t_return,
-      realtype *y_return,
-      realtype *yp_return,
-      realtype *yS_return,
-      realtype *ypS_return,
-      realtype *yterm_return):
+      void *y_return,
+      void *yp_return,
+      void *yS_return,
+      void *ypS_return,
+      realtype *yterm_return,
+      const SolveStats &stats,
+      StorageType output_type = StorageType::Float64,
+      StorageType sensitivity_type = StorageType::Float64):
       flag(flag),
       number_of_timesteps(number_of_timesteps),
       length_of_return_vector(length_of_return_vector),
@@ -42,12 +49,16 @@ class SolutionData
       arg_sens2(arg_sens2),
       length_of_final_sv_slice(length_of_final_sv_slice),
       save_hermite(save_hermite),
+      time_major_sensitivities(time_major_sensitivities),
       t_return(t_return),
       y_return(y_return),
       yp_return(yp_return),
       yS_return(yS_return),
       ypS_return(ypS_return),
-      yterm_return(yterm_return)
+      yterm_return(yterm_return),
+      output_type(output_type),
+      sensitivity_type(sensitivity_type),
+      stats(stats)
     {}
 
 
@@ -58,9 +69,85 @@ class SolutionData
 
     /**
      * @brief Create a solution object from this data
+     *
+     * The buffers (allocated with malloc) are handed to numpy without copying
      */
     Solution generate_solution();
 
+    /**
+     * @brief Free the buffers of a solution that is not handed to numpy
+     */
+    void free_buffers();
+
+    /**
+     * @brief Split the solution of an ensemble of n_members stacked systems
+     * (without sensitivities) into the solutions of its first n_rows members
+     *
+     * Each row of y and yp is made of segments (the output variables, or the
+     * states) of `segment_lengths` values per member, stored member after
+     * member. They are regrouped in place, member after member, and the
+     * members share the buffers (memory-mapped or not), which are freed with
+     * the last of them. This solution keeps only its t and final state
+     * buffers. The final state slice is split evenly between the members.
+     * Ensembles are always stored in double precision.
+     */
+    std::vector<SolutionData> split_ensemble(
+      int n_rows,
+      int n_members,
+      const std::vector<int> &segment_lengths);
+
+    /**
+     * @brief Set the final integrator state, from which a later solve can resume
+     */
+    void set_checkpoint(SolverCheckpoint solver_checkpoint) {
+      checkpoint = std::move(solver_checkpoint);
+    }
+
+    /**
+     * @brief IDA return flag of the solve
+     */
+    int get_flag() const { return flag; }
+
+    /**
+     * @brief Number of saved time points (rows of t, y and yS)
+     */
+    int get_number_of_timesteps() const { return number_of_timesteps; }
+
+    /**
+     * @brief Length of each row of y
+     */
+    int get_length_of_return_vector() const { return length_of_return_vector; }
+
+    /**
+     * @brief Raw saved times, valid until handed over or freed
+     */
+    const realtype *get_t() const { return t_return; }
+
+    /**
+     * @brief Element y[i_var] at row i_time
+     */
+    realtype get_y(int i_time, int i_var) const {
+      return load_value(
+        y_return, output_type,
+        static_cast<size_t>(i_time) * length_of_return_vector + i_var);
+    }
+
+    /**
+     * @brief Sensitivity element dy[i_var]/dp[i_param] at row i_time
+     */
+    realtype get_yS(int i_time, int i_var, int i_param) const {
+      if (time_major_sensitivities) {
+        // [time][parameter][state]
+        return load_value(
+          yS_return, sensitivity_type,
+          (static_cast<size_t>(i_time) * arg_sens0 + i_param) * arg_sens2 + i_var);
+      }
+      // [time][variable][parameter]
+      return load_value(
+        yS_return, sensitivity_type,
+        (static_cast<size_t>(i_time) * arg_sens1 + i_var) * arg_sens2 + i_param);
+    }
+
 private:
 
     int flag;
@@ -71,12 +158,20 @@ private:
     int arg_sens2;
     int length_of_final_sv_slice;
     bool save_hermite;
-    realtype *t_return;
-    realtype *y_return;
-    realtype *yp_return;
-    realtype *yS_return;
-    realtype *ypS_return;
-    realtype *yterm_return;
+    bool time_major_sensitivities;  // yS/ypS stored as [t][p][y], shaped [p][t][y]
+    realtype *t_return = nullptr;
+    void *y_return = nullptr;
+    void *yp_return = nullptr;
+    void *yS_return = nullptr;
+    void *ypS_return = nullptr;
+    realtype *yterm_return = nullptr;
+    // Set if y_return / yp_return point into a buffer shared with other solutions
+    std::shared_ptr<void> y_owner;
+    std::shared_ptr<void> yp_owner;
+    StorageType output_type = StorageType::Float64;  // of y and yp
+    StorageType sensitivity_type = StorageType::Float64;  // of yS and ypS
+    SolveStats stats;
+    SolverCheckpoint checkpoint;
 };
 
 #endif // PYBAMM_IDAKLU_SOLUTION_DATA_HPP
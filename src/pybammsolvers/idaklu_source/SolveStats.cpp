@@ -0,0 +1,107 @@
+#include "SolveStats.hpp"
+#include "Trace.hpp"
+#include <stdexcept>
+
+namespace {
+
+// The solver wrapped by a timed linear solver
+SUNLinearSolver inner(SUNLinearSolver S) {
+  return static_cast<SUNLinearSolver>(S->content);
+}
+
+SUNLinearSolver_Type timed_gettype(SUNLinearSolver S) {
+  return SUNLinSolGetType(inner(S));
+}
+
+SUNLinearSolver_ID timed_getid(SUNLinearSolver S) {
+  return SUNLinSolGetID(inner(S));
+}
+
+int timed_setatimes(SUNLinearSolver S, void *A_data, SUNATimesFn ATimes) {
+  return SUNLinSolSetATimes(inner(S), A_data, ATimes);
+}
+
+int timed_setpreconditioner(
+  SUNLinearSolver S, void *P_data, SUNPSetupFn Pset, SUNPSolveFn Psol) {
+  return SUNLinSolSetPreconditioner(inner(S), P_data, Pset, Psol);
+}
+
+int timed_setscalingvectors(SUNLinearSolver S, N_Vector s1, N_Vector s2) {
+  return SUNLinSolSetScalingVectors(inner(S), s1, s2);
+}
+
+int timed_setzeroguess(SUNLinearSolver S, booleantype onoff) {
+  return SUNLinSolSetZeroGuess(inner(S), onoff);
+}
+
+int timed_initialize(SUNLinearSolver S) {
+  return SUNLinSolInitialize(inner(S));
+}
+
+int timed_setup(SUNLinearSolver S, SUNMatrix A) {
+  PhaseTimer timer(&SolveStats::linear_solve_time);
+  TRACE_SPAN("linear_setup");
+  return SUNLinSolSetup(inner(S), A);
+}
+
+int timed_solve(SUNLinearSolver S, SUNMatrix A, N_Vector x, N_Vector b, realtype tol) {
+  PhaseTimer timer(&SolveStats::linear_solve_time);
+  TRACE_SPAN("linear_solve");
+  return SUNLinSolSolve(inner(S), A, x, b, tol);
+}
+
+int timed_numiters(SUNLinearSolver S) {
+  return SUNLinSolNumIters(inner(S));
+}
+
+realtype timed_resnorm(SUNLinearSolver S) {
+  return SUNLinSolResNorm(inner(S));
+}
+
+N_Vector timed_resid(SUNLinearSolver S) {
+  return SUNLinSolResid(inner(S));
+}
+
+sunindextype timed_lastflag(SUNLinearSolver S) {
+  return SUNLinSolLastFlag(inner(S));
+}
+
+int timed_space(SUNLinearSolver S, long int *lenrwLS, long int *leniwLS) {
+  return SUNLinSolSpace(inner(S), lenrwLS, leniwLS);
+}
+
+// The wrapped solver is owned by the caller and freed separately
+int timed_free(SUNLinearSolver S) {
+  SUNLinSolFreeEmpty(S);
+  return SUNLS_SUCCESS;
+}
+
+}  // namespace
+
+SUNLinearSolver timed_linear_solver(SUNLinearSolver LS, SUNContext sunctx) {
+  SUNLinearSolver S = SUNLinSolNewEmpty(sunctx);
+  if (S == nullptr) {
+    throw std::runtime_error("Failed to allocate the timed linear solver");
+  }
+  S->content = LS;
+
+  // Only provide the operations the wrapped solver has: IDAS checks which
+  // are present (e.g. setatimes for the iterative solvers)
+  const auto *ops = LS->ops;
+  S->ops->gettype = timed_gettype;
+  S->ops->free = timed_free;
+  if (ops->getid != nullptr) S->ops->getid = timed_getid;
+  if (ops->setatimes != nullptr) S->ops->setatimes = timed_setatimes;
+  if (ops->setpreconditioner != nullptr) S->ops->setpreconditioner = timed_setpreconditioner;
+  if (ops->setscalingvectors != nullptr) S->ops->setscalingvectors = timed_setscalingvectors;
+  if (ops->setzeroguess != nullptr) S->ops->setzeroguess = timed_setzeroguess;
+  if (ops->initialize != nullptr) S->ops->initialize = timed_initialize;
+  if (ops->setup != nullptr) S->ops->setup = timed_setup;
+  if (ops->solve != nullptr) S->ops->solve = timed_solve;
+  if (ops->numiters != nullptr) S->ops->numiters = timed_numiters;
+  if (ops->resnorm != nullptr) S->ops->resnorm = timed_resnorm;
+  if (ops->resid != nullptr) S->ops->resid = timed_resid;
+  if (ops->lastflag != nullptr) S->ops->lastflag = timed_lastflag;
+  if (ops->space != nullptr) S->ops->space = timed_space;
+  return S;
+}
@@ -0,0 +1,104 @@
+#ifndef PYBAMM_IDAKLU_SOLVE_STATS_HPP
+#define PYBAMM_IDAKLU_SOLVE_STATS_HPP
+
+#include "common.hpp"
+#include <chrono>
+
+/**
+ * @brief Integrator counters and wall-clock phase timings of a single solve
+ *
+ * Times are in seconds. The phases do not overlap for the direct linear
+ * solvers; for the iterative solvers the linear-solve time includes the
+ * Jacobian-vector products and preconditioner residuals it calls.
+ */
+struct SolveStats
+{
+  // IDA counters, summed over the integrator restarts of the solve
+  long int nsteps = 0;
+  long int nrevals = 0;
+  long int nlinsetups = 0;
+  long int njevals = 0;
+  long int netfails = 0;
+  long int nniters = 0;
+  long int nncfails = 0;
+  long int ngevalsBBDP = 0;
+
+  // Wall-clock time of the whole solve and of its phases
+  double total_time = 0.0;
+  double residual_time = 0.0;
+  double jacobian_time = 0.0;
+  double linear_solve_time = 0.0;
+  double output_time = 0.0;
+  double storage_time = 0.0;
+};
+
+/**
+ * @brief The stats of the solve running on this thread (nullptr if none)
+ *
+ * Sundials calls back into the solver on the thread that called IDASolve, so
+ * the callbacks find the stats here rather than through their user data.
+ */
+inline SolveStats *&active_solve_stats()
+{
+  thread_local SolveStats *stats = nullptr;
+  return stats;
+}
+
+/**
+ * @brief Make `stats` the active stats of this thread for the guard's lifetime
+ */
+class SolveStatsScope
+{
+public:
+  explicit SolveStatsScope(SolveStats &stats) : previous(active_solve_stats()) {
+    active_solve_stats() = &stats;
+  }
+  ~SolveStatsScope() { active_solve_stats() = previous; }
+
+  SolveStatsScope(const SolveStatsScope &) = delete;
+  SolveStatsScope &operator=(const SolveStatsScope &) = delete;
+
+private:
+  SolveStats *previous;
+};
+
+/**
+ * @brief Add the time until destruction to a phase of the active stats
+ */
+class PhaseTimer
+{
+public:
+  using clock = std::chrono::steady_clock;
+
+  explicit PhaseTimer(double SolveStats::*phase)
+    : stats(active_solve_stats()), phase(phase) {
+    if (stats != nullptr) {
+      start = clock::now();
+    }
+  }
+  ~PhaseTimer() {
+    if (stats != nullptr) {
+      stats->*phase += std::chrono::duration<double>(clock::now() - start).count();
+    }
+  }
+
+  PhaseTimer(const PhaseTimer &) = delete;
+  PhaseTimer &operator=(const PhaseTimer &) = delete;
+
+private:
+  SolveStats *stats;
+  double SolveStats::*phase;
+  clock::time_point start;
+};
+
+/**
+ * @brief A linear solver that forwards to `LS`, adding the time of its setup
+ * and solve operations to the linear-solve phase of the active stats
+ *
+ * The wrapper is built through the generic SUNLinearSolver interface
+ * (SUNLinSolNewEmpty) and does not take ownership of `LS`: free it with
+ * SUNLinSolFree before freeing `LS`.
+ */
+SUNLinearSolver timed_linear_solver(SUNLinearSolver LS, SUNContext sunctx);
+
+#endif // PYBAMM_IDAKLU_SOLVE_STATS_HPP
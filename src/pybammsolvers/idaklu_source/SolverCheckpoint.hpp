@@ -0,0 +1,31 @@
+#ifndef PYBAMM_IDAKLU_SOLVER_CHECKPOINT_HPP
+#define PYBAMM_IDAKLU_SOLVER_CHECKPOINT_HPP
+
+#include "common.hpp"
+#include <vector>
+
+/**
+ * @brief The integrator state at the end of a solve, from which a later
+ * solve can resume
+ *
+ * Only filled in if the `save_checkpoint` solver option is set.
+ *
+ * IDAS does not expose its history arrays, so a resumed solve restarts the
+ * BDF method at order 1. It does start from the final (consistent) states
+ * and sensitivities with the last step size, instead of a consistent
+ * initialisation and a step size ramp-up from dt_init.
+ */
+struct SolverCheckpoint
+{
+  realtype t = 0.0;  // time of the checkpoint
+  std::vector<realtype> y;  // states and sensitivities, laid out as a row of y0
+  std::vector<realtype> yp;  // their time derivatives, laid out as a row of yp0
+  realtype step_size = 0.0;  // last step size taken
+
+  /**
+   * @brief False for the checkpoint of a failed solve, or if none was saved
+   */
+  bool valid() const { return !y.empty(); }
+};
+
+#endif // PYBAMM_IDAKLU_SOLVER_CHECKPOINT_HPP
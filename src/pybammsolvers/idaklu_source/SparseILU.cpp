@@ -0,0 +1,122 @@
+#include "SparseILU.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+void SparseILU::analyse(
+    int n,
+    const std::vector<int64_t> &colptrs,
+    const std::vector<int64_t> &rowvals) {
+  if (n < 0 || colptrs.size() != static_cast<std::size_t>(n) + 1 ||
+      rowvals.size() != static_cast<std::size_t>(colptrs[n])) {
+    throw std::invalid_argument("SparseILU: inconsistent CSC pattern");
+  }
+  m_n = n;
+
+  // Transpose the CSC pattern, adding any missing diagonal entries
+  std::vector<char> has_diagonal(n, 0);
+  m_row_ptrs.assign(n + 1, 0);
+  for (int col = 0; col < n; col++) {
+    for (auto k = colptrs[col]; k < colptrs[col + 1]; k++) {
+      if (rowvals[k] < 0 || rowvals[k] >= n) {
+        throw std::invalid_argument("SparseILU: row index out of range");
+      }
+      m_row_ptrs[rowvals[k] + 1]++;
+      if (rowvals[k] == col) {
+        has_diagonal[col] = 1;
+      }
+    }
+  }
+  for (int row = 0; row < n; row++) {
+    m_row_ptrs[row + 1] += m_row_ptrs[row] + (has_diagonal[row] ? 0 : 1);
+  }
+
+  const auto nnz = m_row_ptrs[n];
+  m_col_vals.resize(nnz);
+  m_gather.resize(nnz);
+  m_diagonal.resize(n);
+  std::vector<int64_t> next(m_row_ptrs.begin(), m_row_ptrs.end() - 1);
+  // Columns are visited in order, so each row comes out sorted (a missing
+  // diagonal entry is added when its column is visited)
+  for (int col = 0; col < n; col++) {
+    if (!has_diagonal[col]) {
+      auto const pos = next[col]++;
+      m_col_vals[pos] = col;
+      m_gather[pos] = -1;
+      m_diagonal[col] = pos;
+    }
+    for (auto k = colptrs[col]; k < colptrs[col + 1]; k++) {
+      auto const pos = next[rowvals[k]]++;
+      m_col_vals[pos] = col;
+      m_gather[pos] = k;
+      if (rowvals[k] == col) {
+        m_diagonal[col] = pos;
+      }
+    }
+  }
+
+  m_values.resize(nnz);
+  m_marker.assign(n, -1);
+}
+
+void SparseILU::factorise(const realtype *csc_values) {
+  for (std::size_t pos = 0; pos < m_values.size(); pos++) {
+    m_values[pos] = m_gather[pos] < 0 ? 0.0 : csc_values[m_gather[pos]];
+  }
+
+  realtype const eps = std::numeric_limits<realtype>::epsilon();
+  for (int i = 0; i < m_n; i++) {
+    auto const begin = m_row_ptrs[i];
+    auto const end = m_row_ptrs[i + 1];
+    realtype row_scale = 0.0;
+    for (auto pos = begin; pos < end; pos++) {
+      m_marker[m_col_vals[pos]] = pos;
+      row_scale = std::max(row_scale, std::abs(m_values[pos]));
+    }
+
+    // Eliminate the entries left of the diagonal, dropping any fill-in
+    for (auto pos = begin; pos < m_diagonal[i]; pos++) {
+      auto const k = m_col_vals[pos];
+      realtype const l_ik = m_values[pos] / m_values[m_diagonal[k]];
+      m_values[pos] = l_ik;
+      for (auto q = m_diagonal[k] + 1; q < m_row_ptrs[k + 1]; q++) {
+        auto const target = m_marker[m_col_vals[q]];
+        if (target >= 0) {
+          m_values[target] -= l_ik * m_values[q];
+        }
+      }
+    }
+
+    realtype &pivot = m_values[m_diagonal[i]];
+    if (row_scale == 0.0) {
+      row_scale = 1.0;
+    }
+    if (std::abs(pivot) < eps * row_scale) {
+      pivot = std::copysign(std::sqrt(eps) * row_scale, pivot);
+    }
+
+    for (auto pos = begin; pos < end; pos++) {
+      m_marker[m_col_vals[pos]] = -1;
+    }
+  }
+}
+
+void SparseILU::solve(const realtype *r, realtype *z) const {
+  // L z = r (unit diagonal)
+  for (int i = 0; i < m_n; i++) {
+    realtype sum = r[i];
+    for (auto pos = m_row_ptrs[i]; pos < m_diagonal[i]; pos++) {
+      sum -= m_values[pos] * z[m_col_vals[pos]];
+    }
+    z[i] = sum;
+  }
+  // U z = z
+  for (int i = m_n - 1; i >= 0; i--) {
+    realtype sum = z[i];
+    for (auto pos = m_diagonal[i] + 1; pos < m_row_ptrs[i + 1]; pos++) {
+      sum -= m_values[pos] * z[m_col_vals[pos]];
+    }
+    z[i] = sum / m_values[m_diagonal[i]];
+  }
+}
@@ -0,0 +1,59 @@
+#ifndef PYBAMM_IDAKLU_SPARSE_ILU_HPP
+#define PYBAMM_IDAKLU_SPARSE_ILU_HPP
+
+#include "common.hpp"
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Incomplete LU factorisation, without fill-in (ILU(0)), of a sparse
+ * matrix given in CSC order
+ *
+ * The factors share the pattern of the matrix (plus its diagonal), stored
+ * row by row. The pattern is analysed once; each factorisation only gathers
+ * the new values and eliminates in place. Near-zero pivots (e.g. on
+ * algebraic rows without a diagonal entry) are replaced by a small value
+ * relative to the row, so the factors can always be applied.
+ */
+class SparseILU
+{
+public:
+  /**
+   * @brief Analyse the CSC pattern of an n x n matrix
+   */
+  void analyse(
+    int n,
+    const std::vector<int64_t> &colptrs,
+    const std::vector<int64_t> &rowvals);
+
+  /**
+   * @brief Whether analyse has been called
+   */
+  bool analysed() const { return !m_row_ptrs.empty(); }
+
+  /**
+   * @brief Size of the matrix
+   */
+  int size() const { return m_n; }
+
+  /**
+   * @brief Factorise the matrix with the given CSC values
+   */
+  void factorise(const realtype *csc_values);
+
+  /**
+   * @brief z = (LU)^-1 r (z may alias r)
+   */
+  void solve(const realtype *r, realtype *z) const;
+
+private:
+  int m_n = 0;
+  std::vector<int64_t> m_row_ptrs;
+  std::vector<int64_t> m_col_vals;
+  std::vector<int64_t> m_gather;  // CSR position -> CSC position, or -1 (diagonal)
+  std::vector<int64_t> m_diagonal;  // CSR position of each diagonal entry
+  std::vector<realtype> m_values;  // L (unit diagonal) and U, in the CSR pattern
+  std::vector<int64_t> m_marker;  // scratch: CSR position of each column in a row
+};
+
+#endif // PYBAMM_IDAKLU_SPARSE_ILU_HPP
@@ -0,0 +1,163 @@
+#include "ThreadPlacement.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+#ifdef __linux__
+// Parse a kernel CPU list such as "0-3,8,10-11"
+std::vector<int> parse_cpu_list(const std::string &list) {
+  std::vector<int> cpus;
+  std::stringstream ranges(list);
+  std::string range;
+  while (std::getline(ranges, range, ',')) {
+    if (range.empty() || range == "\n") {
+      continue;
+    }
+    const auto dash = range.find('-');
+    const int first = std::stoi(range.substr(0, dash));
+    const int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+    for (int cpu = first; cpu <= last; cpu++) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+// The allowed CPUs of each NUMA node (a single node if the topology is unknown)
+std::vector<std::vector<int>> numa_nodes(const cpu_set_t &allowed) {
+  std::vector<std::pair<int, std::vector<int>>> nodes;
+  if (DIR *dir = opendir("/sys/devices/system/node")) {
+    while (dirent *entry = readdir(dir)) {
+      int node = 0;
+      if (std::sscanf(entry->d_name, "node%d", &node) != 1) {
+        continue;
+      }
+      std::ifstream file(
+        std::string("/sys/devices/system/node/") + entry->d_name + "/cpulist");
+      std::string list;
+      std::getline(file, list);
+      std::vector<int> cpus;
+      for (const int cpu : parse_cpu_list(list)) {
+        if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+          cpus.push_back(cpu);
+        }
+      }
+      if (!cpus.empty()) {
+        nodes.emplace_back(node, std::move(cpus));
+      }
+    }
+    closedir(dir);
+  }
+  std::sort(nodes.begin(), nodes.end());
+
+  std::vector<std::vector<int>> result;
+  for (auto &node : nodes) {
+    result.push_back(std::move(node.second));
+  }
+  if (result.empty()) {
+    result.emplace_back();
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &allowed)) {
+        result.back().push_back(cpu);
+      }
+    }
+  }
+  return result;
+}
+#endif
+
+}  // namespace
+
+ThreadPlacement::ThreadPlacement(
+    const std::string &policy,
+    int number_of_solvers,
+    int threads_per_solver) :
+  m_threads_per_solver(std::max(1, threads_per_solver)) {
+  if (policy != "none" && policy != "compact" && policy != "spread") {
+    throw std::domain_error(
+      "Unknown thread_placement \"" + policy +
+      "\". Should be one of \"none\", \"compact\" or \"spread\"");
+  }
+#ifdef __linux__
+  if (policy == "none") {
+    return;
+  }
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    return;
+  }
+  const auto nodes = numa_nodes(allowed);
+  const int T = m_threads_per_solver;
+
+  // Next unused CPU of each node
+  std::vector<std::size_t> cursor(nodes.size(), 0);
+  std::size_t node = 0;
+  for (int k = 0; k < number_of_solvers; k++) {
+    if (policy == "spread") {
+      node = k % nodes.size();
+    } else if (cursor[node] + T > nodes[node].size()) {
+      // compact: move on to the next node with room, or start over
+      std::size_t next = node;
+      do {
+        next = (next + 1) % nodes.size();
+      } while (next != node && cursor[next] + T > nodes[next].size());
+      if (next == node) {
+        std::fill(cursor.begin(), cursor.end(), 0);
+        next = 0;
+      }
+      node = next;
+    }
+    // Take T CPUs of the node, sharing them if the node is too small
+    std::vector<int> cpus;
+    for (int i = 0; i < T; i++) {
+      cpus.push_back(nodes[node][cursor[node]++ % nodes[node].size()]);
+    }
+    m_cpus.push_back(std::move(cpus));
+  }
+#endif
+}
+
+ThreadPlacement::Scope::Scope(const ThreadPlacement &placement, int solver) {
+#ifdef __linux__
+  if (!placement.enabled()) {
+    return;
+  }
+  cpu_set_t previous;
+  if (pthread_getaffinity_np(pthread_self(), sizeof(previous), &previous) != 0) {
+    return;
+  }
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  for (const int cpu : placement.m_cpus[solver % placement.m_cpus.size()]) {
+    CPU_SET(cpu, &cpus);
+  }
+  if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+    return;
+  }
+  m_previous.resize(sizeof(previous));
+  std::memcpy(m_previous.data(), &previous, sizeof(previous));
+  m_pinned = true;
+#endif
+}
+
+ThreadPlacement::Scope::~Scope() {
+#ifdef __linux__
+  if (m_pinned) {
+    cpu_set_t previous;
+    std::memcpy(&previous, m_previous.data(), sizeof(previous));
+    pthread_setaffinity_np(pthread_self(), sizeof(previous), &previous);
+  }
+#endif
+}
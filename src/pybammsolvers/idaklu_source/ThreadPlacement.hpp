@@ -0,0 +1,68 @@
+#ifndef PYBAMM_IDAKLU_THREAD_PLACEMENT_HPP
+#define PYBAMM_IDAKLU_THREAD_PLACEMENT_HPP
+
+#include <string>
+#include <vector>
+
+/**
+ * @brief The CPUs on which each solver of a group runs
+ *
+ * Each solver gets a set of `threads_per_solver` CPUs on a single NUMA node
+ * (where the node is large enough), from the CPUs the process may run on.
+ * The policy is one of
+ *  - "none": no pinning,
+ *  - "compact": fill the NUMA nodes one after the other,
+ *  - "spread": deal the solvers out to the NUMA nodes in turn, to balance
+ *    the memory bandwidth.
+ * Pinning is only available on Linux; elsewhere every policy acts as "none".
+ */
+class ThreadPlacement
+{
+public:
+  /**
+   * @brief No pinning
+   */
+  ThreadPlacement() = default;
+
+  ThreadPlacement(
+    const std::string &policy,
+    int number_of_solvers,
+    int threads_per_solver);
+
+  /**
+   * @brief Whether the solvers are pinned
+   */
+  bool enabled() const { return !m_cpus.empty(); }
+
+  /**
+   * @brief Number of OpenMP threads of each solver's vector operations
+   */
+  int threads_per_solver() const { return m_threads_per_solver; }
+
+  /**
+   * @brief Pins the calling thread to the CPUs of a solver while in scope
+   *
+   * Data first written in the scope is allocated on the solver's NUMA node.
+   * The nested vector operation teams started in the scope inherit the
+   * CPU set.
+   */
+  class Scope
+  {
+  public:
+    Scope(const ThreadPlacement &placement, int solver);
+    ~Scope();
+
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+  private:
+    bool m_pinned = false;
+    std::vector<unsigned char> m_previous;  // the cpu_set_t to restore
+  };
+
+private:
+  std::vector<std::vector<int>> m_cpus;  // CPUs of each solver
+  int m_threads_per_solver = 1;
+};
+
+#endif // PYBAMM_IDAKLU_THREAD_PLACEMENT_HPP
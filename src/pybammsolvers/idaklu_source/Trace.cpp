@@ -0,0 +1,157 @@
+#include "Trace.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+struct TraceEvent
+{
+  const char *name;
+  int64_t start_ns;
+  int64_t end_ns;
+  int64_t index;
+};
+
+// Ring buffer written only by its own thread
+struct TraceBuffer
+{
+  TraceBuffer(std::size_t capacity, int thread) : events(capacity), thread(thread) {}
+
+  std::vector<TraceEvent> events;
+  std::atomic<uint64_t> head{0};  // number of spans ever recorded
+  int thread;
+};
+
+struct TraceRegistry
+{
+  std::mutex mutex;
+  std::vector<std::shared_ptr<TraceBuffer>> buffers;
+  std::size_t capacity = 1 << 16;
+  // Bumped to make every thread start a new buffer
+  std::atomic<uint64_t> generation{0};
+  std::atomic<int> next_thread{0};
+};
+
+TraceRegistry &registry() {
+  static TraceRegistry registry;
+  return registry;
+}
+
+const std::chrono::steady_clock::time_point trace_origin = std::chrono::steady_clock::now();
+
+std::shared_ptr<TraceBuffer> new_buffer(int thread) {
+  auto &reg = registry();
+  std::lock_guard<std::mutex> lock(reg.mutex);
+  auto buffer = std::make_shared<TraceBuffer>(reg.capacity, thread);
+  reg.buffers.push_back(buffer);
+  return buffer;
+}
+
+}  // namespace
+
+void set_tracing(bool enabled, std::size_t capacity) {
+  auto &reg = registry();
+  if (enabled) {
+#ifndef TRACE_ENABLE
+    throw std::runtime_error(
+      "idaklu was built without tracing (set PYBAMM_IDAKLU_TRACE=ON to enable it)");
+#endif
+    if (capacity == 0) {
+      throw std::invalid_argument("The trace capacity must be positive");
+    }
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    if (capacity != reg.capacity) {
+      reg.capacity = capacity;
+      reg.generation++;
+    }
+  }
+  tracing_enabled().store(enabled, std::memory_order_relaxed);
+}
+
+void clear_trace() {
+  auto &reg = registry();
+  std::lock_guard<std::mutex> lock(reg.mutex);
+  reg.buffers.clear();
+  reg.generation++;
+}
+
+int64_t trace_clock_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - trace_origin).count();
+}
+
+void record_trace_span(const char *name, int64_t start_ns, int64_t end_ns, int64_t index) {
+  thread_local const int thread = registry().next_thread++;
+  thread_local std::shared_ptr<TraceBuffer> buffer;
+  thread_local uint64_t generation = UINT64_MAX;
+
+  auto const current = registry().generation.load(std::memory_order_acquire);
+  if (generation != current) {
+    buffer = new_buffer(thread);
+    generation = current;
+  }
+
+  auto const i = buffer->head.load(std::memory_order_relaxed);
+  buffer->events[i % buffer->events.size()] = {name, start_ns, end_ns, index};
+  buffer->head.store(i + 1, std::memory_order_release);
+}
+
+std::string trace_json() {
+  auto &reg = registry();
+  std::lock_guard<std::mutex> lock(reg.mutex);
+
+  std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  char entry[256];
+  bool first = true;
+  auto append = [&](int length) {
+    if (!first) {
+      json += ',';
+    }
+    json.append(entry, std::min<std::size_t>(length, sizeof(entry) - 1));
+    first = false;
+  };
+
+  std::set<int> threads;
+  for (const auto &buffer : reg.buffers) {
+    auto const head = buffer->head.load(std::memory_order_acquire);
+    auto const capacity = buffer->events.size();
+    auto const count = std::min<uint64_t>(head, capacity);
+    for (uint64_t k = head - count; k < head; k++) {
+      const TraceEvent &event = buffer->events[k % capacity];
+      // Chrome traces are in microseconds
+      int length = std::snprintf(
+        entry, sizeof(entry),
+        "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+        event.name, buffer->thread, event.start_ns * 1e-3,
+        (event.end_ns - event.start_ns) * 1e-3);
+      if (event.index >= 0 && length < static_cast<int>(sizeof(entry))) {
+        length += std::snprintf(
+          entry + length, sizeof(entry) - length,
+          ",\"args\":{\"index\":%" PRId64 "}", event.index);
+      }
+      if (length < static_cast<int>(sizeof(entry))) {
+        length += std::snprintf(entry + length, sizeof(entry) - length, "}");
+      }
+      append(length);
+    }
+    threads.insert(buffer->thread);
+  }
+
+  for (const int thread : threads) {
+    append(std::snprintf(
+      entry, sizeof(entry),
+      "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+      "\"args\":{\"name\":\"idaklu thread %d\"}}",
+      thread, thread));
+  }
+
+  json += "]}";
+  return json;
+}
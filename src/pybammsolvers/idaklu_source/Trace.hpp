@@ -0,0 +1,102 @@
+#ifndef PYBAMM_IDAKLU_TRACE_HPP
+#define PYBAMM_IDAKLU_TRACE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * Timeline tracing of the solver callbacks and of the solves of a group.
+ *
+ * Each thread records timestamped spans into its own fixed-size ring buffer
+ * (the oldest spans are overwritten once it is full), without locking. The
+ * spans of all threads can be exported in the Chrome trace event format,
+ * which chrome://tracing and Perfetto open directly.
+ *
+ * Tracing is compiled in if TRACE_ENABLE is defined (the
+ * PYBAMM_IDAKLU_TRACE build option); a span then costs a single branch
+ * while tracing is switched off. Otherwise TRACE_SPAN compiles to nothing.
+ */
+
+/**
+ * @brief Whether spans are being recorded
+ */
+inline std::atomic<bool> &tracing_enabled()
+{
+  static std::atomic<bool> enabled(false);
+  return enabled;
+}
+
+/**
+ * @brief Start recording, with room for `capacity` spans per thread, or stop
+ */
+void set_tracing(bool enabled, std::size_t capacity);
+
+/**
+ * @brief Drop all the recorded spans
+ *
+ * Spans being recorded by a running solve may be lost or kept.
+ */
+void clear_trace();
+
+/**
+ * @brief The recorded spans of all threads as a Chrome trace (JSON)
+ *
+ * Should be called while no solve is running, as the ring buffers are read
+ * without locking.
+ */
+std::string trace_json();
+
+/**
+ * @brief Current time on the trace clock, in nanoseconds
+ */
+int64_t trace_clock_ns();
+
+/**
+ * @brief Record a finished span on this thread's ring buffer
+ *
+ * `name` must be a string literal (only the pointer is stored). `index`
+ * (e.g. the input row of a solve) is exported if it is not negative.
+ */
+void record_trace_span(const char *name, int64_t start_ns, int64_t end_ns, int64_t index);
+
+/**
+ * @brief Record the span from construction to destruction, if tracing
+ */
+class TraceSpan
+{
+public:
+  explicit TraceSpan(const char *name, int64_t index = -1)
+    : m_name(tracing_enabled().load(std::memory_order_relaxed) ? name : nullptr),
+      m_index(index) {
+    if (m_name != nullptr) {
+      m_start = trace_clock_ns();
+    }
+  }
+  ~TraceSpan() {
+    if (m_name != nullptr) {
+      record_trace_span(m_name, m_start, trace_clock_ns(), m_index);
+    }
+  }
+
+  TraceSpan(const TraceSpan &) = delete;
+  TraceSpan &operator=(const TraceSpan &) = delete;
+
+private:
+  const char *m_name;
+  int64_t m_index;
+  int64_t m_start = 0;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#ifdef TRACE_ENABLE
+  // Trace the rest of the enclosing scope as a span called `name`
+  #define TRACE_SPAN(...) TraceSpan TRACE_CONCAT(trace_span_, __LINE__)(__VA_ARGS__)
+#else
+  #define TRACE_SPAN(...)
+#endif
+
+#endif // PYBAMM_IDAKLU_TRACE_HPP
@@ -1,4 +1,7 @@
 #include "common.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
 
 std::vector<realtype> numpy2realtype(const np_array& input_np) {
   std::vector<realtype> output(input_np.request().size);
@@ -17,3 +20,30 @@ std::vector<realtype> makeSortedUnique(const np_array& input_np) {
     const auto input_vec = numpy2realtype(input_np);
     return makeSortedUnique(input_vec.begin(), input_vec.end());
 }
+
+uint64_t fnv1a(const std::string& str, uint64_t hash) {
+  for (unsigned char c : str) {
+    hash ^= c;
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+std::filesystem::path cache_dir(const std::string& subdir) {
+  std::string env = "PYBAMM_" + subdir + "_CACHE_DIR";
+  std::transform(env.begin(), env.end(), env.begin(),
+    [](unsigned char c) { return std::toupper(c); });
+  const char *dir = std::getenv(env.c_str());
+  if (dir != NULL) {
+    return std::filesystem::path(dir);
+  }
+  const char *xdg = std::getenv("XDG_CACHE_HOME");
+  if (xdg != NULL && xdg[0] != '\0') {
+    return std::filesystem::path(xdg) / "pybammsolvers" / subdir;
+  }
+  const char *home = std::getenv("HOME");
+  if (home != NULL && home[0] != '\0') {
+    return std::filesystem::path(home) / ".cache" / "pybammsolvers" / subdir;
+  }
+  return std::filesystem::path();
+}
@@ -1,7 +1,10 @@
 #ifndef PYBAMM_IDAKLU_COMMON_HPP
 #define PYBAMM_IDAKLU_COMMON_HPP
 
+#include <cstdint>
+#include <filesystem>
 #include <iostream>
+#include <string>
 
 #include <idas/idas.h>                 /* prototypes for IDAS fcts., consts.    */
 #include <idas/idas_bbdpre.h>         /* access to IDABBDPRE preconditioner          */
@@ -27,6 +30,13 @@
 #include <sunmatrix/sunmatrix_sparse.h> /* access to sparse SUNMatrix           */
 #include <sunmatrix/sunmatrix_dense.h> /* access to dense SUNMatrix           */
 
+#ifdef CUDA_ENABLE
+  #include <cuda_runtime.h>
+  #include <nvector/nvector_cuda.h>  /* access to CUDA N_Vector            */
+  #include <sunmatrix/sunmatrix_cusparse.h>  /* access to cuSPARSE SUNMatrix */
+  #include <sunlinsol/sunlinsol_cusolversp_batchqr.h>  /* batched QR linear solver */
+#endif
+
 #include <pybind11/numpy.h>
 #include <pybind11/stl.h>
 
@@ -76,6 +86,49 @@ void csc_csr(const realtype f[], const T1 c[], const T1 r[], realtype nf[], T2 n
 }
 
 
+/**
+ * @brief Wait for the device to finish working on `v` (no-op for host vectors)
+ *
+ * Device (CUDA) vectors are allocated in managed memory, so that the host
+ * can read and write them directly once the pending kernels are done.
+ */
+inline void wait_for_device(N_Vector v) {
+#ifdef CUDA_ENABLE
+  if (N_VGetVectorID(v) == SUNDIALS_NVEC_CUDA) {
+    cudaDeviceSynchronize();
+  }
+#else
+  (void)v;
+#endif
+}
+
+/**
+ * @brief Host pointer to the data of a serial, OpenMP or device vector
+ *
+ * This does not synchronise: call wait_for_device once before reading a
+ * device vector, e.g. at the start of each residual or linear-solve callback.
+ */
+inline realtype *host_data(N_Vector v) {
+#ifdef CUDA_ENABLE
+  if (N_VGetVectorID(v) == SUNDIALS_NVEC_CUDA) {
+    return N_VGetHostArrayPointer_Cuda(v);
+  }
+#endif
+  return NV_DATA_OMP(v);
+}
+
+/**
+ * @brief Whether `A` is stored on a device (a cuSPARSE matrix)
+ */
+inline bool is_device_matrix(SUNMatrix A) {
+#ifdef CUDA_ENABLE
+  return A != nullptr && SUNMatGetID(A) == SUNMATRIX_CUSPARSE;
+#else
+  (void)A;
+  return false;
+#endif
+}
+
 /**
  * @brief Utility function to convert numpy array to std::vector<realtype>
  */
@@ -106,6 +159,22 @@ std::vector<realtype> makeSortedUnique(const T input_begin, const T input_end) {
 
 std::vector<realtype> makeSortedUnique(const np_array& input_np);
 
+/**
+ * @brief FNV-1a hash, stable across processes (unlike std::hash)
+ *
+ * Pass the result of a previous call as `hash` to continue hashing.
+ */
+uint64_t fnv1a(const std::string& str, uint64_t hash = 14695981039346656037ULL);
+
+/**
+ * @brief On-disk cache location for `subdir` (e.g. "iree")
+ *
+ * $PYBAMM_<SUBDIR>_CACHE_DIR if set (an empty value disables the disk
+ * cache, and gives an empty path), otherwise
+ * $XDG_CACHE_HOME/pybammsolvers/<subdir> or ~/.cache/pybammsolvers/<subdir>.
+ */
+std::filesystem::path cache_dir(const std::string& subdir);
+
 #ifdef NDEBUG
 #define DEBUG_VECTOR(vector)
 #define DEBUG_VECTORn(vector, N)
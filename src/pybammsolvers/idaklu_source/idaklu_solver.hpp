@@ -3,8 +3,14 @@
 
 #include "IDAKLUSolverOpenMP_solvers.hpp"
 #include "IDAKLUSolverGroup.hpp"
+#include "Autotune.hpp"
+#include "Expressions/Ensemble/EnsembleFunctions.hpp"
 #include <idas/idas.h>
+#include <chrono>
+#include <limits>
 #include <memory>
+#include <thread>
+#include <type_traits>
 
 /**
  * Creates a concrete solver given a linear solver, as specified in
@@ -83,6 +89,25 @@ IDAKLUSolver *create_idaklu_solver(
       solver_opts
      );
   }
+#ifdef CUDA_ENABLE
+  else if (setup_opts.linear_solver == "SUNLinSol_cuSolverSp_batchQR")
+  {
+    DEBUG("\tsetting SUNLinSol_cuSolverSp_batchQR linear solver");
+    idakluSolver = new IDAKLUSolverOpenMP_cuSolverSp_batchQR<ExprSet>(
+      atol_np,
+      rel_tol,
+      rhs_alg_id,
+      number_of_parameters,
+      number_of_events,
+      jac_times_cjmass_nnz,
+      jac_bandwidth_lower,
+      jac_bandwidth_upper,
+      std::move(functions),
+      setup_opts,
+      solver_opts
+     );
+  }
+#endif
   else if (setup_opts.linear_solver == "SUNLinSol_SPBCGS")
   {
     DEBUG("\tsetting SUNLinSol_SPBCGS_linear solver");
@@ -185,41 +210,98 @@ IDAKLUSolverGroup *create_idaklu_solver_group(
   const std::vector<typename ExprSet::BaseFunctionType*>& var_fcns,
   const std::vector<typename ExprSet::BaseFunctionType*>& dvar_dy_fcns,
   const std::vector<typename ExprSet::BaseFunctionType*>& dvar_dp_fcns,
-  py::dict py_opts
+  py::dict py_opts,
+  const typename ExprSet::BaseFunctionType *jac_action_batched,
+  const typename ExprSet::BaseFunctionType *var_fused,
+  const std::vector<typename ExprSet::BaseFunctionType*>& rhs_alg_blocks,
+  const std::vector<typename ExprSet::BaseFunctionType*>& jac_times_cjmass_blocks,
+  const std::vector<typename ExprSet::BaseFunctionType*>& jac_action_blocks
 ) {
   auto setup_opts = SetupOptions(py_opts);
   auto solver_opts = SolverOptions(py_opts);
 
 
+  std::unique_ptr<ExprSet> prototype;
+  auto make_functions = [&]() {
+    std::unique_ptr<ExprSet> functions;
+    if constexpr (std::is_copy_constructible<ExprSet>::value) {
+      // Copies share the functions and sparsity patterns of the first
+      // expression set and only allocate their own work arrays
+      if (!prototype) {
+        prototype = std::make_unique<ExprSet>(
+          rhs_alg,
+          jac_times_cjmass,
+          jac_times_cjmass_nnz,
+          jac_bandwidth_lower,
+          jac_bandwidth_upper,
+          jac_times_cjmass_rowvals,
+          jac_times_cjmass_colptrs,
+          inputs_length,
+          jac_action,
+          mass_action,
+          sens,
+          events,
+          number_of_states,
+          number_of_events,
+          number_of_parameters,
+          var_fcns,
+          dvar_dy_fcns,
+          dvar_dp_fcns,
+          setup_opts,
+          jac_action_batched,
+          var_fused,
+          rhs_alg_blocks,
+          jac_times_cjmass_blocks,
+          jac_action_blocks
+        );
+      }
+      functions = std::make_unique<ExprSet>(*prototype);
+    } else {
+      // Note: we can't copy this ExprSet (it owns per-function runtime
+      // state), so we create it in the loop
+      functions = std::make_unique<ExprSet>(
+        rhs_alg,
+        jac_times_cjmass,
+        jac_times_cjmass_nnz,
+        jac_bandwidth_lower,
+        jac_bandwidth_upper,
+        jac_times_cjmass_rowvals,
+        jac_times_cjmass_colptrs,
+        inputs_length,
+        jac_action,
+        mass_action,
+        sens,
+        events,
+        number_of_states,
+        number_of_events,
+        number_of_parameters,
+        var_fcns,
+        dvar_dy_fcns,
+        dvar_dp_fcns,
+        setup_opts,
+        jac_action_batched,
+        var_fused,
+        rhs_alg_blocks,
+        jac_times_cjmass_blocks,
+        jac_action_blocks
+      );
+    }
+    return functions;
+  };
+
+  // Each solver is set up while pinned to its own CPUs, so that its vectors,
+  // matrices and workspaces are first touched on (and so allocated to) the
+  // NUMA node it will run on
+  ThreadPlacement placement(
+    setup_opts.thread_placement, setup_opts.num_solvers, setup_opts.num_threads);
+
   std::vector<std::unique_ptr<IDAKLUSolver>> solvers;
   for (int i = 0; i < setup_opts.num_solvers; i++) {
-    // Note: we can't copy an ExprSet as it contains raw pointers to the functions
-    // So we create it in the loop
-    auto functions = std::make_unique<ExprSet>(
-      rhs_alg,
-      jac_times_cjmass,
-      jac_times_cjmass_nnz,
-      jac_bandwidth_lower,
-      jac_bandwidth_upper,
-      jac_times_cjmass_rowvals,
-      jac_times_cjmass_colptrs,
-      inputs_length,
-      jac_action,
-      mass_action,
-      sens,
-      events,
-      number_of_states,
-      number_of_events,
-      number_of_parameters,
-      var_fcns,
-      dvar_dy_fcns,
-      dvar_dp_fcns,
-      setup_opts
-    );
+    ThreadPlacement::Scope pinned(placement, i);
     solvers.emplace_back(
       std::unique_ptr<IDAKLUSolver>(
         create_idaklu_solver(
-          std::move(functions),
+          make_functions(),
           number_of_parameters,
           jac_times_cjmass_colptrs,
           jac_times_cjmass_rowvals,
@@ -238,9 +320,268 @@ IDAKLUSolverGroup *create_idaklu_solver_group(
     );
   }
 
-  return new IDAKLUSolverGroup(std::move(solvers), number_of_states, number_of_parameters);
+  // Ensembles of small models, solved as one stacked system per solver
+  std::vector<std::unique_ptr<IDAKLUEnsembleSolver>> ensembles;
+  const int K = setup_opts.ensemble_size;
+  if (K > 1) {
+    if (number_of_parameters > 0) {
+      throw std::invalid_argument("ensemble_size > 1 does not support sensitivities");
+    }
+    if (solver_opts.output_dtype != "float64") {
+      throw std::invalid_argument("ensemble_size > 1 requires a float64 output_dtype");
+    }
+    if (!setup_opts.using_sparse_matrix && !setup_opts.using_banded_matrix) {
+      throw std::invalid_argument(
+        "ensemble_size > 1 requires a sparse, banded or matrix-free jacobian");
+    }
+    np_array rhs_alg_id_stacked = tile_members(rhs_alg_id, K);
+    np_array atol_stacked = tile_members(atol_np, K);
+    for (int i = 0; i < setup_opts.num_solvers; i++) {
+      ThreadPlacement::Scope pinned(placement, i);
+      auto member = make_functions();
+      std::vector<int> output_lengths;
+      for (auto &var_fcn : member->var_fcns) {
+        output_lengths.push_back(var_fcn->nnz_out());
+      }
+      auto functions = std::make_unique<EnsembleFunctions<ExprSet>>(std::move(member), K);
+      ensembles.emplace_back(
+        std::make_unique<IDAKLUEnsembleSolver>(
+          std::unique_ptr<IDAKLUSolver>(
+            create_idaklu_solver(
+              std::move(functions),
+              0,
+              jac_times_cjmass_colptrs,
+              jac_times_cjmass_rowvals,
+              K * jac_times_cjmass_nnz,
+              jac_bandwidth_lower,
+              jac_bandwidth_upper,
+              K * number_of_events,
+              rhs_alg_id_stacked,
+              atol_stacked,
+              rel_tol,
+              K * inputs_length,
+              solver_opts,
+              setup_opts
+            )
+          ),
+          K,
+          number_of_states,
+          inputs_length,
+          std::move(output_lengths)
+        )
+      );
+    }
+  }
+
+  return new IDAKLUSolverGroup(
+    std::move(solvers), number_of_states, number_of_parameters, std::move(ensembles),
+    std::move(placement));
 }
 
 
+/**
+ * Times short trial solves of a representative sample (t_eval, y0, yp0 and
+ * inputs, as passed to IDAKLUSolverGroup::solve) with each candidate
+ * linear solver, then with each split of the threads into solvers, and
+ * returns a copy of the options with the fastest settings. Candidates that
+ * cannot be set up or fail on the sample are skipped. Each trial is the
+ * best of `repeats` solves, so the sample should be short.
+ *
+ * If `cache_dir` is set, the result is cached there, keyed by a hash of the
+ * model functions, sizes, tolerances, every option other than the tuned
+ * ones and the thread budget, and a cached result is returned without any
+ * trials.
+ * @brief Pick the fastest linear solver and parallel layout for a model
+ */
+template<class ExprSet>
+py::dict autotune_idaklu_solver_group(
+  int number_of_states,
+  int number_of_parameters,
+  const typename ExprSet::BaseFunctionType &rhs_alg,
+  const typename ExprSet::BaseFunctionType &jac_times_cjmass,
+  const np_array_int &jac_times_cjmass_colptrs,
+  const np_array_int &jac_times_cjmass_rowvals,
+  const int jac_times_cjmass_nnz,
+  const int jac_bandwidth_lower,
+  const int jac_bandwidth_upper,
+  const typename ExprSet::BaseFunctionType &jac_action,
+  const typename ExprSet::BaseFunctionType &mass_action,
+  const typename ExprSet::BaseFunctionType &sens,
+  const typename ExprSet::BaseFunctionType &events,
+  const int number_of_events,
+  np_array rhs_alg_id,
+  np_array atol_np,
+  double rel_tol,
+  int inputs_length,
+  const std::vector<typename ExprSet::BaseFunctionType*>& var_fcns,
+  const std::vector<typename ExprSet::BaseFunctionType*>& dvar_dy_fcns,
+  const std::vector<typename ExprSet::BaseFunctionType*>& dvar_dp_fcns,
+  py::dict py_opts,
+  np_array t_eval,
+  np_array y0,
+  np_array yp0,
+  np_array inputs,
+  const typename ExprSet::BaseFunctionType *jac_action_batched,
+  const typename ExprSet::BaseFunctionType *var_fused,
+  const std::vector<typename ExprSet::BaseFunctionType*>& rhs_alg_blocks,
+  const std::vector<typename ExprSet::BaseFunctionType*>& jac_times_cjmass_blocks,
+  const std::vector<typename ExprSet::BaseFunctionType*>& jac_action_blocks,
+  int repeats,
+  const std::string &cache_dir
+) {
+  if (repeats < 1) {
+    throw std::invalid_argument("repeats must be at least 1");
+  }
+  if (y0.ndim() != 2) {
+    throw std::invalid_argument("y0 must have one row per trial solve");
+  }
+  const int number_of_rows = static_cast<int>(y0.shape()[0]);
+
+  AutotuneCandidate base;
+  base.jacobian = py_opts["jacobian"].cast<std::string>();
+  base.linear_solver = py_opts["linear_solver"].cast<std::string>();
+  base.preconditioner = py_opts["preconditioner"].cast<std::string>();
+  base.num_solvers = py_opts["num_solvers"].cast<int>();
+  base.num_threads = py_opts["num_threads"].cast<int>();
+
+  // Everything but the tuned settings changes the cost of each candidate
+  // (the model functions, events and mass matrix, the tolerances and all
+  // the other options), so it is all part of the key
+  std::string tolerances = autotune_hash_part(rel_tol);
+  auto atol = atol_np.unchecked<1>();
+  for (py::ssize_t i = 0; i < atol.shape(0); i++) {
+    tolerances += "," + autotune_hash_part(atol(i));
+  }
+  std::string algebraic;
+  auto id = rhs_alg_id.unchecked<1>();
+  for (py::ssize_t i = 0; i < id.shape(0); i++) {
+    algebraic += id(i) != 0.0 ? '1' : '0';
+  }
+  // Outputs and the optional batched, fused and partitioned functions
+  std::string outputs;
+  for (const auto *fcns : {&var_fcns, &dvar_dy_fcns, &dvar_dp_fcns,
+                           &rhs_alg_blocks, &jac_times_cjmass_blocks, &jac_action_blocks}) {
+    for (const auto *fcn : *fcns) {
+      outputs += ExprSet::fingerprint(*fcn) + "\n";
+    }
+    outputs += ";";
+  }
+  for (const auto *fcn : {jac_action_batched, var_fused}) {
+    outputs += (fcn != nullptr ? ExprSet::fingerprint(*fcn) : std::string()) + ";";
+  }
+  const uint64_t key = autotune_hash({
+    AUTOTUNE_CANDIDATES_VERSION,
+    ExprSet::fingerprint(rhs_alg),
+    ExprSet::fingerprint(jac_times_cjmass),
+    ExprSet::fingerprint(jac_action),
+    ExprSet::fingerprint(mass_action),
+    std::to_string(number_of_states),
+    std::to_string(number_of_parameters),
+    ExprSet::fingerprint(sens),
+    ExprSet::fingerprint(events),
+    std::to_string(number_of_events),
+    algebraic,
+    outputs,
+    std::to_string(inputs_length),
+    std::to_string(jac_times_cjmass_nnz),
+    std::to_string(jac_bandwidth_lower) + "," + std::to_string(jac_bandwidth_upper),
+    tolerances,
+    autotune_hash_part(py_opts),
+    std::to_string(number_of_rows),
+    std::to_string(base.num_threads),
+    std::to_string(std::thread::hardware_concurrency())
+  });
+  if (!cache_dir.empty()) {
+    AutotuneCandidate cached;
+    if (read_autotune_cache(cache_dir, key, cached)) {
+      DEBUG("autotune: cache hit");
+      return autotune_options(py_opts, cached);
+    }
+  }
+
+  np_array t_interp(0);
+
+  // Wall-clock time of a candidate, or infinity if it does not solve
+  auto trial = [&](const AutotuneCandidate &candidate) {
+    double best = std::numeric_limits<double>::infinity();
+    try {
+      std::unique_ptr<IDAKLUSolverGroup> group(create_idaklu_solver_group<ExprSet>(
+        number_of_states,
+        number_of_parameters,
+        rhs_alg,
+        jac_times_cjmass,
+        jac_times_cjmass_colptrs,
+        jac_times_cjmass_rowvals,
+        jac_times_cjmass_nnz,
+        jac_bandwidth_lower,
+        jac_bandwidth_upper,
+        jac_action,
+        mass_action,
+        sens,
+        events,
+        number_of_events,
+        rhs_alg_id,
+        atol_np,
+        rel_tol,
+        inputs_length,
+        var_fcns,
+        dvar_dy_fcns,
+        dvar_dp_fcns,
+        autotune_options(py_opts, candidate),
+        jac_action_batched,
+        var_fused,
+        rhs_alg_blocks,
+        jac_times_cjmass_blocks,
+        jac_action_blocks
+      ));
+      for (int r = 0; r < repeats; r++) {
+        const auto start = std::chrono::steady_clock::now();
+        auto solutions = group->solve(t_eval, t_interp, y0, yp0, inputs, np_array());
+        const std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - start;
+        for (const auto &solution : solutions) {
+          if (solution.flag < 0) {
+            return std::numeric_limits<double>::infinity();
+          }
+        }
+        best = std::min(best, elapsed.count());
+      }
+    } catch (std::exception &e) {
+      DEBUG("autotune: skipping " << candidate.linear_solver << ": " << e.what());
+      return std::numeric_limits<double>::infinity();
+    }
+    DEBUG("autotune: " << candidate.linear_solver << " with " << candidate.num_solvers
+      << " solvers took " << best << " s");
+    return best;
+  };
+
+  auto fastest = [&](const std::vector<AutotuneCandidate> &candidates) {
+    const AutotuneCandidate *best = nullptr;
+    double best_time = std::numeric_limits<double>::infinity();
+    for (const auto &candidate : candidates) {
+      const double time = trial(candidate);
+      if (time < best_time) {
+        best_time = time;
+        best = &candidate;
+      }
+    }
+    if (best == nullptr) {
+      throw std::runtime_error("autotune: no candidate configuration solved the sample");
+    }
+    return *best;
+  };
+
+  // The linear solver and the layout are tuned one after the other, rather
+  // than over every combination, to keep the number of trials small
+  const AutotuneCandidate solver = fastest(autotune_linear_solvers(
+    base, number_of_states, jac_bandwidth_lower, jac_bandwidth_upper));
+  const AutotuneCandidate tuned = fastest(autotune_layouts(solver, number_of_rows));
+
+  if (!cache_dir.empty()) {
+    write_autotune_cache(cache_dir, key, tuned);
+  }
+  return autotune_options(py_opts, tuned);
+}
+
 
 #endif // PYBAMM_CREATE_IDAKLU_SOLVER_HPP
@@ -1,4 +1,11 @@
 #include "observe.hpp"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <list>
+#include <mutex>
+#include <omp.h>
+#include <string_view>
 
 int _setup_len_spatial(const std::vector<int>& shape) {
     // Calculate the product of all dimensions except the last (spatial dimensions)
@@ -14,53 +21,307 @@ int _setup_len_spatial(const std::vector<int>& shape) {
     return size_spatial;
 }
 
-// Coupled observe and Hermite interpolation of variables
+namespace {
+
+void check_num_threads(const int num_threads) {
+    if (num_threads < 1) {
+        throw std::invalid_argument("num_threads must be at least 1");
+    }
+}
+
+// Exceptions cannot leave an OpenMP region, so the first one is kept and
+// rethrown by the caller once the region has finished
+class FirstError {
+public:
+    template <class F>
+    void run(const F& f) {
+        if (failed) {
+            return;
+        }
+        try {
+            f();
+        } catch (...) {
+            #pragma omp critical(observe_first_error)
+            {
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+            failed = true;
+        }
+    }
+
+    void rethrow() const {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    std::atomic<bool> failed{false};
+    std::exception_ptr error;
+};
+
+typedef py::detail::unchecked_reference<realtype, 1> view_1d;
+typedef py::detail::unchecked_reference<realtype, 2> view_2d;
+
+// Per-thread casadi memory and work arrays for one function
+class CasadiWorkspace {
+public:
+    explicit CasadiWorkspace(const casadi::Function& f)
+        : func(f), args(f.sz_arg()), results(f.sz_res()), iw(f.sz_iw()), w(f.sz_w()) {
+        #pragma omp critical(observe_casadi_checkout)
+        mem = func.checkout();
+    }
+
+    ~CasadiWorkspace() {
+        #pragma omp critical(observe_casadi_checkout)
+        func.release(mem);
+    }
+
+    CasadiWorkspace(const CasadiWorkspace&) = delete;
+    CasadiWorkspace& operator=(const CasadiWorkspace&) = delete;
+
+    void operator()(const realtype* t, const realtype* y, const realtype* inputs, realtype* out) {
+        args[0] = t;
+        args[1] = y;
+        args[2] = inputs;
+        results[0] = out;
+        func(args.data(), results.data(), iw.data(), w.data(), mem);
+    }
+
+private:
+    const casadi::Function& func;
+    int mem;
+    vector<const realtype*> args;
+    vector<realtype*> results;
+    vector<casadi_int> iw;
+    vector<realtype> w;
+};
+
+// Index j of the first interval [t(j), t(j+1)] containing t_val, clamped to
+// the valid intervals so that points outside the data are extrapolated
+py::ssize_t bisect_interval(const view_1d& t, const realtype t_val) {
+    py::ssize_t lo = 0;
+    py::ssize_t hi = t.size();
+    while (lo < hi) {
+        const py::ssize_t mid = lo + (hi - lo) / 2;
+        if (t(mid) < t_val) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return std::min(std::max<py::ssize_t>(lo - 1, 0), t.size() - 2);
+}
+
+// Advance the interval cursor j to the first interval whose right end
+// reaches t_val (t_val is non-decreasing between calls). The step doubles
+// until the interval is bracketed and is then bisected, so the cost is
+// O(log gap) rather than linear in the number of skipped data points
+py::ssize_t gallop_interval(const view_1d& t, const py::ssize_t j, const realtype t_val) {
+    const py::ssize_t j_max = t.size() - 2;
+    if (j >= j_max || t(j + 1) >= t_val) {
+        return std::min(j, j_max);
+    }
+
+    // Invariant: t(lo + 1) < t_val, and the answer lies in (lo, hi]
+    py::ssize_t lo = j;
+    py::ssize_t step = 1;
+    py::ssize_t hi = std::min(lo + step, j_max);
+    while (hi < j_max && t(hi + 1) < t_val) {
+        lo = hi;
+        step *= 2;
+        hi = std::min(lo + step, j_max);
+    }
+    while (hi - lo > 1) {
+        const py::ssize_t mid = lo + (hi - lo) / 2;
+        if (t(mid + 1) < t_val) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return hi;
+}
+
+// Copy column j of a [state][time] array into a contiguous buffer
+void gather_column(const view_2d& y, const py::ssize_t j, realtype* out) {
+    const py::ssize_t M = y.shape(0);
+    if (y.stride(0) == static_cast<py::ssize_t>(sizeof(realtype))) {
+        std::copy_n(&y(0, j), M, out);
+        return;
+    }
+    for (py::ssize_t i = 0; i < M; ++i) {
+        out[i] = y(i, j);
+    }
+}
+
+// Process-wide least-recently-used cache of deserialized casadi functions,
+// keyed on the serialized string
+class FunctionCache {
+public:
+    std::shared_ptr<const casadi::Function> get(const std::string& str) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = index.find(std::string_view(str));
+            if (it != index.end()) {
+                // Move the entry to the front of the recency list
+                entries.splice(entries.begin(), entries, it->second);
+                ++hits;
+                return it->second->second;
+            }
+            ++misses;
+        }
+
+        // Deserialize outside the lock so other threads are not blocked
+        auto func = std::make_shared<const casadi::Function>(casadi::Function::deserialize(str));
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(std::string_view(str));
+        if (it != index.end()) {
+            // Another thread inserted the same function in the meantime
+            entries.splice(entries.begin(), entries, it->second);
+            return it->second->second;
+        }
+        if (max_size > 0) {
+            entries.emplace_front(str, func);
+            index.emplace(std::string_view(entries.front().first), entries.begin());
+            evict();
+        }
+        return func;
+    }
+
+    void set_max_size(const size_t size) {
+        std::lock_guard<std::mutex> lock(mutex);
+        max_size = size;
+        evict();
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        index.clear();
+        entries.clear();
+        hits = 0;
+        misses = 0;
+    }
+
+    py::dict info() {
+        std::lock_guard<std::mutex> lock(mutex);
+        py::dict d;
+        d["hits"] = hits;
+        d["misses"] = misses;
+        d["size"] = entries.size();
+        d["max_size"] = max_size;
+        return d;
+    }
+
+private:
+    void evict() {
+        while (entries.size() > max_size) {
+            index.erase(std::string_view(entries.back().first));
+            entries.pop_back();
+        }
+    }
+
+    typedef std::pair<std::string, std::shared_ptr<const casadi::Function>> entry_type;
+
+    std::mutex mutex;
+    std::list<entry_type> entries;
+    // Keyed by a view of the string in its list entry, so each serialised
+    // function is stored once (list nodes never move)
+    std::unordered_map<std::string_view, std::list<entry_type>::iterator> index;
+    size_t max_size = 512;
+    size_t hits = 0;
+    size_t misses = 0;
+};
+
+FunctionCache& function_cache() {
+    static FunctionCache cache;
+    return cache;
+}
+
+// An observed variable: one function per sub-solution and its output array
+struct ObservedVariable {
+    vector<std::shared_ptr<const casadi::Function>> funcs;
+    realtype* entries;
+    int size_spatial;
+};
+
+}  // namespace
+
+// Coupled observe and Hermite interpolation of variables. The cubic for the
+// current interval is held as contiguous per-state coefficient arrays so that
+// both the knot computation and the evaluation vectorise over the states
 class HermiteInterpolator {
 public:
-    HermiteInterpolator(const py::detail::unchecked_reference<realtype, 1>& t,
-                       const py::detail::unchecked_reference<realtype, 2>& y,
-                       const py::detail::unchecked_reference<realtype, 2>& yp)
-        : t(t), y(y), yp(yp) {}
+    void reset(const view_1d& _t, const view_2d& _y, const view_2d& _yp) {
+        t = &_t;
+        y = &_y;
+        yp = &_yp;
+        const size_t M = y->shape(0);
+        a.resize(M);
+        b.resize(M);
+        c.resize(M);
+        d.resize(M);
+        y_next.resize(M);
+        yp_next.resize(M);
+    }
 
-    void compute_knots(const size_t j, vector<realtype>& c, vector<realtype>& d) const {
+    void compute_knots(const py::ssize_t j) {
         // Called at the start of each interval
-        const realtype h_full = t(j + 1) - t(j);
+        t_j = (*t)(j);
+        const realtype h_full = (*t)(j + 1) - t_j;
         const realtype inv_h = 1.0 / h_full;
         const realtype inv_h2 = inv_h * inv_h;
         const realtype inv_h3 = inv_h2 * inv_h;
 
-        for (size_t i = 0; i < y.shape(0); ++i) {
-            realtype y_ij = y(i, j);
-            realtype yp_ij = yp(i, j);
-            realtype y_ijp1 = y(i, j + 1);
-            realtype yp_ijp1 = yp(i, j + 1);
-
-            c[i] = 3.0 * (y_ijp1 - y_ij) * inv_h2 - (2.0 * yp_ij + yp_ijp1) * inv_h;
-            d[i] = 2.0 * (y_ij - y_ijp1) * inv_h3 + (yp_ij + yp_ijp1) * inv_h2;
+        gather_column(*y, j, a.data());
+        gather_column(*yp, j, b.data());
+        gather_column(*y, j + 1, y_next.data());
+        gather_column(*yp, j + 1, yp_next.data());
+
+        const size_t M = a.size();
+        const realtype* y0 = a.data();
+        const realtype* yp0 = b.data();
+        const realtype* y1 = y_next.data();
+        const realtype* yp1 = yp_next.data();
+        realtype* c_ = c.data();
+        realtype* d_ = d.data();
+        #pragma omp simd
+        for (size_t i = 0; i < M; ++i) {
+            c_[i] = 3.0 * (y1[i] - y0[i]) * inv_h2 - (2.0 * yp0[i] + yp1[i]) * inv_h;
+            d_[i] = 2.0 * (y0[i] - y1[i]) * inv_h3 + (yp0[i] + yp1[i]) * inv_h2;
         }
     }
 
-    void interpolate(vector<realtype>& entries,
-    realtype t_interp,
-    const size_t j,
-    vector<realtype>& c,
-    vector<realtype>& d) const {
+    void interpolate(vector<realtype>& entries, const realtype t_interp) const {
         // Must be called after compute_knots
-        const realtype h = t_interp - t(j);
-        const realtype h2 = h * h;
-        const realtype h3 = h2 * h;
-
-        for (size_t i = 0; i < entries.size(); ++i) {
-            realtype y_ij = y(i, j);
-            realtype yp_ij = yp(i, j);
-            entries[i] = y_ij + yp_ij * h + c[i] * h2 + d[i] * h3;
+        const realtype h = t_interp - t_j;
+        const size_t M = entries.size();
+        const realtype* a_ = a.data();
+        const realtype* b_ = b.data();
+        const realtype* c_ = c.data();
+        const realtype* d_ = d.data();
+        realtype* out = entries.data();
+        #pragma omp simd
+        for (size_t i = 0; i < M; ++i) {
+            out[i] = a_[i] + h * (b_[i] + h * (c_[i] + h * d_[i]));
         }
     }
 
 private:
-    const py::detail::unchecked_reference<realtype, 1>& t;
-    const py::detail::unchecked_reference<realtype, 2>& y;
-    const py::detail::unchecked_reference<realtype, 2>& yp;
+    const view_1d* t = nullptr;
+    const view_2d* y = nullptr;
+    const view_2d* yp = nullptr;
+    realtype t_j = 0.0;
+    // y = a + b h + c h^2 + d h^3 on the current interval
+    vector<realtype> a;
+    vector<realtype> b;
+    vector<realtype> c;
+    vector<realtype> d;
+    vector<realtype> y_next;
+    vector<realtype> yp_next;
 };
 
 class TimeSeriesInterpolator {
@@ -70,131 +331,100 @@ public:
                            const vector<np_array_realtype>& _ys_data,
                            const vector<np_array_realtype>& _yps_data,
                            const vector<np_array_realtype>& _inputs,
-                           const vector<std::shared_ptr<const casadi::Function>>& _funcs,
-                           realtype* _entries,
-                           const int _size_spatial)
+                           const vector<ObservedVariable>& _variables,
+                           const int _num_threads)
         : t_interp_np(_t_interp), ts_data_np(_ts_data), ys_data_np(_ys_data),
-          yps_data_np(_yps_data), inputs_np(_inputs), funcs(_funcs),
-          entries(_entries), size_spatial(_size_spatial) {}
+          yps_data_np(_yps_data), inputs_np(_inputs), variables(_variables),
+          num_threads(_num_threads) {}
 
     void process() {
-        auto t_interp = t_interp_np.unchecked<1>();
-        ssize_t i_interp = 0;
-        int i_entries = 0;
-        const ssize_t N_interp = t_interp.size();
-
-        // Main processing within bounds
-        process_within_bounds(i_interp, i_entries, t_interp, N_interp);
-
-        // Extrapolation for remaining points
-        if (i_interp < N_interp) {
-            extrapolate_remaining(i_interp, i_entries, t_interp, N_interp);
+        // Take views of the data while holding the GIL
+        const auto t_interp = t_interp_np.unchecked<1>();
+        const py::ssize_t N_interp = t_interp.size();
+        const size_t n_sols = ts_data_np.size();
+
+        vector<view_1d> t_data;
+        vector<view_2d> y_data;
+        vector<view_2d> yp_data;
+        vector<const realtype*> inputs;
+        for (size_t i = 0; i < n_sols; i++) {
+            t_data.push_back(ts_data_np[i].unchecked<1>());
+            y_data.push_back(ys_data_np[i].unchecked<2>());
+            yp_data.push_back(yps_data_np[i].unchecked<2>());
+            inputs.push_back(inputs_np[i].data());
         }
-    }
 
-    void process_within_bounds(
-            ssize_t& i_interp,
-            int& i_entries,
-            const py::detail::unchecked_reference<realtype, 1>& t_interp,
-            const ssize_t N_interp
-        ) {
-        for (size_t i = 0; i < ts_data_np.size(); i++) {
-            const auto& t_data = ts_data_np[i].unchecked<1>();
+        // Assign each point to the first sub-solution that reaches it. Points
+        // beyond the final data point are extrapolated from the last interval
+        vector<int> point_solution(N_interp, static_cast<int>(n_sols) - 1);
+        py::ssize_t k = 0;
+        for (size_t i = 0; i < n_sols && k < N_interp; i++) {
             // Continue if there is no data
-            if (t_data.size() == 0) {
+            if (t_data[i].size() == 0) {
                 continue;
             }
-
-            const realtype t_data_final = t_data(t_data.size() - 1);
-            realtype t_interp_next = t_interp(i_interp);
-            // Continue if the next interpolation point is beyond the final data point
-            if (t_interp_next > t_data_final) {
-                continue;
+            const realtype t_data_final = t_data[i](t_data[i].size() - 1);
+            for (; k < N_interp && t_interp(k) <= t_data_final; k++) {
+                point_solution[k] = i;
             }
+        }
 
-            const auto& y_data = ys_data_np[i].unchecked<2>();
-            const auto& yp_data = yps_data_np[i].unchecked<2>();
-            const auto input = inputs_np[i].data();
-            const auto func = *funcs[i];
-
-            resize_arrays(y_data.shape(0), funcs[i]);
-            args[1] = y_buffer.data();
-            args[2] = input;
-
-            ssize_t j = 0;
-            ssize_t j_prev = -1;
-            const auto itp = HermiteInterpolator(t_data, y_data, yp_data);
-            while (t_interp_next <= t_data_final) {
-                for (; j < t_data.size() - 2; ++j) {
-                    if (t_data(j) <= t_interp_next && t_interp_next <= t_data(j + 1)) {
-                        break;
+        // The output offsets are known up front, so the points are
+        // independent and can be evaluated in parallel
+        check_num_threads(num_threads);
+        py::gil_scoped_release release;
+        FirstError error;
+
+        #pragma omp parallel num_threads(num_threads)
+        {
+            // The state is interpolated once per point and shared by all variables
+            vector<std::unique_ptr<CasadiWorkspace>> funcs(variables.size());
+            vector<realtype> y_buffer;
+            HermiteInterpolator itp;
+            int i_prev = -1;
+            py::ssize_t j = 0;
+            py::ssize_t j_prev = -1;
+
+            #pragma omp for schedule(static)
+            for (py::ssize_t i_interp = 0; i_interp < N_interp; i_interp++) {
+                error.run([&] {
+                    const int i = point_solution[i_interp];
+                    const realtype t_interp_next = t_interp(i_interp);
+                    const auto& t_i = t_data[i];
+
+                    if (i != i_prev) {
+                        for (size_t v = 0; v < variables.size(); v++) {
+                            funcs[v].reset();
+                            funcs[v] = std::make_unique<CasadiWorkspace>(*variables[v].funcs[i]);
+                        }
+                        y_buffer.resize(y_data[i].shape(0));
+                        itp.reset(t_i, y_data[i], yp_data[i]);
+                        j = bisect_interval(t_i, t_interp_next);
+                        j_prev = -1;
+                        i_prev = i;
                     }
-                }
 
-                if (j != j_prev) {
-                    // Compute c and d for the new interval
-                    itp.compute_knots(j, c, d);
-                }
-
-                itp.interpolate(y_buffer, t_interp(i_interp), j, c, d);
+                    // Advance the interval cursor (t_interp is sorted)
+                    j = gallop_interval(t_i, j, t_interp_next);
 
-                args[0] = &t_interp(i_interp);
-                results[0] = &entries[i_entries];
-                func(args.data(), results.data(), iw.data(), w.data(), 0);
+                    if (j != j_prev) {
+                        // Compute the coefficients for the new interval
+                        itp.compute_knots(j);
+                        j_prev = j;
+                    }
 
-                ++i_interp;
-                if (i_interp == N_interp) {
-                    return;
-                }
-                t_interp_next = t_interp(i_interp);
-                i_entries += size_spatial;
-                j_prev = j;
+                    itp.interpolate(y_buffer, t_interp_next);
+                    for (size_t v = 0; v < variables.size(); v++) {
+                        const auto& var = variables[v];
+                        (*funcs[v])(&t_interp_next, y_buffer.data(), inputs[i], &var.entries[i_interp * var.size_spatial]);
+                    }
+                });
             }
-        }
-    }
 
-    void extrapolate_remaining(
-            ssize_t& i_interp,
-            int& i_entries,
-            const py::detail::unchecked_reference<realtype, 1>& t_interp,
-            const ssize_t N_interp
-        ) {
-        const auto& t_data = ts_data_np.back().unchecked<1>();
-        const auto& y_data = ys_data_np.back().unchecked<2>();
-        const auto& yp_data = yps_data_np.back().unchecked<2>();
-        const auto input = inputs_np.back().data();
-        const auto func = *funcs.back();
-        const ssize_t j = t_data.size() - 2;
-
-        resize_arrays(y_data.shape(0), funcs.back());
-        args[1] = y_buffer.data();
-        args[2] = input;
-
-        const auto itp = HermiteInterpolator(t_data, y_data, yp_data);
-        itp.compute_knots(j, c, d);
-
-        for (; i_interp < N_interp; ++i_interp) {
-            const realtype t_interp_next = t_interp(i_interp);
-            itp.interpolate(y_buffer, t_interp_next, j, c, d);
-
-            args[0] = &t_interp_next;
-            results[0] = &entries[i_entries];
-            func(args.data(), results.data(), iw.data(), w.data(), 0);
-
-            i_entries += size_spatial;
+            funcs.clear();
         }
-    }
 
-    void resize_arrays(const int M, std::shared_ptr<const casadi::Function> func) {
-        args.resize(func->sz_arg());
-        results.resize(func->sz_res());
-        iw.resize(func->sz_iw());
-        w.resize(func->sz_w());
-        if (y_buffer.size() < M) {
-            y_buffer.resize(M);
-            c.resize(M);
-            d.resize(M);
-        }
+        error.rethrow();
     }
 
 private:
@@ -203,16 +433,8 @@ private:
     const vector<np_array_realtype>& ys_data_np;
     const vector<np_array_realtype>& yps_data_np;
     const vector<np_array_realtype>& inputs_np;
-    const vector<std::shared_ptr<const casadi::Function>>& funcs;
-    realtype* entries;
-    const int size_spatial;
-    vector<realtype> c;
-    vector<realtype> d;
-    vector<realtype> y_buffer;
-    vector<const realtype*> args;
-    vector<realtype*> results;
-    vector<casadi_int> iw;
-    vector<realtype> w;
+    const vector<ObservedVariable>& variables;
+    const int num_threads;
 };
 
 // Observe the raw data
@@ -224,44 +446,70 @@ public:
                         const vector<std::shared_ptr<const casadi::Function>>& _funcs,
                         realtype* _entries,
                         const bool _is_f_contiguous,
-                        const int _size_spatial)
+                        const int _size_spatial,
+                        const int _num_threads)
         : ts(_ts), ys(_ys), inputs(_inputs), funcs(_funcs),
-          entries(_entries), is_f_contiguous(_is_f_contiguous), size_spatial(_size_spatial) {}
+          entries(_entries), is_f_contiguous(_is_f_contiguous), size_spatial(_size_spatial),
+          num_threads(_num_threads) {}
 
     void process() {
-        int i_entries = 0;
-        for (size_t i = 0; i < ts.size(); i++) {
-            const auto& t = ts[i].unchecked<1>();
-            // Continue if there is no data
-            if (t.size() == 0) {
-                continue;
-            }
-            const auto& y = ys[i].unchecked<2>();
-            const auto input = inputs[i].data();
-            const auto func = *funcs[i];
-
-            resize_arrays(y.shape(0), funcs[i]);
-            args[2] = input;
-
-            for (size_t j = 0; j < t.size(); j++) {
-                const realtype t_val = t(j);
-                const realtype* y_val = is_f_contiguous ? &y(0, j) : copy_to_buffer(y_buffer, y, j);
-
-                args[0] = &t_val;
-                args[1] = y_val;
-                results[0] = &entries[i_entries];
-
-                func(args.data(), results.data(), iw.data(), w.data(), 0);
+        // Take views of the data while holding the GIL
+        const size_t n_sols = ts.size();
+        vector<view_1d> t_data;
+        vector<view_2d> y_data;
+        vector<const realtype*> input_data;
+        // offsets[i] is the index of the first time point of sub-solution i
+        vector<py::ssize_t> offsets(n_sols + 1, 0);
+        for (size_t i = 0; i < n_sols; i++) {
+            t_data.push_back(ts[i].unchecked<1>());
+            y_data.push_back(ys[i].unchecked<2>());
+            input_data.push_back(inputs[i].data());
+            offsets[i + 1] = offsets[i] + t_data[i].size();
+        }
+        const py::ssize_t N = offsets.back();
+
+        check_num_threads(num_threads);
+        py::gil_scoped_release release;
+        FirstError error;
+
+        #pragma omp parallel num_threads(num_threads)
+        {
+            std::unique_ptr<CasadiWorkspace> func;
+            vector<realtype> y_buffer;
+            py::ssize_t i_prev = -1;
+
+            #pragma omp for schedule(static)
+            for (py::ssize_t k = 0; k < N; k++) {
+                error.run([&] {
+                    // Sub-solution containing point k (empty sub-solutions are skipped)
+                    const py::ssize_t i = std::upper_bound(offsets.begin(), offsets.end(), k) - offsets.begin() - 1;
+                    const py::ssize_t j = k - offsets[i];
+
+                    if (i != i_prev) {
+                        func.reset();
+                        func = std::make_unique<CasadiWorkspace>(*funcs[i]);
+                        if (!is_f_contiguous) {
+                            y_buffer.resize(y_data[i].shape(0));
+                        }
+                        i_prev = i;
+                    }
 
-                i_entries += size_spatial;
+                    const realtype t_val = t_data[i](j);
+                    const realtype* y_val = is_f_contiguous ? &y_data[i](0, j) : copy_to_buffer(y_buffer, y_data[i], j);
+                    (*func)(&t_val, y_val, input_data[i], &entries[k * size_spatial]);
+                });
             }
+
+            func.reset();
         }
+
+        error.rethrow();
     }
 
 private:
-    const realtype* copy_to_buffer(
+    static const realtype* copy_to_buffer(
         vector<realtype>& entries,
-        const py::detail::unchecked_reference<realtype, 2>& y,
+        const view_2d& y,
         size_t j) {
         for (size_t i = 0; i < entries.size(); ++i) {
             entries[i] = y(i, j);
@@ -270,16 +518,6 @@ private:
         return entries.data();
     }
 
-    void resize_arrays(const int M, std::shared_ptr<const casadi::Function> func) {
-        args.resize(func->sz_arg());
-        results.resize(func->sz_res());
-        iw.resize(func->sz_iw());
-        w.resize(func->sz_w());
-        if (!is_f_contiguous && y_buffer.size() < M) {
-            y_buffer.resize(M);
-        }
-    }
-
     const vector<np_array_realtype>& ts;
     const vector<np_array_realtype>& ys;
     const vector<np_array_realtype>& inputs;
@@ -287,11 +525,7 @@ private:
     realtype* entries;
     const bool is_f_contiguous;
     int size_spatial;
-    vector<realtype> y_buffer;
-    vector<const realtype*> args;
-    vector<realtype*> results;
-    vector<casadi_int> iw;
-    vector<realtype> w;
+    const int num_threads;
 };
 
 const np_array_realtype observe_hermite_interp(
@@ -301,52 +535,95 @@ const np_array_realtype observe_hermite_interp(
     const vector<np_array_realtype>& yps_np,
     const vector<np_array_realtype>& inputs_np,
     const vector<std::string>& strings,
-    const vector<int>& shape
+    const vector<int>& shape,
+    const int num_threads
 ) {
     const int size_spatial = _setup_len_spatial(shape);
-    const auto& funcs = setup_casadi_funcs(strings);
     py::array_t<realtype, py::array::f_style> out_array(shape);
-    auto entries = out_array.mutable_data();
+    const vector<ObservedVariable> variables {
+        {setup_casadi_funcs(strings), out_array.mutable_data(), size_spatial}
+    };
 
-    TimeSeriesInterpolator(t_interp_np, ts_np, ys_np, yps_np, inputs_np, funcs, entries, size_spatial).process();
+    TimeSeriesInterpolator(t_interp_np, ts_np, ys_np, yps_np, inputs_np, variables, num_threads).process();
 
     return out_array;
 }
 
+const vector<np_array_realtype> observe_hermite_interp_multi(
+    const np_array_realtype& t_interp_np,
+    const vector<np_array_realtype>& ts_np,
+    const vector<np_array_realtype>& ys_np,
+    const vector<np_array_realtype>& yps_np,
+    const vector<np_array_realtype>& inputs_np,
+    const vector<vector<std::string>>& strings,
+    const vector<vector<int>>& shapes,
+    const int num_threads
+) {
+    if (strings.size() != shapes.size()) {
+        throw std::invalid_argument("funcs and shapes must have the same number of variables");
+    }
+
+    vector<np_array_realtype> out_arrays;
+    vector<ObservedVariable> variables;
+    out_arrays.reserve(strings.size());
+    variables.reserve(strings.size());
+    for (size_t v = 0; v < strings.size(); v++) {
+        if (strings[v].size() != ts_np.size()) {
+            throw std::invalid_argument("each variable must have one function per sub-solution");
+        }
+        const int size_spatial = _setup_len_spatial(shapes[v]);
+        py::array_t<realtype, py::array::f_style> out_array(shapes[v]);
+        variables.push_back({setup_casadi_funcs(strings[v]), out_array.mutable_data(), size_spatial});
+        out_arrays.push_back(out_array);
+    }
+
+    TimeSeriesInterpolator(t_interp_np, ts_np, ys_np, yps_np, inputs_np, variables, num_threads).process();
+
+    return out_arrays;
+}
+
 const np_array_realtype observe(
     const vector<np_array_realtype>& ts_np,
     const vector<np_array_realtype>& ys_np,
     const vector<np_array_realtype>& inputs_np,
     const vector<std::string>& strings,
     const bool is_f_contiguous,
-    const vector<int>& shape
+    const vector<int>& shape,
+    const int num_threads
 ) {
     const int size_spatial = _setup_len_spatial(shape);
     const auto& funcs = setup_casadi_funcs(strings);
     py::array_t<realtype, py::array::f_style> out_array(shape);
     auto entries = out_array.mutable_data();
 
-    TimeSeriesProcessor(ts_np, ys_np, inputs_np, funcs, entries, is_f_contiguous, size_spatial).process();
+    TimeSeriesProcessor(ts_np, ys_np, inputs_np, funcs, entries, is_f_contiguous, size_spatial, num_threads).process();
 
     return out_array;
 }
 
 const vector<std::shared_ptr<const casadi::Function>> setup_casadi_funcs(const vector<std::string>& strings) {
-    std::unordered_map<std::string, std::shared_ptr<casadi::Function>> function_cache;
     vector<std::shared_ptr<const casadi::Function>> funcs(strings.size());
 
     for (size_t i = 0; i < strings.size(); ++i) {
-        const std::string& str = strings[i];
-
-        // Check if function is already in the local cache
-        if (function_cache.find(str) == function_cache.end()) {
-            // If not in the cache, create a new casadi::Function::deserialize and store it
-            function_cache[str] = std::make_shared<casadi::Function>(casadi::Function::deserialize(str));
+        // Consecutive sub-solutions usually share the same function
+        if (i > 0 && strings[i] == strings[i - 1]) {
+            funcs[i] = funcs[i - 1];
+            continue;
         }
-
-        // Retrieve the function from the cache as a shared pointer
-        funcs[i] = function_cache[str];
+        funcs[i] = function_cache().get(strings[i]);
     }
 
     return funcs;
 }
+
+py::dict observe_cache_info() {
+    return function_cache().info();
+}
+
+void set_observe_cache_size(const size_t max_size) {
+    function_cache().set_max_size(max_size);
+}
+
+void clear_observe_cache() {
+    function_cache().clear();
+}
@@ -24,9 +24,24 @@ const np_array_realtype observe_hermite_interp(
     const vector<np_array_realtype>& yps,
     const vector<np_array_realtype>& inputs,
     const vector<std::string>& strings,
-    const vector<int>& shape
+    const vector<int>& shape,
+    const int num_threads
 );
 
+/**
+ * @brief Observe and Hermite interpolate several ND variables at once,
+ * sharing the state interpolation at each point between the variables
+ */
+const vector<np_array_realtype> observe_hermite_interp_multi(
+    const np_array_realtype& t_interp,
+    const vector<np_array_realtype>& ts,
+    const vector<np_array_realtype>& ys,
+    const vector<np_array_realtype>& yps,
+    const vector<np_array_realtype>& inputs,
+    const vector<vector<std::string>>& strings,
+    const vector<vector<int>>& shapes,
+    const int num_threads
+);
 
 /**
  * @brief Observe ND variables
@@ -37,11 +52,27 @@ const np_array_realtype observe(
     const vector<np_array_realtype>& inputs_np,
     const vector<std::string>& strings,
     const bool is_f_contiguous,
-    const vector<int>& shape
+    const vector<int>& shape,
+    const int num_threads
 );
 
 const vector<std::shared_ptr<const casadi::Function>> setup_casadi_funcs(const vector<std::string>& strings);
 
+/**
+ * @brief Hit/miss counters and size of the deserialized function cache
+ */
+py::dict observe_cache_info();
+
+/**
+ * @brief Set the maximum number of cached functions (0 disables caching)
+ */
+void set_observe_cache_size(const size_t max_size);
+
+/**
+ * @brief Empty the function cache and reset its counters
+ */
+void clear_observe_cache();
+
 int _setup_len_spatial(const vector<int>& shape);
 
 #endif // PYBAMM_CREATE_OBSERVE_HPP
@@ -2,11 +2,75 @@
 #define PYBAMM_SUNDIALS_FUNCTIONS_HPP
 
 #include "common.hpp"
+#include "Expressions/Expressions.hpp"
+#include <cstring>
+#include <vector>
 
 template<typename T>
 void axpy(int n, T alpha, const T* x, T* y) {
   if (!x || !y) return;
-  for (int i=0; i<n; ++i) *y++ += alpha**x++;
+  #pragma omp simd
+  for (int i=0; i<n; ++i) y[i] += alpha * x[i];
+}
+
+/**
+ * @brief y <- a*diag(d)*x + y
+ */
+template<typename T>
+void diag_axpy(int n, T alpha, const T* d, const T* x, T* y) {
+  if (!d || !x || !y) return;
+  #pragma omp simd
+  for (int i=0; i<n; ++i) y[i] += alpha * d[i] * x[i];
+}
+
+/**
+ * @brief Zero the values of a sparse matrix but keep its sparsity pattern
+ *
+ * IDA zeros the Jacobian before every evaluation. The default sparse zero op
+ * also clears the index arrays, which would force the (fixed) pattern to be
+ * copied back in on every call.
+ */
+inline int SUNMatZero_Sparse_KeepPattern(SUNMatrix A) {
+  std::memset(SUNSparseMatrix_Data(A), 0, SUNSparseMatrix_NNZ(A) * sizeof(realtype));
+  return SUNMAT_SUCCESS;
+}
+
+/**
+ * @brief User data of the adjoint (backward) problem of an integral loss
+ *
+ * The loss integrand g is a scalar output variable. The mass matrix values
+ * are only needed (and set) if the mass matrix is not diagonal.
+ */
+template<class T>
+struct AdjointData
+{
+  T *functions;
+  Expression *loss;  // g(t, y, inputs)
+  Expression *dloss_dy;  // dg/dy, sparse
+  Expression *dloss_dp;  // dg/dp, sparse
+  std::vector<realtype> mass;  // CSC values of the mass matrix on the Jacobian pattern
+  std::vector<realtype> jac;  // CSC values of the Jacobian (scratch)
+  std::vector<realtype> res;  // output variable values (scratch)
+  std::vector<realtype> sens;  // dF/dp, parameter after parameter (scratch)
+};
+
+/**
+ * @brief y <- A^T x + y for a matrix A with values `data` on the Jacobian
+ * (CSC) pattern
+ */
+template<class T>
+void jacobian_pattern_transpose_axpy(const T *p_python_functions,
+                                     const realtype *data, const realtype *x, realtype *y) {
+  auto const &colptrs = *p_python_functions->jac_times_cjmass_colptrs;
+  auto const &rowvals = *p_python_functions->jac_times_cjmass_rowvals;
+  const int ns = p_python_functions->number_of_states;
+  for (int col = 0; col < ns; col++) {
+    realtype sum = 0.0;
+    for (auto k = colptrs[col]; k < colptrs[col + 1]; k++) {
+      sum += data[k] * x[rowvals[k]];
+    }
+    y[col] += sum;
+  }
 }
 
 int residual_eval(realtype tres, N_Vector yy, N_Vector yp, N_Vector rr,
@@ -31,6 +95,15 @@ int jacobian_eval(realtype tt, realtype cj, N_Vector yy, N_Vector yp,
 int residual_eval_approx(sunindextype Nlocal, realtype tt, N_Vector yy,
                            N_Vector yp, N_Vector gval, void *user_data);
 
+template<class T>
+int precondition_setup(realtype tt, N_Vector yy, N_Vector yp, N_Vector rr,
+                         realtype cj, void *user_data);
+
+template<class T>
+int precondition_solve(realtype tt, N_Vector yy, N_Vector yp, N_Vector rr,
+                         N_Vector rvec, N_Vector zvec, realtype cj,
+                         realtype delta, void *user_data);
+
 #include "sundials_functions.inl"
 
 #endif // PYBAMM_SUNDIALS_FUNCTIONS_HPP
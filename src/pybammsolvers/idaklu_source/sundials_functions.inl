@@ -1,36 +1,139 @@
 #include "sundials_functions.hpp"
 #include "Expressions/Expressions.hpp"
 #include "common.hpp"
+#include "SolveStats.hpp"
+#include "Trace.hpp"
+#include <atomic>
+#include <initializer_list>
+#include <stdexcept>
+#include <string>
 #include <type_traits>
 
-#define NV_DATA NV_DATA_OMP  // Serial: NV_DATA_S
+#define NV_DATA host_data  // Serial, OpenMP or CUDA (managed) vectors
+
+// y <- alpha * mass_matrix * x + y, skipping the mass_action expression
+// if the mass matrix is diagonal
+template<class T>
+void mass_axpy(T *p_python_functions, realtype alpha, realtype *x, realtype *y)
+{
+  const int ns = p_python_functions->number_of_states;
+  if (p_python_functions->mass_matrix_is_identity) {
+    axpy(ns, alpha, x, y);
+  } else if (p_python_functions->mass_matrix_is_diagonal) {
+    diag_axpy(ns, alpha, p_python_functions->mass_matrix_diagonal.data(), x, y);
+  } else {
+    realtype *tmp = p_python_functions->get_tmp_state_vector();
+    p_python_functions->mass_action->m_arg[0] = x;
+    p_python_functions->mass_action->m_res[0] = tmp;
+    p_python_functions->evaluate(p_python_functions->mass_action);
+    axpy(ns, alpha, tmp, y);
+  }
+}
+
+// Evaluate the blocks of a partitioned expression (see
+// ExpressionSet::set_partition) on the solver's threads. Each block has its
+// own workspace and fills its own slice of `result`.
+//
+// Exceptions must not unwind through the IDAS frames of the calling
+// callback, so a failure is kept in callback_error and reported by returning
+// false; the callback then returns -1 (unrecoverable) and the solver raises
+// the message once IDAS has returned.
+template<class T>
+bool evaluate_blocks(
+  T *p_python_functions,
+  const std::vector<Expression*> &blocks,
+  const std::vector<int64_t> &offsets,
+  std::initializer_list<const realtype *> args,
+  realtype *result)
+{
+  const int number_of_blocks = static_cast<int>(blocks.size());
+  std::atomic<bool> failed(false);
+  std::string error;
+  #pragma omp parallel for schedule(dynamic) num_threads(p_python_functions->setup_opts.num_threads)
+  for (int k = 0; k < number_of_blocks; k++) {
+    Expression *block = blocks[k];
+    std::size_t i = 0;
+    for (const realtype *arg : args) {
+      block->m_arg[i++] = arg;
+    }
+    block->m_res[0] = result + offsets[k];
+    try {
+      p_python_functions->evaluate(block);
+    } catch (std::exception &e) {
+      // exceptions cannot leave the parallel region
+      #pragma omp critical
+      {
+        error = e.what();
+      }
+      failed = true;
+    }
+  }
+  if (failed) {
+    p_python_functions->callback_error = error;
+    return false;
+  }
+  return true;
+}
+
+// Evaluate the CSC values of dF/dy + cj dF/dyp (false on failure, see
+// evaluate_blocks)
+template<class T>
+bool evaluate_jac_times_cjmass(
+  T *p_python_functions, realtype &tt, N_Vector yy, realtype &cj, realtype *jac_data)
+{
+  if (!p_python_functions->jac_times_cjmass_blocks.empty()) {
+    return evaluate_blocks(
+      p_python_functions,
+      p_python_functions->jac_times_cjmass_blocks,
+      p_python_functions->jac_times_cjmass_block_offsets,
+      {&tt, NV_DATA(yy), p_python_functions->inputs.data(), &cj},
+      jac_data);
+  } else {
+    p_python_functions->jac_times_cjmass->m_arg[0] = &tt;
+    p_python_functions->jac_times_cjmass->m_arg[1] = NV_DATA(yy);
+    p_python_functions->jac_times_cjmass->m_arg[2] =
+        p_python_functions->inputs.data();
+    p_python_functions->jac_times_cjmass->m_arg[3] = &cj;
+    p_python_functions->jac_times_cjmass->m_res[0] = jac_data;
+    p_python_functions->evaluate(p_python_functions->jac_times_cjmass);
+  }
+  return true;
+}
 
 template<class T>
 int residual_eval(realtype tres, N_Vector yy, N_Vector yp, N_Vector rr, void *user_data)
 {
   DEBUG("residual_eval");
-  ExpressionSet<T> *p_python_functions =
-    static_cast<ExpressionSet<T> *>(user_data);
+  PhaseTimer timer(&SolveStats::residual_time);
+  TRACE_SPAN("residual");
+  wait_for_device(yy);
+  T *p_python_functions =
+    static_cast<T *>(user_data);
 
   DEBUG_VECTORn(yy, 100);
   DEBUG_VECTORn(yp, 100);
 
-  p_python_functions->rhs_alg->m_arg[0] = &tres;
-  p_python_functions->rhs_alg->m_arg[1] = NV_DATA(yy);
-  p_python_functions->rhs_alg->m_arg[2] = p_python_functions->inputs.data();
-  p_python_functions->rhs_alg->m_res[0] = NV_DATA(rr);
-  (*p_python_functions->rhs_alg)();
+  if (!p_python_functions->rhs_alg_blocks.empty()) {
+    if (!evaluate_blocks(
+          p_python_functions,
+          p_python_functions->rhs_alg_blocks,
+          p_python_functions->rhs_alg_block_offsets,
+          {&tres, NV_DATA(yy), p_python_functions->inputs.data()},
+          NV_DATA(rr))) {
+      return -1;
+    }
+  } else {
+    p_python_functions->rhs_alg->m_arg[0] = &tres;
+    p_python_functions->rhs_alg->m_arg[1] = NV_DATA(yy);
+    p_python_functions->rhs_alg->m_arg[2] = p_python_functions->inputs.data();
+    p_python_functions->rhs_alg->m_res[0] = NV_DATA(rr);
+    p_python_functions->evaluate(p_python_functions->rhs_alg);
+  }
 
   DEBUG_VECTORn(rr, 100);
 
-  realtype *tmp = p_python_functions->get_tmp_state_vector();
-  p_python_functions->mass_action->m_arg[0] = NV_DATA(yp);
-  p_python_functions->mass_action->m_res[0] = tmp;
-  (*p_python_functions->mass_action)();
-
-  // AXPY: y <- a*x + y
-  const int ns = p_python_functions->number_of_states;
-  axpy(ns, -1., tmp, NV_DATA(rr));
+  // rr <- rr - mass_matrix * yp
+  mass_axpy(p_python_functions, -1., NV_DATA(yp), NV_DATA(rr));
 
   DEBUG("mass - rhs");
   DEBUG_VECTORn(rr, 100);
@@ -74,11 +177,46 @@ int residual_eval_approx(sunindextype Nlocal, realtype tt, N_Vector yy,
 {
   DEBUG("residual_eval_approx");
 
-  // Just use true residual for now
+  // Just use true residual for now (which times itself)
   int result = residual_eval<T>(tt, yy, yp, gval, user_data);
   return result;
 }
 
+// Preconditioner setup of the "ILU" preconditioner: evaluate the analytic
+// Jacobian dF/dy + cj dF/dyp and factorise it on the pattern analysed by
+// the solver
+template<class T>
+int precondition_setup(realtype tt, N_Vector yy, N_Vector yp, N_Vector rr,
+                         realtype cj, void *user_data)
+{
+  DEBUG("precondition_setup");
+  PhaseTimer timer(&SolveStats::jacobian_time);
+  TRACE_SPAN("precondition_setup");
+  wait_for_device(yy);
+  T *p_python_functions = static_cast<T *>(user_data);
+
+  realtype *jac_data = p_python_functions->get_tmp_sparse_jacobian_data();
+  if (!evaluate_jac_times_cjmass(p_python_functions, tt, yy, cj, jac_data)) {
+    return -1;
+  }
+  p_python_functions->jac_times_cjmass_ilu.factorise(jac_data);
+  return 0;
+}
+
+// Preconditioner solve of the "ILU" preconditioner: zvec = (LU)^-1 rvec
+template<class T>
+int precondition_solve(realtype tt, N_Vector yy, N_Vector yp, N_Vector rr,
+                         N_Vector rvec, N_Vector zvec, realtype cj,
+                         realtype delta, void *user_data)
+{
+  DEBUG("precondition_solve");
+  TRACE_SPAN("precondition_solve");
+  wait_for_device(yy);
+  T *p_python_functions = static_cast<T *>(user_data);
+  p_python_functions->jac_times_cjmass_ilu.solve(NV_DATA(rvec), NV_DATA(zvec));
+  return 0;
+}
+
 // Purpose This function computes the product Jv of the DAE system Jacobian J
 // (or an approximation to it) and a given vector v, where J is defined by Eq.
 // (2.6).
@@ -105,27 +243,33 @@ int jtimes_eval(realtype tt, N_Vector yy, N_Vector yp, N_Vector rr,
                   N_Vector tmp1, N_Vector tmp2)
 {
   DEBUG("jtimes_eval");
+  PhaseTimer timer(&SolveStats::jacobian_time);
+  TRACE_SPAN("jtimes");
+  wait_for_device(yy);
   T *p_python_functions =
       static_cast<T *>(user_data);
 
   // Jv has ∂F/∂y v
-  p_python_functions->jac_action->m_arg[0] = &tt;
-  p_python_functions->jac_action->m_arg[1] = NV_DATA(yy);
-  p_python_functions->jac_action->m_arg[2] = p_python_functions->inputs.data();
-  p_python_functions->jac_action->m_arg[3] = NV_DATA(v);
-  p_python_functions->jac_action->m_res[0] = NV_DATA(Jv);
-  (*p_python_functions->jac_action)();
-
-  // tmp has -∂F/∂y˙ v
-  realtype *tmp = p_python_functions->get_tmp_state_vector();
-  p_python_functions->mass_action->m_arg[0] = NV_DATA(v);
-  p_python_functions->mass_action->m_res[0] = tmp;
-  (*p_python_functions->mass_action)();
-
-  // AXPY: y <- a*x + y
-  // Jv has ∂F/∂y v + cj ∂F/∂y˙ v
-  const int ns = p_python_functions->number_of_states;
-  axpy(ns, -cj, tmp, NV_DATA(Jv));
+  if (!p_python_functions->jac_action_blocks.empty()) {
+    if (!evaluate_blocks(
+          p_python_functions,
+          p_python_functions->jac_action_blocks,
+          p_python_functions->jac_action_block_offsets,
+          {&tt, NV_DATA(yy), p_python_functions->inputs.data(), NV_DATA(v)},
+          NV_DATA(Jv))) {
+      return -1;
+    }
+  } else {
+    p_python_functions->jac_action->m_arg[0] = &tt;
+    p_python_functions->jac_action->m_arg[1] = NV_DATA(yy);
+    p_python_functions->jac_action->m_arg[2] = p_python_functions->inputs.data();
+    p_python_functions->jac_action->m_arg[3] = NV_DATA(v);
+    p_python_functions->jac_action->m_res[0] = NV_DATA(Jv);
+    p_python_functions->evaluate(p_python_functions->jac_action);
+  }
+
+  // Jv has ∂F/∂y v + cj ∂F/∂y˙ v  (∂F/∂y˙ = -mass_matrix)
+  mass_axpy(p_python_functions, -cj, NV_DATA(v), NV_DATA(Jv));
 
   DEBUG_VECTORn(Jv, 10);
 
@@ -155,16 +299,31 @@ int jacobian_eval(realtype tt, realtype cj, N_Vector yy, N_Vector yp,
                     N_Vector tempv1, N_Vector tempv2, N_Vector tempv3)
 {
   DEBUG("jacobian_eval");
+  PhaseTimer timer(&SolveStats::jacobian_time);
+  TRACE_SPAN("jacobian");
+  wait_for_device(yy);
 
   T *p_python_functions =
       static_cast<T *>(user_data);
 
   // create pointer to jac data, column pointers, and row values
+  // (the sparsity pattern is installed once, when the matrix is created)
   realtype *jac_data;
-  if (p_python_functions->setup_opts.using_sparse_matrix)
+  // a device matrix is filled from a CSR copy on the host
+  bool const using_device = is_device_matrix(JJ);
+  bool const using_csr = using_device || (
+    p_python_functions->setup_opts.using_sparse_matrix &&
+    SUNSparseMatrix_SparseType(JJ) == CSR_MAT
+  );
+  if (p_python_functions->setup_opts.using_sparse_matrix && !using_csr)
   {
     jac_data = SUNSparseMatrix_Data(JJ);
   }
+  else if (using_csr)
+  {
+    // evaluate in CSC order, then gather into the CSR matrix
+    jac_data = p_python_functions->get_tmp_sparse_jacobian_data();
+  }
   else if (p_python_functions->setup_opts.using_banded_matrix) {
     jac_data = p_python_functions->get_tmp_sparse_jacobian_data();
   }
@@ -176,13 +335,9 @@ int jacobian_eval(realtype tt, realtype cj, N_Vector yy, N_Vector yp,
   DEBUG_VECTORn(yy, 100);
 
   // args are t, y, cj, put result in jacobian data matrix
-  p_python_functions->jac_times_cjmass->m_arg[0] = &tt;
-  p_python_functions->jac_times_cjmass->m_arg[1] = NV_DATA(yy);
-  p_python_functions->jac_times_cjmass->m_arg[2] =
-      p_python_functions->inputs.data();
-  p_python_functions->jac_times_cjmass->m_arg[3] = &cj;
-  p_python_functions->jac_times_cjmass->m_res[0] = jac_data;
-  (*p_python_functions->jac_times_cjmass)();
+  if (!evaluate_jac_times_cjmass(p_python_functions, tt, yy, cj, jac_data)) {
+    return -1;
+  }
 
   DEBUG("jac_times_cjmass [" << sizeof(jac_data) << "]");
   DEBUG("t = " << tt);
@@ -193,69 +348,34 @@ int jacobian_eval(realtype tt, realtype cj, N_Vector yy, N_Vector yp,
 
   if (p_python_functions->setup_opts.using_banded_matrix)
   {
-    // copy data from temporary matrix to the banded matrix
-    auto jac_colptrs = p_python_functions->jac_times_cjmass_colptrs.data();
-    auto jac_rowvals = p_python_functions->jac_times_cjmass_rowvals.data();
-    int ncols = p_python_functions->number_of_states;
-    for (int col_ij = 0; col_ij < ncols; col_ij++) {
-      realtype *banded_col = SM_COLUMN_B(JJ, col_ij);
-      for (auto data_i = jac_colptrs[col_ij]; data_i < jac_colptrs[col_ij+1]; data_i++) {
-        auto row_ij = jac_rowvals[data_i];
-        const realtype value_ij = jac_data[data_i];
-        DEBUG("(" << row_ij << ", " << col_ij << ") = " << value_ij);
-        SM_COLUMN_ELEMENT_B(banded_col, row_ij, col_ij) = value_ij;
-      }
+    // scatter the CSC values into the band storage (see SetBandScatter)
+    realtype *banded_data = SM_DATA_B(JJ);
+    auto scatter = p_python_functions->jac_times_cjmass_band_scatter.data();
+    const auto nnz = p_python_functions->jac_times_cjmass_band_scatter.size();
+    for (size_t i = 0; i < nnz; i++)
+    {
+      banded_data[scatter[i]] = jac_data[i];
     }
   }
-  else if (p_python_functions->setup_opts.using_sparse_matrix)
+  else if (using_csr)
   {
-    if (SUNSparseMatrix_SparseType(JJ) == CSC_MAT)
+    realtype *csr_data = using_device ?
+      p_python_functions->jac_times_cjmass_csr_data.data() :
+      SUNSparseMatrix_Data(JJ);
+    auto gather = p_python_functions->jac_times_cjmass_csr_gather.data();
+    const auto nnz = p_python_functions->jac_times_cjmass_csr_gather.size();
+    for (size_t i = 0; i < nnz; i++)
     {
-      sunindextype *jac_colptrs = SUNSparseMatrix_IndexPointers(JJ);
-      sunindextype *jac_rowvals = SUNSparseMatrix_IndexValues(JJ);
-      // row vals and col ptrs
-      const int n_row_vals = p_python_functions->jac_times_cjmass_rowvals.size();
-      auto p_jac_times_cjmass_rowvals =
-          p_python_functions->jac_times_cjmass_rowvals.data();
-
-      // just copy across row vals (do I need to do this every time?)
-      // (or just in the setup?)
-      for (int i = 0; i < n_row_vals; i++)
-      {
-        jac_rowvals[i] = p_jac_times_cjmass_rowvals[i];
-      }
-
-      const int n_col_ptrs = p_python_functions->jac_times_cjmass_colptrs.size();
-      auto p_jac_times_cjmass_colptrs =
-          p_python_functions->jac_times_cjmass_colptrs.data();
-
-      // just copy across col ptrs (do I need to do this every time?)
-      for (int i = 0; i < n_col_ptrs; i++)
-      {
-        jac_colptrs[i] = p_jac_times_cjmass_colptrs[i];
-      }
-    } else if (SUNSparseMatrix_SparseType(JJ) == CSR_MAT) {
-      // make a copy so that we can overwrite jac_data as CSR
-      std::vector<realtype> newjac(&jac_data[0], &jac_data[SUNSparseMatrix_NNZ(JJ)]);
-      sunindextype *jac_ptrs = SUNSparseMatrix_IndexPointers(JJ);
-      sunindextype *jac_vals = SUNSparseMatrix_IndexValues(JJ);
-
-      // convert CSC format to CSR
-      csc_csr<
-          std::remove_pointer_t<decltype(p_python_functions->jac_times_cjmass_rowvals.data())>,
-          std::remove_pointer_t<decltype(jac_vals)>
-      >(
-        newjac.data(),
-        p_python_functions->jac_times_cjmass_rowvals.data(),
-        p_python_functions->jac_times_cjmass_colptrs.data(),
-        jac_data,
-        jac_ptrs,
-        jac_vals,
-        SUNSparseMatrix_NNZ(JJ),
-        SUNSparseMatrix_NP(JJ)
-      );
-    } else
-      throw std::runtime_error("Unknown matrix format detected (Expected CSC or CSR)");
+      csr_data[i] = jac_data[gather[i]];
+    }
+#ifdef CUDA_ENABLE
+    if (using_device &&
+        SUNMatrix_cuSparse_CopyToDevice(JJ, csr_data, NULL, NULL) != 0)
+    {
+      // the device Jacobian would be stale: fail the solve
+      return -1;
+    }
+#endif
   }
 
   return (0);
@@ -266,6 +386,8 @@ int events_eval(realtype t, N_Vector yy, N_Vector yp, realtype *events_ptr,
                   void *user_data)
 {
   DEBUG("events_eval");
+  TRACE_SPAN("events");
+  wait_for_device(yy);
   T *p_python_functions =
       static_cast<T*>(user_data);
 
@@ -274,7 +396,7 @@ int events_eval(realtype t, N_Vector yy, N_Vector yp, realtype *events_ptr,
   p_python_functions->events->m_arg[1] = NV_DATA(yy);
   p_python_functions->events->m_arg[2] = p_python_functions->inputs.data();
   p_python_functions->events->m_res[0] = events_ptr;
-  (*p_python_functions->events)();
+  p_python_functions->evaluate(p_python_functions->events);
 
   return (0);
 }
@@ -308,6 +430,9 @@ int sensitivities_eval(int Ns, realtype t, N_Vector yy, N_Vector yp,
 {
 
   DEBUG("sensitivities_eval");
+  PhaseTimer timer(&SolveStats::residual_time);
+  TRACE_SPAN("sensitivities");
+  wait_for_device(yy);
   T *p_python_functions =
       static_cast<T*>(user_data);
 
@@ -322,7 +447,33 @@ int sensitivities_eval(int Ns, realtype t, N_Vector yy, N_Vector yp,
     p_python_functions->sens->m_res[i] = NV_DATA(resvalS[i]);
   }
   // resvalsS now has (∂F/∂p i )
-  (*p_python_functions->sens)();
+  p_python_functions->evaluate(p_python_functions->sens);
+
+  const int ns = p_python_functions->number_of_states;
+
+  if (p_python_functions->jac_action_batched != nullptr)
+  {
+    // evaluate (∂F/∂y)[s_0 .. s_np] in a single call
+    realtype *block_in = p_python_functions->get_tmp_sensitivity_block();
+    realtype *block_out = block_in + ns * np;
+    for (int i = 0; i < np; i++)
+    {
+      std::memcpy(block_in + i * ns, NV_DATA(yS[i]), ns * sizeof(realtype));
+    }
+    p_python_functions->jac_action_batched->m_arg[0] = &t;
+    p_python_functions->jac_action_batched->m_arg[1] = NV_DATA(yy);
+    p_python_functions->jac_action_batched->m_arg[2] = p_python_functions->inputs.data();
+    p_python_functions->jac_action_batched->m_arg[3] = block_in;
+    p_python_functions->jac_action_batched->m_res[0] = block_out;
+    p_python_functions->evaluate(p_python_functions->jac_action_batched);
+
+    for (int i = 0; i < np; i++)
+    {
+      axpy(ns, 1., block_out + i * ns, NV_DATA(resvalS[i]));
+      mass_axpy(p_python_functions, -1., NV_DATA(ypS[i]), NV_DATA(resvalS[i]));
+    }
+    return 0;
+  }
 
   for (int i = 0; i < np; i++)
   {
@@ -333,20 +484,138 @@ int sensitivities_eval(int Ns, realtype t, N_Vector yy, N_Vector yp,
     p_python_functions->jac_action->m_arg[2] = p_python_functions->inputs.data();
     p_python_functions->jac_action->m_arg[3] = NV_DATA(yS[i]);
     p_python_functions->jac_action->m_res[0] = tmp;
-    (*p_python_functions->jac_action)();
+    p_python_functions->evaluate(p_python_functions->jac_action);
 
-    const int ns = p_python_functions->number_of_states;
     axpy(ns, 1., tmp, NV_DATA(resvalS[i]));
 
-    // put -(∂F/∂ ẏ) ṡ i (t) in tmp2
-    p_python_functions->mass_action->m_arg[0] = NV_DATA(ypS[i]);
-    p_python_functions->mass_action->m_res[0] = tmp;
-    (*p_python_functions->mass_action)();
-
     // (∂F/∂y)s i (t)+(∂F/∂ ẏ) ṡ i (t)+(∂F/∂p i )
-    // AXPY: y <- a*x + y
-    axpy(ns, -1., tmp, NV_DATA(resvalS[i]));
+    mass_axpy(p_python_functions, -1., NV_DATA(ypS[i]), NV_DATA(resvalS[i]));
+  }
+
+  return 0;
+}
+
+// Residual of the adjoint system of the loss L = int g dt,
+//   (J^T) yB + (M^T) ypB - (dg/dy)^T = 0,
+// where J = ∂F/∂y and M = -∂F/∂y˙ are evaluated on the forward solution yy
+// (IDAS interpolates it from the checkpoints). yB is the adjoint variable.
+template<class T>
+int adjoint_residual_eval(realtype t, N_Vector yy, N_Vector yp, N_Vector yB,
+                            N_Vector ypB, N_Vector rrB, void *user_dataB)
+{
+  DEBUG("adjoint_residual_eval");
+  PhaseTimer timer(&SolveStats::residual_time);
+  TRACE_SPAN("adjoint_residual");
+  wait_for_device(yy);
+  auto *adjoint = static_cast<AdjointData<T> *>(user_dataB);
+  T *p_python_functions = adjoint->functions;
+  const int ns = p_python_functions->number_of_states;
+
+  // Jacobian values (cj = 0 leaves ∂F/∂y only)
+  realtype cj = 0.0;
+  p_python_functions->jac_times_cjmass->m_arg[0] = &t;
+  p_python_functions->jac_times_cjmass->m_arg[1] = NV_DATA(yy);
+  p_python_functions->jac_times_cjmass->m_arg[2] =
+      p_python_functions->inputs.data();
+  p_python_functions->jac_times_cjmass->m_arg[3] = &cj;
+  p_python_functions->jac_times_cjmass->m_res[0] = adjoint->jac.data();
+  p_python_functions->evaluate(p_python_functions->jac_times_cjmass);
+
+  realtype *rr = NV_DATA(rrB);
+  std::fill_n(rr, ns, 0.0);
+  jacobian_pattern_transpose_axpy(
+    p_python_functions, adjoint->jac.data(), NV_DATA(yB), rr);
+
+  if (p_python_functions->mass_matrix_is_diagonal) {
+    mass_axpy(p_python_functions, 1., NV_DATA(ypB), rr);
+  } else {
+    jacobian_pattern_transpose_axpy(
+      p_python_functions, adjoint->mass.data(), NV_DATA(ypB), rr);
+  }
+
+  // rrB <- rrB - (dg/dy)^T
+  T::evaluate(adjoint->dloss_dy, &t, NV_DATA(yy),
+    p_python_functions->inputs.data(), adjoint->res.data());
+  const auto &cols = adjoint->dloss_dy->get_col();
+  for (expr_int k = 0; k < adjoint->dloss_dy->nnz_out(); k++) {
+    rr[cols[k]] -= adjoint->res[k];
   }
+  return 0;
+}
 
+// Jacobian of the adjoint residual, J^T + cjB M^T = (∂F/∂y - (-cjB) ∂F/∂y˙)^T.
+// JB is a CSR matrix with the (CSC) pattern of the forward Jacobian, so
+// the CSC values of the forward Jacobian at cj = -cjB are its values.
+template<class T>
+int adjoint_jacobian_eval(realtype tt, realtype cjB, N_Vector yy, N_Vector yp,
+                            N_Vector yB, N_Vector ypB, N_Vector rrB, SUNMatrix JB,
+                            void *user_dataB, N_Vector tmp1B, N_Vector tmp2B,
+                            N_Vector tmp3B)
+{
+  DEBUG("adjoint_jacobian_eval");
+  PhaseTimer timer(&SolveStats::jacobian_time);
+  TRACE_SPAN("adjoint_jacobian");
+  wait_for_device(yy);
+  auto *adjoint = static_cast<AdjointData<T> *>(user_dataB);
+  T *p_python_functions = adjoint->functions;
+
+  realtype cj = -cjB;
+  p_python_functions->jac_times_cjmass->m_arg[0] = &tt;
+  p_python_functions->jac_times_cjmass->m_arg[1] = NV_DATA(yy);
+  p_python_functions->jac_times_cjmass->m_arg[2] =
+      p_python_functions->inputs.data();
+  p_python_functions->jac_times_cjmass->m_arg[3] = &cj;
+  p_python_functions->jac_times_cjmass->m_res[0] = SUNSparseMatrix_Data(JB);
+  p_python_functions->evaluate(p_python_functions->jac_times_cjmass);
+  return 0;
+}
+
+// Integrands of the backward quadratures, which IDAS integrates from tf
+// down to t0 (so each is the negative of the forward integrand):
+//   [0]: -g, giving L
+//   [1 + i]: yB^T ∂F/∂p_i - ∂g/∂p_i, giving int (∂g/∂p_i - yB^T ∂F/∂p_i) dt
+template<class T>
+int adjoint_quadrature_eval(realtype t, N_Vector yy, N_Vector yp, N_Vector yB,
+                              N_Vector ypB, N_Vector rhsvalBQ, void *user_dataB)
+{
+  DEBUG("adjoint_quadrature_eval");
+  PhaseTimer timer(&SolveStats::residual_time);
+  TRACE_SPAN("adjoint_quadrature");
+  wait_for_device(yy);
+  auto *adjoint = static_cast<AdjointData<T> *>(user_dataB);
+  T *p_python_functions = adjoint->functions;
+  const int ns = p_python_functions->number_of_states;
+  const int np = p_python_functions->number_of_parameters;
+  realtype *q = NV_DATA(rhsvalBQ);
+  const realtype *y = NV_DATA(yy);
+  const realtype *lambda = NV_DATA(yB);
+  const realtype *inputs = p_python_functions->inputs.data();
+
+  T::evaluate(adjoint->loss, &t, y, inputs, adjoint->res.data());
+  q[0] = -adjoint->res[0];
+
+  // ∂F/∂p, one vector per parameter
+  p_python_functions->sens->m_arg[0] = &t;
+  p_python_functions->sens->m_arg[1] = y;
+  p_python_functions->sens->m_arg[2] = inputs;
+  for (int i = 0; i < np; i++) {
+    p_python_functions->sens->m_res[i] = adjoint->sens.data() + i * ns;
+  }
+  p_python_functions->evaluate(p_python_functions->sens);
+  for (int i = 0; i < np; i++) {
+    const realtype *dF_dp = adjoint->sens.data() + i * ns;
+    realtype sum = 0.0;
+    #pragma omp simd reduction(+:sum)
+    for (int j = 0; j < ns; j++) {
+      sum += lambda[j] * dF_dp[j];
+    }
+    q[1 + i] = sum;
+  }
+
+  T::evaluate(adjoint->dloss_dp, &t, y, inputs, adjoint->res.data());
+  const auto &rows = adjoint->dloss_dp->get_row();
+  for (expr_int k = 0; k < adjoint->dloss_dp->nnz_out(); k++) {
+    q[1 + rows[k]] -= adjoint->res[k];
+  }
   return 0;
 }
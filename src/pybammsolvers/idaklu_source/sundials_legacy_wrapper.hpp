@@ -62,6 +62,11 @@
     return SUNLinSol_Dense(y, A, sunctx);
   }
 
+  SUNLinearSolver SUNLinSolNewEmpty(SUNContext sunctx)
+  {
+    return SUNLinSolNewEmpty();
+  }
+
   SUNLinearSolver SUNLinSol_KLU(N_Vector y, SUNMatrix A, SUNContext sunctx)
   {
     return SUNLinSol_KLU(y, A, sunctx);
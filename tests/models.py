@@ -0,0 +1,348 @@
+"""
+Small casadi models for the solver tests, built as in benchmarks/solver_suite.py
+"""
+
+import casadi
+import numpy as np
+
+from pybammsolvers import idaklu
+
+
+def base_options(**overrides):
+    options = {
+        # setup
+        "jacobian": "sparse",
+        "preconditioner": "none",
+        "precon_half_bandwidth": 5,
+        "precon_half_bandwidth_keep": 5,
+        "num_threads": 1,
+        "num_solvers": 1,
+        "linear_solver": "SUNLinSol_KLU",
+        "linsol_max_iterations": 5,
+        # solver
+        "print_stats": False,
+        "max_order_bdf": 5,
+        "max_num_steps": 100_000,
+        "dt_init": 0.0,
+        "dt_max": 0.0,
+        "max_error_test_failures": 10,
+        "max_nonlinear_iterations": 40,
+        "max_convergence_failures": 100,
+        "nonlinear_convergence_coefficient": 0.33,
+        "nonlinear_convergence_coefficient_ic": 0.0033,
+        "suppress_algebraic_error": False,
+        "hermite_interpolation": True,
+        "calc_ic": True,
+        "init_all_y_ic": False,
+        "max_num_steps_ic": 50,
+        "max_num_jacobians_ic": 40,
+        "max_num_iterations_ic": 100,
+        "max_linesearch_backtracks_ic": 100,
+        "linesearch_off_ic": False,
+        "linear_solution_scaling": True,
+        "epsilon_linear_tolerance": 0.05,
+        "increment_factor": 1.0,
+    }
+    options.update(overrides)
+    return options
+
+
+def particle_rhs(c, diffusivity, surface_flux):
+    """Finite volume diffusion in a particle of len(c) shells"""
+    n = c.shape[0]
+    dr = 1.0 / n
+    d = diffusivity * (1 + 0.5 * c)
+    flux = [-0.5 * (d[i] + d[i + 1]) * (c[i + 1] - c[i]) / dr for i in range(n - 1)]
+    flux = [0] + flux + [surface_flux]
+    return casadi.vertcat(*[-(flux[i + 1] - flux[i]) / dr for i in range(n)])
+
+
+class Model:
+    """The casadi functions of a DAE F(t, y, p) = M y'"""
+
+    def __init__(self, rhs, y, p, t, mass, y0, event=None):
+        self.symbols = (t, y, p)
+        self.n = y.shape[0]
+        self.n_inputs = p.shape[0]
+        self.mass = np.asarray(mass, dtype=float)
+        self.y0 = np.asarray(y0, dtype=float)
+
+        cj = casadi.SX.sym("cj")
+        v = casadi.SX.sym("v", self.n)
+        jac = casadi.jacobian(rhs, y) - cj * casadi.diag(casadi.SX(self.mass))
+        self.rhs_alg = casadi.Function("rhs_alg", [t, y, p], [rhs])
+        self.jac_times_cjmass = casadi.Function(
+            "jac_times_cjmass", [t, y, p, cj], [jac]
+        )
+        self.jac_action = casadi.Function(
+            "jac_action", [t, y, p, v], [casadi.jtimes(rhs, y, v)]
+        )
+        self.mass_action = casadi.Function(
+            "mass_action", [v], [casadi.SX(self.mass) * v]
+        )
+        dfdp = casadi.jacobian(rhs, p)
+        self.sens = casadi.Function(
+            "sens",
+            [t, y, p],
+            [casadi.densify(dfdp[:, i]) for i in range(self.n_inputs)],
+        )
+        # By default a cut-off that is never reached
+        self.events = casadi.Function(
+            "events", [t, y, p], [y[0] + 1e3 if event is None else event]
+        )
+        self.output = casadi.Function("output", [t, y, p], [casadi.sum1(y) / self.n])
+
+        sparsity = self.jac_times_cjmass.sparsity_out(0)
+        self.colptrs = np.array(sparsity.colind(), dtype=np.int64)
+        self.rowvals = np.array(sparsity.row(), dtype=np.int64)
+        self.nnz = sparsity.nnz()
+        cols = np.repeat(np.arange(self.n), np.diff(self.colptrs))
+        self.bandwidth_lower = int(np.max(self.rowvals - cols))
+        self.bandwidth_upper = int(np.max(cols - self.rowvals))
+
+    def consistent_yp0(self, inputs):
+        """yp0 of the differential states (algebraic ones are found by calc_ic)"""
+        f = np.array(self.rhs_alg(0.0, self.y0, inputs)).ravel()
+        return np.where(self.mass != 0, f / np.where(self.mass != 0, self.mass, 1), 0)
+
+    def output_functions(self, expressions):
+        """var_fcns, dvar_dy_fcns and dvar_dp_fcns of expressions in (t, y, p)"""
+        t, y, p = self.symbols
+        return (
+            [casadi.Function("var", [t, y, p], [e]) for e in expressions],
+            [
+                casadi.Function("dvar_dy", [t, y, p], [casadi.jacobian(e, y)])
+                for e in expressions
+            ],
+            # one row per parameter
+            [
+                casadi.Function("dvar_dp", [t, y, p], [casadi.jacobian(e, p).T])
+                for e in expressions
+            ],
+        )
+
+    def fused_output_function(self, expressions):
+        """var_fused: the nonzeros of all the expressions back to back"""
+        t, y, p = self.symbols
+        return casadi.Function(
+            "var_fused", [t, y, p], [casadi.vertcat(*[e.nz[:] for e in expressions])]
+        )
+
+    def block_functions(self, number_of_blocks):
+        """
+        rhs_alg, jac_times_cjmass and jac_action split into consecutive blocks
+        of rows (of columns for the Jacobian)
+        """
+        t, y, p = self.symbols
+        cj = casadi.SX.sym("cj")
+        v = casadi.SX.sym("v", self.n)
+        rhs = self.rhs_alg(t, y, p)
+        jac = self.jac_times_cjmass(t, y, p, cj)
+        jac_v = self.jac_action(t, y, p, v)
+        edges = np.linspace(0, self.n, number_of_blocks + 1).astype(int)
+        slices = [slice(a, b) for a, b in zip(edges[:-1], edges[1:])]
+        return (
+            [casadi.Function("rhs_alg", [t, y, p], [rhs[s]]) for s in slices],
+            [
+                casadi.Function("jac_times_cjmass", [t, y, p, cj], [jac[:, s]])
+                for s in slices
+            ],
+            [casadi.Function("jac_action", [t, y, p, v], [jac_v[s]]) for s in slices],
+        )
+
+    def create_solver(
+        self,
+        number_of_parameters=0,
+        outputs=(),
+        blocks=0,
+        codegen=False,
+        fused=False,
+        **options,
+    ):
+        """
+        A solver group; `outputs` are expressions in `symbols` that are saved
+        instead of the states (evaluated by a single var_fused function if
+        `fused`), and the model functions are partitioned into `blocks` blocks
+        if it is positive. With `codegen`, the functions are compiled from
+        casadi generated C code instead of called through casadi.
+        """
+        if codegen:
+            generator = casadi.CodeGenerator("model")
+            compiled = []
+
+            def convert(f):
+                # One source for all the functions, so their names must differ
+                symbols = f.sx_in()
+                f = casadi.Function(
+                    f"{f.name()}_{len(compiled)}", symbols, f.call(symbols)
+                )
+                generator.add(f)
+                compiled.append(idaklu.CodegenFunction(f.name(), ""))
+                return compiled[-1]
+
+        else:
+
+            def convert(f):
+                return idaklu.generate_function(f.serialize())
+
+        arguments = self.solver_arguments(
+            convert, number_of_parameters, outputs, blocks, fused, options
+        )
+
+        if codegen:
+            source = generator.dump()
+            for function in compiled:
+                function.source = source
+            return idaklu.create_codegen_solver_group(**arguments)
+        return idaklu.create_casadi_solver_group(**arguments)
+
+    def solver_arguments(
+        self,
+        convert,
+        number_of_parameters=0,
+        outputs=(),
+        blocks=0,
+        fused=False,
+        options=None,
+    ):
+        """The arguments of the solver group factories, with `convert` applied
+        to each function"""
+        var_fcns, dvar_dy_fcns, dvar_dp_fcns = self.output_functions(outputs)
+        rhs_alg_blocks, jac_times_cjmass_blocks, jac_action_blocks = (
+            self.block_functions(blocks) if blocks > 0 else ([], [], [])
+        )
+
+        return dict(
+            number_of_states=self.n,
+            number_of_parameters=number_of_parameters,
+            rhs_alg=convert(self.rhs_alg),
+            jac_times_cjmass=convert(self.jac_times_cjmass),
+            jac_times_cjmass_colptrs=self.colptrs,
+            jac_times_cjmass_rowvals=self.rowvals,
+            jac_times_cjmass_nnz=self.nnz,
+            jac_bandwidth_lower=self.bandwidth_lower,
+            jac_bandwidth_upper=self.bandwidth_upper,
+            jac_action=convert(self.jac_action),
+            mass_action=convert(self.mass_action),
+            sens=convert(self.sens),
+            events=convert(self.events),
+            number_of_events=1,
+            rhs_alg_id=(self.mass != 0).astype(float),
+            atol=np.full(self.n, 1e-6),
+            rtol=1e-6,
+            inputs=self.n_inputs,
+            var_fcns=[convert(f) for f in var_fcns],
+            dvar_dy_fcns=[convert(f) for f in dvar_dy_fcns],
+            dvar_dp_fcns=[convert(f) for f in dvar_dp_fcns],
+            options=base_options(**(options or {})),
+            rhs_alg_blocks=[convert(f) for f in rhs_alg_blocks],
+            jac_times_cjmass_blocks=[convert(f) for f in jac_times_cjmass_blocks],
+            jac_action_blocks=[convert(f) for f in jac_action_blocks],
+            var_fused=convert(self.fused_output_function(outputs)) if fused else None,
+        )
+
+    def autotune(
+        self,
+        t_eval,
+        inputs,
+        number_of_parameters=0,
+        repeats=1,
+        cache_dir="",
+        **options,
+    ):
+        """The options chosen by the autotuner for solving the rows of `inputs`"""
+        inputs = np.atleast_2d(np.asarray(inputs, dtype=float))
+        y0, yp0 = self.initial_rows(inputs, number_of_parameters)
+        return idaklu.autotune_casadi_solver_group(
+            **self.solver_arguments(
+                lambda f: idaklu.generate_function(f.serialize()),
+                number_of_parameters,
+                options=options,
+            ),
+            t_eval=np.asarray(t_eval, dtype=float),
+            y0=y0,
+            yp0=yp0,
+            inputs_sample=inputs,
+            repeats=repeats,
+            cache_dir=str(cache_dir),
+        )
+
+    def initial_rows(self, inputs, number_of_parameters=0):
+        """y0 and yp0 rows (states, then zero sensitivities) for each input row"""
+        n_coeffs = self.n * (1 + number_of_parameters)
+        y0 = np.zeros((len(inputs), n_coeffs))
+        yp0 = np.zeros((len(inputs), n_coeffs))
+        for i, row in enumerate(inputs):
+            y0[i, : self.n] = self.y0
+            yp0[i, : self.n] = self.consistent_yp0(row)
+        return y0, yp0
+
+    def solve(self, solver, t_eval, inputs, number_of_parameters=0):
+        """The solution of a single input row, saving the adaptive steps"""
+        inputs = np.atleast_2d(np.asarray(inputs, dtype=float))
+        y0, yp0 = self.initial_rows(inputs, number_of_parameters)
+        return solver.solve(np.asarray(t_eval, dtype=float), np.array([]), y0, yp0, inputs)[0]
+
+    def states(self, solution, name="y"):
+        """The states (or their derivatives) of a solution, one column per time"""
+        t = np.asarray(solution.t)
+        values = np.asarray(getattr(solution, name), dtype=float)
+        return np.asfortranarray(values.reshape(len(t), self.n).T)
+
+
+def spm(n_shells, event=None):
+    """
+    Two particles with nonlinear diffusion, driven by a surface flux p[0].
+
+    The mean concentration of the first particle is 0.8 + p[0] t. `event`
+    maps the states y to an event expression.
+    """
+    t = casadi.SX.sym("t")
+    y = casadi.SX.sym("y", 2 * n_shells)
+    p = casadi.SX.sym("p", 2)  # current, diffusivity
+    negative = particle_rhs(y[:n_shells], p[1], -p[0])
+    positive = particle_rhs(y[n_shells:], p[1], p[0])
+    rhs = casadi.vertcat(negative, positive)
+    y0 = np.concatenate([np.full(n_shells, 0.8), np.full(n_shells, 0.2)])
+    return Model(
+        rhs, y, p, t, np.ones(2 * n_shells), y0, None if event is None else event(y)
+    )
+
+
+def dfn(n_nodes, n_shells):
+    """
+    Electrolyte diffusion, an algebraic potential with Butler-Volmer kinetics
+    and a particle at every electrolyte node (a semi-explicit DAE)
+    """
+    t = casadi.SX.sym("t")
+    n_particles = n_nodes * n_shells
+    y = casadi.SX.sym("y", 2 * n_nodes + n_particles)
+    p = casadi.SX.sym("p", 2)  # current, diffusivity
+    ce = y[:n_nodes]
+    phi = y[n_nodes : 2 * n_nodes]
+    offset = 2 * n_nodes
+    cs = [
+        y[offset + k * n_shells : offset + (k + 1) * n_shells] for k in range(n_nodes)
+    ]
+    dx = 1.0 / n_nodes
+
+    j = [
+        casadi.sinh(0.5 * (phi[k] - (0.5 - 0.2 * cs[k][n_shells - 1])))
+        for k in range(n_nodes)
+    ]
+    ce_flux = [0] + [-(ce[k + 1] - ce[k]) / dx for k in range(n_nodes - 1)] + [0]
+    i_e = (
+        [0]
+        + [-(1 + 0.1 * ce[k]) * (phi[k + 1] - phi[k]) / dx for k in range(n_nodes - 1)]
+        + [p[0]]
+    )
+    dce = [-(ce_flux[k + 1] - ce_flux[k]) / dx + 0.1 * j[k] for k in range(n_nodes)]
+    alg = [(i_e[k + 1] - i_e[k]) / dx - j[k] for k in range(n_nodes)]
+    dcs = [particle_rhs(cs[k], p[1], 0.1 * j[k]) for k in range(n_nodes)]
+
+    rhs = casadi.vertcat(*dce, *alg, *dcs)
+    mass = np.concatenate([np.ones(n_nodes), np.zeros(n_nodes), np.ones(n_particles)])
+    y0 = np.concatenate(
+        [np.ones(n_nodes), np.zeros(n_nodes), np.full(n_particles, 0.5)]
+    )
+    return Model(rhs, y, p, t, mass, y0)
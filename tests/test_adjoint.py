@@ -0,0 +1,47 @@
+import numpy as np
+import pytest
+
+from .models import dfn, spm
+
+
+def trapezoid(values, t):
+    """Trapezoidal integral along the first axis"""
+    dt = np.diff(t).reshape((-1,) + (1,) * (values.ndim - 1))
+    return np.sum(0.5 * dt * (values[1:] + values[:-1]), axis=0)
+
+
+@pytest.mark.parametrize(
+    "model, t_final, inputs",
+    [
+        (spm(10), 60.0, [0.01, 1.0]),
+        (dfn(5, 4), 100.0, [1.0, 1.0]),
+    ],
+)
+def test_adjoint_matches_forward_sensitivities(model, t_final, inputs):
+    _, y, p = model.symbols
+    # Depends on p directly as well as through the states
+    loss = y[0] ** 2 + 0.1 * p[1] * y[model.n - 1]
+    number_of_parameters = model.n_inputs
+    inputs = np.array([inputs])
+    y0, yp0 = model.initial_rows(inputs, number_of_parameters)
+    t_eval = np.array([0.0, t_final])
+
+    forward = model.create_solver(number_of_parameters, outputs=[loss]).solve(
+        t_eval, np.linspace(0.0, t_final, 2001), y0, yp0, inputs
+    )[0]
+    assert forward.flag >= 0
+    t = np.asarray(forward.t)
+    g = np.asarray(forward.y)
+    dg_dp = np.asarray(forward.yS).reshape(len(t), number_of_parameters)
+
+    adjoint = model.create_solver(number_of_parameters, outputs=[loss])
+    loss_value, gradient, flag = adjoint.solve_adjoint(t_eval, y0, yp0, inputs, 0)
+    assert flag[0] >= 0
+
+    np.testing.assert_allclose(loss_value[0], trapezoid(g, t), rtol=1e-4)
+    np.testing.assert_allclose(
+        gradient[0],
+        trapezoid(dg_dp, t),
+        rtol=1e-3,
+        atol=1e-6 * np.max(np.abs(dg_dp)) * t_final,
+    )
@@ -0,0 +1,51 @@
+import numpy as np
+import pytest
+
+from .models import spm
+
+
+def test_autotune_returns_a_usable_configuration(tmp_path):
+    model = spm(10)
+    inputs = np.array([[0.01, 1.0], [0.005, 0.5], [0.002, 2.0], [0.008, 1.5]])
+    t_eval = np.array([0.0, 60.0])
+
+    tuned = model.autotune(t_eval, inputs, num_threads=2, cache_dir=tmp_path)
+    assert tuned["linear_solver"] in {
+        "SUNLinSol_KLU",
+        "SUNLinSol_Band",
+        "SUNLinSol_Dense",
+        "SUNLinSol_SPGMR",
+    }
+    assert tuned["num_threads"] == 2
+    assert tuned["num_solvers"] in {1, 2}
+
+    y0, yp0 = model.initial_rows(inputs)
+    t_interp = np.linspace(0.0, 60.0, 13)
+    expected = model.create_solver(num_threads=2).solve(
+        t_eval, t_interp, y0, yp0, inputs
+    )
+    solutions = model.create_solver(**tuned).solve(t_eval, t_interp, y0, yp0, inputs)
+    for solution, row in zip(solutions, expected):
+        assert solution.flag >= 0
+        np.testing.assert_allclose(
+            model.states(solution), model.states(row), rtol=1e-4, atol=1e-6
+        )
+
+
+def test_autotune_reuses_the_cached_configuration(tmp_path):
+    model = spm(10)
+    inputs = np.array([[0.01, 1.0], [0.005, 0.5]])
+    t_eval = np.array([0.0, 60.0])
+
+    tuned = model.autotune(t_eval, inputs, num_threads=2, cache_dir=tmp_path)
+    entries = sorted(path.name for path in tmp_path.iterdir())
+    assert len(entries) == 1
+
+    # No candidate solves a sample of NaN inputs, so it is only accepted if
+    # the trials are skipped (the sample values are not part of the key)
+    unsolvable = np.full_like(inputs, np.nan)
+    with pytest.raises(RuntimeError, match="no candidate"):
+        model.autotune(t_eval, unsolvable, num_threads=2, cache_dir=tmp_path / "new")
+    cached = model.autotune(t_eval, unsolvable, num_threads=2, cache_dir=tmp_path)
+    assert cached == tuned
+    assert sorted(path.name for path in tmp_path.iterdir()) == entries
@@ -0,0 +1,97 @@
+import gc
+
+import casadi
+import numpy as np
+import pytest
+
+from pybammsolvers import idaklu
+
+from .models import spm
+
+pytestmark = pytest.mark.skipif(
+    not hasattr(idaklu, "create_codegen_solver_group"),
+    reason="idaklu was built without the codegen backend",
+)
+
+
+def solve_both(model, inputs, **options):
+    y0, yp0 = model.initial_rows(inputs, model.n_inputs)
+    t_eval = np.array([0.0, 60.0])
+    t_interp = np.linspace(0.0, 60.0, 13)
+    return [
+        model.create_solver(model.n_inputs, codegen=codegen, **options).solve(
+            t_eval, t_interp, y0, yp0, inputs
+        )
+        for codegen in (False, True)
+    ]
+
+
+@pytest.fixture
+def codegen_cache(tmp_path, monkeypatch):
+    monkeypatch.setenv("PYBAMM_CODEGEN_CACHE_DIR", str(tmp_path / "codegen"))
+    return tmp_path / "codegen"
+
+
+def test_codegen_matches_casadi(codegen_cache):
+    model = spm(10)
+    inputs = np.array([[0.01, 1.0], [0.005, 0.5]])
+
+    for casadi_row, codegen_row in zip(*solve_both(model, inputs)):
+        assert codegen_row.flag == casadi_row.flag
+        np.testing.assert_array_equal(
+            np.asarray(codegen_row.t), np.asarray(casadi_row.t)
+        )
+        np.testing.assert_allclose(
+            model.states(codegen_row), model.states(casadi_row), rtol=1e-6, atol=1e-8
+        )
+        np.testing.assert_allclose(
+            np.asarray(codegen_row.yS), np.asarray(casadi_row.yS), rtol=1e-5, atol=1e-8
+        )
+
+
+def test_codegen_outputs_match_casadi(codegen_cache):
+    model = spm(10)
+    _, y, p = model.symbols
+    outputs = [casadi.sum1(y) / model.n, y[0] * p[1]]
+    inputs = np.array([[0.01, 1.0], [0.005, 0.5]])
+
+    for casadi_row, codegen_row in zip(*solve_both(model, inputs, outputs=outputs)):
+        np.testing.assert_allclose(
+            np.asarray(codegen_row.y), np.asarray(casadi_row.y), rtol=1e-6, atol=1e-8
+        )
+        np.testing.assert_allclose(
+            np.asarray(codegen_row.yS), np.asarray(casadi_row.yS), rtol=1e-5, atol=1e-8
+        )
+
+
+def test_codegen_reuses_compiled_code(codegen_cache, tmp_path, monkeypatch):
+    model = spm(10)
+    inputs = np.array([[0.01, 1.0]])
+    # Unload the libraries of earlier tests
+    gc.collect()
+
+    first = model.create_solver(codegen=True)
+    libraries = sorted(codegen_cache.glob("*.so"))
+    assert len(libraries) == 1
+    built = libraries[0].stat().st_mtime_ns
+    expected = model.solve(first, [0.0, 60.0], inputs)
+
+    # The same source hashes to the same key: while it is loaded the library
+    # is shared in memory, without even looking at the cache directory
+    monkeypatch.setenv("PYBAMM_CODEGEN_CACHE_DIR", str(tmp_path / "unused"))
+    shared = model.create_solver(codegen=True)
+    assert not (tmp_path / "unused").exists()
+    np.testing.assert_array_equal(
+        np.asarray(model.solve(shared, [0.0, 60.0], inputs).y), np.asarray(expected.y)
+    )
+
+    # Once unloaded, it is loaded back from the cache directory, not rebuilt
+    del first, shared
+    gc.collect()
+    monkeypatch.setenv("PYBAMM_CODEGEN_CACHE_DIR", str(codegen_cache))
+    reloaded = model.create_solver(codegen=True)
+    assert sorted(codegen_cache.glob("*.so")) == libraries
+    assert libraries[0].stat().st_mtime_ns == built
+    np.testing.assert_array_equal(
+        np.asarray(model.solve(reloaded, [0.0, 60.0], inputs).y), np.asarray(expected.y)
+    )
@@ -0,0 +1,39 @@
+import casadi
+import numpy as np
+import pytest
+
+from .models import dfn, spm
+
+
+@pytest.mark.parametrize(
+    "model, t_final, inputs",
+    [
+        (spm(10), 60.0, [[0.01, 1.0], [0.005, 0.5]]),
+        (dfn(5, 4), 100.0, [[1.0, 1.0], [0.5, 2.0]]),
+    ],
+)
+def test_deferred_outputs_match_in_loop_outputs(model, t_final, inputs):
+    _, y, p = model.symbols
+    outputs = [casadi.sum1(y) / model.n, y[0] * p[1], y[-1] ** 2]
+    inputs = np.array(inputs)
+    y0, yp0 = model.initial_rows(inputs, model.n_inputs)
+    t_eval = np.array([0.0, t_final])
+    t_interp = np.linspace(0.0, t_final, 25)
+
+    in_loop, deferred = [
+        model.create_solver(
+            model.n_inputs, outputs=outputs, defer_interp_output=defer
+        ).solve(t_eval, t_interp, y0, yp0, inputs)
+        for defer in (False, True)
+    ]
+
+    # The integration is the same; only the outputs are evaluated later
+    for expected, row in zip(in_loop, deferred):
+        assert row.flag == expected.flag
+        np.testing.assert_array_equal(np.asarray(row.t), np.asarray(expected.t))
+        np.testing.assert_allclose(
+            np.asarray(row.y), np.asarray(expected.y), rtol=1e-12, atol=1e-14
+        )
+        np.testing.assert_allclose(
+            np.asarray(row.yS), np.asarray(expected.yS), rtol=1e-12, atol=1e-14
+        )
@@ -0,0 +1,45 @@
+import numpy as np
+import pytest
+
+from .models import dfn, spm
+
+
+def solve(model, solver, t_eval, inputs, **kwargs):
+    inputs = np.array([inputs])
+    y0, yp0 = model.initial_rows(inputs)
+    return solver.solve(t_eval, t_eval, y0, yp0, inputs, **kwargs)[0]
+
+
+@pytest.mark.parametrize(
+    "model, inputs",
+    [(spm(10), [0.01, 1.0]), (dfn(5, 4), [1.0, 1.0])],
+)
+@pytest.mark.parametrize("t_discontinuity", [[], [30.0]])
+def test_restarts_match_default(model, inputs, t_discontinuity):
+    # Many output times in a smooth solve, so that restarting at each of
+    # them is wasted work
+    t_eval = np.linspace(0.0, 60.0, 41)
+    solver = model.create_solver()
+
+    default = solve(model, solver, t_eval, inputs)
+    restricted = solve(
+        model, solver, t_eval, inputs, t_discontinuity=np.array(t_discontinuity)
+    )
+    assert default.flag >= 0 and restricted.flag >= 0
+    np.testing.assert_array_equal(np.asarray(restricted.t), np.asarray(default.t))
+    np.testing.assert_allclose(
+        model.states(restricted), model.states(default), rtol=1e-4, atol=1e-6
+    )
+    assert restricted.stats.nsteps < default.stats.nsteps
+
+
+def test_rejects_times_outside_t_eval():
+    model = spm(10)
+    with pytest.raises(ValueError, match="t_discontinuity"):
+        solve(
+            model,
+            model.create_solver(),
+            np.linspace(0.0, 60.0, 5),
+            [0.01, 1.0],
+            t_discontinuity=np.array([10.0]),
+        )
@@ -0,0 +1,49 @@
+import casadi
+import numpy as np
+
+from .models import spm
+
+N_SHELLS = 10
+
+
+def solve_rows(model, solver, t_eval, t_interp, inputs):
+    y0, yp0 = model.initial_rows(inputs)
+    return solver.solve(t_eval, t_interp, y0, yp0, inputs)
+
+
+def check_matches_rows(model, t_eval, t_interp, inputs, **options):
+    ensemble = solve_rows(
+        model, model.create_solver(ensemble_size=4, **options), t_eval, t_interp, inputs
+    )
+    rows = solve_rows(model, model.create_solver(**options), t_eval, t_interp, inputs)
+    assert len(ensemble) == len(rows)
+    for member, row in zip(ensemble, rows):
+        assert member.flag == row.flag
+        np.testing.assert_array_equal(np.asarray(member.t), np.asarray(row.t))
+        np.testing.assert_allclose(
+            model.states(member), model.states(row), rtol=1e-4, atol=1e-6
+        )
+        np.testing.assert_allclose(
+            model.states(member, "yp"), model.states(row, "yp"), rtol=1e-3, atol=1e-5
+        )
+
+
+def test_ensemble_matches_rows():
+    model = spm(N_SHELLS)
+    t_eval = np.array([0.0, 30.0, 60.0])
+    t_interp = np.linspace(0.0, 60.0, 13)
+    # 3 rows in an ensemble of 4, so the last member is padding
+    inputs = np.array([[0.01, 1.0], [0.005, 0.5], [0.002, 2.0]])
+    check_matches_rows(model, t_eval, t_interp, inputs)
+
+
+def test_ensemble_falls_back_to_rows_on_event():
+    # The mean of the first particle is 0.8 + p[0] t, so only the first row
+    # reaches the event (at t = 10)
+    model = spm(
+        N_SHELLS, event=lambda y: casadi.sum1(y[:N_SHELLS]) / N_SHELLS - 0.9
+    )
+    t_eval = np.array([0.0, 15.0])
+    t_interp = np.linspace(0.0, 15.0, 7)
+    inputs = np.array([[0.01, 1.0], [0.001, 1.0], [0.002, 0.5], [0.004, 2.0]])
+    check_matches_rows(model, t_eval, t_interp, inputs)
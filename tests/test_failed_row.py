@@ -0,0 +1,28 @@
+import numpy as np
+import pytest
+
+from .models import spm
+
+
+def test_failed_row_raises_and_solver_recovers():
+    model = spm(10)
+    inputs = np.array([[0.01, 1.0], [0.005, 0.5], [0.002, 2.0]])
+    y0, yp0 = model.initial_rows(inputs)
+    solver = model.create_solver(save_checkpoint=True)
+
+    def checkpoints(t_end):
+        solutions = solver.solve(np.array([0.0, t_end]), np.array([]), y0, yp0, inputs)
+        return [solution.checkpoint for solution in solutions]
+
+    at_30 = checkpoints(30.0)
+    # The middle row resumes from the wrong time, so only its solve throws,
+    # after the first row has been solved
+    resume_from = [at_30[0], checkpoints(20.0)[1], at_30[2]]
+    t_eval = np.array([30.0, 60.0])
+    with pytest.raises(ValueError, match="Checkpoint time"):
+        solver.solve(
+            t_eval, np.array([]), y0, yp0, inputs, resume_from=resume_from
+        )
+
+    resumed = solver.solve(t_eval, np.array([]), y0, yp0, inputs, resume_from=at_30)
+    assert all(solution.flag >= 0 for solution in resumed)
@@ -0,0 +1,46 @@
+import casadi
+import numpy as np
+import pytest
+
+from .models import dfn, spm
+
+
+@pytest.mark.parametrize(
+    "model, t_final, inputs",
+    [
+        (spm(10), 60.0, [[0.01, 1.0], [0.005, 0.5]]),
+        (dfn(5, 4), 100.0, [[1.0, 1.0], [0.5, 2.0]]),
+    ],
+)
+@pytest.mark.parametrize("defer_interp_output", [False, True])
+def test_fused_outputs_match_unfused(model, t_final, inputs, defer_interp_output):
+    _, y, p = model.symbols
+    # Sharing the subexpression sum1(y) is what fusing is for
+    mean = casadi.sum1(y) / model.n
+    outputs = [mean, mean * p[1], y[:3] ** 2]
+    inputs = np.array(inputs)
+    y0, yp0 = model.initial_rows(inputs, model.n_inputs)
+    t_eval = np.array([0.0, t_final])
+    t_interp = np.linspace(0.0, t_final, 25)
+
+    unfused, fused = [
+        model.create_solver(
+            model.n_inputs,
+            outputs=outputs,
+            fused=fused,
+            defer_interp_output=defer_interp_output,
+        ).solve(t_eval, t_interp, y0, yp0, inputs)
+        for fused in (False, True)
+    ]
+
+    for expected, row in zip(unfused, fused):
+        assert row.flag == expected.flag
+        np.testing.assert_array_equal(np.asarray(row.t), np.asarray(expected.t))
+        np.testing.assert_allclose(
+            np.asarray(row.y), np.asarray(expected.y), rtol=1e-12, atol=1e-14
+        )
+        # The output sensitivities still come from dvar_dy_fcns and dvar_dp_fcns
+        np.testing.assert_allclose(
+            np.asarray(row.yS), np.asarray(expected.yS), rtol=1e-12, atol=1e-14
+        )
+
@@ -0,0 +1,188 @@
+import ctypes
+
+import casadi
+import numpy as np
+import pytest
+
+from pybammsolvers import idaklu
+
+from .models import spm
+
+N_SHELLS = 10
+
+
+def custom_call(name, operands, out):
+    """Call an XLA custom call target with the given operand buffers"""
+    get_pointer = ctypes.pythonapi.PyCapsule_GetPointer
+    get_pointer.restype = ctypes.c_void_p
+    get_pointer.argtypes = [ctypes.py_object, ctypes.c_char_p]
+    address = get_pointer(idaklu.registrations()[name], b"xla._CUSTOM_CALL_TARGET")
+    target = ctypes.CFUNCTYPE(None, ctypes.c_void_p, ctypes.POINTER(ctypes.c_void_p))(
+        address
+    )
+    buffers = [np.ascontiguousarray(x) for x in operands]
+    pointers = (ctypes.c_void_p * len(buffers))(*[b.ctypes.data for b in buffers])
+    target(out.ctypes.data, pointers)
+    return out
+
+
+def scalar(n):
+    return np.array([n], dtype=np.int64)
+
+
+def scalar_f(x):
+    return np.array([x], dtype=float)
+
+
+class NativeJax:
+    """The native (registered solver group) primitives of a model's outputs"""
+
+    def __init__(self, model, outputs, t_eval, nominal_inputs, initial_conditions=None):
+        self.n_vars = len(outputs)
+        self.n_inputs = model.n_inputs
+        self.solver = model.create_solver(model.n_inputs, outputs=outputs)
+        y0, yp0 = model.initial_rows(np.array([nominal_inputs]), model.n_inputs)
+        self.jax = idaklu.create_idaklu_jax()
+        self.jax.register_solver(
+            self.solver,
+            t_eval,
+            y0[0],
+            yp0[0],
+            self.n_vars,
+            initial_conditions=initial_conditions,
+        )
+        self.index = scalar(self.jax.get_index())
+
+    def header(self, t):
+        return [self.index, scalar(len(t)), scalar(self.n_vars), scalar(self.n_inputs)]
+
+    def eval(self, t, inputs):
+        out = np.empty((len(t), self.n_vars))
+        return custom_call(
+            "cpu_idaklu_f64", self.header(t) + [t] + [scalar_f(p) for p in inputs], out
+        )
+
+    def jvp(self, t, inputs, tangent):
+        out = np.empty((len(t), self.n_vars))
+        return custom_call(
+            "cpu_idaklu_jvp_f64",
+            self.header(t)
+            + [t]
+            + [scalar_f(p) for p in inputs]
+            + [np.zeros_like(t)]
+            + [scalar_f(dp) for dp in tangent],
+            out,
+        )
+
+    def vjp(self, t, inputs, y_bar, invar):
+        out = np.empty(1)
+        return custom_call(
+            "cpu_idaklu_vjp_f64",
+            [
+                self.index,
+                scalar(len(t)),
+                scalar(self.n_inputs),
+                scalar(y_bar.shape[0]),
+                scalar(y_bar.shape[1]),
+                y_bar,
+                scalar(invar),
+                t,
+            ]
+            + [scalar_f(p) for p in inputs],
+            out,
+        )[0]
+
+
+def test_native_jvp_vjp_match_finite_differences():
+    model = spm(N_SHELLS)
+    _, y, _ = model.symbols
+    outputs = [y[0], casadi.sum1(y[N_SHELLS:]) / N_SHELLS]
+    inputs = np.array([0.01, 1.0])
+    native = NativeJax(model, outputs, np.array([0.0, 60.0]), inputs)
+    t = np.linspace(0.0, 60.0, 7)
+
+    values = native.eval(t, inputs)
+    assert np.all(np.isfinite(values))
+
+    steps = 1e-2 * inputs
+    for i, h in enumerate(steps):
+        tangent = np.zeros_like(inputs)
+        tangent[i] = 1.0
+        jvp = native.jvp(t, inputs, tangent)
+        fd = (
+            native.eval(t, inputs + h * tangent) - native.eval(t, inputs - h * tangent)
+        ) / (2 * h)
+        np.testing.assert_allclose(jvp, fd, rtol=1e-2, atol=1e-3 * np.max(np.abs(fd)))
+
+        y_bar = np.random.default_rng(i).standard_normal(values.shape)
+        np.testing.assert_allclose(
+            native.vjp(t, inputs, y_bar, i), np.sum(y_bar * jvp), rtol=1e-10
+        )
+
+
+def test_native_times_outside_t_eval_are_nan():
+    model = spm(N_SHELLS)
+    _, y, _ = model.symbols
+    native = NativeJax(model, [y[0]], np.array([0.0, 60.0]), np.array([0.01, 1.0]))
+    values = native.eval(np.array([30.0, 90.0]), np.array([0.01, 1.0]))
+    assert np.all(np.isnan(values))
+
+
+def test_register_solver_rejects_output_reductions():
+    model = spm(N_SHELLS)
+    _, y, _ = model.symbols
+    solver = model.create_solver(outputs=[y[0]], output_reductions=["max"])
+    y0, yp0 = model.initial_rows(np.array([[0.01, 1.0]]))
+    jax = idaklu.create_idaklu_jax()
+    with pytest.raises(ValueError, match="output_reductions"):
+        jax.register_solver(solver, np.array([0.0, 60.0]), y0[0], yp0[0], 1)
+
+
+def input_dependent_initial_conditions(model):
+    """y0 and yp0 rows (with sensitivities) of an spm whose y0 scales with p[1]"""
+    _, _, p = model.symbols
+    y0 = casadi.DM(model.y0) * (1 + 0.1 * (p[1] - 1))
+    yp0 = model.rhs_alg(0.0, y0, p)  # the mass matrix is the identity
+    rows = [
+        casadi.vertcat(x, *[casadi.jacobian(x, p)[:, i] for i in range(model.n_inputs)])
+        for x in (y0, yp0)
+    ]
+    return casadi.Function("initial_conditions", [p], rows)
+
+
+def test_native_recomputes_input_dependent_initial_conditions():
+    model = spm(N_SHELLS)
+    _, y, _ = model.symbols
+    outputs = [y[0], casadi.sum1(y[N_SHELLS:]) / N_SHELLS]
+    f = input_dependent_initial_conditions(model)
+    native = NativeJax(
+        model,
+        outputs,
+        np.array([0.0, 60.0]),
+        np.array([0.01, 1.0]),
+        initial_conditions=idaklu.generate_function(f.serialize()),
+    )
+    t = np.linspace(0.0, 60.0, 7)
+    inputs = np.array([0.01, 2.0])
+
+    y0, yp0 = (np.array(x).T for x in f(inputs))
+    expected = native.solver.solve(
+        np.array([0.0, 60.0]), t, y0, yp0, inputs[None, :]
+    )[0]
+    t_saved = np.asarray(expected.t)
+    rows = np.searchsorted(t_saved, t)
+    np.testing.assert_allclose(
+        native.eval(t, inputs),
+        np.asarray(expected.y).reshape(len(t_saved), len(outputs))[rows],
+        rtol=1e-10,
+    )
+
+    # The sensitivities include those of the initial conditions
+    tangent = np.array([0.0, 1.0])
+    h = 1e-2
+    fd = (native.eval(t, inputs + h * tangent) - native.eval(t, inputs - h * tangent)) / (
+        2 * h
+    )
+    np.testing.assert_allclose(
+        native.jvp(t, inputs, tangent), fd, rtol=1e-2, atol=1e-3 * np.max(np.abs(fd))
+    )
@@ -0,0 +1,132 @@
+import casadi
+import numpy as np
+import pytest
+
+from pybammsolvers import idaklu
+
+from .models import spm
+
+N_SHELLS = 10
+
+
+def sub_solutions(model, solution, split=None):
+    """t, y and yp of a solution, optionally split in two at the index `split`"""
+    t = np.asarray(solution.t)
+    y = model.states(solution, "y")
+    yp = model.states(solution, "yp")
+    if split is None:
+        return [t], [y], [yp]
+    # The pieces share the knot at `split`, as consecutive sub-solutions do
+    return (
+        [t[: split + 1], t[split:]],
+        [np.asfortranarray(y[:, : split + 1]), np.asfortranarray(y[:, split:])],
+        [np.asfortranarray(yp[:, : split + 1]), np.asfortranarray(yp[:, split:])],
+    )
+
+
+def interp(t_interp, data, inputs, f, num_threads=1):
+    """f interpolated at t_interp, with one copy of f per sub-solution"""
+    ts, ys, yps = data
+    return np.asarray(
+        idaklu.observe_hermite_interp(
+            t_interp,
+            idaklu.VectorRealtypeNdArray(ts),
+            idaklu.VectorRealtypeNdArray(ys),
+            idaklu.VectorRealtypeNdArray(yps),
+            idaklu.VectorRealtypeNdArray([inputs] * len(ts)),
+            [f.serialize()] * len(ts),
+            [1, len(t_interp)],
+            num_threads,
+        )
+    ).ravel()
+
+
+@pytest.fixture(scope="module")
+def solved():
+    model = spm(N_SHELLS)
+    inputs = np.array([0.01, 1.0])
+    solution = model.solve(model.create_solver(), [0.0, 60.0], inputs)
+    return model, solution, inputs
+
+
+def t_interp_points(t):
+    # Dense points inside a few intervals, then sparse ones that skip many
+    # intervals at a time, so the cursor both stays put and gallops
+    return np.sort(
+        np.concatenate(
+            [
+                np.linspace(t[1], t[3], 40),
+                np.linspace(t[3], t[-1], 9),
+                [t[len(t) // 2]],
+            ]
+        )
+    )
+
+
+def test_galloping_matches_pointwise(solved):
+    model, solution, inputs = solved
+    data = sub_solutions(model, solution)
+    t_interp = t_interp_points(data[0][0])
+
+    batched = interp(t_interp, data, inputs, model.output)
+    # A single point is located by bisection alone
+    pointwise = np.array(
+        [interp(np.array([t]), data, inputs, model.output)[0] for t in t_interp]
+    )
+    np.testing.assert_allclose(batched, pointwise, rtol=1e-12, atol=1e-14)
+
+
+@pytest.mark.parametrize("split", [None, 5])
+def test_parallel_matches_serial(solved, split):
+    model, solution, inputs = solved
+    data = sub_solutions(model, solution, split)
+    t_interp = t_interp_points(np.asarray(solution.t))
+
+    serial = interp(t_interp, data, inputs, model.output)
+    for num_threads in [2, 4]:
+        np.testing.assert_allclose(
+            interp(t_interp, data, inputs, model.output, num_threads),
+            serial,
+            rtol=1e-12,
+            atol=1e-14,
+        )
+    if split is not None:
+        unsplit = interp(t_interp, sub_solutions(model, solution), inputs, model.output)
+        np.testing.assert_allclose(serial, unsplit, rtol=1e-12, atol=1e-14)
+
+
+def test_multi_matches_single_variables(solved):
+    model, solution, inputs = solved
+    t, y, p = model.symbols
+    surface = casadi.Function("surface", [t, y, p], [y[N_SHELLS - 1]])
+    data = sub_solutions(model, solution, 5)
+    ts, ys, yps = data
+    t_interp = t_interp_points(np.asarray(solution.t))
+    variables = [model.output, surface]
+
+    for num_threads in [1, 3]:
+        outputs = idaklu.observe_hermite_interp_multi(
+            t_interp,
+            idaklu.VectorRealtypeNdArray(ts),
+            idaklu.VectorRealtypeNdArray(ys),
+            idaklu.VectorRealtypeNdArray(yps),
+            idaklu.VectorRealtypeNdArray([inputs] * len(ts)),
+            [[f.serialize()] * len(ts) for f in variables],
+            [[1, len(t_interp)]] * len(variables),
+            num_threads,
+        )
+        assert len(outputs) == len(variables)
+        for output, f in zip(outputs, variables):
+            np.testing.assert_allclose(
+                np.asarray(output).ravel(),
+                interp(t_interp, data, inputs, f),
+                rtol=1e-12,
+                atol=1e-14,
+            )
+
+
+def test_rejects_no_threads(solved):
+    model, solution, inputs = solved
+    data = sub_solutions(model, solution)
+    with pytest.raises(ValueError, match="num_threads"):
+        interp(np.asarray(solution.t), data, inputs, model.output, 0)
@@ -0,0 +1,43 @@
+import numpy as np
+
+from .models import spm
+
+
+def bfloat16_to_float32(bits):
+    """bfloat16 values, stored as the upper 16 bits of float32s"""
+    return (np.asarray(bits).astype(np.uint32) << 16).view(np.float32)
+
+
+def test_reduced_precision_outputs():
+    model = spm(10)
+    t_eval = np.array([0.0, 60.0])
+    inputs = np.array([0.01, 1.0])
+    number_of_parameters = model.n_inputs
+
+    full = model.solve(
+        model.create_solver(number_of_parameters), t_eval, inputs, number_of_parameters
+    )
+    reduced = model.solve(
+        model.create_solver(
+            number_of_parameters, output_dtype="float32", sensitivity_dtype="bfloat16"
+        ),
+        t_eval,
+        inputs,
+        number_of_parameters,
+    )
+
+    np.testing.assert_array_equal(np.asarray(reduced.t), np.asarray(full.t))
+    for name in ["y", "yp"]:
+        values = getattr(reduced, name)
+        assert values.dtype == np.float32
+        assert values.shape == getattr(full, name).shape
+        np.testing.assert_allclose(
+            values, getattr(full, name), rtol=1e-6, atol=1e-30
+        )
+    for name in ["yS", "ypS"]:
+        values = getattr(reduced, name)
+        assert values.dtype == np.uint16
+        assert values.shape == getattr(full, name).shape
+        np.testing.assert_allclose(
+            bfloat16_to_float32(values), getattr(full, name), rtol=1e-2, atol=1e-30
+        )
@@ -0,0 +1,84 @@
+import casadi
+import numpy as np
+import pytest
+
+from .models import spm
+
+N_SHELLS = 10
+
+
+def trapezoid(values, t):
+    """Trapezoidal integral along the first axis"""
+    dt = np.diff(t).reshape((-1,) + (1,) * (values.ndim - 1))
+    return np.sum(0.5 * dt * (values[1:] + values[:-1]), axis=0)
+
+
+def first_crossing(values, t):
+    """Linearly interpolated time at which values first changes sign"""
+    for k in range(1, len(t)):
+        if values[k - 1] == 0.0:
+            return t[k - 1]
+        if np.sign(values[k]) != np.sign(values[k - 1]):
+            return t[k - 1] - values[k - 1] * (t[k] - t[k - 1]) / (
+                values[k] - values[k - 1]
+            )
+    return np.nan
+
+
+@pytest.fixture(scope="module")
+def solved():
+    model = spm(N_SHELLS)
+    _, y, _ = model.symbols
+    # The mean of the first particle is 0.8 + p[0] t, so it reaches 0.9 at t = 10
+    mean = casadi.sum1(y[:N_SHELLS]) / N_SHELLS
+    # The first is smallest at t = 5, inside the time span
+    outputs = [(mean - 0.85) ** 2, y[N_SHELLS - 1], mean, mean, mean - 0.9]
+    reductions = ["min", "max", "last", "integral", "event_time"]
+    inputs = np.array([[0.01, 1.0]])
+    y0, yp0 = model.initial_rows(inputs, model.n_inputs)
+    t_eval = np.array([0.0, 30.0])
+    t_interp = np.linspace(0.0, 30.0, 61)
+
+    def solve(**options):
+        solver = model.create_solver(model.n_inputs, outputs=outputs, **options)
+        return solver.solve(t_eval, t_interp, y0, yp0, inputs)[0]
+
+    full = solve()
+    reduced = solve(output_reductions=reductions)
+    return full, reduced, len(outputs), model.n_inputs
+
+
+def test_reductions_match_numpy(solved):
+    full, reduced, n_vars, _ = solved
+    assert full.flag >= 0 and reduced.flag >= 0
+    t = np.asarray(full.t)
+    y = np.asarray(full.y).reshape(len(t), n_vars)
+    value = np.asarray(reduced.y).ravel()
+    assert value.shape == (n_vars,)
+    assert np.asarray(reduced.t)[-1] == t[-1]
+
+    expected = [
+        np.min(y[:, 0]),
+        np.max(y[:, 1]),
+        y[-1, 2],
+        trapezoid(y[:, 3], t),
+        first_crossing(y[:, 4], t),
+    ]
+    np.testing.assert_allclose(value, expected, rtol=1e-10)
+    np.testing.assert_allclose(value[4], 10.0, rtol=1e-3)
+
+
+def test_reduced_sensitivities_match_numpy(solved):
+    full, reduced, n_vars, n_p = solved
+    t = np.asarray(full.t)
+    y = np.asarray(full.y).reshape(len(t), n_vars)
+    yS = np.asarray(full.yS).reshape(len(t), n_vars, n_p)
+    valueS = np.asarray(reduced.yS).reshape(n_vars, n_p)
+
+    expected = [
+        yS[np.argmin(y[:, 0]), 0],
+        yS[np.argmax(y[:, 1]), 1],
+        yS[-1, 2],
+        trapezoid(yS[:, 3], t),
+    ]
+    np.testing.assert_allclose(valueS[:4], expected, rtol=1e-10, atol=1e-14)
@@ -0,0 +1,101 @@
+import casadi
+import numpy as np
+
+from pybammsolvers import idaklu
+
+from .models import spm
+
+N_SHELLS = 10
+
+
+def model_with_event():
+    # The mean of the first particle is 0.8 + 0.01 t, so the event is at t = 10
+    return spm(N_SHELLS, event=lambda y: casadi.sum1(y[:N_SHELLS]) / N_SHELLS - 0.9)
+
+
+def observe_output(model, solution, inputs, t_interp):
+    t = np.asarray(solution.t)
+    return np.asarray(
+        idaklu.observe_hermite_interp(
+            t_interp,
+            idaklu.VectorRealtypeNdArray([t]),
+            idaklu.VectorRealtypeNdArray([model.states(solution, "y")]),
+            idaklu.VectorRealtypeNdArray([model.states(solution, "yp")]),
+            idaklu.VectorRealtypeNdArray([np.asarray(inputs)]),
+            [model.output.serialize()],
+            [1, len(t_interp)],
+        )
+    ).ravel()
+
+
+def test_thinning_keeps_t_eval_and_events():
+    model = model_with_event()
+    t_eval = np.array([0.0, 2.5, 5.0, 7.5, 12.5, 15.0])
+    inputs = np.array([0.01, 1.0])
+
+    full = model.solve(model.create_solver(), t_eval, inputs)
+    thinned = model.solve(
+        model.create_solver(output_thinning_tolerance=1.0), t_eval, inputs
+    )
+    t_full = np.asarray(full.t)
+    t_thinned = np.asarray(thinned.t)
+
+    # Stopped by the event before the end of t_eval
+    t_event = t_full[-1]
+    np.testing.assert_allclose(t_event, 10.0, rtol=1e-4)
+    assert t_thinned[-1] == t_event
+
+    assert len(t_thinned) < len(t_full)
+    for t in t_eval[t_eval <= t_event]:
+        assert np.any(t_thinned == t)
+
+    t_interp = np.linspace(0.0, t_event, 200)
+    np.testing.assert_allclose(
+        observe_output(model, thinned, inputs, t_interp),
+        observe_output(model, full, inputs, t_interp),
+        rtol=1e-4,
+        atol=1e-5,
+    )
+
+
+def hermite(t, t_knots, y, yp):
+    """Cubic Hermite interpolant of the rows of y (with derivatives yp) at t"""
+    j = np.clip(np.searchsorted(t_knots, t, side="right") - 1, 0, len(t_knots) - 2)
+    h = (t_knots[j + 1] - t_knots[j])[:, None]
+    s = (t - t_knots[j])[:, None] / h
+    return (
+        (2 * s**3 - 3 * s**2 + 1) * y[j]
+        + (s**3 - 2 * s**2 + s) * h * yp[j]
+        + (-2 * s**3 + 3 * s**2) * y[j + 1]
+        + (s**3 - s**2) * h * yp[j + 1]
+    )
+
+
+def test_thinning_keeps_sensitivities_within_tolerance():
+    model = spm(N_SHELLS)
+    t_eval = np.array([0.0, 60.0])
+    inputs = np.array([0.01, 1.0])
+    tolerance = 1.0
+    n_p = model.n_inputs
+
+    full = model.solve(model.create_solver(n_p), t_eval, inputs, n_p)
+    thinned = model.solve(
+        model.create_solver(n_p, output_thinning_tolerance=tolerance),
+        t_eval,
+        inputs,
+        n_p,
+    )
+    t_full = np.asarray(full.t)
+    t_thinned = np.asarray(thinned.t)
+    assert len(t_thinned) < len(t_full)
+
+    # The kept steps are unchanged, and the dropped ones are reproduced by
+    # the interpolant of the kept ones to within the thinning tolerance
+    # (atol = rtol = 1e-6)
+    yS_full = np.asarray(full.yS)
+    yS = np.asarray(thinned.yS)
+    ypS = np.asarray(thinned.ypS)
+    for p in range(n_p):
+        interpolated = hermite(t_full, t_thinned, yS[p], ypS[p])
+        bound = tolerance * (1e-6 + 1e-6 * np.abs(yS_full[p]))
+        assert np.all(np.abs(interpolated - yS_full[p]) <= 1.01 * bound)
@@ -0,0 +1,41 @@
+import numpy as np
+import pytest
+
+from .models import dfn, spm
+
+
+@pytest.mark.parametrize(
+    "model, t_final, inputs",
+    [(spm(10), 60.0, [0.01, 1.0]), (dfn(5, 4), 100.0, [1.0, 1.0])],
+)
+@pytest.mark.parametrize(
+    "options",
+    [
+        {},
+        {
+            "linear_solver": "SUNLinSol_SPGMR",
+            "jacobian": "matrix-free",
+            "linsol_max_iterations": 20,
+        },
+    ],
+)
+def test_blocks_match_unpartitioned(model, t_final, inputs, options):
+    t_eval = np.array([0.0, t_final])
+    t_interp = np.linspace(0.0, t_final, 11)
+    inputs = np.array([inputs])
+    y0, yp0 = model.initial_rows(inputs)
+
+    def solve(**kwargs):
+        solver = model.create_solver(num_threads=2, **options, **kwargs)
+        solution = solver.solve(t_eval, t_interp, y0, yp0, inputs)[0]
+        assert solution.flag >= 0
+        return solution
+
+    whole = solve()
+    blocked = solve(blocks=3)
+    np.testing.assert_array_equal(np.asarray(blocked.t), np.asarray(whole.t))
+    # The blocks compute the same values, so the integration is identical up
+    # to rounding
+    np.testing.assert_allclose(
+        model.states(blocked), model.states(whole), rtol=1e-8, atol=1e-12
+    )
@@ -0,0 +1,64 @@
+import numpy as np
+
+from .models import spm
+
+
+def test_resumed_solve_matches_straight_solve():
+    model = spm(10)
+    inputs = np.array([[0.01, 1.0]])
+    y0, yp0 = model.initial_rows(inputs)
+    solver = model.create_solver(save_checkpoint=True)
+
+    straight = solver.solve(np.array([0.0, 60.0]), np.array([]), y0, yp0, inputs)[0]
+    first = solver.solve(np.array([0.0, 30.0]), np.array([]), y0, yp0, inputs)[0]
+    checkpoint = first.checkpoint
+    assert checkpoint.valid()
+    assert checkpoint.t == 30.0
+    np.testing.assert_allclose(checkpoint.y, model.states(first)[:, -1])
+
+    resumed = solver.solve(
+        np.array([30.0, 60.0]),
+        np.array([]),
+        y0,
+        yp0,
+        inputs,
+        resume_from=[checkpoint],
+        resume_consistent=True,
+    )[0]
+    assert resumed.flag >= 0
+    assert np.asarray(resumed.t)[0] == 30.0
+    np.testing.assert_allclose(
+        model.states(resumed)[:, -1], model.states(straight)[:, -1], rtol=1e-4
+    )
+
+
+def test_checkpoint_is_opt_in():
+    model = spm(10)
+    solution = model.solve(model.create_solver(), [0.0, 30.0], [0.01, 1.0])
+    assert not solution.checkpoint.valid()
+
+
+def test_async_and_stream_solves_resume():
+    model = spm(10)
+    inputs = np.array([[0.01, 1.0], [0.005, 0.5]])
+    y0, yp0 = model.initial_rows(inputs)
+    solver = model.create_solver(save_checkpoint=True)
+    first = solver.solve(np.array([0.0, 30.0]), np.array([]), y0, yp0, inputs)
+    resume = dict(resume_from=[row.checkpoint for row in first], resume_consistent=True)
+    t_eval = np.array([30.0, 60.0])
+
+    expected = solver.solve(t_eval, np.array([]), y0, yp0, inputs, **resume)
+    in_background = solver.solve_async(
+        t_eval, np.array([]), y0, yp0, inputs, **resume
+    ).result()
+    streamed = [None] * len(inputs)
+
+    def collect(index, solution):
+        streamed[index] = solution
+
+    solver.solve_stream(t_eval, np.array([]), y0, yp0, inputs, collect, **resume)
+
+    for solutions in (in_background, streamed):
+        for solution, row in zip(solutions, expected):
+            assert np.asarray(solution.t)[0] == 30.0
+            np.testing.assert_allclose(model.states(solution), model.states(row))
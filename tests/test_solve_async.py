@@ -0,0 +1,26 @@
+import numpy as np
+import pytest
+
+from .models import spm
+
+
+def test_solve_async_matches_solve():
+    model = spm(10)
+    inputs = np.array([[0.01, 1.0], [0.005, 0.5], [0.002, 2.0]])
+    y0, yp0 = model.initial_rows(inputs)
+    t_eval = np.array([0.0, 60.0])
+    t_interp = np.linspace(0.0, 60.0, 13)
+    solver = model.create_solver(num_threads=2, num_solvers=2)
+
+    handle = solver.solve_async(t_eval, t_interp, y0, yp0, inputs)
+    solutions = handle.result()
+    assert handle.done()
+    with pytest.raises(RuntimeError):
+        handle.result()
+
+    expected = solver.solve(t_eval, t_interp, y0, yp0, inputs)
+    assert len(solutions) == len(expected)
+    for solution, row in zip(solutions, expected):
+        assert solution.flag == row.flag
+        np.testing.assert_array_equal(np.asarray(solution.t), np.asarray(row.t))
+        np.testing.assert_allclose(model.states(solution), model.states(row))
@@ -0,0 +1,119 @@
+import json
+import time
+
+import numpy as np
+import pytest
+
+from pybammsolvers import idaklu
+
+from .models import spm
+
+
+def stream_inputs(number_of_rows):
+    return np.column_stack(
+        [
+            np.linspace(0.002, 0.01, number_of_rows),
+            np.linspace(0.5, 2.0, number_of_rows),
+        ]
+    )
+
+
+@pytest.mark.parametrize("num_solvers", [1, 2])
+def test_stream_delivers_every_row_once(num_solvers):
+    model = spm(10)
+    inputs = stream_inputs(6)
+    y0, yp0 = model.initial_rows(inputs)
+    t_eval = np.array([0.0, 60.0])
+    solver = model.create_solver(num_threads=num_solvers, num_solvers=num_solvers)
+
+    delivered = []
+    solver.solve_stream(
+        t_eval,
+        np.array([]),
+        y0,
+        yp0,
+        inputs,
+        lambda index, solution: delivered.append((index, solution)),
+    )
+
+    indices = [index for index, _ in delivered]
+    if num_solvers == 1:
+        # A single solver finishes the rows in the order they are dispatched
+        assert indices == list(range(len(inputs)))
+    else:
+        assert sorted(indices) == list(range(len(inputs)))
+
+    expected = solver.solve(t_eval, np.array([]), y0, yp0, inputs)
+    for index, solution in delivered:
+        np.testing.assert_allclose(
+            model.states(solution), model.states(expected[index])
+        )
+
+
+def test_stream_waits_for_a_slow_callback():
+    try:
+        idaklu.set_tracing(True)
+    except RuntimeError:
+        pytest.skip("idaklu was built without tracing")
+    model = spm(10)
+    inputs = stream_inputs(8)
+    y0, yp0 = model.initial_rows(inputs)
+    solver = model.create_solver()
+    max_pending = 1
+
+    def slow_first_callback(index, solution):
+        if index == 0:
+            time.sleep(0.5)
+
+    try:
+        idaklu.clear_trace()
+        solver.solve_stream(
+            np.array([0.0, 60.0]),
+            np.array([]),
+            y0,
+            yp0,
+            inputs,
+            slow_first_callback,
+            max_pending=max_pending,
+        )
+        events = json.loads(idaklu.trace_json())["traceEvents"]
+    finally:
+        idaklu.set_tracing(False)
+        idaklu.clear_trace()
+
+    solves = sorted(
+        (event for event in events if event["name"] == "solve"), key=lambda e: e["ts"]
+    )
+    assert [event["args"]["index"] for event in solves] == list(range(len(inputs)))
+    # While the first callback sleeps, the solver can only finish the row in
+    # the callback, max_pending queued rows and the row it is pushing; then
+    # it waits (the trace is in microseconds)
+    gaps = [b["ts"] - (a["ts"] + a["dur"]) for a, b in zip(solves, solves[1:])]
+    assert max(gaps) > 0.3e6
+    assert int(np.argmax(gaps)) <= max_pending + 1
+
+
+@pytest.mark.parametrize("failing_call", [0, 3])
+def test_stream_callback_error_stops_the_solve(failing_call):
+    model = spm(10)
+    inputs = stream_inputs(12)
+    y0, yp0 = model.initial_rows(inputs)
+    t_eval = np.array([0.0, 60.0])
+    solver = model.create_solver(num_threads=2, num_solvers=2)
+    calls = []
+
+    def callback(index, solution):
+        if len(calls) == failing_call:
+            raise KeyError("stop")
+        calls.append(index)
+
+    # The solvers are blocked on the full queue when the callback raises
+    with pytest.raises(KeyError, match="stop"):
+        solver.solve_stream(
+            t_eval, np.array([]), y0, yp0, inputs, callback, max_pending=1
+        )
+    assert len(calls) == failing_call
+
+    # The cancelled solve has released the group
+    solutions = solver.solve(t_eval, np.array([]), y0, yp0, inputs)
+    assert all(solution.flag >= 0 for solution in solutions)
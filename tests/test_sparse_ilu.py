@@ -0,0 +1,26 @@
+import numpy as np
+
+from .models import dfn
+
+
+def test_ilu_preconditioned_gmres_matches_klu():
+    model = dfn(10, 5)
+    t_eval = np.array([0.0, 600.0])
+    inputs = [1.0, 1.0]
+
+    def solve(**options):
+        solution = model.solve(model.create_solver(**options), t_eval, inputs)
+        assert solution.flag >= 0
+        return solution
+
+    klu = solve()
+    iterative = {"linear_solver": "SUNLinSol_SPGMR", "linsol_max_iterations": 20}
+    ilu = solve(preconditioner="ILU", **iterative)
+    bbdp = solve(preconditioner="BBDP", **iterative)
+
+    np.testing.assert_allclose(
+        model.states(ilu)[:, -1], model.states(klu)[:, -1], rtol=1e-4, atol=1e-5
+    )
+    # ILU factorises the analytic Jacobian; BBDP approximates it with
+    # difference quotients of the residual
+    assert ilu.stats.nrevals < bbdp.stats.nrevals + bbdp.stats.ngevalsBBDP
@@ -0,0 +1,33 @@
+import numpy as np
+
+from .models import spm
+
+
+def test_file_backed_solution_matches_memory(tmp_path):
+    model = spm(10)
+    t_eval = np.array([0.0, 30.0, 60.0])
+    inputs = np.array([0.01, 1.0])
+
+    memory = model.solve(model.create_solver(), t_eval, inputs)
+    mapped_solver = model.create_solver(storage_directory=str(tmp_path))
+    mapped = model.solve(mapped_solver, t_eval, inputs)
+    t = np.asarray(mapped.t)
+    np.testing.assert_array_equal(t, np.asarray(memory.t))
+    np.testing.assert_array_equal(model.states(mapped), model.states(memory))
+    np.testing.assert_array_equal(
+        model.states(mapped, "yp"), model.states(memory, "yp")
+    )
+
+    # The rows are streamed to the files as raw row-major values
+    (y_file,) = tmp_path.glob("*_y.bin")
+    (t_file,) = tmp_path.glob("*_t.bin")
+    np.testing.assert_array_equal(np.fromfile(t_file)[: len(t)], t)
+    np.testing.assert_array_equal(
+        np.fromfile(y_file)[: len(t) * model.n], np.asarray(mapped.y).ravel()
+    )
+
+    # A second solve maps new files and leaves the first solution intact
+    y_first = np.array(mapped.y, copy=True)
+    model.solve(mapped_solver, t_eval, [0.02, 0.5])
+    assert len(list(tmp_path.glob("*_y.bin"))) == 2
+    np.testing.assert_array_equal(np.asarray(mapped.y), y_first)
@@ -0,0 +1,69 @@
+import json
+
+import numpy as np
+import pytest
+
+from pybammsolvers import idaklu
+
+from .models import spm
+
+
+@pytest.fixture
+def tracing():
+    try:
+        idaklu.set_tracing(True)
+    except RuntimeError:
+        pytest.skip("idaklu was built without tracing")
+    idaklu.clear_trace()
+    yield
+    idaklu.set_tracing(False)
+    idaklu.clear_trace()
+
+
+def test_trace_is_a_chrome_trace_of_the_solve(tracing):
+    model = spm(10)
+    inputs = np.array([[0.01, 1.0], [0.005, 0.5], [0.002, 2.0]])
+    y0, yp0 = model.initial_rows(inputs)
+    solver = model.create_solver(num_threads=2, num_solvers=2)
+    solver.solve(np.array([0.0, 60.0]), np.array([]), y0, yp0, inputs)
+
+    trace = json.loads(idaklu.trace_json())
+    assert trace["displayTimeUnit"] == "ms"
+    events = trace["traceEvents"]
+    spans = [event for event in events if event["ph"] == "X"]
+    threads = [event for event in events if event["ph"] == "M"]
+
+    names = {span["name"] for span in spans}
+    assert {"solve", "residual", "jacobian", "linear_setup", "linear_solve"} <= names
+    for span in spans:
+        assert span["pid"] == 1
+        assert span["dur"] >= 0
+    # One solve span per input row, each on a named thread
+    solves = [span for span in spans if span["name"] == "solve"]
+    assert sorted(span["args"]["index"] for span in solves) == [0, 1, 2]
+    named = {event["tid"] for event in threads if event["name"] == "thread_name"}
+    assert {span["tid"] for span in spans} <= named
+
+    # The callbacks of a solve run inside it, on the same thread
+    for solve in solves:
+        end = solve["ts"] + solve["dur"]
+        inside = [
+            span
+            for span in spans
+            if span["tid"] == solve["tid"] and solve["ts"] <= span["ts"] <= end
+        ]
+        assert any(span["name"] == "residual" for span in inside)
+
+
+def test_clear_trace_and_disabled_tracing_record_nothing(tracing):
+    model = spm(10)
+    solver = model.create_solver()
+    model.solve(solver, [0.0, 60.0], [0.01, 1.0])
+    assert json.loads(idaklu.trace_json())["traceEvents"]
+
+    idaklu.clear_trace()
+    assert json.loads(idaklu.trace_json())["traceEvents"] == []
+
+    idaklu.set_tracing(False)
+    model.solve(solver, [0.0, 60.0], [0.01, 1.0])
+    assert json.loads(idaklu.trace_json())["traceEvents"] == []